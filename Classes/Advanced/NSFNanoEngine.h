@@ -45,8 +45,18 @@
 @property (nonatomic, assign, readonly, nonnull) sqlite3 *sqlite;
 /** * The file path where the database is located. */
 @property (nonatomic, copy, readonly, nonnull) NSString *path;
-/** * The cache mechanism being used. */
+/** * The cache mechanism being used.
+ @note NSFNanoStore opens the engine with the cache method set beforehand, CacheAllData otherwise. The setting can be changed at any time and applies to the searches executed afterwards.
+ Only objects stored as NSFNanoObject are returned as faults: other classes, such as NSFNanoBag, are instantiated from their data and always load it. A fault loads the data
+ stored when it fires, which may be more recent than the search that returned it. Modifying a fault loads its data and keeps it, whatever the cache method.
+ */
 @property (nonatomic, assign, readwrite) NSFCacheMethod cacheMethod;
+/** * Maximum number of read-only connections searches can run on, next to the connection used for writing. Zero, the default, runs everything on a single connection.
+ @note Must be set before the database is opened. Opening a file-backed database with readers enabled switches it to the WAL journal mode, so searches on different threads
+ run in parallel and keep running while the writer commits. Memory-backed and temporary databases can't be shared across connections and always use a single one.
+ A search issued by the thread that has a transaction open runs on the writer, so it sees the changes made by the transaction.
+ */
+@property (nonatomic, assign, readwrite) NSUInteger maximumNumberOfReaders;
 
 /** @name Creating and Initializing NanoEngine
  */
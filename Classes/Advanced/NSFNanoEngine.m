@@ -37,6 +37,7 @@
 #pragma mark// ==================================
 
 int NSFP_commitCallback(void* nsfdb);
+void NSFP_caseFoldFunction(sqlite3_context *context, int argc, sqlite3_value **argv);
 
 static char     __NSFP_base64Table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 static NSArray  *__NSFP_SQLCommandsReturningData = nil;
@@ -53,6 +54,10 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
 @property (nonatomic, readwrite) NSMutableDictionary *schema;
 @property (nonatomic, readwrite) BOOL willCommitChangeSchema;
 @property (nonatomic, readwrite) unsigned int busyTimeout;
+@property (nonatomic, readwrite) unsigned long long NSFP_commitCount;
+@property (nonatomic) NSMutableArray *idleReaders;
+@property (nonatomic) dispatch_semaphore_t readerSlots;
+@property (nonatomic, weak) NSThread *transactionThread;
 /** \endcond */
 
 @end
@@ -101,6 +106,8 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
     if ((self = [super init])) {
         _path = nil;
         _schema = nil;
+        _maximumNumberOfReaders = 0;
+        _idleReaders = [NSMutableArray new];
     }
     return self;
 }
@@ -187,6 +194,12 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
         
     }
 
+    // Readers need their own view of the database while the writer commits, which WAL provides
+    if ((_maximumNumberOfReaders > 0) && [self NSFP_canOpenReaders]) {
+        sqlite3_exec(self.sqlite, "PRAGMA journal_mode = WAL;", NULL, NULL, NULL);
+        _readerSlots = dispatch_semaphore_create(_maximumNumberOfReaders);
+    }
+    
     // Save whether we want data to be fetched lazily
     _cacheMethod = theCacheMethod;
     
@@ -197,6 +210,8 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
     
     [self NSFP_installCommitCallback];
     
+    [self NSFP_installFunctions];
+    
     return YES;
 }
 
@@ -224,6 +239,8 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
         [self commitTransaction];
     }
     
+    [self NSFP_closeIdleReaders];
+    
     int status = sqlite3_close(self.sqlite);
     _sqlite = NULL;
     
@@ -270,15 +287,11 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
         return NO;
     }
     
-    if (NO == _willCommitChangeSchema)
-        [self NSFP_uninstallCommitCallback];
-    
+    // The commit callback stays installed: it counts the commit, which the caches compare against to find out they went stale
     BOOL success = (nil == [self executeSQL:@"COMMIT TRANSACTION;"].error);
     
-    if (NO == _willCommitChangeSchema)
-        [self NSFP_installCommitCallback];
-    
     _willCommitChangeSchema = NO;
+    _transactionThread = nil;
     
     return success;
 }
@@ -293,6 +306,7 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
     BOOL success = (nil == [self executeSQL:@"ROLLBACK TRANSACTION;"].error);
     
     _willCommitChangeSchema = NO;
+    _transactionThread = nil;
     
     return success;
 }
@@ -442,7 +456,8 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
                                  reason:[NSString stringWithFormat:@"*** -[%@ %@]: indexName is nil.", [self class], NSStringFromSelector(_cmd)]
                                userInfo:nil]raise];
     
-    NSString  *theSQLStatement = [[NSString alloc]initWithFormat:@"DROP INDEX %@;", indexName];
+    // Quote the name: attribute indexes carry the attribute, which may contain any character
+    NSString  *theSQLStatement = [[NSString alloc]initWithFormat:@"DROP INDEX \"%@\";", [indexName stringByReplacingOccurrencesOfString:@"\"" withString:@"\"\""]];
     
     [self executeSQL:theSQLStatement];
 }
@@ -562,7 +577,7 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
     
     // Check whether we will need to return a dictionary with results
     sqlite3 *sqliteStore = self.sqlite;
-    NSMutableDictionary *info = [NSMutableDictionary dictionary];
+    NSFNanoResult *result = nil;
     BOOL returnInfo = NO;
     
     for (NSString *sqlCommand in __NSFP_SQLCommandsReturningData) {
@@ -583,58 +598,7 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
         status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
 
         if (SQLITE_OK == status) {
-            info = [NSMutableDictionary dictionary];
-            int columnIndex, numColumns = sqlite3_column_count (theSQLiteStatement);
-            
-            while (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) {
-                
-                id value = nil;
-                for (columnIndex = 0; columnIndex < numColumns; columnIndex++) {
-                    // Safety check: obtain the column and value. If the column is NULL, skip the iteration.
-                    char *columnUTF8 = (char *)sqlite3_column_name (theSQLiteStatement, columnIndex);
-                    if (NULL == columnUTF8) {
-                        continue;
-                    }
-                    NSString *column = @(columnUTF8);
-
-                    // Sanity check: some queries return NULL, which would cause a crash below.
-                    if ([column isEqualToString:NSFKeyedArchive]) {
-                        //KeyedArchive is a blob
-                        value = [[NSData alloc] initWithBytes:sqlite3_column_blob(theSQLiteStatement, columnIndex) length: sqlite3_column_bytes(theSQLiteStatement, 1)];
-                    }else
-                    {
-                        char *valueUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, columnIndex);
-                        if (NULL != valueUTF8) {
-                            value = @(valueUTF8);
-                        } else {
-                            value = [NSNull null].description;
-                        }
-                    }
-
-                    // Obtain the array to collect the values. If the array doesn't exist, create it.
-                    NSMutableArray *values = info[column];
-                    if (nil == values) {
-                        values = [NSMutableArray new];
-                        info[column] = values;
-                    }
-                    
-                    /* Do the safety dance: don't attempt to add a nil object to the values array... */
-                    
-                    if (value == nil) {
-                        id exceptionInfo = @{
-                                             @"SQL statement" : theSQLStatement,
-                                             @"requested column" : column,
-                                             };
-                        [[NSException exceptionWithName:NSInternalInconsistencyException reason:@"failed to get object value for column" userInfo:exceptionInfo]raise];
-                    }
-                    
-                    [values addObject:value];
-                    
-                    // Let's cleanup. This will keep the memory footprint low...
-                }
-                
-            }
-            
+            result = [NSFNanoResult _resultWithStatement:theSQLiteStatement];
             sqlite3_finalize (theSQLiteStatement);
         }
     } else {
@@ -647,15 +611,13 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
         status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
     }
     
-    NSFNanoResult *result = nil;
-    
     if (SQLITE_OK != status) {
         NSString *msg = (NULL != errorMessage) ? @(errorMessage) : [NSString stringWithFormat:@"SQLite error ID: %d", status];
         result = [NSFNanoResult _resultWithError:[NSError errorWithDomain:NSFDomainKey
                                                                     code:NSFNanoStoreErrorKey
                                                                 userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: %@", [self class], NSStringFromSelector(_cmd), msg]}]];
-    } else {
-        result = [NSFNanoResult _resultWithDictionary:info];
+    } else if (nil == result) {
+        result = [NSFNanoResult _resultWithStatement:NULL];
     }
     
     // Cleanup
@@ -674,12 +636,11 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
                                userInfo:nil]raise];
     }
     
-    NSString *sql = [[NSString alloc]initWithFormat:@"SELECT max(ROWID) FROM %@", table];
+    NSString *sql = [[NSString alloc]initWithFormat:@"SELECT max(ROWID) AS NSFMaxRowUID FROM %@", table];
     
     NSFNanoResult *result = [self executeSQL:sql];
     
-    
-    return [result firstValue].longLongValue;
+    return (result.numberOfRows > 0) ? [result int64AtIndex:0 forColumn:@"NSFMaxRowUID"] : 0;
 }
 
 #pragma mark// ==================================
@@ -740,8 +701,7 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
 - (NSUInteger)cacheSize
 {
     NSFNanoResult *result = [self executeSQL:@"PRAGMA cache_size;"];
-    NSString *value = [result firstValue];
-    return value.integerValue;
+    return (result.numberOfRows > 0) ? (NSUInteger)[result int64AtIndex:0 forColumn:@"cache_size"] : 0;
 }
 
 - (BOOL)setPageSize:(NSUInteger)numberOfBytes
@@ -754,8 +714,7 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
 - (NSUInteger)pageSize
 {
     NSFNanoResult *result = [self executeSQL:@"PRAGMA page_size;"];
-    NSString *value = [result firstValue];
-    return value.integerValue;
+    return (result.numberOfRows > 0) ? (NSUInteger)[result int64AtIndex:0 forColumn:@"page_size"] : 0;
 }
 
 - (BOOL)setEncodingType:(NSFEncodingType)theEncodingType
@@ -1236,7 +1195,12 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
                 }
             } while (continueTrying);
             
-            return (SQLITE_OK == sqlite3_finalize(NSF_sqliteVM));
+            BOOL success = (SQLITE_OK == sqlite3_finalize(NSF_sqliteVM));
+            if (success) {
+                _transactionThread = [NSThread currentThread];
+            }
+            
+            return success;
         }
     }
     
@@ -1667,9 +1631,224 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
 
 int NSFP_commitCallback(void* nsfdb)
 {
+    // Keep it cheap: this runs on every commit, including the implicit ones. Caches compare
+    // the count against the one they were filled with to find out whether they went stale.
+    NSFNanoEngine *engine = (__bridge NSFNanoEngine *)nsfdb;
+    engine.NSFP_commitCount++;
+    
     return SQLITE_OK;
 }
 
+- (void)NSFP_installFunctions
+{
+    [self NSFP_installFunctionsOnConnection:self.sqlite];
+}
+
+- (void)NSFP_installFunctionsOnConnection:(sqlite3 *)aConnection
+{
+    sqlite3_create_function_v2(aConnection, "NSFCaseFold", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, NSFP_caseFoldFunction, NULL, NULL, NULL);
+}
+
+- (BOOL)NSFP_canOpenReaders
+{
+    // Memory and temporary databases are private to the connection that created them
+    return ((_path.length > 0) && (NO == [[_path lowercaseString]isEqualToString:NSFMemoryDatabase]));
+}
+
+- (BOOL)NSFP_hasReaders
+{
+    return (NULL != _readerSlots);
+}
+
+- (sqlite3 *)NSFP_checkOutReadConnection
+{
+    sqlite3 *snapshotConnection = [self NSFP_readSnapshotConnection];
+    if (NULL != snapshotConnection) {
+        return snapshotConnection;
+    }
+    
+    if ((NULL == _readerSlots) || (NULL == self.sqlite)) {
+        return self.sqlite;
+    }
+    
+    // Only the writer sees the changes of a transaction that hasn't been committed yet, so the thread
+    // that opened it keeps reading through the writer
+    if ([self isTransactionActive]) {
+        NSThread *transactionThread = _transactionThread;
+        if ((nil == transactionThread) || (transactionThread == [NSThread currentThread])) {
+            return self.sqlite;
+        }
+    }
+    
+    // A thread already holding a reader gets it again: objects decoded while a search steps through its rows
+    // may look up more objects, and waiting for a second slot would deadlock once every slot is taken
+    NSMutableDictionary *threadDictionary = [NSThread currentThread].threadDictionary;
+    NSString *checkOutKey = [self NSFP_readConnectionThreadKey];
+    NSMutableDictionary *checkOut = threadDictionary[checkOutKey];
+    if (nil != checkOut) {
+        checkOut[@"depth"] = @([checkOut[@"depth"]unsignedIntegerValue] + 1);
+        return [checkOut[@"connection"]pointerValue];
+    }
+    
+    dispatch_semaphore_wait(_readerSlots, DISPATCH_TIME_FOREVER);
+    
+    sqlite3 *reader = NULL;
+    
+    @synchronized(_idleReaders) {
+        if (_idleReaders.count > 0) {
+            reader = [_idleReaders.lastObject pointerValue];
+            [_idleReaders removeLastObject];
+        }
+    }
+    
+    if (NULL == reader) {
+        reader = [self NSFP_openReader];
+    }
+    
+    if (NULL == reader) {
+        dispatch_semaphore_signal(_readerSlots);
+        return self.sqlite;
+    }
+    
+    threadDictionary[checkOutKey] = [@{@"connection" : [NSValue valueWithPointer:reader], @"depth" : @1}mutableCopy];
+    
+    return reader;
+}
+
+- (void)NSFP_checkInReadConnection:(sqlite3 *)aConnection
+{
+    if ((NULL == aConnection) || (aConnection == self.sqlite) || (aConnection == [self NSFP_readSnapshotConnection])) {
+        return;
+    }
+    
+    // Nested check-outs hand the reader back to the outer one
+    NSMutableDictionary *threadDictionary = [NSThread currentThread].threadDictionary;
+    NSString *checkOutKey = [self NSFP_readConnectionThreadKey];
+    NSMutableDictionary *checkOut = threadDictionary[checkOutKey];
+    if ((nil != checkOut) && ([checkOut[@"connection"]pointerValue] == aConnection)) {
+        NSUInteger depth = [checkOut[@"depth"]unsignedIntegerValue] - 1;
+        if (depth > 0) {
+            checkOut[@"depth"] = @(depth);
+            return;
+        }
+        [threadDictionary removeObjectForKey:checkOutKey];
+    }
+    
+    @synchronized(_idleReaders) {
+        if (NULL == self.sqlite) {
+            // The engine was closed while the reader was checked out
+            sqlite3_close(aConnection);
+        } else {
+            [_idleReaders addObject:[NSValue valueWithPointer:aConnection]];
+        }
+    }
+    
+    dispatch_semaphore_signal(_readerSlots);
+}
+
+- (sqlite3 *)NSFP_openReader
+{
+    sqlite3 *reader = NULL;
+    
+    // Each reader is used by one thread at a time, so it can skip SQLite's own locking
+    int status = sqlite3_open_v2(_path.UTF8String, &reader, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    
+    if (SQLITE_OK != status) {
+        sqlite3_close(reader);
+        return NULL;
+    }
+    
+    sqlite3_extended_result_codes(reader, 1);
+    sqlite3_busy_timeout(reader, _busyTimeout);
+    [self NSFP_installFunctionsOnConnection:reader];
+    
+    return reader;
+}
+
+- (NSString *)NSFP_readConnectionThreadKey
+{
+    return [NSString stringWithFormat:@"NSFNanoEngine.readConnection.%p", self];
+}
+
+- (NSString *)NSFP_readSnapshotThreadKey
+{
+    return [NSString stringWithFormat:@"NSFNanoEngine.readSnapshot.%p", self];
+}
+
+- (sqlite3 *)NSFP_readSnapshotConnection
+{
+    return [[NSThread currentThread].threadDictionary[[self NSFP_readSnapshotThreadKey]]pointerValue];
+}
+
+- (BOOL)NSFP_isReadSnapshotActive
+{
+    return (NULL != [self NSFP_readSnapshotConnection]);
+}
+
+- (BOOL)NSFP_beginReadSnapshot
+{
+    sqlite3 *reader = [self NSFP_checkOutReadConnection];
+    
+    // Without a reader of its own the thread shares the writer, which can't hold a snapshot for it alone
+    if ((NULL == reader) || (reader == self.sqlite)) {
+        return NO;
+    }
+    
+    // BEGIN alone doesn't read anything: the first read is what pins the snapshot in the WAL
+    int status = sqlite3_exec(reader, "BEGIN DEFERRED TRANSACTION; SELECT count(*) FROM sqlite_master;", NULL, NULL, NULL);
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    
+    if (SQLITE_OK != status) {
+        if (0 == sqlite3_get_autocommit(reader)) {
+            sqlite3_exec(reader, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+        }
+        [self NSFP_checkInReadConnection:reader];
+        return NO;
+    }
+    
+    [NSThread currentThread].threadDictionary[[self NSFP_readSnapshotThreadKey]] = [NSValue valueWithPointer:reader];
+    
+    return YES;
+}
+
+- (void)NSFP_endReadSnapshot
+{
+    sqlite3 *reader = [self NSFP_readSnapshotConnection];
+    
+    if (NULL == reader) {
+        return;
+    }
+    
+    [[NSThread currentThread].threadDictionary removeObjectForKey:[self NSFP_readSnapshotThreadKey]];
+    
+    sqlite3_exec(reader, "COMMIT TRANSACTION;", NULL, NULL, NULL);
+    [self NSFP_checkInReadConnection:reader];
+}
+
+- (void)NSFP_closeIdleReaders
+{
+    @synchronized(_idleReaders) {
+        for (NSValue *reader in _idleReaders) {
+            sqlite3_close([reader pointerValue]);
+        }
+        [_idleReaders removeAllObjects];
+    }
+}
+
+void NSFP_caseFoldFunction(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    if (SQLITE_TEXT != sqlite3_value_type(argv[0])) {
+        sqlite3_result_null(context);
+        return;
+    }
+    
+    @autoreleasepool {
+        NSString *value = @((const char *)sqlite3_value_text(argv[0]));
+        sqlite3_result_text(context, NSFCaseFoldedString(value).UTF8String, -1, SQLITE_TRANSIENT);
+    }
+}
+
 /** \endcond */
 
 @end
@@ -36,6 +36,10 @@
  * associated values.
  *
  * @par
+ * The values are kept the way SQLite returned them, column by column: integers and reals in place, text and blobs in a single buffer. The typed accessors read
+ * them directly, while the NSString-based accessors create their strings on demand.
+ *
+ * @par
  * After obtaining a NanoResult, it's always a good idea to check whether the <i>error</i> property is nil. If so, the result can be assumed to be
  * correct. Otherwise, <i>error</i> will point to the main cause of failure.
  *
@@ -80,7 +84,7 @@
 //@{
 
 /** * Returns a new array containing the columns.
- * @returns An array with the columns retrieved from the result set.
+ * @returns An array with the columns retrieved from the result set, in the order the statement returned them.
  */
 
 @property (nonatomic, readonly, copy, nonnull) NSArray *columns;
@@ -101,6 +105,42 @@
 
 - (nonnull NSArray *)valuesForColumn:(nonnull NSString *)theColumn;
 
+/** * Returns a value as a 64-bit integer.
+ * @param theIndex is the index of the value in the result set.
+ * @param theColumn is the name of the column in the result set.
+ * @returns The value converted the way SQLite's sqlite3_column_int64() would, or 0 if the column doesn't exist or the value is NULL.
+ * @throws NSRangeException is thrown if the index is out of bounds.
+ */
+
+- (long long)int64AtIndex:(NSUInteger)theIndex forColumn:(nonnull NSString *)theColumn;
+
+/** * Returns a value as a double.
+ * @param theIndex is the index of the value in the result set.
+ * @param theColumn is the name of the column in the result set.
+ * @returns The value converted the way SQLite's sqlite3_column_double() would, or 0 if the column doesn't exist or the value is NULL.
+ * @throws NSRangeException is thrown if the index is out of bounds.
+ */
+
+- (double)doubleAtIndex:(NSUInteger)theIndex forColumn:(nonnull NSString *)theColumn;
+
+/** * Returns the bytes of a text or blob value.
+ * @param theIndex is the index of the value in the result set.
+ * @param theColumn is the name of the column in the result set.
+ * @returns The bytes of the value (UTF-8 for text and numbers), or nil if the column doesn't exist or the value is NULL.
+ * @throws NSRangeException is thrown if the index is out of bounds.
+ */
+
+- (nullable NSData *)dataAtIndex:(NSUInteger)theIndex forColumn:(nonnull NSString *)theColumn;
+
+/** * Checks whether a value is NULL.
+ * @param theIndex is the index of the value in the result set.
+ * @param theColumn is the name of the column in the result set.
+ * @returns YES if the value is NULL or the column doesn't exist, NO otherwise.
+ * @throws NSRangeException is thrown if the index is out of bounds.
+ */
+
+- (BOOL)isNullAtIndex:(NSUInteger)theIndex forColumn:(nonnull NSString *)theColumn;
+
 /** * Returns the first value.
  * @returns The value of the first element from the result set.
  */
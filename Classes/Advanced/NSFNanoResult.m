@@ -27,12 +27,30 @@
 #import "NSFNanoResult.h"
 #import "NanoStore_Private.h"
 
+/** \cond */
+
+// One value of a column. Numbers are stored inline; text and blobs point into the result's byte buffer.
+typedef struct {
+    union {
+        long long integer;
+        double real;
+        NSUInteger offset;
+    } value;
+    NSUInteger length;
+    int type;
+} NSFNanoResultCell;
+
+/** \endcond */
+
 @interface NSFNanoResult ()
 
 /** \cond */
 @property (nonatomic, assign, readwrite) NSUInteger numberOfRows;
 @property (nonatomic, strong, readwrite) NSError *error;
-@property (nonatomic) NSDictionary *results;
+@property (nonatomic) NSArray *columnNames;
+@property (nonatomic) NSDictionary *columnIndexes;
+@property (nonatomic) NSArray *cellsByColumn;
+@property (nonatomic) NSMutableData *bytes;
 /** \endcond */
 
 @end
@@ -58,7 +76,7 @@
 
 - (NSString *)description
 {
-    NSUInteger numberOfColumns = _results.allKeys.count;
+    NSUInteger numberOfColumns = _columnNames.count;
     
     NSMutableString *description = [NSMutableString string];
     [description appendString:@"\n"];
@@ -142,7 +160,7 @@
 
 - (NSFOrderedDictionary *)dictionaryDescription
 {
-    NSUInteger numberOfColumns = _results.allKeys.count;
+    NSUInteger numberOfColumns = _columnNames.count;
 
     NSFOrderedDictionary *values = [NSFOrderedDictionary new];
     
@@ -252,29 +270,101 @@
 
 - (NSArray *)columns
 {
-    return _results.allKeys;
+    return (nil != _columnNames) ? _columnNames : [NSArray array];
 }
 
 - (NSString *)valueAtIndex:(NSUInteger)index forColumn:(NSString *)column
 {
-    return _results[column][index];
+    const NSFNanoResultCell *cell = [self _cellAtIndex:index forColumn:column];
+    if (NULL == cell) {
+        return nil;
+    }
+    
+    return [self _valueForCell:cell isKeyedArchive:[column isEqualToString:NSFKeyedArchive]];
 }
 
 - (NSArray *)valuesForColumn:(NSString *)column
 {
-    NSArray *values = _results[column];
+    NSNumber *columnIndex = _columnIndexes[column];
+    
+    if (nil == columnIndex) {
+        return [NSArray array];
+    }
     
-    if (nil == values)
-        values = [NSArray array];
+    const NSFNanoResultCell *cells = [_cellsByColumn[columnIndex.unsignedIntegerValue]bytes];
+    BOOL isKeyedArchive = [column isEqualToString:NSFKeyedArchive];
+    NSMutableArray *values = [NSMutableArray arrayWithCapacity:_numberOfRows];
+    
+    for (NSUInteger i = 0; i < _numberOfRows; i++) {
+        [values addObject:[self _valueForCell:&cells[i] isKeyedArchive:isKeyedArchive]];
+    }
     
     return values;
 }
 
+- (long long)int64AtIndex:(NSUInteger)theIndex forColumn:(NSString *)theColumn
+{
+    const NSFNanoResultCell *cell = [self _cellAtIndex:theIndex forColumn:theColumn];
+    if (NULL == cell) {
+        return 0;
+    }
+    
+    switch (cell->type) {
+        case SQLITE_INTEGER:
+            return cell->value.integer;
+        case SQLITE_FLOAT:
+            return (long long)cell->value.real;
+        case SQLITE_TEXT:
+            return [self _stringForCell:cell].longLongValue;
+        default:
+            return 0;
+    }
+}
+
+- (double)doubleAtIndex:(NSUInteger)theIndex forColumn:(NSString *)theColumn
+{
+    const NSFNanoResultCell *cell = [self _cellAtIndex:theIndex forColumn:theColumn];
+    if (NULL == cell) {
+        return 0;
+    }
+    
+    switch (cell->type) {
+        case SQLITE_INTEGER:
+            return (double)cell->value.integer;
+        case SQLITE_FLOAT:
+            return cell->value.real;
+        case SQLITE_TEXT:
+            return [self _stringForCell:cell].doubleValue;
+        default:
+            return 0;
+    }
+}
+
+- (NSData *)dataAtIndex:(NSUInteger)theIndex forColumn:(NSString *)theColumn
+{
+    const NSFNanoResultCell *cell = [self _cellAtIndex:theIndex forColumn:theColumn];
+    if ((NULL == cell) || (SQLITE_NULL == cell->type)) {
+        return nil;
+    }
+    
+    if ((SQLITE_TEXT == cell->type) || (SQLITE_BLOB == cell->type)) {
+        return [_bytes subdataWithRange:NSMakeRange(cell->value.offset, cell->length)];
+    }
+    
+    return [[self _valueForCell:cell isKeyedArchive:NO]dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+- (BOOL)isNullAtIndex:(NSUInteger)theIndex forColumn:(NSString *)theColumn
+{
+    const NSFNanoResultCell *cell = [self _cellAtIndex:theIndex forColumn:theColumn];
+    
+    return ((NULL == cell) || (SQLITE_NULL == cell->type));
+}
+
 - (NSString *)firstValue
 {
-    NSArray *columns = _results.allKeys;
-    if ((columns.count > 0) && (_numberOfRows > 0)) {
-        return _results[columns[0]][0];
+    if ((_columnNames.count > 0) && (_numberOfRows > 0)) {
+        return [self valueAtIndex:0 forColumn:_columnNames[0]];
     }
     
     return nil;
@@ -282,16 +372,25 @@
 
 - (void)writeToFile:(NSString *)path;
 {
-    [_results writeToFile:path.stringByExpandingTildeInPath atomically:YES];
+    NSMutableDictionary *results = [NSMutableDictionary dictionaryWithCapacity:_columnNames.count];
+    
+    // Columns without rows were never written out
+    if (_numberOfRows > 0) {
+        for (NSString *column in _columnNames) {
+            results[column] = [self valuesForColumn:column];
+        }
+    }
+    
+    [results writeToFile:path.stringByExpandingTildeInPath atomically:YES];
 }
 
 #pragma mark - Private Methods
 #pragma mark -
 
 /** \cond */
-+ (NSFNanoResult *)_resultWithDictionary:(NSDictionary *)theResults
++ (NSFNanoResult *)_resultWithStatement:(sqlite3_stmt *)theStatement
 {
-    return [[self alloc]_initWithDictionary:theResults];
+    return [[self alloc]_initWithStatement:theStatement];
 }
 
 + (NSFNanoResult *)_resultWithError:(NSError *)theError
@@ -299,21 +398,80 @@
     return [[self alloc]_initWithError:theError];
 }
 
-- (id)_initWithDictionary:(NSDictionary *)theResults
+- (id)_initWithStatement:(sqlite3_stmt *)theStatement
 {
-    if (nil == theResults)
-        [[NSException exceptionWithName:NSFUnexpectedParameterException
-                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: theResults is nil.", [self class], NSStringFromSelector(_cmd)]
-                               userInfo:nil]raise];
-    
-    if ([theResults respondsToSelector:@selector(objectForKey:)] == NO)
-        [[NSException exceptionWithName:NSFUnexpectedParameterException
-                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: theResults is not of type NSDictionary.", [self class], NSStringFromSelector(_cmd)]
-                               userInfo:nil]raise];
-    
     if ((self = [self init])) {
-        _results = theResults;
-        [self _calculateNumberOfRows];
+        _numberOfRows = 0;
+        
+        int numberOfColumns = (NULL != theStatement) ? sqlite3_column_count (theStatement) : 0;
+        NSMutableArray *columnNames = [NSMutableArray arrayWithCapacity:numberOfColumns];
+        NSMutableDictionary *columnIndexes = [NSMutableDictionary dictionaryWithCapacity:numberOfColumns];
+        NSMutableArray *cellsByColumn = [NSMutableArray arrayWithCapacity:numberOfColumns];
+        
+        // Map every statement column to the first result column carrying its name
+        int *resultColumns = calloc (MAX(numberOfColumns, 1), sizeof(int));
+        
+        for (int i = 0; i < numberOfColumns; i++) {
+            const char *columnUTF8 = sqlite3_column_name (theStatement, i);
+            NSString *column = (NULL != columnUTF8) ? @(columnUTF8) : nil;
+            
+            if ((nil == column) || (nil != columnIndexes[column])) {
+                resultColumns[i] = -1;
+                continue;
+            }
+            
+            resultColumns[i] = (int)columnNames.count;
+            columnIndexes[column] = @(columnNames.count);
+            [columnNames addObject:column];
+            [cellsByColumn addObject:[NSMutableData new]];
+        }
+        
+        _bytes = [NSMutableData new];
+        
+        while ((NULL != theStatement) && (SQLITE_ROW == sqlite3_step (theStatement))) {
+            for (int i = 0; i < numberOfColumns; i++) {
+                if (resultColumns[i] < 0) {
+                    continue;
+                }
+                
+                NSFNanoResultCell cell;
+                cell.type = sqlite3_column_type (theStatement, i);
+                cell.length = 0;
+                
+                switch (cell.type) {
+                    case SQLITE_INTEGER:
+                        cell.value.integer = sqlite3_column_int64 (theStatement, i);
+                        break;
+                    case SQLITE_FLOAT:
+                        cell.value.real = sqlite3_column_double (theStatement, i);
+                        break;
+                    case SQLITE_TEXT:
+                    case SQLITE_BLOB: {
+                        // Ask for the bytes before their length, as SQLite requires
+                        const void *bytes = (SQLITE_TEXT == cell.type) ? (const void *)sqlite3_column_text (theStatement, i) : sqlite3_column_blob (theStatement, i);
+                        cell.length = (NSUInteger)sqlite3_column_bytes (theStatement, i);
+                        cell.value.offset = _bytes.length;
+                        if ((NULL != bytes) && (cell.length > 0)) {
+                            [_bytes appendBytes:bytes length:cell.length];
+                        }
+                        break;
+                    }
+                    default:
+                        cell.value.integer = 0;
+                        break;
+                }
+                
+                [cellsByColumn[resultColumns[i]] appendBytes:&cell length:sizeof(NSFNanoResultCell)];
+            }
+            
+            _numberOfRows++;
+        }
+        
+        free (resultColumns);
+        
+        _columnNames = columnNames;
+        _columnIndexes = columnIndexes;
+        _cellsByColumn = cellsByColumn;
     }
     
     return self;
@@ -333,30 +491,78 @@
     
     if ((self = [self init])) {
         _error = theError;
-        [self _calculateNumberOfRows];
+        _numberOfRows = 0;
     }
     
     return self;
 }
 
-- (void)_reset
+- (const NSFNanoResultCell *)_cellAtIndex:(NSUInteger)theIndex forColumn:(NSString *)theColumn
 {
-    _numberOfRows = -1;
-    _results = nil;
-    _error = nil;
+    NSNumber *columnIndex = _columnIndexes[theColumn];
+    
+    if (nil == columnIndex) {
+        return NULL;
+    }
+    
+    if (theIndex >= _numberOfRows) {
+        [[NSException exceptionWithName:NSRangeException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: index %lu beyond bounds [0 .. %ld].", [self class], NSStringFromSelector(_cmd), (unsigned long)theIndex, (long)_numberOfRows - 1]
+                               userInfo:nil]raise];
+    }
+    
+    const NSFNanoResultCell *cells = [_cellsByColumn[columnIndex.unsignedIntegerValue]bytes];
+    
+    return &cells[theIndex];
 }
 
-- (void)_calculateNumberOfRows
+- (id)_valueForCell:(const NSFNanoResultCell *)theCell isKeyedArchive:(BOOL)isKeyedArchive
 {
-    // We cache the value once, for performance reasons
-    if (-1 == _numberOfRows) {
-        NSArray *allKeys = _results.allKeys;
-        if (allKeys.count == 0)
-            _numberOfRows = 0;
-        else
-            _numberOfRows = [_results[allKeys.lastObject]count];
+    // The archives are handed out as data, everything else as text, the way SQLite would convert it
+    if (isKeyedArchive) {
+        if ((SQLITE_BLOB == theCell->type) || (SQLITE_TEXT == theCell->type)) {
+            return [_bytes subdataWithRange:NSMakeRange(theCell->value.offset, theCell->length)];
+        }
+        if (SQLITE_NULL == theCell->type) {
+            return [NSData data];
+        }
+    }
+    
+    switch (theCell->type) {
+        case SQLITE_INTEGER:
+            return [NSString stringWithFormat:@"%lld", theCell->value.integer];
+        case SQLITE_FLOAT: {
+            // Same as SQLite's "%!.15g": integral values keep their decimal point
+            NSString *value = [NSString stringWithFormat:@"%.15g", theCell->value.real];
+            if ((NSNotFound == [value rangeOfCharacterFromSet:[NSCharacterSet characterSetWithCharactersInString:@".einIN"]].location)) {
+                value = [value stringByAppendingString:@".0"];
+            }
+            return value;
+        }
+        case SQLITE_TEXT:
+        case SQLITE_BLOB: {
+            NSString *value = [self _stringForCell:theCell];
+            return (nil != value) ? value : [NSNull null].description;
+        }
+        default:
+            return [NSNull null].description;
     }
 }
+
+- (NSString *)_stringForCell:(const NSFNanoResultCell *)theCell
+{
+    return [[NSString alloc]initWithBytes:(const char *)_bytes.bytes + theCell->value.offset length:theCell->length encoding:NSUTF8StringEncoding];
+}
+
+- (void)_reset
+{
+    _numberOfRows = 0;
+    _columnNames = nil;
+    _columnIndexes = nil;
+    _cellsByColumn = nil;
+    _bytes = nil;
+    _error = nil;
+}
 /** \endcond */
 
 @end
@@ -34,6 +34,13 @@
 - (void)_setStore:(nonnull NSFNanoStore *)aStore;
 - (BOOL)_saveInStore:(nonnull NSFNanoStore *)someStore error:(NSError * _Nullable * _Nullable)outError;
 - (void)_inflateObjectsWithKeys:(nonnull NSArray *)someKeys;
+- (nonnull NSDictionary *)_storedDictionaryRepresentation;
+- (void)_loadMemberKeysIfNeeded;
+- (void)_addPlaceholdersForKeys:(nonnull NSArray *)someKeys;
+- (nonnull NSArray *)_savedObjectKeys;
+- (nonnull NSString *)_membersSQL;
+- (BOOL)_hasUnsavedMembers;
+- (nullable NSString *)_SQLForOperation:(NSFBagOperation)theOperation withBag:(nonnull NSFNanoBag *)theBag error:(NSError * _Nullable * _Nullable)outError;
 @end
 
 /** \endcond */
@@ -62,6 +62,21 @@
 
 - (void)NSFP_installCommitCallback;
 - (void)NSFP_uninstallCommitCallback;
+- (void)NSFP_installFunctions;
+- (void)NSFP_installFunctionsOnConnection:(sqlite3 * _Nonnull)aConnection;
+@property (nonatomic, readonly) BOOL NSFP_canOpenReaders;
+@property (nonatomic, readonly) BOOL NSFP_hasReaders;
+- (nullable sqlite3 *)NSFP_checkOutReadConnection;
+- (void)NSFP_checkInReadConnection:(nullable sqlite3 *)aConnection;
+- (nullable sqlite3 *)NSFP_openReader;
+- (void)NSFP_closeIdleReaders;
+@property (nonatomic, readonly, copy, nonnull) NSString *NSFP_readConnectionThreadKey;
+@property (nonatomic, readonly, copy, nonnull) NSString *NSFP_readSnapshotThreadKey;
+- (nullable sqlite3 *)NSFP_readSnapshotConnection;
+@property (nonatomic, readonly) BOOL NSFP_isReadSnapshotActive;
+- (BOOL)NSFP_beginReadSnapshot;
+- (void)NSFP_endReadSnapshot;
+@property (nonatomic, readonly) unsigned long long NSFP_commitCount;
 @end
 
 /** \endcond */
@@ -30,6 +30,9 @@
 
 @interface NSFNanoExpression (Private)
 - (nonnull NSArray *)arrayDescription;
+@property (nonatomic, readonly) BOOL _isCompound;
+- (nonnull NSString *)_keysSQL;
+- (nonnull NSArray *)_leafExpressions;
 @end
 
 /** \endcond */
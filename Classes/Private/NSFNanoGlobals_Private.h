@@ -58,6 +58,7 @@ extern NSArray * safeJSONArrayFromArray (NSArray *array);
 extern id safeJSONObjectFromObject (id object);
 
 extern NSString * NSFStringFromMatchType (NSFMatchType aMatchType);
+extern NSString * NSFCaseFoldedString (NSString *aString);
 
 extern void _NSFLog (NSString  *format, ...);
 
@@ -73,6 +74,16 @@ extern NSString * const NSFCalendarDate;
 extern NSString * const NSFObjectClass;
 extern NSString * const NSFKeyedArchive;
 extern NSString * const NSFAttribute;
+extern NSString * const NSFKeyPathSegments;
+extern NSString * const NSFSegment;
+extern NSString * const NSFDepth;
+extern NSString * const NSFBagMembers;
+extern NSString * const NSFBagKey;
+extern NSString * const NSFFullTextValues;
+extern NSString * const NSFFullTextAttributes;
+extern NSString * const NSFFoldedValue;
+extern NSString * const NSFFoldedAttributes;
+extern NSString * const NSFAttributeIndexes;
 
 #pragma mark -
 
@@ -84,10 +95,18 @@ extern NSString * const NSF_Private_NSFValues_NSFValue;
 extern NSString * const NSF_Private_NSFNanoBag_Name;
 extern NSString * const NSF_Private_NSFNanoBag_NSFKey;
 extern NSString * const NSF_Private_NSFNanoBag_NSFObjectKeys;
+extern NSString * const NSF_Private_ResultCacheResultsKey;
+extern NSString * const NSF_Private_ResultCacheAttributesKey;
+extern NSString * const NSF_Private_ResultCacheObjectClassKey;
+extern NSString * const NSF_Private_ObjectCacheInfoKey;
+extern NSString * const NSF_Private_ObjectCacheCostKey;
 extern NSString * const NSF_Private_ToDeleteTableKey;
+extern NSString * const NSF_Private_AllAttributesKey;
 
 extern NSInteger const NSF_Private_InvalidParameterDataCodeKey;
 extern NSInteger const NSF_Private_MacOSXErrorCodeKey;
+extern NSInteger const NSF_Private_KeyLookupChunkSize;
+extern NSInteger const NSF_Private_ExportBufferSize;
 
 #pragma mark -
 
@@ -28,12 +28,29 @@
 
 /** \cond */
 
+@class NSFNanoSearch;
+
+/*
+ The faults created by one search share a group, so the first one to fire loads a batch of its siblings in the same lookup.
+ Under DoNotCacheData the group doesn't batch: every access loads the fault's data again and nothing is kept.
+ */
+@interface NSFNanoObjectFaultGroup : NSObject
+@property (nonatomic, readonly) BOOL dropsLoadedData;
+
+- (nonnull instancetype)initWithSearch:(nonnull NSFNanoSearch *)aSearch dropsLoadedData:(BOOL)dropsLoadedData;
+- (void)addFault:(nonnull NSFNanoObject *)aFault;
+- (nullable NSDictionary *)infoForFault:(nonnull NSFNanoObject *)aFault;
+@end
+
 @interface NSFNanoObject ()
 @property (nonatomic, readwrite, nullable) NSFNanoStore *store;
 @property (nonatomic, copy, readwrite, nullable) NSString *key;
 @property (nonatomic, readwrite) BOOL hasUnsavedChanges;
 
 - (void)_setOriginalClassString:(nullable NSString *)theClassString;
+- (void)_setFaultGroup:(nullable NSFNanoObjectFaultGroup *)aFaultGroup;
+- (void)_fulfillFaultWithInfo:(nullable NSDictionary *)theInfo;
+- (void)_fireFaultForMutation;
 + (nonnull NSString *)_NSObjectToJSONString:(nonnull id)object error:(NSError * _Nullable * _Nullable)error;
 + (nonnull NSDictionary *)_safeDictionaryFromDictionary:(nonnull NSDictionary *)dictionary;
 + (nonnull NSArray *)_safeArrayFromArray:(nonnull NSArray *)array;
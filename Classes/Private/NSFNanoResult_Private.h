@@ -25,19 +25,19 @@
  */
 
 #import "NSFNanoResult.h"
+#import "sqlite3.h"
 
 /** \cond */
 
 @interface NSFNanoResult (Private)
-+ (nonnull NSFNanoResult *)_resultWithDictionary:(nonnull NSDictionary *)results;
++ (nonnull NSFNanoResult *)_resultWithStatement:(nullable sqlite3_stmt *)theStatement;
 + (nonnull NSFNanoResult *)_resultWithError:(nonnull NSError *)error;
 
-- (nonnull id)_initWithDictionary:(nonnull NSDictionary *)results;
+- (nonnull id)_initWithStatement:(nullable sqlite3_stmt *)theStatement;
 - (nonnull id)_initWithError:(nonnull NSError *)error;
 
 - (void)_setError:(nonnull NSError *)error;
 - (void)_reset;
-- (void)_calculateNumberOfRows;
 @end
 
 /** \endcond */
@@ -28,18 +28,57 @@
 
 /** \cond */
 
+@class NSFNanoObjectFaultGroup;
+
 @interface NSFNanoSearch (Private)
 - (nullable NSDictionary *)_retrieveDataWithError:(NSError * _Nullable * _Nullable)outError;
 - (nullable NSDictionary *)_retrieveDataAdded:(NSFDateMatchType)aDateMatch calendarDate:(nonnull NSDate *)aDate error:(NSError * _Nullable * _Nullable)outError;
 @property (nonatomic, readonly, copy, nonnull) NSString *_preparedSQL;
-- (nonnull NSString *)_prepareSQLQueryStringWithKey:(nullable NSString *)aKey attribute:(nullable NSString *)anAttribute value:(nullable id)aValue matching:(NSFMatchType)match;
-- (nonnull NSString *)_prepareSQLQueryStringWithExpressions:(nonnull NSArray *)someExpressions;
+- (nonnull NSString *)_preparedSQLWithReturnType:(NSFReturnType)theReturnType;
+- (nonnull NSString *)_prepareSQLQueryStringWithKey:(nullable NSString *)aKey attribute:(nullable NSString *)anAttribute value:(nullable id)aValue matching:(NSFMatchType)match returnType:(NSFReturnType)theReturnType;
+- (nonnull NSString *)_prepareSQLQueryStringWithExpressions:(nonnull NSArray *)someExpressions returnType:(NSFReturnType)theReturnType;
 - (nonnull NSArray *)_resultsFromSQLQuery:(nonnull NSString *)theSQLStatement;
-+ (nonnull NSString *)_prepareSQLQueryStringWithKeys:(nonnull NSArray *)someKeys;
 + (nonnull NSString *)_querySegmentForColumn:(nonnull NSString *)aColumn value:(nonnull id)aValue matching:(NSFMatchType)match;
 + (nonnull NSString *)_querySegmentForAttributeColumnWithValue:(nonnull id)anAttributeValue matching:(NSFMatchType)match valueColumnWithValue:(nullable id)aValue;
++ (nonnull NSString *)_querySegmentForKeyPathsContainingSegment:(nonnull NSString *)aSegment;
+- (BOOL)_shouldUseFullTextIndexForAttribute:(nullable NSString *)anAttribute value:(nullable id)aValue matching:(NSFMatchType)aMatch;
++ (nonnull NSString *)_fullTextQueryForContainedValue:(nonnull NSString *)aValue;
++ (nonnull NSString *)_querySegmentForFullTextQuery:(nonnull NSString *)aQuery;
+- (nullable id)_nanoObjectWithArchive:(nullable NSData *)anArchive key:(nonnull NSString *)aKey className:(nonnull NSString *)aClassName;
+- (nonnull NSDictionary *)_subsetOfInfo:(nonnull NSDictionary *)anInfo;
+- (BOOL)_exportSQL:(nonnull NSString *)theSQLStatement format:(NSFExportFormat)theFormat toFileDescriptor:(int)theFileDescriptor syncInterval:(NSUInteger)theRowCount decodesArchives:(BOOL)decodesArchives error:(NSError * _Nullable * _Nullable)outError;
+- (void)_appendArchiveForColumn:(int)aColumn statement:(nonnull sqlite3_stmt *)aStatement format:(NSFExportFormat)aFormat toBuffer:(nonnull NSMutableData *)aBuffer;
++ (void)_appendValueForColumn:(int)aColumn statement:(nonnull sqlite3_stmt *)aStatement format:(NSFExportFormat)aFormat toBuffer:(nonnull NSMutableData *)aBuffer;
++ (void)_appendCSVField:(nonnull const char *)someBytes length:(NSUInteger)aLength toBuffer:(nonnull NSMutableData *)aBuffer;
++ (void)_appendJSONString:(nonnull const char *)someBytes length:(NSUInteger)aLength toBuffer:(nonnull NSMutableData *)aBuffer;
++ (BOOL)_writeBuffer:(nonnull NSMutableData *)aBuffer toFileDescriptor:(int)aFileDescriptor;
+- (nullable NSFNanoObjectFaultGroup *)_faultGroupForCacheMethod;
++ (nonnull NSString *)_archiveColumnForFaultingWithPrefix:(nonnull NSString *)aPrefix;
+- (nonnull id)_nanoObjectFaultWithKey:(nonnull NSString *)aKey faultGroup:(nonnull NSFNanoObjectFaultGroup *)aFaultGroup;
+- (void)_hydrateObjectsConcurrentlyFromStatement:(nonnull sqlite3_stmt *)aStatement intoResults:(nonnull NSMutableDictionary *)someResults;
++ (NSFQueryPlanWarning)_warningsForQueryPlanDetail:(nonnull NSString *)aDetail;
+- (void)_recordSearchShape;
++ (nonnull NSString *)_continuationTokenWithValue:(nullable id)aValue key:(nonnull NSString *)aKey fingerprint:(nonnull NSString *)aFingerprint;
++ (nullable NSDictionary *)_dictionaryFromContinuationToken:(nonnull NSString *)aToken;
++ (nonnull NSString *)_digestOfString:(nonnull NSString *)aString;
++ (void)_bindObject:(nullable id)anObject toParameter:(int)aParameter statement:(nonnull sqlite3_stmt *)aStatement;
+- (nonnull NSString *)_keysSQLHonoringBag;
++ (nonnull NSString *)_querySegmentForBagMembers;
+- (void)_bindBagToStatement:(nonnull sqlite3_stmt *)aStatement;
+- (nonnull NSString *)_batchShape;
+- (long long)_int64ForSQL:(nonnull NSString *)theSQLStatement error:(NSError * _Nullable * _Nullable)outError;
+- (BOOL)_enumerateRowsForSQL:(nonnull NSString *)theSQLStatement error:(NSError * _Nullable * _Nullable)outError usingBlock:(nonnull void (^)(NSString * _Nonnull aKey, NSData * _Nonnull anArchive, NSString * _Nonnull aClassName))theBlock;
++ (nullable NSString *)_aggregateColumnForFunctionType:(NSFAggregateFunctionType)theFunctionType;
++ (nonnull id)_objectForColumn:(int)aColumn statement:(nonnull sqlite3_stmt *)aStatement;
+- (nullable NSSet *)_attributesBoundingResults;
+- (BOOL)_shouldUseAttributeIndexForAttribute:(nonnull NSString *)anAttribute value:(nullable id)aValue matching:(NSFMatchType)aMatch;
++ (nonnull NSString *)_querySegmentForIndexedValue:(nonnull id)aValue type:(NSFNanoDatatype)aType matching:(NSFMatchType)aMatch;
++ (BOOL)_isTypedValue:(nullable id)aValue matching:(NSFMatchType)aMatch;
++ (nonnull NSString *)_SQLLiteralForTypedValue:(nonnull id)aValue;
++ (nonnull NSString *)_querySegmentForTypedValue:(nonnull id)aValue column:(nonnull NSString *)aColumn matching:(NSFMatchType)aMatch;
+- (BOOL)_shouldUseCaseFoldedValuesForAttribute:(nonnull NSString *)anAttribute value:(nullable id)aValue matching:(NSFMatchType)aMatch;
++ (nonnull NSString *)_querySegmentForCaseFoldedValue:(nonnull NSString *)aValue matching:(NSFMatchType)aMatch;
 - (nonnull NSDictionary *)_dictionaryForKeyPath:(nonnull NSString *)keyPath value:(nonnull id)value;
-+ (nonnull NSString *)_quoteStrings:(nonnull NSArray *)strings joiningWithDelimiter:(nonnull NSString *)delimiter;
 - (nonnull id)_sortResultsIfApplicable:(nonnull NSDictionary *)results returnType:(NSFReturnType)theReturnType;
 @end
 
@@ -46,10 +46,55 @@
 - (NSFNanoDatatype)_NSFDatatypeOfObject:(nonnull id)value;
 - (nonnull NSString *)_stringFromValue:(nonnull id)aValue;
 + (nonnull NSString *)_calendarDateToString:(nonnull NSDate *)aDate;
+- (BOOL)_storeKeyPathSegmentsForAttribute:(nonnull NSString *)anAttribute;
+- (BOOL)_storeFullTextValue:(nonnull NSString *)aValue rowUID:(long long)aRowUID;
+- (void)_loadFullTextAttributes;
+- (BOOL)_isFullTextIndexedKeyPath:(nonnull NSString *)aKeyPath;
+- (nonnull NSFNanoResult *)_populateFullTextIndexForAttribute:(nonnull NSString *)anAttribute;
+- (nonnull NSString *)_SQLForCreatingFullTextTableNamed:(nonnull NSString *)aTableName;
+- (BOOL)_rebuildFullTextTable;
+- (BOOL)_isCaseFoldedKeyPath:(nonnull NSString *)aKeyPath;
+- (BOOL)_isKeyPath:(nonnull NSString *)aKeyPath coveredByAttributes:(nonnull NSSet *)someAttributes;
+- (void)_loadCaseFoldedAttributes;
+- (nonnull NSFNanoResult *)_populateCaseFoldedValuesForAttribute:(nonnull NSString *)anAttribute;
+- (BOOL)_createCaseFoldedValuesIndex;
+- (BOOL)_createBagMembersIndexes;
+- (nullable NSArray *)_keysOfMembersOfBagWithKey:(nonnull NSString *)aBagKey;
+- (long long)_countOfMembersOfBagWithKey:(nonnull NSString *)aBagKey;
+- (BOOL)_storeMembersOfBagWithKey:(nonnull NSString *)aBagKey addingKeys:(nullable NSArray *)someAddedKeys removingKeys:(nullable NSArray *)someRemovedKeys error:(NSError * _Nullable * _Nullable)outError;
+- (BOOL)_stepBagMemberStatement:(sqlite3_stmt * _Nonnull)aStatement bagKey:(nonnull NSString *)aBagKey objectKeys:(nullable NSArray *)someKeys error:(NSError * _Nullable * _Nullable)outError;
+- (void)_loadAttributeIndexes;
++ (nonnull NSString *)_indexNameForAttribute:(nonnull NSString *)anAttribute;
+- (BOOL)_createIndexForAttribute:(nonnull NSString *)anAttribute;
+- (BOOL)_isOnlyKeyPathWithSegment:(nonnull NSString *)anAttribute;
+- (void)_recordSearchOnAttribute:(nonnull NSString *)anAttribute matching:(NSFMatchType)aMatch;
+- (nonnull NSString *)_querySegmentForRowsOfAttribute:(nonnull NSString *)anAttribute;
+- (NSFNanoDatatype)_prevailingDatatypeForAttribute:(nonnull NSString *)anAttribute;
+- (double)_estimatedRowsSavedPerSearchOnAttribute:(nonnull NSString *)anAttribute;
+- (BOOL)_isResultCacheEnabled;
+- (nullable NSDictionary *)_cachedResultsForKey:(nonnull NSString *)aCacheKey;
+- (void)_cacheResults:(nonnull NSDictionary *)someResults forKey:(nonnull NSString *)aCacheKey attributes:(nullable NSSet *)someAttributes objectClass:(nullable NSString *)aClassName commitCount:(unsigned long long)aCommitCount;
+- (void)_removeCachedResultsForKey:(nonnull NSString *)aCacheKey;
+- (void)_evictCachedResultsToFitCost:(NSUInteger)aCost;
+- (void)_discardResultCacheIfStale;
+- (void)_holdResultCacheUntilCommit;
+- (void)_invalidateCachedResultsContainingKeys:(nonnull NSArray *)someKeys;
+- (nullable id)_liveObjectForKey:(nonnull NSString *)aKey;
+- (void)_registerLiveObject:(nonnull id)anObject;
+- (nullable NSDictionary *)_cachedInfoForKey:(nonnull NSString *)aKey;
+- (void)_cacheInfo:(nonnull NSDictionary *)theInfo forKey:(nonnull NSString *)aKey cost:(NSUInteger)aCost;
+- (void)_evictCachedObjectsWithKeys:(nonnull NSArray *)someKeys;
+- (void)_evictCachedObjectsToFitCount:(NSUInteger)aCount;
+- (void)_removeCachedInfoForKey:(nonnull NSString *)aKey;
+- (void)_invalidateCachedResultsForKeyPaths:(nonnull NSArray *)someKeyPaths objectClass:(nullable NSString *)aClassName;
 - (void)_flattenCollection:(nonnull NSDictionary *)info keys:(NSMutableArray * _Nullable * _Nullable)flattenedKeys values:(NSMutableArray * _Nullable * _Nullable)flattenedValues;
 - (void)_flattenCollection:(nonnull id)someObject keyPath:(NSMutableArray * _Nullable * _Nullable)aKeyPath keys:(NSMutableArray * _Nullable * _Nullable)someKeys values:(NSMutableArray * _Nullable * _Nullable)someValues;
 - (BOOL)_prepareSQLite3Statement:(sqlite3_stmt * _Nonnull * _Nonnull)aStatement theSQLStatement:(nonnull NSString *)aSQLQuery;
-- (void)_executeSQLite3StepUsingSQLite3Statement:(sqlite3_stmt * _Nonnull)aStatement;
+- (int)_executeSQLite3StepUsingSQLite3Statement:(sqlite3_stmt * _Nonnull)aStatement;
++ (nonnull NSString *)_lookupKeysSQLWithCount:(NSUInteger)aCount;
+- (nonnull NSArray *)_objectsWithKeys:(nonnull NSArray *)someKeys objectClassName:(nullable NSString *)aClassName;
+- (nonnull NSArray *)_objectsWithKeys:(nonnull NSArray *)someKeys objectClassName:(nullable NSString *)aClassName search:(nonnull NSFNanoSearch *)aSearch;
+- (BOOL)_removeObjectsWithKeysInArray:(nonnull NSArray *)someKeys removingBagMembers:(BOOL)removesBagMembers error:(NSError * _Nullable * _Nullable)outError;
 - (BOOL)_addObjectsFromArray:(nonnull NSArray *)someObjects forceSave:(BOOL)forceSave error:(NSError * _Nullable * _Nullable)outError;
 + (nonnull NSDictionary *)_defaultTestData;
 - (BOOL)_backupFileStoreToDirectoryAtPath:(nonnull NSString *)aPath extension:(nullable NSString *)anExtension compact:(BOOL)flag error:(NSError * _Nullable * _Nullable)outError;
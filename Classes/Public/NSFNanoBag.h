@@ -65,6 +65,7 @@
 */
 
 #import "NSFNanoObjectProtocol.h"
+#import "NSFNanoGlobals.h"
 
 @interface NSFNanoBag : NSObject <NSFNanoObjectProtocol, NSCopying>
 
@@ -74,7 +75,7 @@
 @property (nonatomic, copy, readwrite, nullable) NSString *name;
 /** * The UUID of the bag.  */
 @property (nonatomic, copy, readonly, nonnull) NSString *key;
-/** * Dictionary of NSString (key) and id<NSFNanoObjectProtocol> (value). */
+/** * Dictionary of NSString (key) and id<NSFNanoObjectProtocol> (value). Bags fetched from the store load their objects the first time this property is accessed. */
 @property (nonatomic, readonly, nonnull) NSDictionary *savedObjects;
 /** * Dictionary of NSString (key) and id<NSFNanoObjectProtocol> (value). */
 @property (nonatomic, readonly, nonnull) NSDictionary *unsavedObjects;
@@ -82,6 +83,8 @@
 @property (nonatomic, readonly, nonnull) NSDictionary *removedObjects;
 /** * To determine whether the bag has uncommited changes.  */
 @property (nonatomic, readonly) BOOL hasUnsavedChanges;
+/** * The keys of the saved and unsaved objects. Obtaining them doesn't fetch the objects from the store.  */
+@property (nonatomic, readonly, nonnull) NSArray *objectKeys;
 
 /** @name Creating and Initializing Bags
  */
@@ -226,6 +229,7 @@
  * @param outError is used if an error occurs. May be NULL.
  * @return YES upon success, NO otherwise.
  * @note Check property hasUnsavedChanges to find out whether the bag has unsaved contents.
+ * @note Only the objects added or removed since the last save are written, so the cost of a save doesn't grow with the size of the bag.
  * @see \link reloadBagWithError: - (BOOL)reloadBagWithError:(NSError * __autoreleasing *)outError \endlink
  * @see \link undoChangesWithError: - (BOOL)undoChangesWithError:(NSError * __autoreleasing *)outError \endlink
  */
@@ -273,6 +277,64 @@
 
 - (void)deflateBag;
 
+/** * Enumerates the objects of the bag a page at a time, fetching each page from the document store when it's reached.
+ * @param thePageSize the maximum number of objects passed to the block at once. Must be greater than zero.
+ * @param block the block receiving each page of objects. Set *stop to YES to end the enumeration early.
+ * @note The fetched objects are not kept by the bag, so memory usage is bounded by the page size rather than by the size of the bag.
+ * @throws NSFUnexpectedParameterException is thrown if thePageSize is zero or the block is nil.
+ * @see \link objectKeys - (NSArray *)objectKeys \endlink
+ */
+
+- (void)enumerateObjectsInPagesOfSize:(NSUInteger)thePageSize usingBlock:(void (^ _Nonnull)(NSArray * _Nonnull objects, BOOL * _Nonnull stop))block;
+
+//@}
+
+/** @name Combining Bags
+ */
+
+//@{
+
+/** * Combines the bag with another one and saves the outcome as a new bag.
+ * @param theOperation the set operation to perform. See NSFBagOperation.
+ * @param theBag the bag to combine the receiver with.
+ * @param theName the name of the new bag. Can be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return The new bag, saved in the store of the receiver, upon success. nil otherwise.
+ * @note The operation runs in the document store over the recorded members, so no object is fetched. The new bag is returned without its objects, which are fetched when first accessed.
+ * @warning Both bags must be saved in the same store, with no member added or removed since. Otherwise an error is returned.
+ * @throws NSFUnexpectedParameterException is thrown if theBag is nil or theOperation is unknown.
+ * @see \link objectKeysFromOperation:withBag:error: - (NSArray *)objectKeysFromOperation:(NSFBagOperation)theOperation withBag:(NSFNanoBag *)theBag error:(NSError * __autoreleasing *)outError \endlink
+ * @see \link countOfObjectsFromOperation:withBag:error: - (long long)countOfObjectsFromOperation:(NSFBagOperation)theOperation withBag:(NSFNanoBag *)theBag error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (nullable NSFNanoBag *)bagFromOperation:(NSFBagOperation)theOperation withBag:(nonnull NSFNanoBag *)theBag name:(nullable NSString *)theName error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Combines the bag with another one and returns the keys of the resulting objects.
+ * @param theOperation the set operation to perform. See NSFBagOperation.
+ * @param theBag the bag to combine the receiver with.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return The keys of the objects resulting from the operation upon success, nil otherwise.
+ * @note The keys are computed in the document store and no object is fetched. Use \link NSFNanoStore::objectsWithKeysInArray: - (NSArray *)objectsWithKeysInArray:(NSArray *)theKeys \endlink to fetch the ones needed.
+ * @warning Both bags must be saved in the same store, with no member added or removed since. Otherwise an error is returned.
+ * @throws NSFUnexpectedParameterException is thrown if theBag is nil or theOperation is unknown.
+ * @see \link bagFromOperation:withBag:name:error: - (NSFNanoBag *)bagFromOperation:(NSFBagOperation)theOperation withBag:(NSFNanoBag *)theBag name:(NSString *)theName error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (nullable NSArray *)objectKeysFromOperation:(NSFBagOperation)theOperation withBag:(nonnull NSFNanoBag *)theBag error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Combines the bag with another one and returns how many objects result from it.
+ * @param theOperation the set operation to perform. See NSFBagOperation.
+ * @param theBag the bag to combine the receiver with.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return The number of objects resulting from the operation upon success, -1 otherwise.
+ * @note The objects are counted in the document store: neither the keys nor the objects are loaded.
+ * @warning Both bags must be saved in the same store, with no member added or removed since. Otherwise an error is returned.
+ * @throws NSFUnexpectedParameterException is thrown if theBag is nil or theOperation is unknown.
+ * @see \link objectKeysFromOperation:withBag:error: - (NSArray *)objectKeysFromOperation:(NSFBagOperation)theOperation withBag:(NSFNanoBag *)theBag error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (long long)countOfObjectsFromOperation:(NSFBagOperation)theOperation withBag:(nonnull NSFNanoBag *)theBag error:(NSError * _Nullable * _Nullable)outError;
+
 //@}
 
 /** @name Miscellaneous
@@ -282,6 +344,7 @@
 
 /** * Returns the number of objects currently in the bag.
  * @return The number of objects currently in the bag.
+ * @note For a bag fetched from the store and not modified since, the count is read from an index without loading the members.
  */
 
 @property (nonatomic, readonly) NSUInteger count;
@@ -289,6 +352,7 @@
 /** * Compares the receiving bag to another bag.
  * @param otherNanoBag is a bag.
  * @return YES if the contents of otherNanoBag are equal to the contents of the receiving bag, otherwise NO.
+ * @note Two bags fetched from the same store and not modified since are compared in the store, without loading their members.
  */
 
 - (BOOL)isEqualToNanoBag:(nullable NSFNanoBag *)otherNanoBag;
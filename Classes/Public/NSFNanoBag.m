@@ -32,6 +32,7 @@
 #import "NSFNanoSearch_Private.h"
 #import "NSFOrderedDictionary.h"
 #import "NSFNanoObject_Private.h"
+#import "NSFNanoResult.h"
 
 @implementation NSFNanoBag
 {
@@ -39,6 +40,9 @@
     NSMutableDictionary *_savedObjects;
     NSMutableDictionary *_unsavedObjects;
     NSMutableDictionary *_removedObjects;
+    BOOL _savesAllMembers;
+    BOOL _hasLoadedMemberKeys;
+    BOOL _materializesOnAccess;
     /** \endcond */
 }
 
@@ -92,6 +96,9 @@
         _unsavedObjects = [NSMutableDictionary new];
         _removedObjects = [NSMutableDictionary new];
         _hasUnsavedChanges = NO;
+        _savesAllMembers = NO;
+        _hasLoadedMemberKeys = YES;
+        _materializesOnAccess = NO;
     }
     
     return self;
@@ -100,6 +107,15 @@
 - (id)copyWithZone:(NSZone *)zone
 {
     NSFNanoBag *copy = [[[self class]allocWithZone:zone]initNanoObjectFromDictionaryRepresentation:[self dictionaryRepresentation] forKey:[NSFNanoEngine stringWithUUID] store:_store];
+    
+    // Hand over the objects already in memory, so the copy doesn't have to fetch them again
+    [copy->_savedObjects addEntriesFromDictionary:_savedObjects];
+    [copy->_savedObjects addEntriesFromDictionary:_unsavedObjects];
+    
+    // The copy has a key of its own, so none of its members have been recorded yet
+    copy->_savesAllMembers = YES;
+    copy->_hasUnsavedChanges = YES;
+    
     return copy;
 }
 
@@ -119,8 +135,32 @@
 
 /** \endcond */
 
+- (NSDictionary *)savedObjects
+{
+    [self _loadMemberKeysIfNeeded];
+    
+    // Bags fetched from the store only hold the member keys until the objects are asked for
+    if (_materializesOnAccess) {
+        [self inflateBag];
+    }
+    
+    return _savedObjects;
+}
+
+- (NSArray *)objectKeys
+{
+    [self _loadMemberKeysIfNeeded];
+    
+    return [_savedObjects.allKeys arrayByAddingObjectsFromArray:_unsavedObjects.allKeys];
+}
+
 - (NSUInteger)count
 {
+    // Until the member keys are needed, the store can count them straight from its index
+    if (NO == _hasLoadedMemberKeys) {
+        return (NSUInteger)[_store _countOfMembersOfBagWithKey:_key];
+    }
+    
     return _savedObjects.count + _unsavedObjects.count;
 }
 
@@ -138,7 +178,7 @@
     values[@"Name"] = (nil != _name) ? _name : @"<untitled>";
     values[@"Document store"] = ([_store dictionaryDescription] ? [_store dictionaryDescription] : @"<nil>");
     values[@"Has unsaved changes?"] = (_hasUnsavedChanges ? @"YES" : @"NO");
-    values[@"Saved objects"] = @(_savedObjects.count);
+    values[@"Saved objects"] = @(self.count - _unsavedObjects.count);
     values[@"Unsaved objects"] = @(_unsavedObjects.count);
     values[@"Removed objects"] = @(_removedObjects.count);
     
@@ -157,14 +197,8 @@
 
 - (NSDictionary *)dictionaryRepresentation
 {
-    // Iterate the objects collecting the object keys
-    NSMutableArray *objectKeys = [NSMutableArray new];
-    for (NSString *objectKey in _savedObjects) {
-        [objectKeys addObject:objectKey];
-    }
-    for (NSString *objectKey in _unsavedObjects) {
-        [objectKeys addObject:objectKey];
-    }
+    // Collect the object keys, without fetching the objects themselves
+    NSArray *objectKeys = self.objectKeys;
     
     NSMutableDictionary *info = [NSMutableDictionary dictionary];
     
@@ -183,27 +217,21 @@
         return YES;
     }
     
-    BOOL success = YES;
+    if (nil == otherNanoBag) {
+        return NO;
+    }
     
-    NSArray *sortedArraySelf = [[_savedObjects allKeys]sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)];
-    NSArray *sortedArrayOther = [[otherNanoBag.savedObjects allKeys]sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)];
-    if (NO == [sortedArraySelf isEqualToArray:sortedArrayOther]) {
-        success = NO;
-    } else {
-        sortedArraySelf = [[_unsavedObjects allKeys]sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)];
-        sortedArrayOther = [[otherNanoBag.unsavedObjects allKeys]sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)];
-        if (NO == [sortedArraySelf isEqualToArray:sortedArrayOther]) {
-            success = NO;
-        } else {
-            sortedArraySelf = [[_removedObjects allKeys]sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)];
-            sortedArrayOther = [[otherNanoBag.removedObjects allKeys]sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)];
-            if (NO == [sortedArraySelf isEqualToArray:sortedArrayOther]) {
-                success = NO;
-            }
-        }
+    // Bags whose members haven't been loaded hold exactly what the store recorded, so let the store compare them
+    if ((NO == _hasLoadedMemberKeys) && (NO == otherNanoBag->_hasLoadedMemberKeys) && (nil != _store) && (_store == otherNanoBag->_store)) {
+        NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT count(*) AS NSFCount FROM (SELECT NSFKey FROM (%@ EXCEPT %@) UNION ALL SELECT NSFKey FROM (%@ EXCEPT %@))",
+                                     [self _membersSQL], [otherNanoBag _membersSQL], [otherNanoBag _membersSQL], [self _membersSQL]];
+        NSFNanoResult *result = [_store _executeSQL:theSQLStatement];
+        return (nil == result.error) && (0 == [result int64AtIndex:0 forColumn:@"NSFCount"]);
     }
-
-    return success;
+    
+    return ([[NSSet setWithArray:[self _savedObjectKeys]]isEqualToSet:[NSSet setWithArray:[otherNanoBag _savedObjectKeys]]] &&
+            [[NSSet setWithArray:_unsavedObjects.allKeys]isEqualToSet:[NSSet setWithArray:otherNanoBag.unsavedObjects.allKeys]] &&
+            [[NSSet setWithArray:_removedObjects.allKeys]isEqualToSet:[NSSet setWithArray:otherNanoBag.removedObjects.allKeys]]);
 }
 
 #pragma mark -
@@ -219,6 +247,8 @@
     NSString *objectKey = [(id)object nanoObjectKey];
     NSDictionary *info = [object nanoObjectDictionaryRepresentation];
     
+    [self _loadMemberKeysIfNeeded];
+    
     if (objectKey && info) {
         [_savedObjects removeObjectForKey:objectKey];
         _unsavedObjects[objectKey] = object;
@@ -272,12 +302,12 @@
 
 - (void)removeAllObjects
 {
+    [self _loadMemberKeysIfNeeded];
+    
     NSMutableDictionary *objects = [[NSMutableDictionary alloc]initWithCapacity:(_savedObjects.count + _removedObjects.count)];
     
     // Save the object and its key
-    for (id object in _savedObjects) {
-        objects[[object performSelector:@selector(key)]] = object;
-    }
+    [objects addEntriesFromDictionary:_savedObjects];
     
     // Save the previously removed objects (if any)
     [objects addEntriesFromDictionary:_removedObjects];
@@ -303,6 +333,8 @@
                                userInfo:nil]raise]; 
     }
     
+    [self _loadMemberKeysIfNeeded];
+    
     // Is the object an existing one?
     id object = _savedObjects[objectKey];
     if (nil != object) {
@@ -352,6 +384,9 @@
 
 - (void)deflateBag
 {
+    [self _loadMemberKeysIfNeeded];
+    _materializesOnAccess = NO;
+    
     NSArray *savedObjectsCopy = [[NSArray alloc]initWithArray:_savedObjects.allKeys];
     
     for (id saveObjectKey in savedObjectsCopy) {
@@ -362,10 +397,157 @@
 
 - (void)inflateBag
 {
-    NSArray *objectKeys = _savedObjects.allKeys;
+    [self _loadMemberKeysIfNeeded];
+    _materializesOnAccess = NO;
+    
+    // Only fetch the objects which are still placeholders
+    NSArray *objectKeys = [_savedObjects keysOfEntriesPassingTest:^BOOL(id key, id object, BOOL *stop) {
+        return (object == [NSNull null]);
+    }].allObjects;
     [self _inflateObjectsWithKeys:objectKeys];
 }
 
+- (void)enumerateObjectsInPagesOfSize:(NSUInteger)thePageSize usingBlock:(void (^)(NSArray *objects, BOOL *stop))block
+{
+    if (0 == thePageSize) {
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: the page size must be greater than zero.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    }
+    
+    if (nil == block) {
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: the block cannot be nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    }
+    
+    NSArray *objectKeys = self.objectKeys;
+    NSUInteger count = objectKeys.count;
+    BOOL stop = NO;
+    
+    for (NSUInteger location = 0; (location < count) && (NO == stop); location += thePageSize) {
+        @autoreleasepool {
+            NSArray *pageKeys = [objectKeys subarrayWithRange:NSMakeRange(location, MIN(thePageSize, count - location))];
+            NSMutableArray *objects = [[NSMutableArray alloc]initWithCapacity:pageKeys.count];
+            NSMutableArray *keysToFetch = [NSMutableArray new];
+            
+            for (NSString *objectKey in pageKeys) {
+                id object = _unsavedObjects[objectKey];
+                if (nil == object) {
+                    object = _savedObjects[objectKey];
+                }
+                
+                if ((nil == object) || ([NSNull null] == object)) {
+                    [keysToFetch addObject:objectKey];
+                } else {
+                    [objects addObject:object];
+                }
+            }
+            
+            // The fetched objects are handed out but not kept, so memory is bounded by the page size
+            if ((keysToFetch.count > 0) && (nil != _store)) {
+                [objects addObjectsFromArray:[_store _objectsWithKeys:keysToFetch objectClassName:nil]];
+            }
+            
+            block(objects, &stop);
+        }
+    }
+}
+
+#pragma mark -
+
+- (NSFNanoBag *)bagFromOperation:(NSFBagOperation)theOperation withBag:(NSFNanoBag *)theBag name:(NSString *)theName error:(NSError * __autoreleasing *)outError
+{
+    NSString *operationSQL = [self _SQLForOperation:theOperation withBag:theBag error:outError];
+    if (nil == operationSQL) {
+        return nil;
+    }
+    
+    // Save the new bag empty, then record its members straight from the operation. Both happen in one
+    // transaction, so a failure doesn't leave an empty bag behind.
+    NSFNanoBag *bag = [NSFNanoBag bagWithName:theName];
+    [bag _setStore:_store];
+    
+    BOOL transactionStartedHere = [_store beginTransactionAndReturnError:nil];
+    BOOL success = NO;
+    
+    @try {
+        success = [bag _saveInStore:_store error:outError];
+        
+        if (success) {
+            NSString *theSQLStatement = [NSString stringWithFormat:@"INSERT INTO %@(%@, %@) SELECT '%@', %@ FROM (%@)", NSFBagMembers, NSFBagKey, NSFKey, bag.key, NSFKey, operationSQL];
+            NSFNanoResult *result = [_store _executeSQL:theSQLStatement];
+            
+            if (nil != result.error) {
+                success = NO;
+                if (nil != outError) {
+                    *outError = [NSError errorWithDomain:NSFDomainKey
+                                                    code:NSFNanoStoreErrorKey
+                                                userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: the members of the new bag could not be recorded. Reason: %@", [self class], NSStringFromSelector(_cmd), result.error.localizedDescription]}];
+                }
+            }
+        }
+        
+        if (success && transactionStartedHere) {
+            success = [_store commitTransactionAndReturnError:outError];
+            transactionStartedHere = (NO == success);
+        }
+    }
+    @finally {
+        if (transactionStartedHere) {
+            [_store rollbackTransactionAndReturnError:nil];
+        }
+        [_store _invalidateCachedResultsForKeyPaths:@[NSF_Private_NSFNanoBag_NSFObjectKeys] objectClass:nil];
+    }
+    
+    if (NO == success) {
+        return nil;
+    }
+    
+    // Hand back a bag which hasn't loaded its members yet
+    return [_store bagsWithKeysInArray:@[bag.key]].lastObject;
+}
+
+- (NSArray *)objectKeysFromOperation:(NSFBagOperation)theOperation withBag:(NSFNanoBag *)theBag error:(NSError * __autoreleasing *)outError
+{
+    NSString *operationSQL = [self _SQLForOperation:theOperation withBag:theBag error:outError];
+    if (nil == operationSQL) {
+        return nil;
+    }
+    
+    NSFNanoResult *result = [_store _executeSQL:operationSQL];
+    if (nil != result.error) {
+        if (nil != outError) {
+            *outError = result.error;
+        }
+        return nil;
+    }
+    
+    NSArray *keys = [result valuesForColumn:NSFKey];
+    
+    return (nil != keys) ? keys : @[];
+}
+
+- (long long)countOfObjectsFromOperation:(NSFBagOperation)theOperation withBag:(NSFNanoBag *)theBag error:(NSError * __autoreleasing *)outError
+{
+    NSString *operationSQL = [self _SQLForOperation:theOperation withBag:theBag error:outError];
+    if (nil == operationSQL) {
+        return -1;
+    }
+    
+    NSFNanoResult *result = [_store _executeSQL:[NSString stringWithFormat:@"SELECT count(*) AS NSFCount FROM (%@)", operationSQL]];
+    if (nil != result.error) {
+        if (nil != outError) {
+            *outError = result.error;
+        }
+        return -1;
+    }
+    
+    return [result int64AtIndex:0 forColumn:@"NSFCount"];
+}
+
+#pragma mark -
+
 - (BOOL)reloadBagWithError:(NSError * __autoreleasing *)outError
 {
     // If the bag is not associated to a document store, there is no need to continue
@@ -373,15 +555,14 @@
         return YES;
     }
     
-    // Refresh the bag to match the contents stored on the database
-    [self _inflateObjectsWithKeys:@[_key]];
-    NSFNanoBag *savedBag = _savedObjects[_key];
-    if (nil != savedBag) {
+    // Refresh the bag to match the members stored on the database. The objects are fetched when asked for.
+    NSArray *objectKeys = [_store _keysOfMembersOfBagWithKey:_key];
+    if (nil != objectKeys) {
         [_savedObjects removeAllObjects];
-        [_savedObjects addEntriesFromDictionary:savedBag.savedObjects];
-        for (NSString *objectKey in _unsavedObjects) {
-            [_savedObjects removeObjectForKey:objectKey];
-        }
+        [self _addPlaceholdersForKeys:objectKeys];
+        _hasLoadedMemberKeys = YES;
+        _materializesOnAccess = YES;
+        _savesAllMembers = NO;
     } else {
         if (nil != outError) {
             *outError = [NSError errorWithDomain:NSFDomainKey
@@ -421,10 +602,17 @@
         _unsavedObjects = [NSMutableDictionary new];
         _removedObjects = [NSMutableDictionary new];
         
+        // Bags saved before the membership table existed (and copies) still carry their member keys.
+        // Otherwise, the keys are read from the store the first time they're needed.
         NSArray *objectKeys = dictionary[NSF_Private_NSFNanoBag_NSFObjectKeys];
+        if (nil != objectKeys) {
+            [self _addPlaceholdersForKeys:objectKeys];
+        } else {
+            _hasLoadedMemberKeys = (nil == aStore);
+        }
         
-        [self _inflateObjectsWithKeys:objectKeys];
-        
+        // Either way, the objects are only fetched when asked for
+        _materializesOnAccess = YES;
         _hasUnsavedChanges = NO;
     }
     
@@ -436,6 +624,18 @@
     return [self dictionaryRepresentation];
 }
 
+- (NSDictionary *)_storedDictionaryRepresentation
+{
+    NSMutableDictionary *info = [NSMutableDictionary dictionary];
+    
+    if (nil != _name) {
+        info[NSF_Private_NSFNanoBag_Name] = _name;
+    }
+    info[NSF_Private_NSFNanoBag_NSFKey] = self.key;
+    
+    return info;
+}
+
 - (NSString *)nanoObjectKey
 {
     return _key;
@@ -454,37 +654,133 @@
         [someStore _addObjectsFromArray:contentsToBeSaved forceSave:YES error:outError];
     }
     
-    // Move the existing objects to the unsaved list, in order to save the bag
-    [_unsavedObjects addEntriesFromDictionary:_savedObjects];
-    [_savedObjects removeAllObjects];
-    [_removedObjects removeAllObjects];
-    
-    // Save the unsaved bag...
+    // Save the bag itself, which no longer carries the list of members...
     BOOL success = [someStore _addObjectsFromArray:@[self] forceSave:YES error:outError];
     
+    // ... and only record the members that joined or left since the last save
     if (success) {
-        [_unsavedObjects removeAllObjects];
-        success = [self reloadBagWithError:outError];
-        if (success) {
-            _hasUnsavedChanges = NO;
+        NSMutableArray *addedKeys = [NSMutableArray arrayWithArray:_unsavedObjects.allKeys];
+        if (_savesAllMembers || (someStore != _store)) {
+            [addedKeys addObjectsFromArray:[self _savedObjectKeys]];
         }
-        return success;
+        
+        success = [someStore _storeMembersOfBagWithKey:_key addingKeys:addedKeys removingKeys:_removedObjects.allKeys error:outError];
+    }
+    
+    if (success) {
+        [_savedObjects addEntriesFromDictionary:_unsavedObjects];
+        [_unsavedObjects removeAllObjects];
+        [_removedObjects removeAllObjects];
+        _savesAllMembers = NO;
+        _hasUnsavedChanges = NO;
     }
     
     return success;
 }
 
+- (NSString *)_membersSQL
+{
+    return [NSString stringWithFormat:@"SELECT %@ FROM %@ WHERE %@ = '%@'", NSFKey, NSFBagMembers, NSFBagKey, [_key stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+}
+
+- (BOOL)_hasUnsavedMembers
+{
+    return (_unsavedObjects.count > 0) || (_removedObjects.count > 0) || _savesAllMembers;
+}
+
+- (NSString *)_SQLForOperation:(NSFBagOperation)theOperation withBag:(NSFNanoBag *)theBag error:(NSError * __autoreleasing *)outError
+{
+    if (nil == theBag) {
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: the bag cannot be nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    }
+    
+    NSString *compoundOperator = nil;
+    switch (theOperation) {
+        case NSFBagUnion:
+            compoundOperator = @"UNION";
+            break;
+        case NSFBagIntersection:
+            compoundOperator = @"INTERSECT";
+            break;
+        case NSFBagDifference:
+            compoundOperator = @"EXCEPT";
+            break;
+        default:
+            [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                     reason:[NSString stringWithFormat:@"*** -[%@ %@]: unknown bag operation: %u.", [self class], NSStringFromSelector(_cmd), theOperation]
+                                   userInfo:nil]raise];
+            break;
+    }
+    
+    // The operation only sees what has been recorded in the store
+    NSString *message = nil;
+    if ((nil == _store) || (_store != theBag->_store)) {
+        message = @"both bags must be saved in the same store.";
+    } else if ([self _hasUnsavedMembers] || [theBag _hasUnsavedMembers]) {
+        message = @"both bags must be saved before being combined.";
+    }
+    
+    if (nil != message) {
+        if (nil != outError) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: %@", [self class], NSStringFromSelector(_cmd), message]}];
+        }
+        return nil;
+    }
+    
+    return [NSString stringWithFormat:@"%@ %@ %@", [self _membersSQL], compoundOperator, [theBag _membersSQL]];
+}
+
+- (void)_loadMemberKeysIfNeeded
+{
+    if (_hasLoadedMemberKeys) {
+        return;
+    }
+    
+    _hasLoadedMemberKeys = YES;
+    
+    NSArray *objectKeys = [_store _keysOfMembersOfBagWithKey:_key];
+    if (nil != objectKeys) {
+        [self _addPlaceholdersForKeys:objectKeys];
+    }
+}
+
+- (void)_addPlaceholdersForKeys:(NSArray *)someKeys
+{
+    NSNull *placeholder = [NSNull null];
+    
+    // Members changed locally since the last save keep their current state
+    for (NSString *objectKey in someKeys) {
+        if ((nil == _savedObjects[objectKey]) && (nil == _unsavedObjects[objectKey]) && (nil == _removedObjects[objectKey])) {
+            _savedObjects[objectKey] = placeholder;
+        }
+    }
+}
+
+- (NSArray *)_savedObjectKeys
+{
+    [self _loadMemberKeysIfNeeded];
+    
+    return _savedObjects.allKeys;
+}
+
 - (void)_inflateObjectsWithKeys:(NSArray *)someKeys
 {
     if (someKeys.count != 0) {
-        NSFNanoSearch *search = [NSFNanoSearch searchWithStore:_store];
-        NSString *quotedString = [NSFNanoSearch _quoteStrings:someKeys joiningWithDelimiter:@","];
-        NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT NSFKey, NSFKeyedArchive, NSFObjectClass FROM NSFKeys WHERE NSFKey IN (%@)", quotedString];
+        NSArray *objects = [_store _objectsWithKeys:someKeys objectClassName:nil];
         
-        NSDictionary *results = [search executeSQL:theSQLStatement returnType:NSFReturnObjects error:nil];
+        for (id <NSFNanoObjectProtocol> object in objects) {
+            _savedObjects[object.nanoObjectKey] = object;
+        }
         
-        if (nil != results) {
-            [_savedObjects addEntriesFromDictionary:results];
+        // Members whose object has been removed from the store are dropped
+        for (NSString *key in someKeys) {
+            if (_savedObjects[key] == [NSNull null]) {
+                [_savedObjects removeObjectForKey:key];
+            }
         }
     }
 }
@@ -57,6 +57,15 @@
  // Close the document store
  [nanoStore closeWithError:nil];
  @endcode
+ *
+ * Expressions can also be combined into a tree of AND, OR and NOT nodes, which is compiled into a single SQLite statement
+ * intersecting, uniting and excepting the sets of matching keys:
+ @code
+ // (City = 'Paris' OR City = 'London') AND NOT Status = 'Inactive'
+ NSFNanoExpression *cities = [NSFNanoExpression expressionWithOperator:NSFOr subexpressions:@[paris, london]];
+ NSFNanoExpression *active = [NSFNanoExpression expressionNegatingExpression:inactive];
+ search.expressions = @[[NSFNanoExpression expressionWithOperator:NSFAnd subexpressions:@[cities, active]]];
+ @endcode
  */
 
 @interface NSFNanoExpression : NSObject
@@ -65,6 +74,10 @@
 @property (nonatomic, readonly, nonnull) NSArray      *predicates;
 /** * Array of NSNumber wrapping \link NSFGlobals::NSFOperator NSFOperator \endlink */
 @property (nonatomic, readonly, nonnull) NSArray      *operators;
+/** * Array of NSFNanoExpression combined by the compound operator. nil unless the expression is compound. */
+@property (nonatomic, readonly, nullable) NSArray     *subexpressions;
+/** * The operator combining the subexpressions: NSFAnd, NSFOr or NSFNot. 0 unless the expression is compound. */
+@property (nonatomic, readonly) NSFOperator           compoundOperator;
 
 /** @name Creating and Initializing Expressions
  */
@@ -91,6 +104,36 @@
 
 - (nonnull instancetype)initWithPredicate:(nonnull NSFNanoPredicate *)thePredicate NS_DESIGNATED_INITIALIZER;
 
+/** * Creates and returns a compound expression combining other expressions.
+ * @param theOperator is NSFAnd to match the objects matching all the subexpressions, NSFOr to match the objects matching any of them, or NSFNot to match the objects not matching the only subexpression.
+ * @param theExpressions is an array of NSFNanoExpression, which can be compound themselves. Must not be empty, and must hold exactly one expression for NSFNot.
+ * @return A compound expression upon success, nil otherwise.
+ * @note Predicates can't be added to a compound expression.
+ * @throws NSFUnexpectedParameterException is thrown if the subexpressions are missing or don't fit the operator.
+ * @see \link initWithOperator:subexpressions: - (id)initWithOperator:(NSFOperator)theOperator subexpressions:(NSArray *)theExpressions \endlink
+ */
+
++ (nonnull NSFNanoExpression *)expressionWithOperator:(NSFOperator)theOperator subexpressions:(nonnull NSArray *)theExpressions;
+
+/** * Creates and returns a compound expression matching the objects which don't match a given expression.
+ * @param theExpression is the expression to negate. Must not be nil.
+ * @return A compound expression upon success, nil otherwise.
+ * @throws NSFUnexpectedParameterException is thrown if the expression is nil.
+ * @see \link expressionWithOperator:subexpressions: + (NSFNanoExpression*)expressionWithOperator:(NSFOperator)theOperator subexpressions:(NSArray *)theExpressions \endlink
+ */
+
++ (nonnull NSFNanoExpression *)expressionNegatingExpression:(nonnull NSFNanoExpression *)theExpression;
+
+/** * Initializes a newly allocated compound expression combining other expressions.
+ * @param theOperator is NSFAnd, NSFOr or NSFNot.
+ * @param theExpressions is an array of NSFNanoExpression. Must not be empty, and must hold exactly one expression for NSFNot.
+ * @return A compound expression upon success, nil otherwise.
+ * @throws NSFUnexpectedParameterException is thrown if the subexpressions are missing or don't fit the operator.
+ * @see \link expressionWithOperator:subexpressions: + (NSFNanoExpression*)expressionWithOperator:(NSFOperator)theOperator subexpressions:(NSArray *)theExpressions \endlink
+ */
+
+- (nonnull instancetype)initWithOperator:(NSFOperator)theOperator subexpressions:(nonnull NSArray *)theExpressions NS_DESIGNATED_INITIALIZER;
+
 //@}
 
 /** @name Adding a Predicate
@@ -102,7 +145,7 @@
  * @param thePredicate is added to the expression.
  * @param theOperator specifies the operation (AND/OR) to be applied.
  * @warning The parameter thePredicate must not be nil.
- * @throws NSFUnexpectedParameterException is thrown if the predicate is nil.
+ * @throws NSFUnexpectedParameterException is thrown if the predicate is nil or the expression is compound.
  */
 
 - (void)addPredicate:(nonnull NSFNanoPredicate *)thePredicate withOperator:(NSFOperator)theOperator;
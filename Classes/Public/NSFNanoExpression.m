@@ -33,6 +33,8 @@
     /** \cond */
     NSMutableArray *_predicates;
     NSMutableArray *_operators;
+    NSArray *_subexpressions;
+    NSFOperator _compoundOperator;
     /** \endcond */
 }
 
@@ -67,8 +69,103 @@
     return self;
 }
 
++ (NSFNanoExpression *)expressionWithOperator:(NSFOperator)theOperator subexpressions:(NSArray *)theExpressions
+{
+    return [[self alloc]initWithOperator:theOperator subexpressions:theExpressions];
+}
+
++ (NSFNanoExpression *)expressionNegatingExpression:(NSFNanoExpression *)theExpression
+{
+    if (nil == theExpression) {
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: the expression is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    }
+    
+    return [[self alloc]initWithOperator:NSFNot subexpressions:@[theExpression]];
+}
+
+- (instancetype)initWithOperator:(NSFOperator)theOperator subexpressions:(NSArray *)theExpressions
+{
+    if (0 == theExpressions.count) {
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: the list of subexpressions is nil or empty.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    }
+    
+    if ((NSFAnd != theOperator) && (NSFOr != theOperator) && (NSFNot != theOperator)) {
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: unknown operator: %u.", [self class], NSStringFromSelector(_cmd), theOperator]
+                               userInfo:nil]raise];
+    }
+    
+    if ((NSFNot == theOperator) && (1 != theExpressions.count)) {
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: NSFNot negates exactly one subexpression.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    }
+    
+    for (id expression in theExpressions) {
+        if (NO == [expression isKindOfClass:[NSFNanoExpression class]]) {
+            [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                     reason:[NSString stringWithFormat:@"*** -[%@ %@]: subexpressions must be of type NSFNanoExpression.", [self class], NSStringFromSelector(_cmd)]
+                                   userInfo:nil]raise];
+        }
+    }
+    
+    if ((self = [super init])) {
+        _predicates = [NSMutableArray new];
+        _operators = [NSMutableArray new];
+        _subexpressions = [theExpressions copy];
+        _compoundOperator = theOperator;
+    }
+    
+    return self;
+}
+
 /** \cond */
 
+- (BOOL)_isCompound
+{
+    return (nil != _subexpressions);
+}
+
+- (NSString *)_keysSQL
+{
+    if (NO == [self _isCompound]) {
+        return [NSString stringWithFormat:@"SELECT NSFKey FROM NSFValues WHERE %@", [self description]];
+    }
+    
+    // Each operand is wrapped so that nested compound selects keep their own grouping
+    NSMutableArray *operands = [[NSMutableArray alloc]initWithCapacity:_subexpressions.count];
+    for (NSFNanoExpression *expression in _subexpressions) {
+        [operands addObject:[NSString stringWithFormat:@"SELECT NSFKey FROM (%@)", [expression _keysSQL]]];
+    }
+    
+    switch (_compoundOperator) {
+        case NSFNot:
+            return [NSString stringWithFormat:@"SELECT NSFKey FROM %@ EXCEPT %@", NSFKeys, operands[0]];
+        case NSFOr:
+            return [operands componentsJoinedByString:@" UNION "];
+        default:
+            return [operands componentsJoinedByString:@" INTERSECT "];
+    }
+}
+
+- (NSArray *)_leafExpressions
+{
+    if (NO == [self _isCompound]) {
+        return @[self];
+    }
+    
+    NSMutableArray *leaves = [NSMutableArray new];
+    for (NSFNanoExpression *expression in _subexpressions) {
+        [leaves addObjectsFromArray:[expression _leafExpressions]];
+    }
+    
+    return leaves;
+}
+
 
 /** \endcond */
 
@@ -81,6 +178,11 @@
                                  reason:[NSString stringWithFormat:@"*** -[%@ %@]: the predicate is nil.", [self class], NSStringFromSelector(_cmd)]
                                userInfo:nil]raise];
     
+    if ([self _isCompound])
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: predicates can't be added to a compound expression.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
     [_predicates addObject:aPredicate];
     [_operators addObject:[NSNumber numberWithInt:someOperator]];
 }
@@ -97,6 +199,12 @@
     NSUInteger i, count = _predicates.count;
     NSMutableArray *values = [NSMutableArray new];
     
+    // A compound expression reads as the set of keys it matches
+    if ([self _isCompound]) {
+        [values addObject:[NSString stringWithFormat:@"NSFKey IN (%@)", [self _keysSQL]]];
+        return values;
+    }
+    
     // We always have one predicate, so make sure add it
     [values addObject:[_predicates[0]description]];
     
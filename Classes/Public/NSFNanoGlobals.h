@@ -84,6 +84,69 @@ extern  NSString * NSFStringFromNanoDataType (NSFNanoDatatype aNanoDatatype);
 /** * Obtains a NSFNanoDatatype datatype by name. */
 extern  NSFNanoDatatype NSFNanoDatatypeFromString (NSString *aNanoDatatype);
 
+/** * Invalidation strategies for the search result cache.
+ * @see \link NSFNanoStore::resultCacheCostLimit resultCacheCostLimit \endlink
+ */
+
+typedef NS_ENUM(unsigned int, NSFResultCacheInvalidation) {
+    /** * Every commit empties the cache. Safe no matter how the document store gets modified. */
+    NSFResultCacheInvalidateOnCommit = 1,
+    /** * Objects stored and removed through NSFNanoStore only evict the cached results they could affect: the ones containing the objects
+     and the ones searching the attributes the objects carry. Changes made with raw SQL go unnoticed, so call
+     \link NSFNanoStore::clearResultCache - (void)clearResultCache \endlink after them. */
+    NSFResultCacheInvalidateByTouchedAttributes
+};
+
+/** * Problems flagged in the nodes of a query plan.
+ * @see \link NSFNanoSearch::queryPlanForSQL:error: - (NSArray *)queryPlanForSQL:(NSString *)theSQLStatement error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+typedef NS_OPTIONS(unsigned int, NSFQueryPlanWarning) {
+    /** * Nothing worth flagging. */
+    NSFQueryPlanNoWarning = 0,
+    /** * NSFValues is read row by row without an index. */
+    NSFQueryPlanFullScanOfValues = 1 << 0,
+    /** * A temporary B-tree is built to sort, group or remove duplicates. */
+    NSFQueryPlanTemporaryBTree = 1 << 1,
+    /** * A subquery is evaluated again for every row of the outer query. */
+    NSFQueryPlanCorrelatedSubquery = 1 << 2
+};
+
+/** * Kinds of index proposed by the index advisor.
+ * @see \link NSFNanoStore::indexRecommendations - (NSArray *)indexRecommendations \endlink
+ */
+
+typedef NS_ENUM(unsigned int, NSFIndexRecommendationType) {
+    /** * A partial index over the values of the attribute. See \link NSFNanoStore::createIndexForAttribute:type:error: - (BOOL)createIndexForAttribute:(NSString *)theAttribute type:(NSFNanoDatatype)theType error:(NSError * __autoreleasing *)outError \endlink. */
+    NSFAttributeIndexRecommendation = 1,
+    /** * A case-folded index over the text values of the attribute. See \link NSFNanoStore::createCaseFoldedIndexForAttribute:error: - (BOOL)createCaseFoldedIndexForAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError \endlink. */
+    NSFCaseFoldedIndexRecommendation
+};
+
+/** * File formats search results can be exported to.
+ * @see \link NSFNanoSearch::exportSQL:format:toFileDescriptor:syncInterval:error: - (BOOL)exportSQL:(NSString *)theSQLStatement format:(NSFExportFormat)theFormat toFileDescriptor:(int)theFileDescriptor syncInterval:(NSUInteger)theRowCount error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+typedef NS_ENUM(unsigned int, NSFExportFormat) {
+    /** * Comma-separated values as described by RFC 4180, starting with a row holding the column names. */
+    NSFExportCSV = 1,
+    /** * JSON Lines: one JSON object per row, keyed by column name. */
+    NSFExportJSONLines
+};
+
+/** * Set operations two bags can be combined with.
+ * @see \link NSFNanoBag::bagFromOperation:withBag:name:error: - (NSFNanoBag *)bagFromOperation:(NSFBagOperation)theOperation withBag:(NSFNanoBag *)theBag name:(NSString *)theName error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+typedef NS_ENUM(unsigned int, NSFBagOperation) {
+    /** * The objects found in either bag. */
+    NSFBagUnion = 1,
+    /** * The objects found in both bags. */
+    NSFBagIntersection,
+    /** * The objects found in the receiving bag but not in the other one. */
+    NSFBagDifference
+};
+
 /** * Types of backing store supported by NanoStore.
  * These values represent the storage options available when generating a NanoStore.
  @see NSFNanoStore
@@ -120,6 +183,8 @@ typedef NS_ENUM(unsigned int, NSFAggregateFunctionType) {
 
 /** * Comparison options.
  * These values represent the options available to some of the classes’ search and comparison methods.
+ * NSFEqualTo, NSFNotEqualTo, NSFGreaterThan, NSFLessThan and NSFBetween also accept NSNumber and NSDate values, which are compared
+ * as numbers and dates against the values stored with the same datatype, so SQLite can seek a range of the value index.
  @see NSFNanoPredicate, NSFNanoSearch
  */
 typedef NS_ENUM(unsigned int, NSFMatchType) {
@@ -146,7 +211,9 @@ typedef NS_ENUM(unsigned int, NSFMatchType) {
     /** * Less than */
     NSFLessThan,
     /** * Not Equal to from */
-    NSFNotEqualTo
+    NSFNotEqualTo,
+    /** * Between two bounds, both included. The value is an NSArray holding the lower and the upper bound, either NSNumber, NSDate or NSString. */
+    NSFBetween
 };
 
 /** * Column types for the Attributes table.
@@ -171,6 +238,8 @@ typedef NS_ENUM(unsigned int, NSFOperator) {
     NSFAnd = 1,
     /** * Or */
     NSFOr,
+    /** * Not. Only applies to compound expressions, negating their single subexpression. */
+    NSFNot
 };
 
 /** * Date comparison options.
@@ -204,9 +273,9 @@ typedef NS_ENUM(unsigned int, NSFReturnType) {
 typedef NS_ENUM(unsigned int, NSFCacheMethod) {
     /** * Load data at as soon as it's available. Uses more memory, but data is available quicker. */
     CacheAllData = 1,
-    /** * Loads data lazily. First access to data is slow because it retrieves it from disk, but is faster on subsequent requests because the data already exists in memory. */
+    /** * Loads data lazily. Searches return NanoObjects as faults carrying only their key. First access to data is slow because it retrieves it from disk, along with the data of the other faults returned by the same search, but is faster on subsequent requests because the data already exists in memory. */
     CacheDataOnDemand,
-    /** * Don't cache data. Slowest mode, uses less memory because it retrieves data from disk every time it's needed. */
+    /** * Don't cache data. Slowest mode, uses less memory because searches return NanoObjects as faults that retrieve their data from disk every time it's needed. */
     DoNotCacheData,
 };
 
@@ -327,3 +396,34 @@ extern NSString * const NSFNanoObjectBehaviorException;
  * (adding, updating, deleting, opening a transaction, commit, etc.).
  */
 extern NSString * const NSFNanoStoreUnableToManipulateStoreException;
+
+/** * Query plan node key: the text SQLite uses to describe the step (NSString). */
+extern NSString * const NSFQueryPlanDetailKey;
+/** * Query plan node key: the problems flagged for the step (NSNumber holding a NSFQueryPlanWarning). */
+extern NSString * const NSFQueryPlanWarningsKey;
+/** * Query plan node key: the steps nested under this one (NSArray of nodes). */
+extern NSString * const NSFQueryPlanChildrenKey;
+
+/** * Index recommendation key: the attribute to be indexed (NSString). */
+extern NSString * const NSFIndexRecommendationAttributeKey;
+/** * Index recommendation key: the kind of index (NSNumber holding a NSFIndexRecommendationType). */
+extern NSString * const NSFIndexRecommendationTypeKey;
+/** * Index recommendation key: the type of the values stored under the attribute (NSNumber holding a NSFNanoDatatype). */
+extern NSString * const NSFIndexRecommendationDatatypeKey;
+/** * Index recommendation key: how many recorded searches would have used the index (NSNumber). */
+extern NSString * const NSFIndexRecommendationSearchCountKey;
+/** * Index recommendation key: the estimated number of NSFValues rows the recorded searches would not have had to visit (NSNumber). */
+extern NSString * const NSFIndexRecommendationEstimatedGainKey;
+
+/** * Object cache statistics key: how many objects were served by the identity map or the object cache (NSNumber). */
+extern NSString * const NSFObjectCacheHitCountKey;
+/** * Object cache statistics key: how many objects had to be decoded from their archive (NSNumber). */
+extern NSString * const NSFObjectCacheMissCountKey;
+/** * Object cache statistics key: hits divided by hits plus misses, between 0 and 1 (NSNumber). */
+extern NSString * const NSFObjectCacheHitRateKey;
+/** * Object cache statistics key: how many decoded documents the object cache holds (NSNumber). */
+extern NSString * const NSFObjectCacheCountKey;
+/** * Object cache statistics key: the size of the archives the cached documents were decoded from, as an estimate of the memory they use (NSNumber). */
+extern NSString * const NSFObjectCacheByteCountKey;
+/** * Object cache statistics key: how many objects the identity map is tracking (NSNumber). */
+extern NSString * const NSFIdentityMapCountKey;
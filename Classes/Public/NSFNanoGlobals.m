@@ -86,11 +86,18 @@ NSString * NSFStringFromMatchType (NSFMatchType aMatchType)
         case NSFGreaterThan: value = @"Greater than"; break;
         case NSFLessThan: value = @"Less than"; break;
         case NSFNotEqualTo: value = @"Not equal to"; break;
+        case NSFBetween: value = @"Between"; break;
     }
     
     return value;
 }
 
+NSString * NSFCaseFoldedString (NSString *aString)
+{
+    // Unicode case folding, so that 'STRASSE', 'Straße' and 'strasse' compare as equal
+    return [aString stringByFoldingWithOptions:NSCaseInsensitiveSearch locale:nil];
+}
+
 void _NSFLog (NSString  *format, ...)
 {
     if (__NSFDebugIsOn) {
@@ -111,6 +118,20 @@ NSString * const NSFUnexpectedParameterException                = @"NSFUnexpecte
 NSString * const NSFNonConformingNanoObjectProtocolException    = @"NSFNonConformingNanoObjectProtocolException";
 NSString * const NSFNanoObjectBehaviorException                 = @"NSFNanoObjectBehaviorException";
 NSString * const NSFNanoStoreUnableToManipulateStoreException   = @"NSFNanoStoreUnableToManipulateStoreException";
+NSString * const NSFQueryPlanDetailKey                          = @"NSFQueryPlanDetailKey";
+NSString * const NSFQueryPlanWarningsKey                        = @"NSFQueryPlanWarningsKey";
+NSString * const NSFQueryPlanChildrenKey                        = @"NSFQueryPlanChildrenKey";
+NSString * const NSFIndexRecommendationAttributeKey             = @"NSFIndexRecommendationAttributeKey";
+NSString * const NSFIndexRecommendationTypeKey                  = @"NSFIndexRecommendationTypeKey";
+NSString * const NSFIndexRecommendationDatatypeKey              = @"NSFIndexRecommendationDatatypeKey";
+NSString * const NSFIndexRecommendationSearchCountKey           = @"NSFIndexRecommendationSearchCountKey";
+NSString * const NSFIndexRecommendationEstimatedGainKey         = @"NSFIndexRecommendationEstimatedGainKey";
+NSString * const NSFObjectCacheHitCountKey                      = @"NSFObjectCacheHitCountKey";
+NSString * const NSFObjectCacheMissCountKey                     = @"NSFObjectCacheMissCountKey";
+NSString * const NSFObjectCacheHitRateKey                       = @"NSFObjectCacheHitRateKey";
+NSString * const NSFObjectCacheCountKey                         = @"NSFObjectCacheCountKey";
+NSString * const NSFObjectCacheByteCountKey                     = @"NSFObjectCacheByteCountKey";
+NSString * const NSFIdentityMapCountKey                         = @"NSFIdentityMapCountKey";
 NSString * const NSFKeys                                        = @"NSFKeys";
 NSString * const NSFValues                                      = @"NSFValues";
 NSString * const NSFKey                                         = @"NSFKey";
@@ -120,6 +141,16 @@ NSString * const NSFDatatype                                    = @"NSFDatatype"
 NSString * const NSFCalendarDate                                = @"NSFCalendarDate";
 NSString * const NSFObjectClass                                 = @"NSFObjectClass";
 NSString * const NSFKeyedArchive                                = @"NSFKeyedArchive";
+NSString * const NSFKeyPathSegments                             = @"NSFKeyPathSegments";
+NSString * const NSFSegment                                     = @"NSFSegment";
+NSString * const NSFDepth                                       = @"NSFDepth";
+NSString * const NSFBagMembers                                  = @"NSFBagMembers";
+NSString * const NSFBagKey                                      = @"NSFBagKey";
+NSString * const NSFFullTextValues                              = @"NSFFullTextValues";
+NSString * const NSFFullTextAttributes                          = @"NSFFullTextAttributes";
+NSString * const NSFFoldedValue                                 = @"NSFFoldedValue";
+NSString * const NSFFoldedAttributes                            = @"NSFFoldedAttributes";
+NSString * const NSFAttributeIndexes                            = @"NSFAttributeIndexes";
 
 #pragma mark -
 
@@ -131,12 +162,20 @@ NSString * const NSF_Private_NSFValues_NSFValue         = @"NSFValues.NSFValue";
 NSString * const NSF_Private_NSFNanoBag_Name            = @"NSF_Private_NSFNanoBag_Name";
 NSString * const NSF_Private_NSFNanoBag_NSFKey          = @"NSF_Private_NSFNanoBag_NSFKey";
 NSString * const NSF_Private_NSFNanoBag_NSFObjectKeys   = @"NSF_Private_NSFNanoBag_NSFObjectKeys";
+NSString * const NSF_Private_ResultCacheResultsKey      = @"NSF_Private_ResultCacheResultsKey";
+NSString * const NSF_Private_ResultCacheAttributesKey   = @"NSF_Private_ResultCacheAttributesKey";
+NSString * const NSF_Private_ResultCacheObjectClassKey  = @"NSF_Private_ResultCacheObjectClassKey";
+NSString * const NSF_Private_ObjectCacheInfoKey         = @"NSF_Private_ObjectCacheInfoKey";
+NSString * const NSF_Private_ObjectCacheCostKey         = @"NSF_Private_ObjectCacheCostKey";
 NSString * const NSF_Private_ToDeleteTableKey           = @"NSF_Private_ToDeleteTableKey";
+NSString * const NSF_Private_AllAttributesKey           = @"*";
 
 NSString * const NSFRowIDColumnName                     = @"ROWID";
 
 NSInteger const NSF_Private_InvalidParameterDataCodeKey            = -10000;
 NSInteger const NSF_Private_MacOSXErrorCodeKey                     = -10001;
+NSInteger const NSF_Private_KeyLookupChunkSize                     = 500;
+NSInteger const NSF_Private_ExportBufferSize                       = 64 * 1024;
 NSInteger const NSFNanoStoreErrorKey                               = -10002;
 
 #pragma mark Private section
@@ -191,6 +191,8 @@
 @property (nonatomic, copy, readonly, nullable) NSString *originalClassString;
 /** * To determine whether the object has uncommited changes.  */
 @property (nonatomic, readonly) BOOL hasUnsavedChanges;
+/** * To determine whether the object is a fault whose data hasn't been loaded yet (see NSFNanoEngine's cacheMethod).  */
+@property (nonatomic, readonly) BOOL isFault;
 
 /** @name Creating and Initializing a NanoObject
  */
@@ -28,11 +28,91 @@
 #import "NSFNanoObject_Private.h"
 #import "NSFNanoGlobals.h"
 #import "NSFNanoGlobals_Private.h"
+#import "NSFNanoSearch.h"
+#import "NSFNanoStore_Private.h"
 #import "NSFOrderedDictionary.h"
 
+/** \cond */
+
+@implementation NSFNanoObjectFaultGroup
+{
+    NSFNanoSearch *_search;
+    NSHashTable *_pendingFaults;
+}
+
+- (instancetype)initWithSearch:(NSFNanoSearch *)aSearch dropsLoadedData:(BOOL)dropsLoadedData
+{
+    if ((self = [super init])) {
+        _search = aSearch;
+        _dropsLoadedData = dropsLoadedData;
+        _pendingFaults = [NSHashTable weakObjectsHashTable];
+    }
+    
+    return self;
+}
+
+- (void)addFault:(NSFNanoObject *)aFault
+{
+    if (_dropsLoadedData) {
+        return;
+    }
+    
+    @synchronized(self) {
+        [_pendingFaults addObject:aFault];
+    }
+}
+
+- (NSDictionary *)infoForFault:(NSFNanoObject *)aFault
+{
+    NSFNanoStore *nanoStore = _search.nanoStore;
+    
+    if (_dropsLoadedData) {
+        return [[nanoStore _objectsWithKeys:@[aFault.key] objectClassName:nil search:_search]firstObject].info;
+    }
+    
+    @synchronized(self) {
+        // A sibling may have fulfilled it while we were waiting
+        if (NO == [_pendingFaults containsObject:aFault]) {
+            return nil;
+        }
+        
+        // Load the fault along with as many of its siblings as a single key lookup takes
+        NSUInteger batchSize = (NSUInteger)NSF_Private_KeyLookupChunkSize;
+        NSMutableArray *faults = [NSMutableArray arrayWithObject:aFault];
+        for (NSFNanoObject *sibling in _pendingFaults) {
+            if (faults.count == batchSize) {
+                break;
+            }
+            if (sibling != aFault) {
+                [faults addObject:sibling];
+            }
+        }
+        
+        NSArray *objects = [nanoStore _objectsWithKeys:[faults valueForKey:@"key"] objectClassName:nil search:_search];
+        NSMutableDictionary *infoByKey = [NSMutableDictionary dictionaryWithCapacity:objects.count];
+        for (NSFNanoObject *object in objects) {
+            if (nil != object.info) {
+                infoByKey[object.key] = object.info;
+            }
+        }
+        
+        for (NSFNanoObject *fault in faults) {
+            [fault _fulfillFaultWithInfo:infoByKey[fault.key]];
+            [_pendingFaults removeObject:fault];
+        }
+        
+        return infoByKey[aFault.key];
+    }
+}
+
+@end
+
+/** \endcond */
+
 @implementation NSFNanoObject
 {
     NSMutableDictionary *_info;
+    NSFNanoObjectFaultGroup *_faultGroup;
 }
 
 + (NSFNanoObject *)nanoObject
@@ -88,6 +168,25 @@
     _store = store;
 }
 
+- (NSDictionary *)info
+{
+    NSFNanoObjectFaultGroup *faultGroup = _faultGroup;
+    
+    if (nil != faultGroup) {
+        NSDictionary *info = [faultGroup infoForFault:self];
+        if (faultGroup.dropsLoadedData) {
+            return info;
+        }
+    }
+    
+    return _info;
+}
+
+- (BOOL)isFault
+{
+    return (nil != _faultGroup);
+}
+
 - (NSString *)description
 {
     return [self JSONDescription];
@@ -100,8 +199,10 @@
     values[@"NanoObject address"] = [NSString stringWithFormat:@"%p", self];
     values[@"Original class"] = (nil != _originalClassString) ? _originalClassString : NSStringFromClass ([self class]);
     values[@"Key"] = _key;
-    values[@"Property count"] = @(_info.count);
-    values[@"Contents"] = _info;
+    
+    NSDictionary *info = self.info;
+    values[@"Property count"] = @(info.count);
+    values[@"Contents"] = info;
     
     return values;
 }
@@ -118,6 +219,8 @@
 
 - (void)addEntriesFromDictionary:(NSDictionary *)otherDictionary
 {
+    [self _fireFaultForMutation];
+    
     // Allocate the dictionary if needed
     if (nil == _info) {
         _info = [NSMutableDictionary new];
@@ -130,6 +233,8 @@
 
 - (void)setObject:(id)anObject forKey:(NSString *)aKey
 {
+    [self _fireFaultForMutation];
+    
     // Allocate the dictionary if needed
     if (nil == _info) {
         _info = [NSMutableDictionary new];
@@ -147,7 +252,7 @@
 
 - (id)objectForKey:(NSString *)aKey
 {
-    return _info[aKey];
+    return self.info[aKey];
 }
 
 - (id)objectForKeyedSubscript:(NSString *)aKey
@@ -157,6 +262,7 @@
 
 - (void)removeObjectForKey:(NSString *)aKey
 {
+    [self _fireFaultForMutation];
     [_info removeObjectForKey:aKey];
     
     _hasUnsavedChanges = YES;
@@ -164,6 +270,7 @@
 
 - (void)removeAllObjects
 {
+    [self _fireFaultForMutation];
     [_info removeAllObjects];
     
     _hasUnsavedChanges = YES;
@@ -171,6 +278,7 @@
 
 - (void)removeObjectsForKeys:(NSArray *)keyArray
 {
+    [self _fireFaultForMutation];
     [_info removeObjectsForKeys:keyArray];
     
     _hasUnsavedChanges = YES;
@@ -191,7 +299,7 @@
     }
     
     if (success) {
-        success = [_info isEqualToDictionary:otherNanoObject.info];
+        success = [self.info isEqualToDictionary:otherNanoObject.info];
     }
     
     return success;
@@ -247,7 +355,7 @@
 
 - (id)rootObject
 {
-    return _info;
+    return self.info;
 }
 
 #pragma mark -
@@ -261,6 +369,34 @@
     }
 }
 
+- (void)_setFaultGroup:(NSFNanoObjectFaultGroup *)aFaultGroup
+{
+    _faultGroup = aFaultGroup;
+    [aFaultGroup addFault:self];
+}
+
+- (void)_fulfillFaultWithInfo:(NSDictionary *)theInfo
+{
+    _info = (nil != theInfo) ? [theInfo mutableCopy] : nil;
+    _faultGroup = nil;
+}
+
+- (void)_fireFaultForMutation
+{
+    NSFNanoObjectFaultGroup *faultGroup = _faultGroup;
+    
+    if (nil == faultGroup) {
+        return;
+    }
+    
+    NSDictionary *info = [faultGroup infoForFault:self];
+    
+    // Data that doesn't stay cached still has to be kept once it starts changing
+    if (faultGroup.dropsLoadedData) {
+        [self _fulfillFaultWithInfo:info];
+    }
+}
+
 + (nonnull NSString *)_NSObjectToJSONString:(nonnull id)object error:(NSError **)error
 {
     // Make sure we have a safe object
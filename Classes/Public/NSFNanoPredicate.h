@@ -87,7 +87,7 @@
 /** * Creates and returns a predicate.
  * @param theType is the column type. Can be \link Globals::NSFKeyColumn NSFKeyColumn \endlink, \link Globals::NSFAttributeColumn NSFAttributeColumn \endlink or \link Globals::NSFValueColumn NSFValueColumn \endlink.
  * @param theMatch is the match operator.
- * @param theValue can be an NSString or [NSNull null]
+ * @param theValue can be an NSString, an NSNumber, an NSDate or [NSNull null]. NSFBetween expects an NSArray holding the lower and the upper bound.
  * @return A predicate which can be used in an NSFNanoExpression.
  * @see \link initWithColumn:matching:value: - (id)initWithColumn:(NSFTableColumnType)theType matching:(NSFMatchType)theMatch value:(NSString *)theValue \endlink
  */
@@ -97,7 +97,7 @@
 /** * Initializes a newly allocated predicate.
  * @param theType is the column type. Can be \link Globals::NSFKeyColumn NSFKeyColumn \endlink, \link Globals::NSFAttributeColumn NSFAttributeColumn \endlink or \link Globals::NSFValueColumn NSFValueColumn \endlink.
  * @param theMatch is the match operator.
- * @param theValue can be an NSString or [NSNull null]
+ * @param theValue can be an NSString, an NSNumber, an NSDate or [NSNull null]. NSFBetween expects an NSArray holding the lower and the upper bound.
  * @return A predicate which can be used in an NSFNanoExpression.
  * @see \link predicateWithColumn:matching:value: + (NSFNanoPredicate*)predicateWithColumn:(NSFTableColumnType)theType matching:(NSFMatchType)theMatch value:(NSString *)theValue \endlink
  */
@@ -60,7 +60,7 @@
 - (instancetype)initWithColumn:(NSFTableColumnType)type matching:(NSFMatchType)matching value:(id)aValue
 {
     NSAssert(nil != aValue, @"*** -[%@ %@]: value is nil.", [self class], NSStringFromSelector(_cmd));
-    NSAssert([aValue isKindOfClass:[NSString class]] || [aValue isKindOfClass:[NSNull class]], @"*** -[%@ %@]: value must be of type NSString or NSNull.", [self class], NSStringFromSelector(_cmd));
+    NSAssert([aValue isKindOfClass:[NSString class]] || [aValue isKindOfClass:[NSNull class]] || [NSFNanoSearch _isTypedValue:aValue matching:matching], @"*** -[%@ %@]: value must be of type NSString, NSNumber, NSDate or NSNull.", [self class], NSStringFromSelector(_cmd));
 
     if ((self = [super init])) {
         _column = type;
@@ -96,6 +96,12 @@
             break;
     }
     
+    // Numbers, dates and ranges are compared natively
+    if ([NSFNanoSearch _isTypedValue:_value matching:_match]) {
+        [values addObject:[NSFNanoSearch _querySegmentForTypedValue:_value column:columnValue matching:_match]];
+        return values;
+    }
+    
     // Make sure we escape quotes if present and the value is a string
     if ([_value isKindOfClass:[NSString class]]) {
         _value = [_value stringByReplacingOccurrencesOfString:@"'" withString:@"''"];
@@ -144,6 +150,8 @@
         case NSFNotEqualTo:
             [values addObject:[NSString stringWithFormat:@"%@ <> '%@'", columnValue, _value]];
             break;
+        case NSFBetween:
+            break;
     }
     
     return values;
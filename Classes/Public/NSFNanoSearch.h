@@ -152,7 +152,7 @@
 
 @class NSFNanoStore, NSFNanoResult;
 
-@interface NSFNanoSearch : NSObject
+@interface NSFNanoSearch : NSObject <NSCopying>
 
 /** * The document store used for searching. */
 @property (nonatomic, readonly, nonnull) NSFNanoStore *nanoStore;
@@ -162,7 +162,7 @@
 @property (nonatomic, copy, readwrite, nullable) NSString *key;
 /** * The attribute used for searching. */
 @property (nonatomic, copy, readwrite, nullable) NSString *attribute;
-/** * The value used for searching. */
+/** * The value used for searching. Can be an NSString, an NSNumber, an NSDate, [NSNull null], or an NSArray holding two bounds when matching with NSFBetween. */
 @property (nonatomic, copy, readwrite, nullable) id value;
 /** * The comparison operator used for searching. */
 @property (nonatomic, assign, readwrite) NSFMatchType match;
@@ -170,7 +170,7 @@
 @property (nonatomic, strong, readwrite, nullable) NSArray *expressions;
 /** * If set to YES, specifying NSFReturnKeys applies the DISTINCT function and groups the values. */
 @property (nonatomic, assign, readwrite) BOOL groupValues;
-/** * The SQL statement used for searching. Set when executeSQL: is invoked. */
+/** * The SQL statement used for searching. Set when executeSQL: is invoked. When the search is scoped to a bag, the bag's key is rendered into the statement so it can be run as-is. */
 @property (nonatomic, copy, readonly, nonnull) NSString *sql;
 /** * The sort holds an array of one or more sort descriptors of type \link NSFNanoSortDescriptor NSFNanoSortDescriptor \endlink. */
 @property (nonatomic, strong, readwrite, nullable) NSArray *sort;
@@ -180,8 +180,12 @@
 @property (nonatomic, assign, readwrite) NSUInteger offset;
 /** * The limit clause is used to place an upper bound on the number of rows returned by a Search operation. */
 @property (nonatomic, assign, readwrite) NSUInteger limit;
-/** * limit a Search to a particular bag. */
+/** * limit a Search to a particular bag. Every form of search (key, attribute, value and expressions) is scoped to the bag's members through its membership index. The bag's key is bound as a parameter when the search runs, and rendered into the sql property so the statement can be run as-is. */
 @property (nonatomic, assign, readwrite, nullable) NSFNanoBag *bag;
+/** * The number of workers used to decode the matching objects. 0 or 1 (the default) decodes them on the calling thread. When greater than 1, the rows are read on the calling thread and the NSFNanoObject instances are decoded in batches on a concurrent queue. Objects of any other class, such as bags or subclasses, are still decoded on the calling thread, since they may run searches while they are initialized. Only applies when objects are returned. */
+@property (nonatomic, assign, readwrite) NSUInteger hydrationConcurrency;
+/** * The type of results returned. Set by the search methods taking a return type; \link NSFNanoStore::executeSearches:dedupesIdenticalSearches:completion: executeSearches:dedupesIdenticalSearches:completion: \endlink returns this type for each search. Defaults to NSFReturnObjects. */
+@property (nonatomic, assign, readwrite) NSFReturnType returnedObjectType;
 
 /** @name Creating and Initializing a Search
  */
@@ -227,6 +231,7 @@
  * @param theReturnType the type of object to be returned. Can be \link Globals::NSFReturnObjects NSFReturnObjects \endlink or \link Globals::NSFReturnKeys NSFReturnKeys \endlink.
  * @param outError is used if an error occurs. May be NULL.
  * @return If theReturnType is \link Globals::NSFReturnObjects NSFReturnObjects \endlink, a dictionary is returned. Otherwise, an array is returned.
+ * @note The filterClass and bag properties are honored.
  * @note The sort descriptor will be ignored when the return type is NSFReturnKeys.
  * @see \link searchObjectsWithReturnType:error: - (id)searchObjectsWithReturnType:(NSFReturnType)theReturnType error:(NSError * __autoreleasing *)outError \endlink
  */
@@ -254,6 +259,101 @@
 
 - (nonnull NSNumber *)aggregateOperation:(NSFAggregateFunctionType)theFunctionType onAttribute:(nonnull NSString *)theAttribute;
 
+/** * Returns one page of the objects matching the search, along with a token to fetch the next one.
+ * @param theReturnType the type of object to be returned. Can be \link Globals::NSFReturnObjects NSFReturnObjects \endlink or \link Globals::NSFReturnKeys NSFReturnKeys \endlink.
+ * @param thePageSize is the maximum number of objects in the page. Must be greater than zero.
+ * @param theToken is the token returned with the previous page. Pass nil to get the first page.
+ * @param outNextToken is set to the token of the next page, or nil if this was the last page. May be NULL.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return An array of objects or keys, nil if an error occurs.
+ * @note Pages are ordered by the first sort descriptor, then by key. Objects lacking the sorted attribute, or holding NULL, come first in either direction.
+ * Without a sort descriptor, pages are ordered by key. Additional sort descriptors, limit and offset are ignored.
+ * @note The token remembers where the previous page ended, and the next page resumes right after it. Deep pages cost as much as the first one,
+ * and objects added or removed meanwhile don't cause rows to be skipped or repeated. Tokens are only valid for the search that produced them, and remain valid across launches.
+ * @details <b>Example:</b>
+ @code
+ * NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+ * search.sort = @[[NSFNanoSortDescriptor sortDescriptorWithAttribute:@"Price" ascending:YES]];
+ *
+ * NSString *token = nil;
+ * do {
+ *     NSArray *page = [search searchObjectsWithReturnType:NSFReturnObjects pageSize:50 continuationToken:token nextContinuationToken:&token error:nil];
+ *     ...
+ * } while (nil != token);
+ @endcode
+ */
+
+- (nullable NSArray *)searchObjectsWithReturnType:(NSFReturnType)theReturnType pageSize:(NSUInteger)thePageSize continuationToken:(nullable NSString *)theToken nextContinuationToken:(NSString * _Nullable * _Nullable)outNextToken error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Counts the objects matching the search without fetching them.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return The number of matching objects, -1 if an error occurs.
+ * @note The filterClass, bag, limit and offset properties are honored. The count runs entirely in SQLite: no key or object is created.
+ * @see \link existsWithError: - (BOOL)existsWithError:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (long long)countOfObjectsWithError:(NSError * _Nullable * _Nullable)outError;
+
+/** * Checks whether at least one object matches the search.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES if an object matches, NO if none does or an error occurs.
+ * @note SQLite stops at the first match. The filterClass and bag properties are honored.
+ * @see \link countOfObjectsWithError: - (long long)countOfObjectsWithError:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (BOOL)existsWithError:(NSError * _Nullable * _Nullable)outError;
+
+/** * Performs several aggregate operations in a single pass over the objects matching the search.
+ * @param theFunctionTypes is an array of NSNumber-wrapped \link Globals::NSFAggregateFunctionType NSFAggregateFunctionType \endlink values. Must not be empty.
+ * @param theAttribute is the attribute whose values are aggregated. Must not be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return An array with one result per function type, in the same order. Results keep the type SQLite computed them with:
+ * counts are 64-bit integers, averages and totals are doubles, and NSNull is returned when there was nothing to aggregate. Returns nil if an error occurs.
+ * @details <b>Example:</b>
+ @code
+ * NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+ * NSArray *results = [search aggregateOperations:@[@(NSFMin), @(NSFMax), @(NSFCount)] onAttribute:@"SomeNumber" error:nil];
+ @endcode
+ * @see \link enumerateAggregateOperations:onAttribute:groupedByAttribute:usingBlock:error: - (BOOL)enumerateAggregateOperations:(NSArray *)theFunctionTypes onAttribute:(NSString *)theAttribute groupedByAttribute:(NSString *)theGroupingAttribute usingBlock:(void (^)(id groupValue, NSArray *values, BOOL *stop))theBlock error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (nullable NSArray *)aggregateOperations:(nonnull NSArray *)theFunctionTypes onAttribute:(nonnull NSString *)theAttribute error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Performs several aggregate operations in a single pass, optionally grouping the objects by the value of another attribute.
+ * @param theFunctionTypes is an array of NSNumber-wrapped \link Globals::NSFAggregateFunctionType NSFAggregateFunctionType \endlink values. Must not be empty.
+ * @param theAttribute is the attribute whose values are aggregated. Must not be nil.
+ * @param theGroupingAttribute is the attribute whose values define the groups. If nil, the block is invoked once with the aggregates of all matching objects.
+ * @param theBlock is invoked once per group, in ascending order of the group value, as the rows are read. It receives the group value (nil when not grouping),
+ * the results in the order of the function types, and a flag that can be set to YES to stop the enumeration. Must not be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @note Objects lacking the grouping attribute are left out. Group values and results keep the type SQLite hands back.
+ * @details <b>Example:</b>
+ @code
+ * NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+ * [search enumerateAggregateOperations:@[@(NSFMin), @(NSFMax), @(NSFAverage), @(NSFCount)]
+ *                          onAttribute:@"Price"
+ *                   groupedByAttribute:@"Category"
+ *                           usingBlock:^(id category, NSArray *values, BOOL *stop) {
+ *                               NSLog(@"%@: %@", category, values);
+ *                           } error:nil];
+ @endcode
+ */
+
+- (BOOL)enumerateAggregateOperations:(nonnull NSArray *)theFunctionTypes onAttribute:(nonnull NSString *)theAttribute groupedByAttribute:(nullable NSString *)theGroupingAttribute usingBlock:(nonnull void (^)(id _Nullable groupValue, NSArray * _Nonnull values, BOOL * _Nonnull stop))theBlock error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Performs a full-text search and returns the matches ordered by relevance, best match first.
+ * @param theQuery is the full-text query. Supports the FTS5 query syntax: words, "phrases", prefix* searches and the AND, OR and NOT operators. Must not be nil.
+ * @param theReturnType the type of object to be returned. Can be \link Globals::NSFReturnObjects NSFReturnObjects \endlink or \link Globals::NSFReturnKeys NSFReturnKeys \endlink.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return An array of objects or keys ordered by relevance, nil if an error occurs.
+ * @note The attribute, filterClass, bag, limit and offset properties are honored. If the attribute is nil, the full-text index covering all attributes must have been declared.
+ * The index is made of trigrams: words and phrases match anywhere in a value regardless of case, and need at least three characters. Objects are ranked by their best matching value. The sort descriptor is ignored.
+ * @see \link NSFNanoStore::createFullTextIndexForAttribute:error: - (BOOL)createFullTextIndexForAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (nullable NSArray *)searchObjectsMatchingFullTextQuery:(nonnull NSString *)theQuery returnType:(NSFReturnType)theReturnType error:(NSError * _Nullable * _Nullable)outError;
+
 /** * Performs a search with a given SQL statement.
  * @param theSQLStatement is the SQL statement to be executed. Must not be nil or an empty string.
  * @param theReturnType the type of object to be returned. Can be \link Globals::NSFReturnObjects NSFReturnObjects \endlink or \link Globals::NSFReturnKeys NSFReturnKeys \endlink.
@@ -359,6 +459,71 @@
 
 - (nonnull NSFNanoResult *)explainSQL:(nonnull NSString *)theSQLStatement;
 
+/** * Returns the query plan SQLite chose for a SQL statement, as a tree.
+ * @param theSQLStatement is the SQL statement to analyze. Must not be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return An array with the top-level steps of the plan, or nil upon error. Each step is a dictionary holding the description under <i>NSFQueryPlanDetailKey</i>,
+ * the problems found under <i>NSFQueryPlanWarningsKey</i> and the nested steps under <i>NSFQueryPlanChildrenKey</i>.
+ * @note Unlike \link explainSQL: - (NSFNanoResult *)explainSQL:(NSString *)theSQLStatement \endlink, which lists the bytecode, this method runs EXPLAIN QUERY PLAN
+ * and flags the steps worth looking at: full scans of NSFValues, temporary B-trees used for sorting or grouping and correlated subqueries. See <i>NSFQueryPlanWarning</i>.
+ * @throws NSFUnexpectedParameterException is thrown if the SQL statement is nil.
+ * @see \link queryPlanWithReturnType:error: - (NSArray *)queryPlanWithReturnType:(NSFReturnType)theReturnType error:(NSError * __autoreleasing *)outError \endlink
+ * @see \link warningsInQueryPlan: + (NSFQueryPlanWarning)warningsInQueryPlan:(NSArray *)thePlan \endlink
+ */
+
+- (nullable NSArray *)queryPlanForSQL:(nonnull NSString *)theSQLStatement error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Returns the query plan of the SQL generated for the search, as a tree.
+ * @param theReturnType the type of object the search would return.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return An array with the top-level steps of the plan, or nil upon error.
+ * @see \link queryPlanForSQL:error: - (NSArray *)queryPlanForSQL:(NSString *)theSQLStatement error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (nullable NSArray *)queryPlanWithReturnType:(NSFReturnType)theReturnType error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Combines the problems flagged anywhere in a query plan.
+ * @param thePlan is a plan returned by \link queryPlanForSQL:error: - (NSArray *)queryPlanForSQL:(NSString *)theSQLStatement error:(NSError * __autoreleasing *)outError \endlink.
+ * @return The union of the warnings of every step.
+ */
+
++ (NSFQueryPlanWarning)warningsInQueryPlan:(nonnull NSArray *)thePlan;
+
+//@}
+
+/** @name Exporting
+ */
+
+//@{
+
+/** * Runs a SQL statement and writes its rows to a file descriptor as they are read.
+ * @param theSQLStatement is the SQL statement to execute. Must not be nil or empty.
+ * @param theFormat the format to write the rows in. See <i>NSFExportFormat</i>.
+ * @param theFileDescriptor is a file descriptor open for writing, such as one obtained with open(2) or from NSFileHandle. It is left open.
+ * @param theRowCount is the number of rows after which the data written is flushed to disk with fsync(2). Zero doesn't sync at all.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @note The rows go straight from the statement to a fixed-size buffer, which is written out whenever it fills up, so memory use doesn't grow with the size of the result.
+ * Integers and reals are written as numbers, text as strings, blobs as base64 strings and NULL as an empty CSV field or a JSON null.
+ * @throws NSFUnexpectedParameterException is thrown if the SQL statement is nil or empty.
+ * @see \link exportObjectsWithFormat:toFileDescriptor:syncInterval:error: - (BOOL)exportObjectsWithFormat:(NSFExportFormat)theFormat toFileDescriptor:(int)theFileDescriptor syncInterval:(NSUInteger)theRowCount error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (BOOL)exportSQL:(nonnull NSString *)theSQLStatement format:(NSFExportFormat)theFormat toFileDescriptor:(int)theFileDescriptor syncInterval:(NSUInteger)theRowCount error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Writes the objects matching the search to a file descriptor as they are read.
+ * @param theFormat the format to write the objects in. See <i>NSFExportFormat</i>.
+ * @param theFileDescriptor is a file descriptor open for writing. It is left open.
+ * @param theRowCount is the number of objects after which the data written is flushed to disk with fsync(2). Zero doesn't sync at all.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @note Every object is written as its key (<i>NSFKey</i>), its class (<i>NSFObjectClass</i>) and its contents (<i>NSFInfo</i>), which are embedded as a JSON object
+ * in JSON Lines and as JSON text in CSV. The contents honor <i>attributesToBeReturned</i>. Objects are decoded one at a time and never instantiated.
+ * @see \link exportSQL:format:toFileDescriptor:syncInterval:error: - (BOOL)exportSQL:(NSString *)theSQLStatement format:(NSFExportFormat)theFormat toFileDescriptor:(int)theFileDescriptor syncInterval:(NSUInteger)theRowCount error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (BOOL)exportObjectsWithFormat:(NSFExportFormat)theFormat toFileDescriptor:(int)theFileDescriptor syncInterval:(NSUInteger)theRowCount error:(NSError * _Nullable * _Nullable)outError;
+
 //@}
 
 /** @name Resetting Values
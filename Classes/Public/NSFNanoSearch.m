@@ -28,12 +28,16 @@
 #import "NanoStore_Private.h"
 #import "NSFNanoSearch_Private.h"
 #import "NSFNanoExpression_Private.h"
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <CommonCrypto/CommonDigest.h>
 
 @interface NSFNanoSearch ()
 
 /** \cond */
 @property (nonatomic, copy, readwrite) NSString *sql;
-@property (nonatomic) NSFReturnType returnedObjectType;
+@property (nonatomic) BOOL ignoresIdentityMap;
 /** \endcond */
 @end
 
@@ -64,12 +68,40 @@
     return self;
 }
 
+- (id)copyWithZone:(NSZone *)zone
+{
+    NSFNanoSearch *copy = [[[self class]allocWithZone:zone]initWithStore:_nanoStore];
+    
+    copy->_attributesToBeReturned = [_attributesToBeReturned copy];
+    copy->_key = [_key copy];
+    copy->_attribute = [_attribute copy];
+    copy->_value = [_value copy];
+    copy->_match = _match;
+    copy->_expressions = [_expressions copy];
+    copy->_groupValues = _groupValues;
+    copy->_sql = [_sql copy];
+    copy->_sort = [_sort copy];
+    copy->_filterClass = [_filterClass copy];
+    copy->_offset = _offset;
+    copy->_limit = _limit;
+    copy->_bag = _bag;
+    copy->_hydrationConcurrency = _hydrationConcurrency;
+    copy->_returnedObjectType = _returnedObjectType;
+    copy->_ignoresIdentityMap = _ignoresIdentityMap;
+    
+    return copy;
+}
+
 #pragma mark -
 
 - (NSString *)sql
 {
-    if (nil == _sql)
-        return [self _preparedSQL];
+    if (nil == _sql) {
+        // The bag is bound when the search runs; render it here so the text can be run as-is through executeSQL: and friends
+        NSString *theSQLStatement = [self _preparedSQL];
+        NSString *bagLiteral = (nil != _bag.key) ? [NSString stringWithFormat:@"'%@'", [_bag.key stringByReplacingOccurrencesOfString:@"'" withString:@"''"]] : @"NULL";
+        return [theSQLStatement stringByReplacingOccurrencesOfString:[NSString stringWithFormat:@":%@", NSFBagKey] withString:bagLiteral];
+    }
     
     return _sql;
 }
@@ -142,6 +174,111 @@
     return [_nanoStore _executeSQL:[NSString stringWithFormat:@"EXPLAIN %@", theSQLStatement]];
 }
 
+- (NSArray *)queryPlanForSQL:(NSString *)theSQLStatement error:(NSError * __autoreleasing *)outError
+{
+    if (nil == theSQLStatement) {
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: the SQL statement is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    }
+    
+    if ([_nanoStore isClosed]) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: the document store is closed.", [self class], NSStringFromSelector(_cmd)]}];
+        return nil;
+    }
+    
+    NSFNanoEngine *engine = _nanoStore.nanoStoreEngine;
+    sqlite3 *sqliteStore = [engine NSFP_checkOutReadConnection];
+    sqlite3_stmt *theSQLiteStatement = NULL;
+    NSString *theExplainStatement = [NSString stringWithFormat:@"EXPLAIN QUERY PLAN %@", theSQLStatement];
+    
+    int status = sqlite3_prepare_v2 (sqliteStore, theExplainStatement.UTF8String, -1, &theSQLiteStatement, NULL);
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    
+    if (SQLITE_OK != status) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: %s", [self class], NSStringFromSelector(_cmd), sqlite3_errmsg(sqliteStore)]}];
+        sqlite3_finalize (theSQLiteStatement);
+        [engine NSFP_checkInReadConnection:sqliteStore];
+        return nil;
+    }
+    
+    // Every row names its parent, which always comes first, so the tree can be assembled in one pass
+    NSMutableArray *plan = [NSMutableArray new];
+    NSMutableDictionary *nodesByID = [NSMutableDictionary new];
+    
+    while (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) {
+        int nodeID = sqlite3_column_int (theSQLiteStatement, 0);
+        int parentID = sqlite3_column_int (theSQLiteStatement, 1);
+        char *detailUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 3);
+        NSString *detail = (NULL == detailUTF8) ? @"" : @(detailUTF8);
+        
+        NSMutableDictionary *node = [@{NSFQueryPlanDetailKey : detail,
+                                       NSFQueryPlanWarningsKey : @([NSFNanoSearch _warningsForQueryPlanDetail:detail]),
+                                       NSFQueryPlanChildrenKey : [NSMutableArray new]} mutableCopy];
+        nodesByID[@(nodeID)] = node;
+        
+        NSMutableDictionary *parent = nodesByID[@(parentID)];
+        if (nil == parent) {
+            [plan addObject:node];
+        } else {
+            [parent[NSFQueryPlanChildrenKey] addObject:node];
+        }
+    }
+    
+    sqlite3_finalize (theSQLiteStatement);
+    [engine NSFP_checkInReadConnection:sqliteStore];
+    
+    return plan;
+}
+
+- (NSArray *)queryPlanWithReturnType:(NSFReturnType)theReturnType error:(NSError * __autoreleasing *)outError
+{
+    _returnedObjectType = theReturnType;
+    
+    // Make sure we don't have a SQL statement around...
+    _sql = nil;
+    
+    return [self queryPlanForSQL:[self _preparedSQL] error:outError];
+}
+
++ (NSFQueryPlanWarning)warningsInQueryPlan:(NSArray *)thePlan
+{
+    NSFQueryPlanWarning warnings = NSFQueryPlanNoWarning;
+    
+    for (NSDictionary *node in thePlan) {
+        warnings |= [node[NSFQueryPlanWarningsKey]unsignedIntValue];
+        warnings |= [NSFNanoSearch warningsInQueryPlan:node[NSFQueryPlanChildrenKey]];
+    }
+    
+    return warnings;
+}
+
+- (BOOL)exportSQL:(NSString *)theSQLStatement format:(NSFExportFormat)theFormat toFileDescriptor:(int)theFileDescriptor syncInterval:(NSUInteger)theRowCount error:(NSError * __autoreleasing *)outError
+{
+    if (0 == theSQLStatement.length) {
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: the SQL statement is nil or empty.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    }
+    
+    return [self _exportSQL:theSQLStatement format:theFormat toFileDescriptor:theFileDescriptor syncInterval:theRowCount decodesArchives:NO error:outError];
+}
+
+- (BOOL)exportObjectsWithFormat:(NSFExportFormat)theFormat toFileDescriptor:(int)theFileDescriptor syncInterval:(NSUInteger)theRowCount error:(NSError * __autoreleasing *)outError
+{
+    [self _recordSearchShape];
+    
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT NSFKey, NSFObjectClass, NSFKeyedArchive AS NSFInfo FROM NSFKeys WHERE NSFKey IN (%@)", [self _keysSQLHonoringBag]];
+    
+    return [self _exportSQL:theSQLStatement format:theFormat toFileDescriptor:theFileDescriptor syncInterval:theRowCount decodesArchives:YES error:outError];
+}
+
 - (void)reset
 {
     _attributesToBeReturned = nil;
@@ -166,7 +303,30 @@
     // Make sure we don't have a SQL statement around...
     _sql = nil;
     
-    id results = [self _retrieveDataWithError:outError];
+    [self _recordSearchShape];
+    
+    NSDictionary *results = nil;
+    NSString *cacheKey = nil;
+    unsigned long long commitCount = 0;
+    
+    if ([_nanoStore _isResultCacheEnabled]) {
+        // Faults and loaded objects don't mix, so the cache method is part of the key
+        // The bag key is bound rather than compiled in, so it's part of the key too
+        // The SQL selects whole archives, so the attributes to be returned are part of the key as well
+        NSArray *attributesToBeReturned = [_attributesToBeReturned sortedArrayUsingSelector:@selector(compare:)];
+        cacheKey = [NSString stringWithFormat:@"%u:%u:%@:%@:%@", theReturnType, _nanoStore.nanoStoreEngine.cacheMethod, (_bag.key ? _bag.key : @""), (attributesToBeReturned ? [attributesToBeReturned componentsJoinedByString:@","] : @""), [self _preparedSQL]];
+        results = [_nanoStore _cachedResultsForKey:cacheKey];
+        
+        // Read before searching, so that a commit made meanwhile keeps the results out of the cache
+        commitCount = [_nanoStore.nanoStoreEngine NSFP_commitCount];
+    }
+    
+    if (nil == results) {
+        results = [self _retrieveDataWithError:outError];
+        if ((nil != cacheKey) && (nil != results)) {
+            [_nanoStore _cacheResults:results forKey:cacheKey attributes:[self _attributesBoundingResults] objectClass:(nil == _bag && _filterClass.length > 0) ? _filterClass : nil commitCount:commitCount];
+        }
+    }
     
     return [self _sortResultsIfApplicable:results returnType:theReturnType];
 }
@@ -187,47 +347,350 @@
     return results;
 }
 
+- (NSArray *)searchObjectsWithReturnType:(NSFReturnType)theReturnType pageSize:(NSUInteger)thePageSize continuationToken:(NSString *)theToken nextContinuationToken:(NSString * __autoreleasing *)outNextToken error:(NSError * __autoreleasing *)outError
+{
+    if (0 == thePageSize)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: the page size must be greater than zero.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    if (nil != outNextToken) {
+        *outNextToken = nil;
+    }
+    
+    if ([_nanoStore isClosed]) {
+        return nil;
+    }
+    
+    [self _recordSearchShape];
+    
+    // Paging replaces limit and offset
+    NSUInteger savedLimit = _limit, savedOffset = _offset;
+    _limit = 0;
+    _offset = 0;
+    NSString *theKeysSQL = [self _keysSQLHonoringBag];
+    _limit = savedLimit;
+    _offset = savedOffset;
+    
+    NSFNanoSortDescriptor *sortDescriptor = _sort.firstObject;
+    NSString *fingerprint = [NSFNanoSearch _digestOfString:[NSString stringWithFormat:@"%@|%@|%@|%d", theKeysSQL, _bag.key, sortDescriptor.attribute, sortDescriptor.isAscending]];
+    
+    NSDictionary *token = nil;
+    if (nil != theToken) {
+        token = [NSFNanoSearch _dictionaryFromContinuationToken:theToken];
+        if ((nil == token) || (NO == [token[@"q"] isEqualToString:fingerprint])) {
+            if (nil != outError)
+                *outError = [NSError errorWithDomain:NSFDomainKey
+                                                code:NSFNanoStoreErrorKey
+                                            userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: the continuation token doesn't belong to this search.", [self class], NSStringFromSelector(_cmd)]}];
+            return nil;
+        }
+    }
+    
+    NSFNanoObjectFaultGroup *faultGroup = (NSFReturnObjects == theReturnType) ? [self _faultGroupForCacheMethod] : nil;
+    NSString *archiveColumns = (NSFReturnObjects == theReturnType) ? @"k.NSFKeyedArchive, k.NSFObjectClass" : @"NULL, NULL";
+    if (nil != faultGroup) {
+        archiveColumns = [NSString stringWithFormat:@"%@, k.NSFObjectClass", [NSFNanoSearch _archiveColumnForFaultingWithPrefix:@"k."]];
+    }
+    NSMutableString *theSQLStatement = nil;
+    
+    // Seek past the last row of the previous page instead of skipping rows, so every page costs the same
+    // and rows committed meanwhile can't shift the pages around
+    if (nil == sortDescriptor) {
+        theSQLStatement = [NSMutableString stringWithFormat:@"SELECT k.NSFKey, NULL, %@ FROM NSFKeys AS k WHERE k.NSFKey IN (%@)", archiveColumns, theKeysSQL];
+        if (nil != token) {
+            [theSQLStatement appendString:@" AND k.NSFKey > :NSFPageKey"];
+        }
+        [theSQLStatement appendFormat:@" ORDER BY k.NSFKey LIMIT %lu", (unsigned long)thePageSize];
+    } else {
+        NSString *comparison = sortDescriptor.isAscending ? @">" : @"<";
+        NSString *direction = sortDescriptor.isAscending ? @"ASC" : @"DESC";
+        NSString *attribute = [sortDescriptor.attribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"];
+        // Objects lacking the sort attribute are kept, sorting first along with the NULL values. An attribute holding
+        // an array has several values: each object is sorted by the lowest one, so it shows up exactly once.
+        theSQLStatement = [NSMutableString stringWithFormat:@"SELECT k.NSFKey, s.NSFValue, %@ FROM NSFKeys AS k LEFT JOIN (SELECT NSFKey, MIN(NSFValue) AS NSFValue FROM NSFValues WHERE NSFAttribute = '%@' GROUP BY NSFKey) AS s ON s.NSFKey = k.NSFKey WHERE k.NSFKey IN (%@)", archiveColumns, attribute, theKeysSQL];
+        if (nil != token) {
+            if ((nil == token[@"v"]) || (token[@"v"] == [NSNull null])) {
+                // Still within the NULLs: finish them, then move on to every value
+                [theSQLStatement appendFormat:@" AND ((s.NSFValue IS NULL) = 0 OR k.NSFKey %@ :NSFPageKey)", comparison];
+            } else {
+                [theSQLStatement appendFormat:@" AND (s.NSFValue IS NULL) = 0 AND (s.NSFValue %@ :NSFPageValue OR (s.NSFValue = :NSFPageValue AND k.NSFKey %@ :NSFPageKey))", comparison, comparison];
+            }
+        }
+        // NULLS FIRST needs SQLite 3.30, so the NULLs are put first by sorting on (s.NSFValue IS NULL) instead
+        [theSQLStatement appendFormat:@" ORDER BY (s.NSFValue IS NULL) DESC, s.NSFValue %@, k.NSFKey %@ LIMIT %lu", direction, direction, (unsigned long)thePageSize];
+    }
+    
+    _NSFLog(@"paged SQL query: %@", theSQLStatement);
+    
+    NSFNanoEngine *engine = _nanoStore.nanoStoreEngine;
+    sqlite3 *sqliteStore = [engine NSFP_checkOutReadConnection];
+    sqlite3_stmt *theSQLiteStatement = NULL;
+    
+    int status = sqlite3_prepare_v2 (sqliteStore, theSQLStatement.UTF8String, -1, &theSQLiteStatement, NULL);
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    
+    if (SQLITE_OK != status) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: %s", [self class], NSStringFromSelector(_cmd), sqlite3_errmsg(sqliteStore)]}];
+        sqlite3_finalize (theSQLiteStatement);
+        [engine NSFP_checkInReadConnection:sqliteStore];
+        return nil;
+    }
+    
+    // The seek is bound by name since the bag scope in the keys adds a parameter of its own
+    [self _bindBagToStatement:theSQLiteStatement];
+    if (nil != token) {
+        int valueParameter = sqlite3_bind_parameter_index (theSQLiteStatement, ":NSFPageValue");
+        if (valueParameter > 0) {
+            [NSFNanoSearch _bindObject:token[@"v"] toParameter:valueParameter statement:theSQLiteStatement];
+        }
+        sqlite3_bind_text (theSQLiteStatement, sqlite3_bind_parameter_index (theSQLiteStatement, ":NSFPageKey"), [token[@"k"] UTF8String], -1, SQLITE_TRANSIENT);
+    }
+    
+    NSMutableArray *page = [[NSMutableArray alloc]initWithCapacity:thePageSize];
+    NSString *lastKey = nil;
+    id lastValue = nil;
+    
+    while (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) {
+        @autoreleasepool {
+            lastKey = [NSFNanoSearch _objectForColumn:0 statement:theSQLiteStatement];
+            lastValue = [NSFNanoSearch _objectForColumn:1 statement:theSQLiteStatement];
+            
+            if (NSFReturnKeys == theReturnType) {
+                [page addObject:lastKey];
+            } else {
+                id archive = [NSFNanoSearch _objectForColumn:2 statement:theSQLiteStatement];
+                id nanoObject = nil;
+                if ((nil != faultGroup) && (archive == [NSNull null])) {
+                    nanoObject = [self _nanoObjectFaultWithKey:lastKey faultGroup:faultGroup];
+                } else {
+                    nanoObject = [self _nanoObjectWithArchive:archive key:lastKey className:[NSFNanoSearch _objectForColumn:3 statement:theSQLiteStatement]];
+                }
+                if (nil != nanoObject) {
+                    [page addObject:nanoObject];
+                }
+            }
+        }
+    }
+    
+    sqlite3_finalize (theSQLiteStatement);
+    [engine NSFP_checkInReadConnection:sqliteStore];
+    
+    // A short page is the last one
+    if ((nil != outNextToken) && (page.count == thePageSize) && (nil != lastKey)) {
+        *outNextToken = [NSFNanoSearch _continuationTokenWithValue:lastValue key:lastKey fingerprint:fingerprint];
+    }
+    
+    return page;
+}
+
+- (long long)countOfObjectsWithError:(NSError * __autoreleasing *)outError
+{
+    [self _recordSearchShape];
+    
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT count(DISTINCT NSFKey) FROM (%@)", [self _keysSQLHonoringBag]];
+    
+    return [self _int64ForSQL:theSQLStatement error:outError];
+}
+
+- (BOOL)existsWithError:(NSError * __autoreleasing *)outError
+{
+    [self _recordSearchShape];
+    
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT EXISTS (SELECT 1 FROM (%@) LIMIT 1)", [self _keysSQLHonoringBag]];
+    
+    return (1 == [self _int64ForSQL:theSQLStatement error:outError]);
+}
+
 - (NSNumber *)aggregateOperation:(NSFAggregateFunctionType)theFunctionType onAttribute:(NSString *)theAttribute
-{    
-    NSFReturnType savedObjectTypeReturned = _returnedObjectType;
-    _returnedObjectType = NSFReturnKeys;
+{
+    id value = [[self aggregateOperations:@[@(theFunctionType)] onAttribute:theAttribute error:nil]firstObject];
     
-    NSString *savedSQL = _sql;
-    _sql = nil;
+    if ((nil == value) || ([value isKindOfClass:[NSNull class]])) {
+        return @(0.0f);
+    }
     
-    NSString *theSearchSQLStatement = self.sql;
-    NSMutableString *theAggregatedSQLStatement = [NSMutableString new];
+    return value;
+}
+
+- (NSArray *)aggregateOperations:(NSArray *)theFunctionTypes onAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError
+{
+    __block NSArray *aggregates = nil;
     
-    switch (theFunctionType) {
-        case NSFAverage:
-            [theAggregatedSQLStatement appendString:[NSString stringWithFormat:@"SELECT avg(NSFValue) FROM NSFValues WHERE NSFAttribute = '%@' AND NSFKey IN (%@)", theAttribute, theSearchSQLStatement]];
-            break;
-        case NSFCount:
-            [theAggregatedSQLStatement appendString:[NSString stringWithFormat:@"SELECT count(*) FROM NSFValues WHERE NSFAttribute = '%@' AND NSFKey IN (%@)", theAttribute, theSearchSQLStatement]];
-            break;
-        case NSFMax:
-            [theAggregatedSQLStatement appendString:[NSString stringWithFormat:@"SELECT max(NSFValue) FROM NSFValues WHERE NSFAttribute = '%@' AND NSFKey IN (%@)", theAttribute, theSearchSQLStatement]];
-            break;
-        case NSFMin:
-            [theAggregatedSQLStatement appendString:[NSString stringWithFormat:@"SELECT min(NSFValue) FROM NSFValues WHERE NSFAttribute = '%@' AND NSFKey IN (%@)", theAttribute, theSearchSQLStatement]];
-            break;
-        case NSFTotal:
-            /* Note:
-             Sum() will throw an "integer overflow" exception if all inputs are integers or NULL and an integer overflow occurs at any point
-             during the computation. Total() never throws an integer overflow.
-             */
-            [theAggregatedSQLStatement appendString:[NSString stringWithFormat:@"SELECT total(NSFValue) FROM NSFValues WHERE NSFAttribute = '%@' AND NSFKey IN (%@)", theAttribute, theSearchSQLStatement]];
-            break;
-        default:
-            break;
+    BOOL success = [self enumerateAggregateOperations:theFunctionTypes onAttribute:theAttribute groupedByAttribute:nil usingBlock:^(id groupValue, NSArray *values, BOOL *stop) {
+        aggregates = values;
+    } error:outError];
+    
+    return success ? aggregates : nil;
+}
+
+- (BOOL)enumerateAggregateOperations:(NSArray *)theFunctionTypes onAttribute:(NSString *)theAttribute groupedByAttribute:(NSString *)theGroupingAttribute usingBlock:(void (^)(id groupValue, NSArray *values, BOOL *stop))theBlock error:(NSError * __autoreleasing *)outError
+{
+    if (0 == theFunctionTypes.count)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: theFunctionTypes is empty.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    if (nil == theAttribute)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: theAttribute is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    if (nil == theBlock)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: theBlock is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    NSMutableArray *aggregateColumns = [NSMutableArray new];
+    for (NSNumber *functionType in theFunctionTypes) {
+        NSString *column = [NSFNanoSearch _aggregateColumnForFunctionType:functionType.unsignedIntValue];
+        if (nil == column)
+            [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                     reason:[NSString stringWithFormat:@"*** -[%@ %@]: unknown aggregate function type: %@.", [self class], NSStringFromSelector(_cmd), functionType]
+                                   userInfo:nil]raise];
+        [aggregateColumns addObject:column];
+    }
+    
+    NSString *theSearchSQLStatement = [self _keysSQLHonoringBag];
+    
+    // All the aggregates are computed in a single pass over the matching values
+    NSString *attribute = [theAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"];
+    NSString *theAggregatedSQLStatement = nil;
+    
+    if (nil == theGroupingAttribute) {
+        theAggregatedSQLStatement = [NSString stringWithFormat:@"SELECT %@ FROM NSFValues AS v WHERE v.NSFAttribute = '%@' AND v.NSFKey IN (%@)",
+                                     [aggregateColumns componentsJoinedByString:@", "], attribute, theSearchSQLStatement];
+    } else {
+        NSString *groupingAttribute = [theGroupingAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"];
+        theAggregatedSQLStatement = [NSString stringWithFormat:@"SELECT g.NSFValue, %@ FROM NSFValues AS v JOIN NSFValues AS g ON g.NSFKey = v.NSFKey AND g.NSFAttribute = '%@' WHERE v.NSFAttribute = '%@' AND v.NSFKey IN (%@) GROUP BY g.NSFValue ORDER BY g.NSFValue",
+                                     [aggregateColumns componentsJoinedByString:@", "], groupingAttribute, attribute, theSearchSQLStatement];
+    }
+    
+    _NSFLog(@"aggregate SQL query: %@", theAggregatedSQLStatement);
+    
+    NSFNanoEngine *engine = _nanoStore.nanoStoreEngine;
+    sqlite3 *sqliteStore = [engine NSFP_checkOutReadConnection];
+    sqlite3_stmt *theSQLiteStatement = NULL;
+    int status = sqlite3_prepare_v2 (sqliteStore, theAggregatedSQLStatement.UTF8String, -1, &theSQLiteStatement, NULL);
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    
+    if (SQLITE_OK != status) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: %s", [self class], NSStringFromSelector(_cmd), sqlite3_errmsg(sqliteStore)]}];
+        sqlite3_finalize (theSQLiteStatement);
+        [engine NSFP_checkInReadConnection:sqliteStore];
+        return NO;
+    }
+    
+    [self _bindBagToStatement:theSQLiteStatement];
+    
+    // Rows are handed over one group at a time instead of being collected up front
+    int firstAggregateColumn = (nil == theGroupingAttribute) ? 0 : 1;
+    int columnCount = sqlite3_column_count (theSQLiteStatement);
+    BOOL stop = NO;
+    
+    while ((NO == stop) && (SQLITE_ROW == sqlite3_step (theSQLiteStatement))) {
+        @autoreleasepool {
+            id groupValue = (nil == theGroupingAttribute) ? nil : [NSFNanoSearch _objectForColumn:0 statement:theSQLiteStatement];
+            NSMutableArray *values = [[NSMutableArray alloc]initWithCapacity:columnCount - firstAggregateColumn];
+            
+            for (int i = firstAggregateColumn; i < columnCount; i++) {
+                [values addObject:[NSFNanoSearch _objectForColumn:i statement:theSQLiteStatement]];
+            }
+            
+            theBlock (groupValue, values, &stop);
+        }
     }
     
-    NSFNanoResult *result = [_nanoStore _executeSQL:theAggregatedSQLStatement];
+    sqlite3_finalize (theSQLiteStatement);
+    [engine NSFP_checkInReadConnection:sqliteStore];
+    
+    return YES;
+}
 
-    _returnedObjectType = savedObjectTypeReturned;
-    _sql = savedSQL;
+- (NSArray *)searchObjectsMatchingFullTextQuery:(NSString *)theQuery returnType:(NSFReturnType)theReturnType error:(NSError * __autoreleasing *)outError
+{
+    if (nil == theQuery) {
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: the query is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    }
+    
+    if ([_nanoStore isClosed]) {
+        return nil;
+    }
+    
+    BOOL isIndexed = (nil == _attribute) ? [_nanoStore hasFullTextIndexForAttribute:nil] : [_nanoStore _isFullTextIndexedKeyPath:_attribute];
+    if (NO == isIndexed) {
+        if (nil != outError) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: no full-text index has been declared for attribute '%@'.", [self class], NSStringFromSelector(_cmd), (_attribute ? _attribute : @"<all>")]}];
+        }
+        return nil;
+    }
+    
+    NSString *query = [theQuery stringByReplacingOccurrencesOfString:@"'" withString:@"''"];
+    
+    // Rank each object by its best matching value. Lower bm25 scores are better matches.
+    NSMutableString *theRankedSQL = [NSMutableString stringWithFormat:@"SELECT %@.%@ AS %@, min(NSFRanked.NSFRank) AS NSFRank FROM (SELECT rowid AS NSFRowUID, rank AS NSFRank FROM %@ WHERE %@ MATCH '%@') AS NSFRanked JOIN %@ ON %@.ROWID = NSFRanked.NSFRowUID",
+                                     NSFValues, NSFKey, NSFKey, NSFFullTextValues, NSFFullTextValues, query, NSFValues, NSFValues];
+    
+    if (nil != _attribute) {
+        NSString *attribute = [_attribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"];
+        if (NSNotFound == [attribute rangeOfString:@"."].location) {
+            [theRankedSQL appendFormat:@" WHERE %@.%@", NSFValues, [NSFNanoSearch _querySegmentForKeyPathsContainingSegment:attribute]];
+        } else {
+            [theRankedSQL appendFormat:@" WHERE %@.%@", NSFValues, [NSFNanoSearch _querySegmentForColumn:NSFAttribute value:attribute matching:NSFEqualTo]];
+        }
+    }
+    
+    [theRankedSQL appendFormat:@" GROUP BY %@.%@", NSFValues, NSFKey];
+    
+    NSMutableString *theSQLStatement = [NSMutableString stringWithFormat:@"SELECT %@.%@, %@.%@, %@.%@ FROM %@ JOIN (%@) AS NSFMatches ON NSFMatches.%@ = %@.%@",
+                                        NSFKeys, NSFKey, NSFKeys, NSFKeyedArchive, NSFKeys, NSFObjectClass, NSFKeys, theRankedSQL, NSFKey, NSFKeys, NSFKey];
+    
+    NSMutableArray *conditions = [NSMutableArray new];
+    if (_filterClass.length > 0) {
+        [conditions addObject:[NSString stringWithFormat:@"(%@.%@ = '%@')", NSFKeys, NSFObjectClass, _filterClass]];
+    }
+    if (nil != _bag) {
+        [conditions addObject:[NSString stringWithFormat:@"%@.%@", NSFKeys, [NSFNanoSearch _querySegmentForBagMembers]]];
+    }
+    if (conditions.count > 0) {
+        [theSQLStatement appendFormat:@" WHERE %@", [conditions componentsJoinedByString:@" AND "]];
+    }
     
-    return @([result firstValue].floatValue);
+    [theSQLStatement appendString:@" ORDER BY NSFMatches.NSFRank"];
+    
+    if (_limit > 0) {
+        [theSQLStatement appendFormat:@" LIMIT %lu", (unsigned long)_limit];
+    }
+    
+    if (_offset > 0) {
+        [theSQLStatement appendFormat:@" OFFSET %lu", (unsigned long)_offset];
+    }
+    
+    // The bag key is bound, so the statement is run here rather than through the document store
+    NSMutableArray *searchResults = [NSMutableArray new];
+    
+    BOOL success = [self _enumerateRowsForSQL:theSQLStatement error:outError usingBlock:^(NSString *aKey, NSData *anArchive, NSString *aClassName) {
+        if (NSFReturnKeys == theReturnType) {
+            [searchResults addObject:aKey];
+        } else {
+            id nanoObject = [self _nanoObjectWithArchive:anArchive key:aKey className:aClassName];
+            if (nil != nanoObject) {
+                [searchResults addObject:nanoObject];
+            }
+        }
+    }];
+    
+    return success ? searchResults : nil;
 }
 
 #pragma mark -
@@ -266,16 +729,25 @@
         aSQLQuery = [self _preparedSQL];
     }
     
+    NSFNanoObjectFaultGroup *faultGroup = (NSFReturnObjects == _returnedObjectType) ? [self _faultGroupForCacheMethod] : nil;
+    if (nil != faultGroup) {
+        // SQLite flattens the subquery, so the archives left out are never read
+        aSQLQuery = [NSString stringWithFormat:@"SELECT NSFKey, %@, NSFObjectClass FROM (%@)", [NSFNanoSearch _archiveColumnForFaultingWithPrefix:@""], aSQLQuery];
+    }
+    
     _NSFLog(@"_dataWithKey SQL query: %@", aSQLQuery);
     
-    sqlite3 *sqliteStore = _nanoStore.nanoStoreEngine.sqlite;    
+    NSFNanoEngine *engine = _nanoStore.nanoStoreEngine;
+    sqlite3 *sqliteStore = [engine NSFP_checkOutReadConnection];
     sqlite3_stmt *theSQLiteStatement = NULL;
     
     int status = sqlite3_prepare_v2 (sqliteStore, aSQLQuery.UTF8String, -1, &theSQLiteStatement, NULL );
     
     status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
     
-    if (SQLITE_OK == status) {        
+    if (SQLITE_OK == status) {
+        [self _bindBagToStatement:theSQLiteStatement];
+        
         switch (_returnedObjectType) {
             case NSFReturnKeys:
                 while (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) {
@@ -292,8 +764,20 @@
                 }
                 break;
             default:
+                if ((_hydrationConcurrency > 1) && (nil == faultGroup)) {
+                    [self _hydrateObjectsConcurrentlyFromStatement:theSQLiteStatement intoResults:searchResults];
+                    break;
+                }
+                
                 while (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) {
                     char *keyUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 0);
+                    
+                    if ((nil != faultGroup) && (NULL != keyUTF8) && (SQLITE_NULL == sqlite3_column_type (theSQLiteStatement, 1))) {
+                        NSString *keyValue = @(keyUTF8);
+                        searchResults[keyValue] = [self _nanoObjectFaultWithKey:keyValue faultGroup:faultGroup];
+                        continue;
+                    }
+                    
                     NSData *dictBinData = [[NSData alloc] initWithBytes:sqlite3_column_blob(theSQLiteStatement, 1) length: sqlite3_column_bytes(theSQLiteStatement, 1)];
                     char *objectClassUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 2);
                     
@@ -304,61 +788,13 @@
                         NSLog(@"*** Warning! These values are NanoStore's resposibility and should *never* be NULL: keyUTF8 (%s) - binArchinve (%@) - objectClassUTF8 (%s)", keyUTF8, dictBinData.debugDescription, objectClassUTF8);
                         continue;
                     }
-                    NSDictionary *info = [NSKeyedUnarchiver unarchiveObjectWithData:dictBinData];
-                    NSString *keyValue = @(keyUTF8);
-                    NSString *objectClass = @(objectClassUTF8);
-                    
-                    if (nil == info) {
-                        continue;
-                    }
                     
-                    if (_attributesToBeReturned.count == 0) {
-                        // Will be released below...
-                    } else {
-                        // Since we want a subset of the attributes, we need to traverse
-                        // the attribute list and find out whether the dictionary contains
-                        // the specified attributes. If so, add them to a subset which will
-                        // be returned as requested.
-                        
-                        NSMutableDictionary *subset = [NSMutableDictionary new];
-                        
-                        for (NSString *attributeValue in _attributesToBeReturned) {
-                            id theValue = [info valueForKeyPath:attributeValue];
-                            if (nil != theValue) {
-                                if (NSNotFound == [attributeValue rangeOfString:@"."].location) {
-                                    [subset setValue:theValue forKeyPath:attributeValue];
-                                } else {
-                                    NSDictionary *subInfo = [self _dictionaryForKeyPath:attributeValue value:theValue];
-                                    if (subInfo.count > 0) {
-                                        NSString *subInfoKey = subInfo.allKeys[0];
-                                        NSString *subInfoValue = subInfo[subInfoKey];
-                                        [subset setValue:subInfoValue forKey:subInfoKey];
-                                    }
-                                }
-                            }
-                        }
-                        
-                        // Will be released below...
-                        info = subset;
-                    }
+                    NSString *keyValue = @(keyUTF8);
+                    id nanoObject = [self _nanoObjectWithArchive:dictBinData key:keyValue className:@(objectClassUTF8)];
                     
-                    Class storedObjectClass = NSClassFromString(objectClass);
-                    BOOL saveOriginalClassReference = NO;
-                    if (nil == storedObjectClass) {
-                        storedObjectClass = [NSFNanoObject class];
-                        saveOriginalClassReference = YES;
+                    if (nil != nanoObject) {
+                        searchResults[keyValue] = nanoObject;
                     }
-                    
-                    id nanoObject = [[storedObjectClass alloc]initNanoObjectFromDictionaryRepresentation:info forKey:keyValue store:_nanoStore];
-                    
-                    // If this process does not have knowledge of the original class as was saved in the store, keep a reference
-                    // so that we can later on restore the object properly (otherwise it would be stored as a NanoObject.)
-                    if (saveOriginalClassReference) {
-                        [nanoObject _setOriginalClassString:objectClass];
-                    }
-                    
-                    searchResults[keyValue] = nanoObject;
-                    
                 }
                 break;
         }
@@ -374,6 +810,8 @@
         }
         searchResults = nil;
     }
+    
+    [engine NSFP_checkInReadConnection:sqliteStore];
         
     return searchResults;
 }
@@ -411,62 +849,40 @@
             break;
     }
     
-    NSFNanoResult *result = [_nanoStore _executeSQL:theSQLStatement];
+    if (nil != _bag) {
+        theSQLStatement = [theSQLStatement stringByAppendingFormat:@" AND %@", [NSFNanoSearch _querySegmentForBagMembers]];
+    }
     
-    NSMutableDictionary *searchResults = [NSMutableDictionary dictionaryWithCapacity:result.numberOfRows];
+    NSMutableDictionary *searchResults = [NSMutableDictionary dictionary];
     
-    if (result.numberOfRows > 0) {
-        if (NSFReturnKeys == _returnedObjectType) {
-            NSArray *resultsKeys = [result valuesForColumn:NSFKey];
-            for (NSString *resultKey in resultsKeys)
-                searchResults[resultKey] = [NSNull null];
-            return searchResults;
-        } else {
-                NSArray *resultsObjectClass = [result valuesForColumn:NSFObjectClass];
-                NSArray *resultsObjects = [result valuesForColumn:NSFKeyedArchive];
-                NSArray *resultsKeys = [result valuesForColumn:NSFKey];
-                NSUInteger i, count = resultsKeys.count;
-                
-            for (i = 0; i < count; i++) {
-                @autoreleasepool {
-                    NSDictionary *info = [NSKeyedUnarchiver unarchiveObjectWithData:resultsObjects[i]];
-                    if (nil != info) {
-                        NSString *keyValue = resultsKeys[i];
-                        
-                        NSString *className = resultsObjectClass[i];
-                        Class storedObjectClass = NSClassFromString(className);
-                        BOOL saveOriginalClassReference = NO;
-                        if (nil == storedObjectClass) {
-                            storedObjectClass = [NSFNanoObject class];
-                            saveOriginalClassReference = YES;
-                        }
-                        
-                        id nanoObject = [[storedObjectClass alloc]initNanoObjectFromDictionaryRepresentation:info forKey:keyValue store:_nanoStore];
-                        
-                        // If this process does not have knowledge of the original class as was saved in the store, keep a reference
-                        // so that we can later on restore the object properly (otherwise it would be stored as a NanoObject.)
-                        if (saveOriginalClassReference) {
-                            [nanoObject _setOriginalClassString:className];
-                        }
-                        
-                        searchResults[keyValue] = nanoObject;
-                    }
-                }
-            }
+    BOOL success = [self _enumerateRowsForSQL:theSQLStatement error:outError usingBlock:^(NSString *aKey, NSData *anArchive, NSString *aClassName) {
+        if (NSFReturnKeys == self.returnedObjectType) {
+            searchResults[aKey] = [NSNull null];
+            return;
         }
-    }
+        
+        id nanoObject = [self _nanoObjectWithArchive:anArchive key:aKey className:aClassName];
+        if (nil != nanoObject) {
+            searchResults[aKey] = nanoObject;
+        }
+    }];
     
-    return searchResults;
+    return success ? searchResults : nil;
 }
 
 - (NSString *)_preparedSQL
+{
+    return [self _preparedSQLWithReturnType:_returnedObjectType];
+}
+
+- (NSString *)_preparedSQLWithReturnType:(NSFReturnType)theReturnType
 {
     NSString *aSQLQuery = nil;
     
     if (nil == _expressions) {
-        aSQLQuery = [self _prepareSQLQueryStringWithKey:_key attribute:_attribute value:_value matching:_match];
+        aSQLQuery = [self _prepareSQLQueryStringWithKey:_key attribute:_attribute value:_value matching:_match returnType:theReturnType];
     } else {
-        aSQLQuery = [self _prepareSQLQueryStringWithExpressions:_expressions];
+        aSQLQuery = [self _prepareSQLQueryStringWithExpressions:_expressions returnType:theReturnType];
     }
     
     // Add the limit clause if required
@@ -482,7 +898,7 @@
     return aSQLQuery;
 }
 
-- (NSString *)_prepareSQLQueryStringWithKey:(NSString *)aKey attribute:(NSString *)anAttribute value:(id)aValue matching:(NSFMatchType)aMatch
+- (NSString *)_prepareSQLQueryStringWithKey:(NSString *)aKey attribute:(NSString *)anAttribute value:(id)aValue matching:(NSFMatchType)aMatch returnType:(NSFReturnType)returnType
 {    
     NSMutableString *theSQLStatement = nil;
     
@@ -502,20 +918,24 @@
         }
     }
     
-    NSFReturnType returnType = _returnedObjectType;
+    NSString *bagSegment = (nil != _bag) ? [NSFNanoSearch _querySegmentForBagMembers] : nil;
     
     if ((nil == aKey) && (nil == anAttribute) && (nil == aValue)) {
         switch (returnType) {
             case NSFReturnKeys:
                 if (_filterClass.length > 0) {
-                    return [NSString stringWithFormat:@"SELECT NSFKey FROM NSFKeys WHERE (NSFObjectClass = '%@')", _filterClass];
+                    return [NSString stringWithFormat:@"SELECT NSFKey FROM NSFKeys WHERE (NSFObjectClass = '%@')%@", _filterClass, (bagSegment ? [@" AND " stringByAppendingString:bagSegment] : @"")];
+                } else if (nil != bagSegment) {
+                    return [NSString stringWithFormat:@"SELECT NSFKEY FROM NSFKeys WHERE %@", bagSegment];
                 } else {
                     return @"SELECT NSFKEY FROM NSFKeys";
                 }
                 break;
             default:
                 if (_filterClass.length > 0) {
-                    return [NSString stringWithFormat:@"SELECT NSFKey, NSFKeyedArchive, NSFObjectClass FROM NSFKeys WHERE (NSFObjectClass = '%@')", _filterClass];
+                    return [NSString stringWithFormat:@"SELECT NSFKey, NSFKeyedArchive, NSFObjectClass FROM NSFKeys WHERE (NSFObjectClass = '%@')%@", _filterClass, (bagSegment ? [@" AND " stringByAppendingString:bagSegment] : @"")];
+                } else if (nil != bagSegment) {
+                    return [NSString stringWithFormat:@"SELECT NSFKey, NSFKeyedArchive, NSFObjectClass FROM NSFKeys WHERE %@", bagSegment];
                 } else {
                     return @"SELECT NSFKey, NSFKeyedArchive, NSFObjectClass FROM NSFKeys";
                 }
@@ -556,7 +976,27 @@
         // We need to introspect whether the attribute contains a dot "." or not. Based on the case, we'll need to GLOB the attribute
         // or leave it as is.
         
-        if (NSNotFound == [anAttribute rangeOfString:@"."].location) {
+        if ([self _shouldUseFullTextIndexForAttribute:anAttribute value:aValue matching:aMatch]) {
+            if (NSNotFound == [anAttribute rangeOfString:@"."].location) {
+                segment = [NSFNanoSearch _querySegmentForKeyPathsContainingSegment:anAttribute];
+            } else {
+                segment = [NSFNanoSearch _querySegmentForColumn:NSFAttribute value:anAttribute matching:NSFEqualTo];
+            }
+            // The index only narrows down the candidates, the original predicate keeps the contains semantics
+            segment = [NSString stringWithFormat:@"(%@ AND %@ AND %@)", segment, [NSFNanoSearch _querySegmentForFullTextQuery:[NSFNanoSearch _fullTextQueryForContainedValue:aValue]],
+                       [NSFNanoSearch _querySegmentForColumn:NSFValue value:aValue matching:aMatch]];
+        } else if ([self _shouldUseCaseFoldedValuesForAttribute:anAttribute value:aValue matching:aMatch]) {
+            if (NSNotFound == [anAttribute rangeOfString:@"."].location) {
+                segment = [NSFNanoSearch _querySegmentForKeyPathsContainingSegment:anAttribute];
+            } else {
+                segment = [NSFNanoSearch _querySegmentForColumn:NSFAttribute value:anAttribute matching:NSFEqualTo];
+            }
+            segment = [NSString stringWithFormat:@"(%@ AND %@)", segment, [NSFNanoSearch _querySegmentForCaseFoldedValue:aValue matching:aMatch]];
+        } else if ([self _shouldUseAttributeIndexForAttribute:anAttribute value:aValue matching:aMatch]) {
+            // Spell out the exact attribute so SQLite picks the partial index declared for it
+            segment = [NSFNanoSearch _querySegmentForColumn:NSFAttribute value:anAttribute matching:NSFEqualTo];
+            segment = [NSString stringWithFormat:@"(%@ AND %@)", segment, [NSFNanoSearch _querySegmentForIndexedValue:aValue type:[_nanoStore typeOfIndexForAttribute:anAttribute] matching:aMatch]];
+        } else if (NSNotFound == [anAttribute rangeOfString:@"."].location) {
             segment = [NSFNanoSearch _querySegmentForAttributeColumnWithValue:anAttribute matching:aMatch valueColumnWithValue:aValue];
         } else {
             if (nil == aValue) {
@@ -570,19 +1010,25 @@
         }
         
         [theSQLStatement appendString:segment];
-        if (self.bag != nil) {
-            NSString *selectInABag = [NSString stringWithFormat:@" AND NSFKey IN (SELECT NSFValue FROM NSFVALUES WHERE NSFKey == '%@' AND NSFAttribute == '%@')",self.bag.key,NSF_Private_NSFNanoBag_NSFObjectKeys];
-            [theSQLStatement appendString:selectInABag];
-        }
     } else {
         if (nil != aValue) {
             if (querySegmentWasAdded)
                 [theSQLStatement appendString:@" AND "];
-            segment = [NSFNanoSearch _querySegmentForColumn:NSFValue value:aValue matching:aMatch];
+            if ([self _shouldUseFullTextIndexForAttribute:nil value:aValue matching:aMatch]) {
+                segment = [NSString stringWithFormat:@"(%@ AND %@)", [NSFNanoSearch _querySegmentForFullTextQuery:[NSFNanoSearch _fullTextQueryForContainedValue:aValue]],
+                           [NSFNanoSearch _querySegmentForColumn:NSFValue value:aValue matching:aMatch]];
+            } else {
+                segment = [NSFNanoSearch _querySegmentForColumn:NSFValue value:aValue matching:aMatch];
+            }
             [theSQLStatement appendString:segment];
         }
     }
     
+    // Scope every form to the bag before limiting or grouping the values
+    if (nil != bagSegment) {
+        [theSQLStatement appendFormat:@" AND %@", bagSegment];
+    }
+    
     if ((_limit > 0) || (_offset > 0)) {
         [theSQLStatement appendString:@" ORDER BY ROWID"];
     }
@@ -606,14 +1052,22 @@
     return theSQLStatement;
 }
 
-- (NSString *)_prepareSQLQueryStringWithExpressions:(NSArray *)someExpressions
+- (NSString *)_prepareSQLQueryStringWithExpressions:(NSArray *)someExpressions returnType:(NSFReturnType)returnType
 {
     NSUInteger i, count = someExpressions.count;
     NSMutableArray *sqlComponents = [NSMutableArray new];
     NSMutableString *parentheses = [NSMutableString new];
-    NSFReturnType returnType = _returnedObjectType;
+    BOOL hasCompoundExpressions = NO;
+    
+    for (NSFNanoExpression *expression in someExpressions) {
+        hasCompoundExpressions |= expression._isCompound;
+    }
 
-    if (count == 0) {
+    if (hasCompoundExpressions) {
+        // Compile the whole tree into a single compound select over the sets of keys
+        NSFNanoExpression *tree = (1 == count) ? someExpressions[0] : [NSFNanoExpression expressionWithOperator:NSFAnd subexpressions:someExpressions];
+        [sqlComponents addObject:[tree _keysSQL]];
+    } else if (count == 0) {
         if (NSFReturnObjects == returnType) {
             [sqlComponents addObject:@"SELECT NSFKEY FROM NSFValues"];
         } else {
@@ -644,39 +1098,26 @@
     
     NSString *theValue = [sqlComponents componentsJoinedByString:@""];
     
+    // The bag is applied like the class filter, once over the keys the whole expression tree matched
+    NSString *bagScope = (nil != _bag) ? [NSString stringWithFormat:@" AND %@", [NSFNanoSearch _querySegmentForBagMembers]] : @"";
+    
     if (NSFReturnObjects == returnType) {
         if (_filterClass.length > 0) {
-            theValue = [NSString stringWithFormat:@"SELECT DISTINCT (NSFKey),NSFKeyedArchive,NSFObjectClass FROM NSFKeys WHERE (NSFObjectClass = '%@') AND NSFKey IN (%@)", _filterClass, theValue];
+            theValue = [NSString stringWithFormat:@"SELECT DISTINCT (NSFKey),NSFKeyedArchive,NSFObjectClass FROM NSFKeys WHERE (NSFObjectClass = '%@') AND NSFKey IN (%@)%@", _filterClass, theValue, bagScope];
         } else {
-            theValue = [NSString stringWithFormat:@"SELECT DISTINCT (NSFKey),NSFKeyedArchive,NSFObjectClass FROM NSFKeys WHERE NSFKey IN (%@)", theValue];
+            theValue = [NSString stringWithFormat:@"SELECT DISTINCT (NSFKey),NSFKeyedArchive,NSFObjectClass FROM NSFKeys WHERE NSFKey IN (%@)%@", theValue, bagScope];
         }
     } else {
         if (_filterClass.length > 0) {
-            theValue = [NSString stringWithFormat:@"SELECT DISTINCT (NSFKey) FROM NSFKeys WHERE (NSFObjectClass = '%@') AND NSFKey IN (%@)", _filterClass, theValue];
+            theValue = [NSString stringWithFormat:@"SELECT DISTINCT (NSFKey) FROM NSFKeys WHERE (NSFObjectClass = '%@') AND NSFKey IN (%@)%@", _filterClass, theValue, bagScope];
+        } else if (nil != _bag) {
+            theValue = [NSString stringWithFormat:@"SELECT DISTINCT (NSFKey) FROM NSFKeys WHERE NSFKey IN (%@)%@", theValue, bagScope];
         }
     }
     
     return theValue;
 }
 
-+ (NSString *)_prepareSQLQueryStringWithKeys:(NSArray *)someKeys
-{
-    //Prepare the keys by single quoting them...
-    NSMutableArray *preparedKeys = [NSMutableArray new];
-    for (NSString *theKey in someKeys) {
-        NSString *quotedKey = [[NSString alloc]initWithFormat:@"'%@'", theKey];
-        [preparedKeys addObject:quotedKey];
-    }
-    
-    NSMutableString *theSQLStatement = [NSMutableString stringWithString:@"SELECT DISTINCT (NSFKEY) FROM NSFValues WHERE NSFKey IN ("];
-    [theSQLStatement appendString:[preparedKeys componentsJoinedByString:@","]];
-    [theSQLStatement appendString:@")"];
-    
-    theSQLStatement = [NSMutableString stringWithFormat:@"SELECT DISTINCT (NSFKey),NSFKeyedArchive,NSFObjectClass FROM NSFKeys WHERE NSFKey IN (%@)", theSQLStatement];
-    
-    return theSQLStatement;
-}
-
 + (NSString *)_querySegmentForColumn:(NSString *)aColumn value:(id)aValue matching:(NSFMatchType)match
 {
     NSMutableString *segment = [NSMutableString string];
@@ -685,7 +1126,9 @@
     NSInteger mutatedStringLength = 0;
     unichar sentinelChar;
     
-    if ([aValue isKindOfClass:[NSString class]]) {
+    if ([NSFNanoSearch _isTypedValue:aValue matching:match]) {
+        [segment appendString:[NSFNanoSearch _querySegmentForTypedValue:aValue column:aColumn matching:match]];
+    } else if ([aValue isKindOfClass:[NSString class]]) {
         switch (match) {
             case NSFEqualTo:
                 value = [[NSMutableString alloc]initWithFormat:@"%@ = '%@'", aColumn, aValue];
@@ -736,6 +1179,9 @@
                 value = [[NSMutableString alloc]initWithFormat:@"%@ <> '%@'", aColumn, aValue];
                 [segment appendString:value];
                 break;
+            case NSFBetween:
+                // Ranges are always built as typed segments
+                break;
         }
     } else if ([aValue isKindOfClass:[NSArray class]]) {
         // Quote the parameters
@@ -775,61 +1221,59 @@
 {
     NSMutableString *segment = [NSMutableString string];
     NSMutableString *value = nil;
+    
+    // The attribute can appear anywhere in the key path. Resolve the matching key paths through the segments table,
+    // which is indexed, instead of GLOBbing NSFAttribute with leading wildcards.
+    NSString *attributeSegment = [NSFNanoSearch _querySegmentForKeyPathsContainingSegment:anAttributeValue];
 
-    if (([aValue isKindOfClass:[NSString class]]) || (nil == aValue)) {
+    if ((nil != aValue) && [NSFNanoSearch _isTypedValue:aValue matching:match]) {
+        [segment appendFormat:@"(%@ AND %@)", attributeSegment, [NSFNanoSearch _querySegmentForTypedValue:aValue column:NSFValue matching:match]];
+    } else if (([aValue isKindOfClass:[NSString class]]) || (nil == aValue)) {
         if (nil == aValue) {
-            value = [[NSMutableString alloc]initWithFormat:@"((%@ = '%@') OR (%@ GLOB '%@.*') OR (%@ GLOB '*.%@.*') OR (%@ GLOB '*.%@'))", NSFAttribute, anAttributeValue, NSFAttribute, anAttributeValue, NSFAttribute, anAttributeValue, NSFAttribute, anAttributeValue];
-            [segment appendString:value];
+            [segment appendString:attributeSegment];
         } else {
             switch (match) {
                 case NSFEqualTo:
-                    value = [[NSMutableString alloc]initWithFormat:@"((%@ = '%@' AND %@ = '%@') OR (%@ GLOB '%@.*' AND %@ = '%@') OR (%@ GLOB '*.%@.*' AND %@ = '%@') OR (%@ GLOB '*.%@' AND %@ = '%@'))", NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue];
-                    [segment appendString:value];
+                    value = [[NSMutableString alloc]initWithFormat:@"%@ = '%@'", NSFValue, aValue];
                     break;
                 case NSFBeginsWith:
-                    value = [[NSMutableString alloc]initWithFormat:@"((%@ = '%@' AND %@ GLOB '%@*') OR (%@ GLOB '%@.*' AND %@ GLOB '%@*') OR (%@ GLOB '*.%@.*' AND %@ GLOB '%@*') OR (%@ GLOB '*.%@' AND %@ GLOB '%@*'))", NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue];
-                    [segment appendString:value];
+                    value = [[NSMutableString alloc]initWithFormat:@"%@ GLOB '%@*'", NSFValue, aValue];
                     break;
                 case NSFContains:
-                    value = [[NSMutableString alloc]initWithFormat:@"((%@ = '%@' AND %@ GLOB '%@') OR (%@ GLOB '%@.*' AND %@ GLOB '%@') OR (%@ GLOB '*.%@.*' AND %@ GLOB '%@') OR (%@ GLOB '*.%@' AND %@ GLOB '%@'))", NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue];
-                    [segment appendString:value];
+                    value = [[NSMutableString alloc]initWithFormat:@"%@ GLOB '%@'", NSFValue, aValue];
                     break;
                 case NSFEndsWith:
-                    value = [[NSMutableString alloc]initWithFormat:@"((%@ = '%@' AND %@ GLOB '*%@') OR (%@ GLOB '%@.*' AND %@ GLOB '*%@') OR (%@ GLOB '*.%@.*' AND %@ GLOB '*%@') OR (%@ GLOB '*.%@' AND %@ GLOB '*%@'))", NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue];
-                    [segment appendString:value];
+                    value = [[NSMutableString alloc]initWithFormat:@"%@ GLOB '*%@'", NSFValue, aValue];
                     break;
                 case NSFInsensitiveEqualTo:
-                    aValue = [aValue uppercaseString];
-                    value = [[NSMutableString alloc]initWithFormat:@"((%@ = '%@' AND upper(%@) = '%@') OR (%@ GLOB '%@.*' AND upper(%@) = '%@') OR (%@ GLOB '*.%@.*' AND upper(%@) = '%@') OR (%@ GLOB '*.%@' AND upper(%@) = '%@'))", NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue];
-                    [segment appendString:value];
+                    value = [[NSMutableString alloc]initWithFormat:@"upper(%@) = '%@'", NSFValue, [aValue uppercaseString]];
                     break;
                 case NSFInsensitiveBeginsWith:
-                    aValue = [aValue uppercaseString];
-                    value = [[NSMutableString alloc]initWithFormat:@"((%@ = '%@' AND upper(%@) GLOB '%@*') OR (%@ GLOB '%@.*' AND upper(%@) GLOB '%@*') OR (%@ GLOB '*.%@.*' AND upper(%@) GLOB '%@*') OR (%@ GLOB '*.%@' AND upper(%@) GLOB '%@*'))", NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue];
-                    [segment appendString:value];
+                    value = [[NSMutableString alloc]initWithFormat:@"upper(%@) GLOB '%@*'", NSFValue, [aValue uppercaseString]];
                     break;
                 case NSFInsensitiveContains:
-                    value = [[NSMutableString alloc]initWithFormat:@"((%@ = '%@' AND %@ LIKE '%@') OR (%@ GLOB '%@.*' AND %@ LIKE '%@') OR (%@ GLOB '*.%@.*' AND %@ LIKE '%@') OR (%@ GLOB '*.%@' AND %@ LIKE '%@'))", NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue];
-                    [segment appendString:value];
+                    value = [[NSMutableString alloc]initWithFormat:@"%@ LIKE '%@'", NSFValue, aValue];
                     break;
                 case NSFInsensitiveEndsWith:
-                    value = [[NSMutableString alloc]initWithFormat:@"((%@ = '%@' AND %@ LIKE '%%%@') OR (%@ GLOB '%@.*' AND %@ LIKE '%%%@') OR (%@ GLOB '*.%@.*' AND %@ LIKE '%%%@') OR (%@ GLOB '*.%@' AND %@ LIKE '%%%@'))", NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue];
-                    [segment appendString:value];
+                    value = [[NSMutableString alloc]initWithFormat:@"%@ LIKE '%%%@'", NSFValue, aValue];
                     break;
                 case NSFGreaterThan:
-                    value = [[NSMutableString alloc]initWithFormat:@"((%@ = '%@' AND %@ > '%@') OR (%@ GLOB '%@.*' AND %@ > '%@') OR (%@ GLOB '*.%@.*' AND %@ > '%@') OR (%@ GLOB '*.%@' AND %@ > '%@'))", NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue];
-                    [segment appendString:value];
+                    value = [[NSMutableString alloc]initWithFormat:@"%@ > '%@'", NSFValue, aValue];
                     break;
                 case NSFLessThan:
-                    value = [[NSMutableString alloc]initWithFormat:@"((%@ = '%@' AND %@ < '%@') OR (%@ GLOB '%@.*' AND %@ < '%@') OR (%@ GLOB '*.%@.*' AND %@ < '%@') OR (%@ GLOB '*.%@' AND %@ < '%@'))", NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue];
-                    [segment appendString:value];
+                    value = [[NSMutableString alloc]initWithFormat:@"%@ < '%@'", NSFValue, aValue];
                     break;
                 case NSFNotEqualTo:
-                    value = [[NSMutableString alloc]initWithFormat:@"((%@ == '%@' AND %@ <> '%@') OR (%@ GLOB '%@.*' AND %@ <> '%@') OR (%@ GLOB '*.%@.*' AND %@ <> '%@') OR (%@ GLOB '*.%@' AND %@ <> '%@'))", NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue, NSFAttribute, anAttributeValue, NSFValue, aValue];
-                    [segment appendString:value];
-
+                    value = [[NSMutableString alloc]initWithFormat:@"%@ <> '%@'", NSFValue, aValue];
+                    break;
+                case NSFBetween:
+                    // Ranges are always built as typed segments
                     break;
             }
+            
+            if (nil != value) {
+                [segment appendFormat:@"(%@ AND %@)", attributeSegment, value];
+            }
         }
     } else if ([aValue isKindOfClass:[NSArray class]]) {
         // Quote the parameters
@@ -851,90 +1295,1142 @@
         NSString *NULLStringValue = NSFStringFromNanoDataType (NSFNanoTypeNULL);
         switch (match) {
             case NSFEqualTo:
-                value = [[NSMutableString alloc]initWithFormat:@"(%@ = '%@' AND %@ = '%@') OR (%@ GLOB '%@.*' AND %@ = '%@') OR (%@ GLOB '*.%@.*' AND %@ = '%@') OR (%@ GLOB '*.%@' AND %@ = '%@')", NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue];
-                [segment appendString:value];
+                value = [[NSMutableString alloc]initWithFormat:@"%@ = '%@'", NSFDatatype, NULLStringValue];
                 break;
             case NSFNotEqualTo:
-                value = [[NSMutableString alloc]initWithFormat:@"(%@ = '%@' AND %@ <> '%@') OR (%@ GLOB '%@.*' AND %@ <> '%@') OR (%@ GLOB '*.%@.*' AND %@ <> '%@') OR (%@ GLOB '*.%@' AND %@ <> '%@')", NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue];
-                [segment appendString:value];
+                value = [[NSMutableString alloc]initWithFormat:@"%@ <> '%@'", NSFDatatype, NULLStringValue];
                 break;
             case NSFBeginsWith:
-                value = [[NSMutableString alloc]initWithFormat:@"(%@ = '%@' AND %@ GLOB '%@*') OR (%@ GLOB '%@.*' AND %@ GLOB '%@*') OR (%@ GLOB '*.%@.*' AND %@ GLOB '%@*') OR (%@ GLOB '*.%@' AND %@ GLOB '%@*')", NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue];
-                [segment appendString:value];
+                value = [[NSMutableString alloc]initWithFormat:@"%@ GLOB '%@*'", NSFDatatype, NULLStringValue];
                 break;
             case NSFContains:
-                value = [[NSMutableString alloc]initWithFormat:@"(%@ = '%@' AND %@ GLOB '%@') OR (%@ GLOB '%@.*' AND %@ GLOB '%@') OR (%@ GLOB '*.%@.*' AND %@ GLOB '%@') OR (%@ GLOB '*.%@' AND %@ GLOB '%@')", NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue];
-                [segment appendString:value];
+                value = [[NSMutableString alloc]initWithFormat:@"%@ GLOB '%@'", NSFDatatype, NULLStringValue];
                 break;
             case NSFEndsWith:
-                value = [[NSMutableString alloc]initWithFormat:@"(%@ = '%@' AND %@ GLOB '*%@') OR (%@ GLOB '%@.*' AND %@ GLOB '*%@') OR (%@ GLOB '*.%@.*' AND %@ GLOB '*%@') OR (%@ GLOB '*.%@' AND %@ GLOB '*%@')", NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue];
-                [segment appendString:value];
+                value = [[NSMutableString alloc]initWithFormat:@"%@ GLOB '*%@'", NSFDatatype, NULLStringValue];
                 break;
             case NSFInsensitiveEqualTo:
-                value = [[NSMutableString alloc]initWithFormat:@"(%@ = '%@' AND upper(%@) = '%@') OR (%@ GLOB '%@.*' AND upper(%@) = '%@') OR (%@ GLOB '*.%@.*' AND upper(%@) = '%@') OR (%@ GLOB '*.%@' AND upper(%@) = '%@')", NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue];
-                [segment appendString:value];
+                value = [[NSMutableString alloc]initWithFormat:@"upper(%@) = '%@'", NSFDatatype, NULLStringValue];
                 break;
             case NSFInsensitiveBeginsWith:
-                value = [[NSMutableString alloc]initWithFormat:@"(%@ = '%@' AND upper(%@) GLOB '%@*') OR (%@ GLOB '%@.*' AND upper(%@) GLOB '%@*') OR (%@ GLOB '*.%@.*' AND upper(%@) GLOB '%@*') OR (%@ GLOB '*.%@' AND upper(%@) GLOB '%@*')", NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue];
-                [segment appendString:value];
+                value = [[NSMutableString alloc]initWithFormat:@"upper(%@) GLOB '%@*'", NSFDatatype, NULLStringValue];
                 break;
             case NSFInsensitiveContains:
-                value = [[NSMutableString alloc]initWithFormat:@"(%@ = '%@' AND %@ LIKE '%@') OR (%@ GLOB '%@.*' AND %@ LIKE '%@') OR (%@ GLOB '*.%@.*' AND %@ LIKE '%@') OR (%@ GLOB '*.%@' AND %@ LIKE '%@')", NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue];
-                [segment appendString:value];
+                value = [[NSMutableString alloc]initWithFormat:@"%@ LIKE '%@'", NSFDatatype, NULLStringValue];
                 break;
             case NSFInsensitiveEndsWith:
-                value = [[NSMutableString alloc]initWithFormat:@"(%@ = '%@' AND %@ LIKE '%%%@') OR (%@ GLOB '%@.*' AND %@ LIKE '%%%@') OR (%@ GLOB '*.%@.*' AND %@ LIKE '%%%@') OR (%@ GLOB '*.%@' AND %@ LIKE '%%%@')", NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue];
-                [segment appendString:value];
+                value = [[NSMutableString alloc]initWithFormat:@"%@ LIKE '%%%@'", NSFDatatype, NULLStringValue];
                 break;
             case NSFGreaterThan:
-                value = [[NSMutableString alloc]initWithFormat:@"(%@ = '%@' AND %@ > '%@') OR (%@ GLOB '%@.*' AND %@ > '%@') OR (%@ GLOB '*.%@.*' AND %@ > '%@') OR (%@ GLOB '*.%@' AND %@ > '%@')", NSFAttribute, NSFDatatype, NULLStringValue, aValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue];
-                [segment appendString:value];
+                value = [[NSMutableString alloc]initWithFormat:@"%@ > '%@'", NSFDatatype, NULLStringValue];
                 break;
             case NSFLessThan:
-                value = [[NSMutableString alloc]initWithFormat:@"(%@ = '%@' AND %@ < '%@') OR (%@ GLOB '%@.*' AND %@ < '%@') OR (%@ GLOB '*.%@.*' AND %@ < '%@') OR (%@ GLOB '*.%@' AND %@ < '%@')", NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue, NSFAttribute, anAttributeValue, NSFDatatype, NULLStringValue];
-                [segment appendString:value];
+                value = [[NSMutableString alloc]initWithFormat:@"%@ < '%@'", NSFDatatype, NULLStringValue];
+                break;
+            case NSFBetween:
                 break;
         }
+        
+        if (nil != value) {
+            [segment appendFormat:@"(%@ AND %@)", attributeSegment, value];
+        }
     }
     
     return segment;
 }
 
-- (NSDictionary *)_dictionaryForKeyPath:(NSString *)keyPath value:(id)theValue
++ (NSString *)_querySegmentForKeyPathsContainingSegment:(NSString *)aSegment
 {
-    NSMutableDictionary *info = [NSMutableDictionary dictionary];
-    NSMutableArray *keys = [[keyPath componentsSeparatedByString:@"."]mutableCopy];
+    return [NSString stringWithFormat:@"%@ IN (SELECT %@ FROM %@ WHERE %@ = '%@')", NSFAttribute, NSFAttribute, NSFKeyPathSegments, NSFSegment, aSegment];
+}
+
+- (BOOL)_shouldUseFullTextIndexForAttribute:(NSString *)anAttribute value:(id)aValue matching:(NSFMatchType)aMatch
+{
+    if ((NSFContains != aMatch) && (NSFInsensitiveContains != aMatch)) {
+        return NO;
+    }
     
-    if (keys.count == 1) {
-        info[keyPath] = theValue;
-        return info;
+    if (NO == [aValue isKindOfClass:[NSString class]]) {
+        return NO;
     }
     
-    NSInteger i;
+    // Values without three characters in a row have nothing to look up in the index
+    if (0 == [NSFNanoSearch _fullTextQueryForContainedValue:aValue].length) {
+        return NO;
+    }
+    
+    if (nil == anAttribute) {
+        return [_nanoStore hasFullTextIndexForAttribute:nil];
+    }
+    
+    return [_nanoStore _isFullTextIndexedKeyPath:anAttribute];
+}
 
-    for (i = 0; i < keys.count; i++) {
-        NSString *keyValue = keys[i];
-        [keys removeObjectAtIndex:0];
-        NSDictionary *subInfo = [self _dictionaryForKeyPath:[keys componentsJoinedByString:@"."] value:theValue];
-        if (nil != subInfo)
-            info[keyValue] = subInfo;
++ (NSString *)_fullTextQueryForContainedValue:(NSString *)aValue
+{
+    // GLOB character classes can't be turned into literal substrings
+    if (NSNotFound != [aValue rangeOfString:@"["].location) {
+        return @"";
     }
     
-    return info;
+    // Contains searches carry GLOB and LIKE wildcards, which the full-text index doesn't understand. The literal runs
+    // between them must all appear in a matching value, which makes them a safe filter.
+    NSCharacterSet *wildcards = [NSCharacterSet characterSetWithCharactersInString:@"*%?_"];
+    NSMutableArray *phrases = [NSMutableArray new];
+    
+    for (NSString *run in [aValue componentsSeparatedByCharactersInSet:wildcards]) {
+        // Trigrams can't match anything shorter than three characters. Quotes arrive escaped for SQL, so count them once.
+        NSString *unescapedRun = [run stringByReplacingOccurrencesOfString:@"''" withString:@"'"];
+        if ([unescapedRun lengthOfBytesUsingEncoding:NSUTF32LittleEndianStringEncoding] / 4 >= 3) {
+            [phrases addObject:[NSString stringWithFormat:@"\"%@\"", [run stringByReplacingOccurrencesOfString:@"\"" withString:@"\"\""]]];
+        }
+    }
+    
+    return [phrases componentsJoinedByString:@" AND "];
+}
+
++ (NSString *)_querySegmentForFullTextQuery:(NSString *)aQuery
+{
+    return [NSString stringWithFormat:@"ROWID IN (SELECT rowid FROM %@ WHERE %@ MATCH '%@')", NSFFullTextValues, NSFFullTextValues, aQuery];
+}
+
+- (id)_nanoObjectWithArchive:(NSData *)anArchive key:(NSString *)aKey className:(NSString *)aClassName
+{
+    if (NO == [anArchive isKindOfClass:[NSData class]]) {
+        return nil;
+    }
+    
+    // Partial objects are never shared
+    BOOL returnsWholeObjects = (0 == _attributesToBeReturned.count) && (NO == _ignoresIdentityMap);
+    if (returnsWholeObjects) {
+        id liveObject = [_nanoStore _liveObjectForKey:aKey];
+        if (nil != liveObject) {
+            return liveObject;
+        }
+    }
+    
+    NSDictionary *info = [_nanoStore _cachedInfoForKey:aKey];
+    if (nil == info) {
+        info = [NSKeyedUnarchiver unarchiveObjectWithData:anArchive];
+        if (nil == info) {
+            return nil;
+        }
+        [_nanoStore _cacheInfo:info forKey:aKey cost:[anArchive length]];
+    }
+    
+    info = [self _subsetOfInfo:info];
+    
+    Class storedObjectClass = NSClassFromString(aClassName);
+    BOOL saveOriginalClassReference = NO;
+    if (nil == storedObjectClass) {
+        storedObjectClass = [NSFNanoObject class];
+        saveOriginalClassReference = YES;
+    }
+    
+    id nanoObject = [[storedObjectClass alloc]initNanoObjectFromDictionaryRepresentation:info forKey:aKey store:_nanoStore];
+    
+    // If this process does not have knowledge of the original class as was saved in the store, keep a reference
+    // so that we can later on restore the object properly (otherwise it would be stored as a NanoObject.)
+    if (saveOriginalClassReference) {
+        [nanoObject _setOriginalClassString:aClassName];
+    }
+    
+    if (returnsWholeObjects && (nil != nanoObject)) {
+        [_nanoStore _registerLiveObject:nanoObject];
+    }
+    
+    return nanoObject;
+}
+
+- (BOOL)_exportSQL:(NSString *)theSQLStatement format:(NSFExportFormat)theFormat toFileDescriptor:(int)theFileDescriptor syncInterval:(NSUInteger)theRowCount decodesArchives:(BOOL)decodesArchives error:(NSError * __autoreleasing *)outError
+{
+    if ((NSFExportCSV != theFormat) && (NSFExportJSONLines != theFormat)) {
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: unknown export format: %u.", [self class], NSStringFromSelector(_cmd), theFormat]
+                               userInfo:nil]raise];
+    }
+    
+    if ([_nanoStore isClosed]) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: the document store is closed.", [self class], NSStringFromSelector(_cmd)]}];
+        return NO;
+    }
+    
+    _NSFLog(@"_exportSQL SQL query: %@", theSQLStatement);
+    
+    NSFNanoEngine *engine = _nanoStore.nanoStoreEngine;
+    sqlite3 *sqliteStore = [engine NSFP_checkOutReadConnection];
+    sqlite3_stmt *theSQLiteStatement = NULL;
+    
+    int status = sqlite3_prepare_v2 (sqliteStore, theSQLStatement.UTF8String, -1, &theSQLiteStatement, NULL);
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    
+    if (SQLITE_OK != status) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: %s", [self class], NSStringFromSelector(_cmd), sqlite3_errmsg(sqliteStore)]}];
+        sqlite3_finalize (theSQLiteStatement);
+        [engine NSFP_checkInReadConnection:sqliteStore];
+        return NO;
+    }
+    
+    [self _bindBagToStatement:theSQLiteStatement];
+    
+    int numColumns = sqlite3_column_count (theSQLiteStatement);
+    NSMutableData *buffer = [[NSMutableData alloc]initWithCapacity:NSF_Private_ExportBufferSize];
+    NSMutableArray *columnNames = [[NSMutableArray alloc]initWithCapacity:numColumns];
+    
+    for (int i = 0; i < numColumns; i++) {
+        const char *columnName = sqlite3_column_name (theSQLiteStatement, i);
+        [columnNames addObject:[NSData dataWithBytes:columnName length:strlen (columnName)]];
+    }
+    
+    // The archive column is only decoded when we're exporting objects
+    int archiveColumn = -1;
+    if (decodesArchives) {
+        archiveColumn = numColumns - 1;
+    }
+    
+    // CSV starts with a header row
+    if (NSFExportCSV == theFormat) {
+        for (int i = 0; i < numColumns; i++) {
+            if (i > 0) {
+                [buffer appendBytes:"," length:1];
+            }
+            NSData *columnName = columnNames[i];
+            [NSFNanoSearch _appendCSVField:columnName.bytes length:columnName.length toBuffer:buffer];
+        }
+        [buffer appendBytes:"\r\n" length:2];
+    }
+    
+    BOOL success = YES;
+    int writeError = 0;
+    NSUInteger rowsSinceSync = 0;
+    
+    while (success) {
+        status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (theSQLiteStatement)];
+        if (SQLITE_ROW != status) {
+            success = (SQLITE_DONE == status);
+            break;
+        }
+        
+        @autoreleasepool {
+            if (NSFExportJSONLines == theFormat) {
+                [buffer appendBytes:"{" length:1];
+            }
+            
+            for (int i = 0; i < numColumns; i++) {
+                if (NSFExportJSONLines == theFormat) {
+                    if (i > 0) {
+                        [buffer appendBytes:"," length:1];
+                    }
+                    NSData *columnName = columnNames[i];
+                    [NSFNanoSearch _appendJSONString:columnName.bytes length:columnName.length toBuffer:buffer];
+                    [buffer appendBytes:":" length:1];
+                } else if (i > 0) {
+                    [buffer appendBytes:"," length:1];
+                }
+                
+                if (i == archiveColumn) {
+                    [self _appendArchiveForColumn:i statement:theSQLiteStatement format:theFormat toBuffer:buffer];
+                } else {
+                    [NSFNanoSearch _appendValueForColumn:i statement:theSQLiteStatement format:theFormat toBuffer:buffer];
+                }
+            }
+            
+            if (NSFExportJSONLines == theFormat) {
+                [buffer appendBytes:"}\n" length:2];
+            } else {
+                [buffer appendBytes:"\r\n" length:2];
+            }
+        }
+        
+        rowsSinceSync++;
+        BOOL syncsNow = (theRowCount > 0) && (rowsSinceSync >= theRowCount);
+        
+        if (syncsNow || (buffer.length >= (NSUInteger)NSF_Private_ExportBufferSize)) {
+            if (NO == [NSFNanoSearch _writeBuffer:buffer toFileDescriptor:theFileDescriptor]) {
+                writeError = errno;
+                success = NO;
+            } else if (syncsNow) {
+                if (0 != fsync (theFileDescriptor)) {
+                    writeError = errno;
+                    success = NO;
+                }
+                rowsSinceSync = 0;
+            }
+        }
+    }
+    
+    // Flush whatever is left, along with the header of an empty CSV export
+    if (success && (buffer.length > 0)) {
+        if (NO == [NSFNanoSearch _writeBuffer:buffer toFileDescriptor:theFileDescriptor]) {
+            writeError = errno;
+            success = NO;
+        }
+    }
+    
+    if (success && (theRowCount > 0) && (rowsSinceSync > 0)) {
+        if (0 != fsync (theFileDescriptor)) {
+            writeError = errno;
+            success = NO;
+        }
+    }
+    
+    if ((NO == success) && (nil != outError)) {
+        NSString *reason = (0 != writeError) ? @(strerror (writeError)) : @(sqlite3_errmsg (sqliteStore));
+        *outError = [NSError errorWithDomain:NSFDomainKey
+                                        code:NSFNanoStoreErrorKey
+                                    userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: %@", [self class], NSStringFromSelector(_cmd), reason]}];
+    }
+    
+    sqlite3_finalize (theSQLiteStatement);
+    [engine NSFP_checkInReadConnection:sqliteStore];
+    
+    return success;
+}
+
+- (void)_appendArchiveForColumn:(int)aColumn statement:(sqlite3_stmt *)aStatement format:(NSFExportFormat)aFormat toBuffer:(NSMutableData *)aBuffer
+{
+    NSData *archive = [NSData dataWithBytesNoCopy:(void *)sqlite3_column_blob (aStatement, aColumn) length:sqlite3_column_bytes (aStatement, aColumn) freeWhenDone:NO];
+    NSDictionary *info = (archive.length > 0) ? [NSKeyedUnarchiver unarchiveObjectWithData:archive] : nil;
+    NSData *JSONData = nil;
+    
+    if ([info isKindOfClass:[NSDictionary class]]) {
+        info = [NSFNanoObject _safeDictionaryFromDictionary:[self _subsetOfInfo:info]];
+        JSONData = [NSJSONSerialization dataWithJSONObject:info options:0 error:nil];
+    }
+    
+    if (NSFExportJSONLines == aFormat) {
+        if (nil == JSONData) {
+            [aBuffer appendBytes:"null" length:4];
+        } else {
+            [aBuffer appendData:JSONData];
+        }
+    } else if (nil != JSONData) {
+        [NSFNanoSearch _appendCSVField:JSONData.bytes length:JSONData.length toBuffer:aBuffer];
+    }
+}
+
++ (void)_appendValueForColumn:(int)aColumn statement:(sqlite3_stmt *)aStatement format:(NSFExportFormat)aFormat toBuffer:(NSMutableData *)aBuffer
+{
+    char number[32];
+    
+    switch (sqlite3_column_type (aStatement, aColumn)) {
+        case SQLITE_INTEGER:
+            snprintf (number, sizeof (number), "%lld", sqlite3_column_int64 (aStatement, aColumn));
+            [aBuffer appendBytes:number length:strlen (number)];
+            break;
+        case SQLITE_FLOAT: {
+            double value = sqlite3_column_double (aStatement, aColumn);
+            if (isfinite (value)) {
+                snprintf (number, sizeof (number), "%.17g", value);
+                [aBuffer appendBytes:number length:strlen (number)];
+            } else if (NSFExportJSONLines == aFormat) {
+                // JSON has no representation for infinities or NaN
+                [aBuffer appendBytes:"null" length:4];
+            }
+            break;
+        }
+        case SQLITE_TEXT: {
+            const char *text = (const char *)sqlite3_column_text (aStatement, aColumn);
+            NSUInteger length = sqlite3_column_bytes (aStatement, aColumn);
+            if (NSFExportJSONLines == aFormat) {
+                [NSFNanoSearch _appendJSONString:text length:length toBuffer:aBuffer];
+            } else {
+                [NSFNanoSearch _appendCSVField:text length:length toBuffer:aBuffer];
+            }
+            break;
+        }
+        case SQLITE_BLOB: {
+            NSData *blob = [NSData dataWithBytesNoCopy:(void *)sqlite3_column_blob (aStatement, aColumn) length:sqlite3_column_bytes (aStatement, aColumn) freeWhenDone:NO];
+            NSData *encodedBlob = [blob base64EncodedDataWithOptions:0];
+            if (NSFExportJSONLines == aFormat) {
+                [aBuffer appendBytes:"\"" length:1];
+                [aBuffer appendData:encodedBlob];
+                [aBuffer appendBytes:"\"" length:1];
+            } else {
+                [aBuffer appendData:encodedBlob];
+            }
+            break;
+        }
+        default:
+            // NULL is an empty CSV field
+            if (NSFExportJSONLines == aFormat) {
+                [aBuffer appendBytes:"null" length:4];
+            }
+            break;
+    }
+}
+
++ (void)_appendCSVField:(const char *)someBytes length:(NSUInteger)aLength toBuffer:(NSMutableData *)aBuffer
+{
+    BOOL needsQuotes = NO;
+    for (NSUInteger i = 0; i < aLength; i++) {
+        char c = someBytes[i];
+        if ((',' == c) || ('"' == c) || ('\n' == c) || ('\r' == c)) {
+            needsQuotes = YES;
+            break;
+        }
+    }
+    
+    if (NO == needsQuotes) {
+        [aBuffer appendBytes:someBytes length:aLength];
+        return;
+    }
+    
+    // Quotes are escaped by doubling them (RFC 4180)
+    [aBuffer appendBytes:"\"" length:1];
+    NSUInteger runStart = 0;
+    for (NSUInteger i = 0; i < aLength; i++) {
+        if ('"' == someBytes[i]) {
+            [aBuffer appendBytes:someBytes + runStart length:i - runStart + 1];
+            [aBuffer appendBytes:"\"" length:1];
+            runStart = i + 1;
+        }
+    }
+    [aBuffer appendBytes:someBytes + runStart length:aLength - runStart];
+    [aBuffer appendBytes:"\"" length:1];
+}
+
++ (void)_appendJSONString:(const char *)someBytes length:(NSUInteger)aLength toBuffer:(NSMutableData *)aBuffer
+{
+    [aBuffer appendBytes:"\"" length:1];
+    
+    NSUInteger runStart = 0;
+    for (NSUInteger i = 0; i < aLength; i++) {
+        unsigned char c = (unsigned char)someBytes[i];
+        if (('"' != c) && ('\\' != c) && (c >= 0x20)) {
+            continue;
+        }
+        
+        [aBuffer appendBytes:someBytes + runStart length:i - runStart];
+        runStart = i + 1;
+        
+        char escape[8];
+        switch (c) {
+            case '"':  [aBuffer appendBytes:"\\\"" length:2]; break;
+            case '\\': [aBuffer appendBytes:"\\\\" length:2]; break;
+            case '\n': [aBuffer appendBytes:"\\n" length:2]; break;
+            case '\r': [aBuffer appendBytes:"\\r" length:2]; break;
+            case '\t': [aBuffer appendBytes:"\\t" length:2]; break;
+            default:
+                snprintf (escape, sizeof (escape), "\\u%04x", c);
+                [aBuffer appendBytes:escape length:6];
+                break;
+        }
+    }
+    [aBuffer appendBytes:someBytes + runStart length:aLength - runStart];
+    
+    [aBuffer appendBytes:"\"" length:1];
+}
+
++ (BOOL)_writeBuffer:(NSMutableData *)aBuffer toFileDescriptor:(int)aFileDescriptor
+{
+    const char *bytes = aBuffer.bytes;
+    NSUInteger remaining = aBuffer.length;
+    
+    while (remaining > 0) {
+        ssize_t written = write (aFileDescriptor, bytes, remaining);
+        if (written < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return NO;
+        }
+        bytes += written;
+        remaining -= written;
+    }
+    
+    aBuffer.length = 0;
+    
+    return YES;
 }
 
-+ (NSString *)_quoteStrings:(NSArray *)strings joiningWithDelimiter:(NSString *)delimiter
+- (NSDictionary *)_subsetOfInfo:(NSDictionary *)anInfo
 {
-    NSMutableArray *quotedParameters = [[NSMutableArray alloc]initWithCapacity:strings.count];
-    for (NSString *string in strings) {
-        NSString *quotedParameter = [[NSString alloc]initWithFormat:@"\"%@\"", string];
-        [quotedParameters addObject:quotedParameter];
+    if (0 == _attributesToBeReturned.count) {
+        return anInfo;
+    }
+    
+    // Since we want a subset of the attributes, we need to traverse
+    // the attribute list and find out whether the dictionary contains
+    // the specified attributes. If so, add them to a subset which will
+    // be returned as requested.
+    
+    NSMutableDictionary *subset = [NSMutableDictionary new];
+    
+    for (NSString *attributeValue in _attributesToBeReturned) {
+        id theValue = [anInfo valueForKeyPath:attributeValue];
+        if (nil != theValue) {
+            if (NSNotFound == [attributeValue rangeOfString:@"."].location) {
+                [subset setValue:theValue forKeyPath:attributeValue];
+            } else {
+                NSDictionary *subInfo = [self _dictionaryForKeyPath:attributeValue value:theValue];
+                if (subInfo.count > 0) {
+                    NSString *subInfoKey = subInfo.allKeys[0];
+                    NSString *subInfoValue = subInfo[subInfoKey];
+                    [subset setValue:subInfoValue forKey:subInfoKey];
+                }
+            }
+        }
     }
     
-    NSString *quotedString = [quotedParameters componentsJoinedByString:@","];
+    return subset;
+}
+
+- (NSFNanoObjectFaultGroup *)_faultGroupForCacheMethod
+{
+    NSFCacheMethod cacheMethod = _nanoStore.nanoStoreEngine.cacheMethod;
+    
+    if ((CacheDataOnDemand != cacheMethod) && (DoNotCacheData != cacheMethod)) {
+        return nil;
+    }
     
+    // The faults load through a search of their own, so changing this one later doesn't affect them
+    // The objects it builds only hand their data over to the faults, so they must not stand in for them in the identity map
+    NSFNanoSearch *loader = [NSFNanoSearch searchWithStore:_nanoStore];
+    loader.attributesToBeReturned = [_attributesToBeReturned copy];
+    loader.ignoresIdentityMap = YES;
     
-    return quotedString;
+    return [[NSFNanoObjectFaultGroup alloc]initWithSearch:loader dropsLoadedData:(DoNotCacheData == cacheMethod)];
+}
+
++ (NSString *)_archiveColumnForFaultingWithPrefix:(NSString *)aPrefix
+{
+    // Only plain NanoObjects can be faulted: other classes are instantiated from their data, so they keep it
+    return [NSString stringWithFormat:@"CASE WHEN %@NSFObjectClass = '%@' THEN NULL ELSE %@NSFKeyedArchive END", aPrefix, NSStringFromClass([NSFNanoObject class]), aPrefix];
+}
+
+- (id)_nanoObjectFaultWithKey:(NSString *)aKey faultGroup:(NSFNanoObjectFaultGroup *)aFaultGroup
+{
+    if (0 == _attributesToBeReturned.count) {
+        id liveObject = [_nanoStore _liveObjectForKey:aKey];
+        if (nil != liveObject) {
+            return liveObject;
+        }
+    }
+    
+    NSFNanoObject *fault = [[NSFNanoObject alloc]initNanoObjectFromDictionaryRepresentation:nil forKey:aKey store:_nanoStore];
+    [fault _setFaultGroup:aFaultGroup];
+    
+    if (0 == _attributesToBeReturned.count) {
+        [_nanoStore _registerLiveObject:fault];
+    }
+    
+    return fault;
+}
+
+- (void)_hydrateObjectsConcurrentlyFromStatement:(sqlite3_stmt *)aStatement intoResults:(NSMutableDictionary *)someResults
+{
+    // The stepping thread only copies the raw columns into batches. Decoding the archives and instantiating
+    // the objects, which is where the time goes, happens on a pool of workers.
+    static const NSUInteger batchSize = 256;
+    
+    dispatch_queue_t queue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+    dispatch_group_t group = dispatch_group_create();
+    
+    // Bound the batches in flight to the requested concurrency so the rows are not copied faster than they can be decoded
+    dispatch_semaphore_t slots = dispatch_semaphore_create(_hydrationConcurrency);
+    
+    NSString *nanoObjectClassName = NSStringFromClass([NSFNanoObject class]);
+    NSMutableArray *batchResults = [NSMutableArray new];
+    NSMutableArray *keys = [[NSMutableArray alloc]initWithCapacity:batchSize];
+    NSMutableArray *archives = [[NSMutableArray alloc]initWithCapacity:batchSize];
+    NSMutableArray *classNames = [[NSMutableArray alloc]initWithCapacity:batchSize];
+    BOOL hasMoreRows = YES;
+    
+    while (hasMoreRows) {
+        @autoreleasepool {
+            hasMoreRows = (SQLITE_ROW == sqlite3_step (aStatement));
+            
+            if (hasMoreRows) {
+                char *keyUTF8 = (char *)sqlite3_column_text (aStatement, 0);
+                char *objectClassUTF8 = (char *)sqlite3_column_text (aStatement, 2);
+                
+                if ((NULL == keyUTF8) || (NULL == objectClassUTF8)) {
+                    NSLog(@"*** Warning! These values are NanoStore's resposibility and should *never* be NULL: keyUTF8 (%s) - objectClassUTF8 (%s)", keyUTF8, objectClassUTF8);
+                    continue;
+                }
+                
+                NSString *key = @(keyUTF8);
+                NSData *archive = [[NSData alloc]initWithBytes:sqlite3_column_blob(aStatement, 1) length:sqlite3_column_bytes(aStatement, 1)];
+                NSString *className = @(objectClassUTF8);
+                
+                if ([className isEqualToString:nanoObjectClassName]) {
+                    [keys addObject:key];
+                    [archives addObject:archive];
+                    [classNames addObject:className];
+                } else {
+                    // Other classes, such as bags or subclasses, may run searches while they are initialized. Those need the
+                    // reader this thread holds, which a worker waiting for a reader of its own would never get.
+                    id nanoObject = [self _nanoObjectWithArchive:archive key:key className:className];
+                    if (nil != nanoObject) {
+                        someResults[key] = nanoObject;
+                    }
+                }
+            }
+            
+            if ((keys.count == batchSize) || ((NO == hasMoreRows) && (keys.count > 0))) {
+                NSMutableArray *objects = [[NSMutableArray alloc]initWithCapacity:keys.count];
+                [batchResults addObject:@[keys, objects]];
+                
+                NSArray *batchArchives = archives;
+                NSArray *batchKeys = keys;
+                NSArray *batchClassNames = classNames;
+                
+                dispatch_semaphore_wait(slots, DISPATCH_TIME_FOREVER);
+                dispatch_group_async(group, queue, ^{
+                    @autoreleasepool {
+                        for (NSUInteger i = 0; i < batchKeys.count; i++) {
+                            id nanoObject = [self _nanoObjectWithArchive:batchArchives[i] key:batchKeys[i] className:batchClassNames[i]];
+                            [objects addObject:(nil == nanoObject) ? [NSNull null] : nanoObject];
+                        }
+                    }
+                    dispatch_semaphore_signal(slots);
+                });
+                
+                keys = [[NSMutableArray alloc]initWithCapacity:batchSize];
+                archives = [[NSMutableArray alloc]initWithCapacity:batchSize];
+                classNames = [[NSMutableArray alloc]initWithCapacity:batchSize];
+            }
+        }
+    }
+    
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    
+    // Merge the batches in the order the rows were read
+    for (NSArray *batch in batchResults) {
+        NSArray *batchKeys = batch[0];
+        NSArray *objects = batch[1];
+        for (NSUInteger i = 0; i < batchKeys.count; i++) {
+            if (objects[i] != [NSNull null]) {
+                someResults[batchKeys[i]] = objects[i];
+            }
+        }
+    }
+}
+
++ (NSString *)_continuationTokenWithValue:(id)aValue key:(NSString *)aKey fingerprint:(NSString *)aFingerprint
+{
+    NSMutableDictionary *token = [NSMutableDictionary new];
+    token[@"k"] = aKey;
+    token[@"q"] = aFingerprint;
+    
+    // JSON can't carry blobs, so flag them and carry their base64 representation instead
+    if ([aValue isKindOfClass:[NSData class]]) {
+        token[@"v"] = [aValue base64EncodedStringWithOptions:0];
+        token[@"b"] = @YES;
+    } else {
+        token[@"v"] = (nil == aValue) ? [NSNull null] : aValue;
+    }
+    
+    NSData *data = [NSJSONSerialization dataWithJSONObject:token options:0 error:nil];
+    
+    return [data base64EncodedStringWithOptions:0];
+}
+
++ (NSString *)_digestOfString:(NSString *)aString
+{
+    // Unlike -hash, the digest is the same in every process and on every OS version, so tokens survive a relaunch
+    NSData *data = [aString dataUsingEncoding:NSUTF8StringEncoding];
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256 (data.bytes, (CC_LONG)data.length, digest);
+    
+    NSMutableString *hexDigest = [[NSMutableString alloc]initWithCapacity:CC_SHA256_DIGEST_LENGTH * 2];
+    for (NSUInteger i = 0; i < CC_SHA256_DIGEST_LENGTH; i++) {
+        [hexDigest appendFormat:@"%02x", digest[i]];
+    }
+    
+    return hexDigest;
+}
+
++ (NSDictionary *)_dictionaryFromContinuationToken:(NSString *)aToken
+{
+    NSData *data = [[NSData alloc]initWithBase64EncodedString:aToken options:0];
+    if (nil == data) {
+        return nil;
+    }
+    
+    NSMutableDictionary *token = [[NSJSONSerialization JSONObjectWithData:data options:NSJSONReadingMutableContainers error:nil]mutableCopy];
+    if ((NO == [token isKindOfClass:[NSDictionary class]]) || (NO == [token[@"k"] isKindOfClass:[NSString class]]) || (NO == [token[@"q"] isKindOfClass:[NSString class]])) {
+        return nil;
+    }
+    
+    if ([token[@"b"] boolValue]) {
+        token[@"v"] = [[NSData alloc]initWithBase64EncodedString:token[@"v"] options:0];
+    }
+    
+    return token;
+}
+
++ (void)_bindObject:(id)anObject toParameter:(int)aParameter statement:(sqlite3_stmt *)aStatement
+{
+    // Bind with the type the value was read with, so the seek compares like with like
+    if ([anObject isKindOfClass:[NSString class]]) {
+        sqlite3_bind_text (aStatement, aParameter, [anObject UTF8String], -1, SQLITE_TRANSIENT);
+    } else if ([anObject isKindOfClass:[NSData class]]) {
+        sqlite3_bind_blob (aStatement, aParameter, [anObject bytes], (int)[anObject length], SQLITE_TRANSIENT);
+    } else if ([anObject isKindOfClass:[NSNumber class]]) {
+        if (CFNumberIsFloatType((__bridge CFNumberRef)anObject)) {
+            sqlite3_bind_double (aStatement, aParameter, [anObject doubleValue]);
+        } else {
+            sqlite3_bind_int64 (aStatement, aParameter, [anObject longLongValue]);
+        }
+    } else {
+        sqlite3_bind_null (aStatement, aParameter);
+    }
+}
+
+- (NSString *)_keysSQLHonoringBag
+{
+    return [self _preparedSQLWithReturnType:NSFReturnKeys];
+}
+
++ (NSString *)_querySegmentForBagMembers
+{
+    // The (NSFBagKey, NSFKey) index covers the lookup, so the semi-join never reads the values of the bag's objects
+    return [NSString stringWithFormat:@"%@ IN (SELECT %@ FROM %@ WHERE %@ = :%@)", NSFKey, NSFKey, NSFBagMembers, NSFBagKey, NSFBagKey];
+}
+
+- (void)_bindBagToStatement:(sqlite3_stmt *)aStatement
+{
+    // Statements that don't scope to the bag have no such parameter
+    int parameter = sqlite3_bind_parameter_index (aStatement, [[NSString stringWithFormat:@":%@", NSFBagKey]UTF8String]);
+    if (parameter > 0) {
+        if (nil != _bag.key) {
+            sqlite3_bind_text (aStatement, parameter, _bag.key.UTF8String, -1, SQLITE_TRANSIENT);
+        } else {
+            sqlite3_bind_null (aStatement, parameter);
+        }
+    }
+}
+
++ (NSFQueryPlanWarning)_warningsForQueryPlanDetail:(NSString *)aDetail
+{
+    NSFQueryPlanWarning warnings = NSFQueryPlanNoWarning;
+    
+    // Older versions of SQLite say "SCAN TABLE NSFValues", newer ones "SCAN NSFValues". Either way,
+    // a scan without USING reads every row.
+    if ([aDetail hasPrefix:@"SCAN"] && (NSNotFound != [aDetail rangeOfString:NSFValues options:NSCaseInsensitiveSearch].location) && (NSNotFound == [aDetail rangeOfString:@" USING "].location)) {
+        warnings |= NSFQueryPlanFullScanOfValues;
+    }
+    
+    if (NSNotFound != [aDetail rangeOfString:@"TEMP B-TREE"].location) {
+        warnings |= NSFQueryPlanTemporaryBTree;
+    }
+    
+    if (NSNotFound != [aDetail rangeOfString:@"CORRELATED"].location) {
+        warnings |= NSFQueryPlanCorrelatedSubquery;
+    }
+    
+    return warnings;
+}
+
+- (void)_recordSearchShape
+{
+    if (NO == _nanoStore.recordsSearchShapes) {
+        return;
+    }
+    
+    if ((nil != _attribute) && (nil != _value) && (nil == _expressions)) {
+        [_nanoStore _recordSearchOnAttribute:_attribute matching:_match];
+    }
+    
+    // Expressions pair an attribute predicate with the value predicate it applies to
+    NSMutableArray *leafExpressions = [NSMutableArray new];
+    for (NSFNanoExpression *expression in _expressions) {
+        [leafExpressions addObjectsFromArray:[expression _leafExpressions]];
+    }
+    
+    for (NSFNanoExpression *expression in leafExpressions) {
+        NSString *attribute = nil;
+        NSFNanoPredicate *valuePredicate = nil;
+        
+        for (NSFNanoPredicate *predicate in expression.predicates) {
+            if ((NSFAttributeColumn == predicate.column) && (NSFEqualTo == predicate.match)) {
+                attribute = predicate.value;
+            } else if (NSFValueColumn == predicate.column) {
+                valuePredicate = predicate;
+            }
+        }
+        
+        if ((nil != attribute) && (nil != valuePredicate)) {
+            [_nanoStore _recordSearchOnAttribute:attribute matching:valuePredicate.match];
+        }
+    }
+    
+    // Sorting reads the values of the attribute in order, which an attribute index provides
+    for (NSFNanoSortDescriptor *sortDescriptor in _sort) {
+        [_nanoStore _recordSearchOnAttribute:sortDescriptor.attribute matching:NSFEqualTo];
+    }
+}
+
+- (NSString *)_batchShape
+{
+    NSString *theSQLStatement = [self _preparedSQL];
+    
+    // The SQL doesn't cover how the objects are decoded and sorted
+    NSMutableArray *sortShape = [NSMutableArray new];
+    for (NSFNanoSortDescriptor *sortDescriptor in _sort) {
+        [sortShape addObject:[NSString stringWithFormat:@"%@ %@", sortDescriptor.attribute, sortDescriptor.isAscending ? @"ASC" : @"DESC"]];
+    }
+    
+    return [NSString stringWithFormat:@"%u\n%@\n%@\n%@\n%@", _returnedObjectType, theSQLStatement, (_bag.key ? _bag.key : @""), [_attributesToBeReturned componentsJoinedByString:@","], [sortShape componentsJoinedByString:@","]];
+}
+
+- (long long)_int64ForSQL:(NSString *)theSQLStatement error:(NSError * __autoreleasing *)outError
+{
+    if ([_nanoStore isClosed]) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: the document store is closed.", [self class], NSStringFromSelector(_cmd)]}];
+        return -1;
+    }
+    
+    _NSFLog(@"_int64ForSQL SQL query: %@", theSQLStatement);
+    
+    NSFNanoEngine *engine = _nanoStore.nanoStoreEngine;
+    sqlite3 *sqliteStore = [engine NSFP_checkOutReadConnection];
+    sqlite3_stmt *theSQLiteStatement = NULL;
+    long long value = -1;
+    
+    int status = sqlite3_prepare_v2 (sqliteStore, theSQLStatement.UTF8String, -1, &theSQLiteStatement, NULL);
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    
+    if (SQLITE_OK == status) {
+        [self _bindBagToStatement:theSQLiteStatement];
+        status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (theSQLiteStatement)];
+        if (SQLITE_ROW == status) {
+            value = sqlite3_column_int64 (theSQLiteStatement, 0);
+        }
+    }
+    
+    if ((-1 == value) && (nil != outError)) {
+        *outError = [NSError errorWithDomain:NSFDomainKey
+                                        code:NSFNanoStoreErrorKey
+                                    userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: %s", [self class], NSStringFromSelector(_cmd), sqlite3_errmsg(sqliteStore)]}];
+    }
+    
+    sqlite3_finalize (theSQLiteStatement);
+    [engine NSFP_checkInReadConnection:sqliteStore];
+    
+    return value;
+}
+
+- (BOOL)_enumerateRowsForSQL:(NSString *)theSQLStatement error:(NSError * __autoreleasing *)outError usingBlock:(void (^)(NSString *aKey, NSData *anArchive, NSString *aClassName))theBlock
+{
+    _NSFLog(@"_enumerateRowsForSQL SQL query: %@", theSQLStatement);
+    
+    NSFNanoEngine *engine = _nanoStore.nanoStoreEngine;
+    sqlite3 *sqliteStore = [engine NSFP_checkOutReadConnection];
+    sqlite3_stmt *theSQLiteStatement = NULL;
+    
+    int status = sqlite3_prepare_v2 (sqliteStore, theSQLStatement.UTF8String, -1, &theSQLiteStatement, NULL);
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    
+    if (SQLITE_OK == status) {
+        [self _bindBagToStatement:theSQLiteStatement];
+        
+        // The statement selects the key, the archive and the class of the objects, in that order
+        while (SQLITE_ROW == (status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (theSQLiteStatement)])) {
+            @autoreleasepool {
+                char *keyUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 0);
+                char *objectClassUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 2);
+                if ((NULL == keyUTF8) || (NULL == objectClassUTF8)) {
+                    continue;
+                }
+                
+                NSData *archive = [[NSData alloc]initWithBytes:sqlite3_column_blob (theSQLiteStatement, 1) length:sqlite3_column_bytes (theSQLiteStatement, 1)];
+                theBlock(@(keyUTF8), archive, @(objectClassUTF8));
+            }
+        }
+    }
+    
+    BOOL success = (SQLITE_DONE == status);
+    if ((NO == success) && (nil != outError)) {
+        *outError = [NSError errorWithDomain:NSFDomainKey
+                                        code:NSFNanoStoreErrorKey
+                                    userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: %s", [self class], NSStringFromSelector(_cmd), sqlite3_errmsg(sqliteStore)]}];
+    }
+    
+    sqlite3_finalize (theSQLiteStatement);
+    [engine NSFP_checkInReadConnection:sqliteStore];
+    
+    return success;
+}
+
++ (NSString *)_aggregateColumnForFunctionType:(NSFAggregateFunctionType)theFunctionType
+{
+    switch (theFunctionType) {
+        case NSFAverage:
+            return @"avg(v.NSFValue)";
+        case NSFCount:
+            return @"count(*)";
+        case NSFMax:
+            return @"max(v.NSFValue)";
+        case NSFMin:
+            return @"min(v.NSFValue)";
+        case NSFTotal:
+            /* Note:
+             Sum() will throw an "integer overflow" exception if all inputs are integers or NULL and an integer overflow occurs at any point
+             during the computation. Total() never throws an integer overflow.
+             */
+            return @"total(v.NSFValue)";
+    }
+    
+    return nil;
+}
+
++ (id)_objectForColumn:(int)aColumn statement:(sqlite3_stmt *)aStatement
+{
+    // Honor the type SQLite hands back instead of going through strings
+    switch (sqlite3_column_type (aStatement, aColumn)) {
+        case SQLITE_INTEGER:
+            return @(sqlite3_column_int64 (aStatement, aColumn));
+        case SQLITE_FLOAT:
+            return @(sqlite3_column_double (aStatement, aColumn));
+        case SQLITE_TEXT:
+            return @((const char *)sqlite3_column_text (aStatement, aColumn));
+        case SQLITE_BLOB:
+            return [NSData dataWithBytes:sqlite3_column_blob (aStatement, aColumn) length:sqlite3_column_bytes (aStatement, aColumn)];
+        default:
+            return [NSNull null];
+    }
+}
+
+- (NSSet *)_attributesBoundingResults
+{
+    NSMutableSet *attributes = nil;
+    
+    if (nil == _expressions) {
+        // Without a value, the match applies to the attribute itself
+        if ((nil != _attribute) && ((nil != _value) || (NSFEqualTo == _match))) {
+            attributes = [NSMutableSet setWithObject:_attribute];
+        }
+    } else {
+        // Expressions are intersected, so any one of them bound by attributes bounds the whole search
+        for (NSFNanoExpression *expression in _expressions) {
+            if ([expression.operators containsObject:@(NSFOr)]) {
+                continue;
+            }
+            
+            for (NSFNanoPredicate *predicate in expression.predicates) {
+                if ((NSFAttributeColumn == predicate.column) && (NSFEqualTo == predicate.match)) {
+                    attributes = [NSMutableSet setWithObject:predicate.value];
+                    break;
+                }
+            }
+            
+            if (nil != attributes) {
+                break;
+            }
+        }
+    }
+    
+    // Objects joining or leaving the bag change the results as well
+    if ((nil != attributes) && (nil != _bag)) {
+        [attributes addObject:NSF_Private_NSFNanoBag_NSFObjectKeys];
+    }
+    
+    return attributes;
+}
+
+- (BOOL)_shouldUseAttributeIndexForAttribute:(NSString *)anAttribute value:(id)aValue matching:(NSFMatchType)aMatch
+{
+    BOOL isComparableValue = [aValue isKindOfClass:[NSString class]] || [NSFNanoSearch _isTypedValue:aValue matching:aMatch];
+    if ((NO == isComparableValue) || (NSFNanoTypeUnknown == [_nanoStore typeOfIndexForAttribute:anAttribute])) {
+        return NO;
+    }
+    
+    // Undotted attributes match at any depth. Narrowing them down to the exact key path is only
+    // safe if no other key path carries the attribute.
+    if (NSNotFound == [anAttribute rangeOfString:@"."].location) {
+        return [_nanoStore _isOnlyKeyPathWithSegment:anAttribute];
+    }
+    
+    return YES;
+}
+
++ (NSString *)_querySegmentForIndexedValue:(id)aValue type:(NSFNanoDatatype)aType matching:(NSFMatchType)aMatch
+{
+    if ([NSFNanoSearch _isTypedValue:aValue matching:aMatch]) {
+        return [NSFNanoSearch _querySegmentForTypedValue:aValue column:NSFValue matching:aMatch];
+    }
+    
+    // Numbers are stored as REAL, which never compares equal to a quoted literal. Knowing the attribute
+    // holds numbers lets us compare numerically.
+    if (NSFNanoTypeNumber == aType) {
+        NSScanner *scanner = [NSScanner scannerWithString:aValue];
+        double number = 0;
+        if ([scanner scanDouble:&number] && scanner.isAtEnd) {
+            switch (aMatch) {
+                case NSFEqualTo:
+                    return [NSString stringWithFormat:@"%@ = %@", NSFValue, aValue];
+                case NSFNotEqualTo:
+                    return [NSString stringWithFormat:@"%@ <> %@", NSFValue, aValue];
+                case NSFGreaterThan:
+                    return [NSString stringWithFormat:@"%@ > %@", NSFValue, aValue];
+                case NSFLessThan:
+                    return [NSString stringWithFormat:@"%@ < %@", NSFValue, aValue];
+                default:
+                    break;
+            }
+        }
+    }
+    
+    return [NSFNanoSearch _querySegmentForColumn:NSFValue value:aValue matching:aMatch];
+}
+
++ (BOOL)_isTypedValue:(id)aValue matching:(NSFMatchType)aMatch
+{
+    // Ranges are validated when their segment is built
+    if (NSFBetween == aMatch) {
+        return YES;
+    }
+    
+    return [aValue isKindOfClass:[NSNumber class]] || [aValue isKindOfClass:[NSDate class]];
+}
+
++ (NSString *)_SQLLiteralForTypedValue:(id)aValue
+{
+    if ([aValue isKindOfClass:[NSNumber class]]) {
+        // Numbers are stored as REAL: render the same double, with all its digits
+        double number = [aValue doubleValue];
+        if (isnan (number)) {
+            return @"NULL";
+        } else if (isinf (number)) {
+            return (number > 0) ? @"9e999" : @"-9e999";
+        }
+        return [NSString stringWithFormat:@"%.17g", number];
+    } else if ([aValue isKindOfClass:[NSDate class]]) {
+        // Dates are stored in a sortable text format
+        return [NSString stringWithFormat:@"'%@'", [NSFNanoStore _calendarDateToString:aValue]];
+    }
+    
+    return [NSString stringWithFormat:@"'%@'", [[aValue description]stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+}
+
++ (NSString *)_querySegmentForTypedValue:(id)aValue column:(NSString *)aColumn matching:(NSFMatchType)aMatch
+{
+    id typedValue = aValue;
+    NSString *segment = nil;
+    
+    if (NSFBetween == aMatch) {
+        BOOL isRange = [aValue isKindOfClass:[NSArray class]] && (2 == [aValue count]);
+        if (isRange) {
+            id lowerBound = aValue[0];
+            id upperBound = aValue[1];
+            isRange = ([lowerBound isKindOfClass:[NSNumber class]] && [upperBound isKindOfClass:[NSNumber class]]) ||
+                      ([lowerBound isKindOfClass:[NSDate class]] && [upperBound isKindOfClass:[NSDate class]]) ||
+                      ([lowerBound isKindOfClass:[NSString class]] && [upperBound isKindOfClass:[NSString class]]);
+        }
+        
+        if (NO == isRange) {
+            [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                     reason:[NSString stringWithFormat:@"*** -[%@ %@]: NSFBetween expects an array holding a lower and an upper bound of the same type.", [self class], NSStringFromSelector(_cmd)]
+                                   userInfo:nil]raise];
+        }
+        
+        typedValue = aValue[0];
+        segment = [NSString stringWithFormat:@"%@ BETWEEN %@ AND %@", aColumn, [NSFNanoSearch _SQLLiteralForTypedValue:aValue[0]], [NSFNanoSearch _SQLLiteralForTypedValue:aValue[1]]];
+    } else {
+        NSString *operator = nil;
+        
+        switch (aMatch) {
+            case NSFEqualTo:
+                operator = @"=";
+                break;
+            case NSFNotEqualTo:
+                operator = @"<>";
+                break;
+            case NSFGreaterThan:
+                operator = @">";
+                break;
+            case NSFLessThan:
+                operator = @"<";
+                break;
+            default:
+                [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                         reason:[NSString stringWithFormat:@"*** -[%@ %@]: %@ can't be used to compare a value of type %@.", [self class], NSStringFromSelector(_cmd), NSFStringFromMatchType(aMatch), [aValue class]]
+                                       userInfo:nil]raise];
+                break;
+        }
+        
+        segment = [NSString stringWithFormat:@"%@ %@ %@", aColumn, operator, [NSFNanoSearch _SQLLiteralForTypedValue:aValue]];
+    }
+    
+    // Only look at the values stored with the same datatype, so numbers never compare against text
+    NSString *datatype = nil;
+    if ([typedValue isKindOfClass:[NSNumber class]]) {
+        datatype = NSFStringFromNanoDataType(NSFNanoTypeNumber);
+    } else if ([typedValue isKindOfClass:[NSDate class]]) {
+        datatype = NSFStringFromNanoDataType(NSFNanoTypeDate);
+    }
+    
+    if ((nil != datatype) && [aColumn isEqualToString:NSFValue]) {
+        segment = [NSString stringWithFormat:@"(%@ = '%@' AND %@)", NSFDatatype, datatype, segment];
+    }
+    
+    return segment;
+}
+
+- (BOOL)_shouldUseCaseFoldedValuesForAttribute:(NSString *)anAttribute value:(id)aValue matching:(NSFMatchType)aMatch
+{
+    if ((NSFInsensitiveEqualTo != aMatch) && (NSFInsensitiveBeginsWith != aMatch)) {
+        return NO;
+    }
+    
+    if ((NO == [aValue isKindOfClass:[NSString class]]) || (0 == [aValue length])) {
+        return NO;
+    }
+    
+    return [_nanoStore _isCaseFoldedKeyPath:anAttribute];
+}
+
++ (NSString *)_querySegmentForCaseFoldedValue:(NSString *)aValue matching:(NSFMatchType)aMatch
+{
+    // The value arrives escaped for SQL; fold the original text, not the escaped one
+    NSString *foldedValue = NSFCaseFoldedString([aValue stringByReplacingOccurrencesOfString:@"''" withString:@"'"]);
+    
+    if (NSFInsensitiveEqualTo == aMatch) {
+        return [NSString stringWithFormat:@"%@ = '%@'", NSFFoldedValue, [foldedValue stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+    }
+    
+    // A prefix match becomes a range scan: anything sorting between the prefix and the prefix
+    // followed by the highest code point starts with the prefix
+    NSString *upperBound = [foldedValue stringByAppendingString:@"\U0010FFFF"];
+    
+    return [NSString stringWithFormat:@"(%@ >= '%@' AND %@ < '%@')",
+            NSFFoldedValue, [foldedValue stringByReplacingOccurrencesOfString:@"'" withString:@"''"],
+            NSFFoldedValue, [upperBound stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+}
+
+- (NSDictionary *)_dictionaryForKeyPath:(NSString *)keyPath value:(id)theValue
+{
+    NSMutableDictionary *info = [NSMutableDictionary dictionary];
+    NSMutableArray *keys = [[keyPath componentsSeparatedByString:@"."]mutableCopy];
+    
+    if (keys.count == 1) {
+        info[keyPath] = theValue;
+        return info;
+    }
+    
+    NSInteger i;
+
+    for (i = 0; i < keys.count; i++) {
+        NSString *keyValue = keys[i];
+        [keys removeObjectAtIndex:0];
+        NSDictionary *subInfo = [self _dictionaryForKeyPath:[keys componentsJoinedByString:@"."] value:theValue];
+        if (nil != subInfo)
+            info[keyValue] = subInfo;
+    }
+    
+    return info;
 }
 
 - (id)_sortResultsIfApplicable:(NSDictionary *)results returnType:(NSFReturnType)theReturnType
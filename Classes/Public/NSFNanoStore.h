@@ -102,6 +102,34 @@
 @property (nonatomic, assign, readwrite) NSUInteger saveInterval;
 /** * Whether there are objects that haven't been saved to the store. */
 @property (nonatomic, readonly) BOOL hasUnsavedChanges;
+/** * Maximum number of rows kept in the search result cache. Zero, the default, disables the cache.
+ Searches run with \link NSFNanoSearch::searchObjectsWithReturnType:error: - (id)searchObjectsWithReturnType:(NSFReturnType)theReturnType error:(NSError * __autoreleasing *)outError \endlink
+ are cached by their SQL, return type and attributes to be returned. When the limit is reached, the least recently used results are evicted first.
+ @note Each search gets a dictionary of its own, but the objects in it are shared: an object returned by a cached search is the same instance every time
+ until the cache gets invalidated, so changes made to it are seen by the searches served from the cache afterwards.
+ @see \link resultCacheInvalidation resultCacheInvalidation \endlink
+ */
+@property (nonatomic, assign, readwrite) NSUInteger resultCacheCostLimit;
+/** * How the search result cache finds out that its contents went stale. Defaults to <i>NSFResultCacheInvalidateOnCommit</i>. See <i>NSFResultCacheInvalidation</i>. */
+@property (nonatomic, assign, readwrite) NSFResultCacheInvalidation resultCacheInvalidation;
+/** * Whether searches return the instance already in memory for a key instead of building a new one. Defaults to NO.
+ The identity map holds the objects weakly: an object is tracked from the moment a search returns it or it's saved, until nobody else retains it.
+ @note Searches returning a subset of the attributes always build new objects.
+ @see \link objectCacheCountLimit objectCacheCountLimit \endlink
+ */
+@property (nonatomic, assign, readwrite) BOOL usesIdentityMap;
+/** * Maximum number of decoded documents kept in the object cache. Zero, the default, disables the cache.
+ Building an object whose document is cached skips decoding its archive. When the limit is reached, the least recently used documents are evicted first.
+ @note Saving and removing objects evict their documents. Changes made with raw SQL are not tracked: call \link clearObjectCache - (void)clearObjectCache \endlink after them.
+ @see \link objectCacheStatistics objectCacheStatistics \endlink
+ */
+@property (nonatomic, assign, readwrite) NSUInteger objectCacheCountLimit;
+/** * Hit rate and memory use of the identity map and the object cache since the document store was created. See <i>NSFObjectCacheHitCountKey</i> and related keys. */
+@property (nonatomic, readonly, nonnull) NSDictionary *objectCacheStatistics;
+/** * Whether the attributes searched on are recorded for the index advisor. Defaults to NO.
+ @see \link indexRecommendations - (NSArray *)indexRecommendations \endlink
+ */
+@property (nonatomic, assign, readwrite) BOOL recordsSearchShapes;
 
 /** @name Creating and Initializing NanoStore
  */
@@ -245,6 +273,7 @@
  * @param theKeys the list of keys to be removed from the document store.
  * @param outError is used if an error occurs. May be NULL.
  * @return YES upon success, NO otherwise.
+ * @note The removed objects are taken out of the bags containing them. Removing a bag doesn't remove its objects.
  * @warning The objects of the array must be \link NSFNanoObjectProtocol::initNanoObjectFromDictionaryRepresentation:forKey:store: NSFNanoObjectProtocol\endlink-compliant.
  * @see \link removeObject:error: - (BOOL)removeObject:(id <NSFNanoObjectProtocol>)theObject error:(NSError * __autoreleasing *)outError \endlink
  * @see \link removeObjectsInArray:error: - (BOOL)removeObjectsInArray:(NSArray *)theObjects error:(NSError * __autoreleasing *)outError \endlink
@@ -286,6 +315,7 @@
 
 /** * Returns a new array containing the bags found in the document store.
  * @returns An array with the bags found in the document store.
+ * @note The bags are returned without their objects, which are fetched when first accessed. See \link NSFNanoBag::enumerateObjectsInPagesOfSize:usingBlock: - (void)enumerateObjectsInPagesOfSize:usingBlock: \endlink to go through large bags.
  * @see \link bagsWithKeysInArray: - (NSArray *)bagsWithKeysInArray:(NSArray *)theKeys \endlink
  * @see \link bagsContainingObjectWithKey: - (NSArray *)bagsContainingObjectWithKey:(NSString *)theKey \endlink
  */
@@ -309,7 +339,7 @@
 
 /** * Returns a new array containing the bags found in the document store matching the specified list of keys.
  * @param theKeys the list of bag keys.
- * @returns An array with the bags that match the specified list of keys.
+ * @returns An array with the bags that match the specified list of keys, in the order the keys were specified.
  * @see \link bags - (NSArray *)bags \endlink
  * @see \link bagsContainingObjectWithKey: - (NSArray *)bagsContainingObjectWithKey:(NSString *)theKey \endlink
  */
@@ -319,15 +349,27 @@
 /** * Returns a new array containing the bags found in the document store which contain the object specified by the key.
  * @param theKey the key of the object.
  * @returns An array with the bags that contain the object matching the specified key.
+ * @note The bags are returned without their objects, which are fetched when first accessed.
  * @see \link bags - (NSArray *)bags \endlink
  * @see \link bagsWithKeysInArray: - (NSArray *)bagsWithKeysInArray:(NSArray *)theKeys \endlink
+ * @see \link bagKeysContainingObjectWithKey: - (NSArray *)bagKeysContainingObjectWithKey:(NSString *)theKey \endlink
  */
 
 - (nonnull NSArray *)bagsContainingObjectWithKey:(nonnull NSString *)theKey;
 
+/** * Returns the keys of the bags which contain the object specified by the key.
+ * @param theKey the key of the object.
+ * @returns An array with the keys of the bags that contain the object matching the specified key, an empty array otherwise.
+ * @note The keys are looked up in the bag membership index, so the cost doesn't depend on the number of bags or objects in the store, and no bag is fetched.
+ * @see \link bagsContainingObjectWithKey: - (NSArray *)bagsContainingObjectWithKey:(NSString *)theKey \endlink
+ */
+
+- (nonnull NSArray *)bagKeysContainingObjectWithKey:(nonnull NSString *)theKey;
+
 /** * Returns a new array containing the objects found in the document store matching the specified list of keys.
  * @param theKeys the list of \link NSFNanoObjectProtocol::initNanoObjectFromDictionaryRepresentation:forKey:store: NSFNanoObjectProtocol\endlink-compliant object keys.
- * @returns An array with the objects matching the specified list of keys.
+ * @returns An array with the objects matching the specified list of keys, in the order the keys were specified. Keys not found in the store are skipped.
+ * @note The keys are bound in fixed-size batches, so very large key lists do not produce oversized SQL statements.
  * @note The keys can belong to any object class: NSFNanoObject, NSFNanoBag or any \link NSFNanoObjectProtocol::initNanoObjectFromDictionaryRepresentation:forKey:store: NSFNanoObjectProtocol\endlink-compliant object.
  */
 
@@ -416,6 +458,189 @@
 
 - (BOOL)rebuildIndexesAndReturnError:(NSError * _Nullable * _Nullable)outError;
 
+/** * Empties the search result cache.
+ * @note Only needed after modifying the document store with raw SQL while using <i>NSFResultCacheInvalidateByTouchedAttributes</i>.
+ * @see \link resultCacheCostLimit resultCacheCostLimit \endlink
+ */
+
+- (void)clearResultCache;
+
+/** * Empties the object cache and the identity map.
+ * @note Only needed after modifying the document store with raw SQL.
+ * @see \link objectCacheCountLimit objectCacheCountLimit \endlink
+ */
+
+- (void)clearObjectCache;
+
+/** * Declares a full-text index for a given attribute, or for all attributes.
+ * @param theAttribute is the attribute to be indexed. It matches at any depth of the key path, just like the search attribute does. An attribute containing a dot names a whole key path (e.g. address.city). If nil, all text values are indexed.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @note The text values already in the document store are indexed right away. From then on, the index is kept up to date as objects are added and removed.
+ * Searches using \link Globals::NSFContains NSFContains \endlink or \link Globals::NSFInsensitiveContains NSFInsensitiveContains \endlink on an indexed attribute
+ * use the index to narrow down the candidates and keep their usual semantics: NSFContains stays case-sensitive and both match any substring. The index is made of trigrams,
+ * so it is only used when the value holds at least three characters in a row. Only text values are indexed; dates are stored as text and get indexed as well.
+ * @attention Requires SQLite to have been built with FTS5 support.
+ * @see \link dropFullTextIndexForAttribute:error: - (BOOL)dropFullTextIndexForAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError \endlink
+ * @see \link NSFNanoSearch::searchObjectsMatchingFullTextQuery:returnType:error: - (NSArray *)searchObjectsMatchingFullTextQuery:(NSString *)theQuery returnType:(NSFReturnType)theReturnType error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (BOOL)createFullTextIndexForAttribute:(nullable NSString *)theAttribute error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Removes a full-text index declared with \link createFullTextIndexForAttribute:error: - (BOOL)createFullTextIndexForAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError \endlink.
+ * @param theAttribute is the attribute whose index should be removed. If nil, the index covering all attributes is removed.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @see \link createFullTextIndexForAttribute:error: - (BOOL)createFullTextIndexForAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (BOOL)dropFullTextIndexForAttribute:(nullable NSString *)theAttribute error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Checks whether a full-text index has been declared for a given attribute.
+ * @param theAttribute is the attribute to check. If nil, checks for the index covering all attributes.
+ * @return YES if the index has been declared, NO otherwise.
+ */
+
+- (BOOL)hasFullTextIndexForAttribute:(nullable NSString *)theAttribute;
+
+/** * Declares a partial index for the values of a given attribute.
+ * @param theAttribute is the key path to be indexed. Must not be nil.
+ * @param theType is the type of the values stored under the attribute: NSFNanoTypeString, NSFNanoTypeNumber or NSFNanoTypeDate.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @note The index covers NSFValue and NSFKey for the rows of this attribute only, so a search such as price > 100 is resolved with a single range scan.
+ * The declaration is stored with the document store and the index is recreated by \link rebuildIndexesAndReturnError: - (BOOL)rebuildIndexesAndReturnError:(NSError * __autoreleasing *)outError \endlink.
+ * Searches on the attribute use the index automatically. When the type is NSFNanoTypeNumber, numeric search values are compared as numbers.
+ * @attention An undotted attribute matches at any depth of the key path. The index is only used while no other key path contains the attribute.
+ * @throws NSFUnexpectedParameterException is thrown if the attribute is nil or the type is not supported.
+ * @see \link dropIndexForAttribute:error: - (BOOL)dropIndexForAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (BOOL)createIndexForAttribute:(NSString *)theAttribute type:(NSFNanoDatatype)theType error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Removes an index declared with \link createIndexForAttribute:type:error: - (BOOL)createIndexForAttribute:(NSString *)theAttribute type:(NSFNanoDatatype)theType error:(NSError * __autoreleasing *)outError \endlink.
+ * @param theAttribute is the key path whose index should be removed. Must not be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @throws NSFUnexpectedParameterException is thrown if the attribute is nil.
+ */
+
+- (BOOL)dropIndexForAttribute:(NSString *)theAttribute error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Returns the type an attribute index has been declared with.
+ * @param theAttribute is the key path to check. Must not be nil.
+ * @return The type of the index, or NSFNanoTypeUnknown if none has been declared.
+ * @throws NSFUnexpectedParameterException is thrown if the attribute is nil.
+ */
+
+- (NSFNanoDatatype)typeOfIndexForAttribute:(NSString *)theAttribute;
+
+/** * Declares a case-folded index for a given attribute.
+ * @param theAttribute is the attribute to be indexed. It matches at any depth of the key path, just like the search attribute does. An attribute containing a dot names a whole key path. Must not be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @note A case-folded copy of every text value stored under the attribute is kept next to the original, using Unicode case folding rather than ASCII upper-casing,
+ * so "STRASSE" and "straße" compare as equal. Searches using \link Globals::NSFInsensitiveEqualTo NSFInsensitiveEqualTo \endlink or
+ * \link Globals::NSFInsensitiveBeginsWith NSFInsensitiveBeginsWith \endlink on the attribute are then resolved through an index instead of scanning every value.
+ * @throws NSFUnexpectedParameterException is thrown if the attribute is nil.
+ * @see \link dropCaseFoldedIndexForAttribute:error: - (BOOL)dropCaseFoldedIndexForAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (BOOL)createCaseFoldedIndexForAttribute:(NSString *)theAttribute error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Removes a case-folded index declared with \link createCaseFoldedIndexForAttribute:error: - (BOOL)createCaseFoldedIndexForAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError \endlink.
+ * @param theAttribute is the attribute whose index should be removed. Must not be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @throws NSFUnexpectedParameterException is thrown if the attribute is nil.
+ * @see \link createCaseFoldedIndexForAttribute:error: - (BOOL)createCaseFoldedIndexForAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (BOOL)dropCaseFoldedIndexForAttribute:(NSString *)theAttribute error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Checks whether a case-folded index has been declared for a given attribute.
+ * @param theAttribute is the attribute to check. Must not be nil.
+ * @return YES if the index has been declared, NO otherwise.
+ * @throws NSFUnexpectedParameterException is thrown if the attribute is nil.
+ */
+
+- (BOOL)hasCaseFoldedIndexForAttribute:(NSString *)theAttribute;
+
+/** * Runs a block in which every search issued by the calling thread reads the same version of the document store.
+ * @param theBlock is the block to run. Must not be nil.
+ * @note The searches run on one read-only connection holding a single read transaction for the whole block, so commits made meanwhile on other threads
+ * don't show up halfway through, say, between fetching a bag and fetching its objects. Writers are not blocked. The statements in the block also share the
+ * transaction instead of starting one each. Snapshots nest: an inner call joins the outer snapshot.
+ * @attention A snapshot needs a reader connection: it requires a file-backed document store opened with \link NSFNanoEngine::maximumNumberOfReaders maximumNumberOfReaders \endlink
+ * greater than zero. Otherwise, or if the calling thread has a transaction open, the block still runs, but its searches go through the writer as usual.
+ * The search result cache is bypassed within the block.
+ * @throws NSFUnexpectedParameterException is thrown if the block is nil.
+ */
+
+- (void)performReadSnapshot:(nonnull void (^)(void))theBlock;
+
+/** * Runs several searches together in the background and hands back all their results at once.
+ * @param theSearches is an array of NSFNanoSearch set up on this document store. Must not be nil.
+ * @param theCompletion is called on the main queue once every search has run. <i>theResults</i> holds one entry per search, in the same order: what
+ * \link NSFNanoSearch::searchObjectsWithReturnType:error: searchObjectsWithReturnType:error: \endlink would have returned for the search's \link NSFNanoSearch::returnedObjectType returnedObjectType \endlink, or [NSNull null] if the search failed.
+ * <i>theError</i> is the error of the first search that failed, nil otherwise. Must not be nil.
+ * @note Equivalent to calling \link executeSearches:dedupesIdenticalSearches:completion: - (void)executeSearches:(NSArray *)theSearches dedupesIdenticalSearches:(BOOL)shouldDedupe completion:(void (^)(NSArray *theResults, NSError *theError))theCompletion \endlink with YES.
+ * @throws NSFUnexpectedParameterException is thrown if the searches or the completion block are nil, or if a search belongs to another document store.
+ */
+
+- (void)executeSearches:(nonnull NSArray *)theSearches completion:(nonnull void (^)(NSArray * _Nonnull theResults, NSError * _Nullable theError))theCompletion;
+
+/** * Runs several searches together in the background and hands back all their results at once.
+ * @param theSearches is an array of NSFNanoSearch set up on this document store. Must not be nil.
+ * @param shouldDedupe if YES, searches compiling to the same SQL, with the same return type, attributes to be returned and sort, run once and share their result.
+ * @param theCompletion is called on the main queue once every search has run. See \link executeSearches:completion: - (void)executeSearches:(NSArray *)theSearches completion:(void (^)(NSArray *theResults, NSError *theError))theCompletion \endlink. Must not be nil.
+ * @note Equivalent to calling \link executeSearches:dedupesIdenticalSearches:completionQueue:completion: - (void)executeSearches:(NSArray *)theSearches dedupesIdenticalSearches:(BOOL)shouldDedupe completionQueue:(dispatch_queue_t)theQueue completion:(void (^)(NSArray *theResults, NSError *theError))theCompletion \endlink with the main queue.
+ * @throws NSFUnexpectedParameterException is thrown if the searches or the completion block are nil, or if a search belongs to another document store.
+ */
+
+- (void)executeSearches:(nonnull NSArray *)theSearches dedupesIdenticalSearches:(BOOL)shouldDedupe completion:(nonnull void (^)(NSArray * _Nonnull theResults, NSError * _Nullable theError))theCompletion;
+
+/** * Runs several searches together in the background and hands back all their results at once.
+ * @param theSearches is an array of NSFNanoSearch set up on this document store. Must not be nil.
+ * @param shouldDedupe if YES, searches compiling to the same SQL, with the same return type, attributes to be returned and sort, run once and share their result.
+ * @param theQueue is the queue the completion block is called on. Must not be nil.
+ * @param theCompletion is called on <i>theQueue</i> once every search has run. See \link executeSearches:completion: - (void)executeSearches:(NSArray *)theSearches completion:(void (^)(NSArray *theResults, NSError *theError))theCompletion \endlink. Must not be nil.
+ * @note The results always come from a single version of the document store. With a pool of readers (see \link NSFNanoEngine::maximumNumberOfReaders maximumNumberOfReaders \endlink),
+ * the searches run in parallel, each on a reader of its own; if this document store commits meanwhile, the batch runs again back to back within a single read snapshot
+ * (see \link performReadSnapshot: - (void)performReadSnapshot:(void (^)(void))theBlock \endlink). Without readers, the searches run back to back within a single read transaction
+ * on the writer, so writes other threads make through this document store meanwhile are only committed once the batch is done. Commits made by other processes
+ * while the searches run in parallel are not detected.
+ * Each search that runs prepares its own statement: statements are not cached across searches, deduping only spares running the same shape again.
+ * @note The searches are copied before the method returns, so they can be changed or reused right away without affecting the batch.
+ * @throws NSFUnexpectedParameterException is thrown if the searches, the queue or the completion block are nil, or if a search belongs to another document store.
+ */
+
+- (void)executeSearches:(nonnull NSArray *)theSearches dedupesIdenticalSearches:(BOOL)shouldDedupe completionQueue:(nonnull dispatch_queue_t)theQueue completion:(nonnull void (^)(NSArray * _Nonnull theResults, NSError * _Nullable theError))theCompletion;
+
+/** * Proposes indexes for the searches executed while \link recordsSearchShapes recordsSearchShapes \endlink was enabled.
+ * @return An array of dictionaries, the most profitable first. Each one describes an index with the keys <i>NSFIndexRecommendationAttributeKey</i>,
+ * <i>NSFIndexRecommendationTypeKey</i>, <i>NSFIndexRecommendationDatatypeKey</i>, <i>NSFIndexRecommendationSearchCountKey</i> and <i>NSFIndexRecommendationEstimatedGainKey</i>.
+ * @note Only attributes compared against a value or used for sorting are considered, and only with comparisons an index can resolve: contains and ends-with
+ * searches are left out. Case-insensitive equality and prefix searches lead to a case-folded index, the rest to an attribute index typed after the values stored under the attribute.
+ * The estimated gain is the number of NSFValues rows the recorded searches would not have visited, based on how many rows the attribute has and how many distinct values they hold.
+ * @see \link createRecommendedIndexes:error: - (BOOL)createRecommendedIndexes:(NSArray *)theRecommendations error:(NSError * __autoreleasing *)outError \endlink
+ */
+
+- (nonnull NSArray *)indexRecommendations;
+
+/** * Creates the indexes described by the recommendations of the index advisor.
+ * @param theRecommendations is an array of recommendations as returned by \link indexRecommendations - (NSArray *)indexRecommendations \endlink. Must not be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise. Creation stops at the first index that fails.
+ * @throws NSFUnexpectedParameterException is thrown if the recommendations are nil.
+ */
+
+- (BOOL)createRecommendedIndexes:(nonnull NSArray *)theRecommendations error:(NSError * _Nullable * _Nullable)outError;
+
+/** * Forgets the searches recorded for the index advisor. */
+
+- (void)clearRecordedSearchShapes;
+
 /** * Makes a copy of the document store to a different location and optionally compacts it to its minimum size.
  * @param thePath is the location where the document store should be copied to.
  * @param shouldCompact is used to flag whether the document store should be compacted.
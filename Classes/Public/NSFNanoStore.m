@@ -44,6 +44,28 @@
 @property (nonatomic, assign) sqlite3_stmt *insertDeleteKeysStatement;
 @property (nonatomic, assign) sqlite3_stmt *storeValuesStatement;
 @property (nonatomic, assign) sqlite3_stmt *storeKeysStatement;
+@property (nonatomic, assign) sqlite3_stmt *storeKeyPathSegmentsStatement;
+@property (nonatomic, assign) sqlite3_stmt *lookupKeysStatement;
+@property (nonatomic) BOOL isLookupKeysStatementInUse;
+@property (nonatomic, assign) sqlite3_stmt *storeBagMemberStatement;
+@property (nonatomic, assign) sqlite3_stmt *removeBagMemberStatement;
+@property (nonatomic) NSMutableSet *indexedKeyPaths;
+@property (nonatomic, assign) sqlite3_stmt *storeFullTextStatement;
+@property (nonatomic) NSMutableSet *fullTextAttributes;
+@property (nonatomic) NSMutableSet *caseFoldedAttributes;
+@property (nonatomic) NSMutableDictionary *attributeIndexes;
+@property (nonatomic) NSMutableDictionary *resultCache;
+@property (nonatomic) NSMutableOrderedSet *resultCacheOrder;
+@property (nonatomic) NSUInteger resultCacheCost;
+@property (nonatomic) unsigned long long resultCacheCommitCount;
+@property (nonatomic) unsigned long long resultCacheOldestCacheableCommitCount;
+@property (nonatomic) NSCountedSet *recordedSearchShapes;
+@property (nonatomic) NSMapTable *liveObjects;
+@property (nonatomic) NSMutableDictionary *objectCache;
+@property (nonatomic) NSMutableOrderedSet *objectCacheOrder;
+@property (nonatomic) NSUInteger objectCacheByteCount;
+@property (nonatomic) unsigned long long objectCacheHitCount;
+@property (nonatomic) unsigned long long objectCacheMissCount;
 /** \endcond */
 
 @end
@@ -114,7 +136,27 @@
         _insertDeleteKeysStatement = NULL;
         _storeValuesStatement = NULL;
         _storeKeysStatement = NULL;
+        _storeKeyPathSegmentsStatement = NULL;
+        _lookupKeysStatement = NULL;
+        _storeBagMemberStatement = NULL;
+        _removeBagMemberStatement = NULL;
+        _storeFullTextStatement = NULL;
         
+        _indexedKeyPaths = [NSMutableSet new];
+        _fullTextAttributes = [NSMutableSet new];
+        _caseFoldedAttributes = [NSMutableSet new];
+        _attributeIndexes = [NSMutableDictionary new];
+        _resultCache = [NSMutableDictionary new];
+        _resultCacheOrder = [NSMutableOrderedSet new];
+        _resultCacheCostLimit = 0;
+        _resultCacheInvalidation = NSFResultCacheInvalidateOnCommit;
+        _recordedSearchShapes = [NSCountedSet new];
+        _recordsSearchShapes = NO;
+        _liveObjects = [NSMapTable strongToWeakObjectsMapTable];
+        _objectCache = [NSMutableDictionary new];
+        _objectCacheOrder = [NSMutableOrderedSet new];
+        _usesIdentityMap = NO;
+        _objectCacheCountLimit = 0;
         _addedObjects = [[NSMutableArray alloc]initWithCapacity:saveInterval];
         
         _hasUnsavedChanges = NO;
@@ -138,7 +180,10 @@
     if ([nanoStoreEngine isDatabaseOpen] == YES)
         return YES;
     
-    if ([nanoStoreEngine openWithCacheMethod:CacheAllData useFastMode:(NSFEngineProcessingFastMode == nanoEngineProcessingMode)] == NO) {
+    // Honor a cache method set on the engine before opening
+    NSFCacheMethod cacheMethod = (0 != nanoStoreEngine.cacheMethod) ? nanoStoreEngine.cacheMethod : CacheAllData;
+    
+    if ([nanoStoreEngine openWithCacheMethod:cacheMethod useFastMode:(NSFEngineProcessingFastMode == nanoEngineProcessingMode)] == NO) {
         NSString *message = [NSString stringWithFormat:@"*** -[%@ %@]: open database failed: %@", [self class], NSStringFromSelector(_cmd), [self filePath]];
         _NSFLog(message);
         if (nil != outError)
@@ -160,6 +205,10 @@
         return NO;
     }
     
+    [self _loadFullTextAttributes];
+    [self _loadCaseFoldedAttributes];
+    [self _loadAttributeIndexes];
+    
     if ([self _initializePreparedStatementsWithError:outError] == NO) {
         NSString *message = [NSString stringWithFormat:@"*** -[%@ %@]: the SQL statements could not be prepared when opening database: %@", [self class], NSStringFromSelector(_cmd), [self filePath]];
         _NSFLog(message);
@@ -173,6 +222,8 @@
 - (BOOL)closeWithError:(NSError * __autoreleasing *)outError
 {
     BOOL success = [self saveStoreAndReturnError:outError];
+    [self clearResultCache];
+    [self clearObjectCache];
     [self _releasePreparedStatements];
     [nanoStoreEngine close];
     
@@ -290,6 +341,11 @@
 }
 
 - (BOOL)removeObjectsWithKeysInArray:(NSArray *)someKeys error:(NSError * __autoreleasing *)outError
+{
+    return [self _removeObjectsWithKeysInArray:someKeys removingBagMembers:YES error:outError];
+}
+
+- (BOOL)_removeObjectsWithKeysInArray:(NSArray *)someKeys removingBagMembers:(BOOL)removesBagMembers error:(NSError * __autoreleasing *)outError
 {
     if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
         return NO;
@@ -304,6 +360,9 @@
     if (0 == count)
         return NO;
     
+    [self _invalidateCachedResultsContainingKeys:someKeys];
+    [self _evictCachedObjectsWithKeys:someKeys];
+    
     BOOL transactionStartedHere = [self beginTransactionAndReturnError:nil];
     
     NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"CREATE TEMP TABLE %@(x);", NSF_Private_ToDeleteTableKey];
@@ -346,10 +405,27 @@
     theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ IN (SELECT * FROM %@);", NSFKeys, NSFKey, NSF_Private_ToDeleteTableKey];
     [nanoStoreEngine executeSQL:theSQLStatement];
     
+    if (_fullTextAttributes.count > 0) {
+        _NSFLog(@"          Before removing the keys to be stored from NSFFullTextValues...");
+        theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE rowid IN (SELECT ROWID FROM %@ WHERE %@ IN (SELECT * FROM %@));", NSFFullTextValues, NSFValues, NSFKey, NSF_Private_ToDeleteTableKey];
+        [nanoStoreEngine executeSQL:theSQLStatement];
+    }
+    
     _NSFLog(@"          Before removing the keys to be stored from NSFValues...");
     theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ IN (SELECT * FROM %@);", NSFValues, NSFKey, NSF_Private_ToDeleteTableKey];
     [nanoStoreEngine executeSQL:theSQLStatement];
     
+    // Deleted objects leave the bags holding them, and deleted bags let go of their members.
+    // Objects being replaced by a save keep their memberships.
+    if (removesBagMembers) {
+        _NSFLog(@"          Before removing the keys to be removed from NSFBagMembers...");
+        theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ IN (SELECT * FROM %@) OR %@ IN (SELECT * FROM %@);", NSFBagMembers, NSFKey, NSF_Private_ToDeleteTableKey, NSFBagKey, NSF_Private_ToDeleteTableKey];
+        [nanoStoreEngine executeSQL:theSQLStatement];
+        
+        // Searches scoped to a removed bag don't hold the bag itself, so they're found by its membership
+        [self _invalidateCachedResultsForKeyPaths:@[NSF_Private_NSFNanoBag_NSFObjectKeys] objectClass:nil];
+    }
+    
     _NSFLog(@"          Before DROP TABLE NSF_Private_ToDeleteTableKey...");
     theSQLStatement = [[NSString alloc]initWithFormat:@"DROP TABLE %@;", NSF_Private_ToDeleteTableKey];
     [nanoStoreEngine executeSQL:theSQLStatement];
@@ -426,11 +502,7 @@
         return [NSArray array];
     }
     
-    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:self];
-    NSString *quotedString = [NSFNanoSearch _quoteStrings:someKeys joiningWithDelimiter:@","];
-    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT NSFKey, NSFKeyedArchive, NSFObjectClass FROM NSFKeys WHERE NSFKey IN (%@) AND NSFObjectClass = \"%@\"", quotedString, NSStringFromClass([NSFNanoBag class])];
-    
-    return [[search executeSQL:theSQLStatement returnType:NSFReturnObjects error:nil]allValues];
+    return [self _objectsWithKeys:someKeys objectClassName:NSStringFromClass([NSFNanoBag class])];
 }
 
 - (NSArray *)bagsContainingObjectWithKey:(NSString *)aKey
@@ -439,10 +511,20 @@
         return [NSArray array];
     }
     
-    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:self];
-    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT NSFKey, NSFKeyedArchive, NSFObjectClass FROM NSFKeys WHERE NSFKey IN (SELECT DISTINCT (NSFKEY) FROM NSFValues WHERE NSFValue = \"%@\") AND NSFObjectClass = \"%@\"", aKey, NSStringFromClass([NSFNanoBag class])];
+    return [self bagsWithKeysInArray:[self bagKeysContainingObjectWithKey:aKey]];
+}
+
+- (NSArray *)bagKeysContainingObjectWithKey:(NSString *)aKey
+{
+    if (nil == aKey) {
+        return [NSArray array];
+    }
     
-    return [[search executeSQL:theSQLStatement returnType:NSFReturnObjects error:nil]allValues];
+    // Answered from the (NSFKey, NSFBagKey) index, without looking at the bags themselves
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT DISTINCT %@ FROM %@ WHERE %@ = '%@'", NSFBagKey, NSFBagMembers, NSFKey, [aKey stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+    NSArray *keys = [[self _executeSQL:theSQLStatement]valuesForColumn:NSFBagKey];
+    
+    return (nil != keys) ? keys : [NSArray array];
 }
 
 - (NSArray *)objectsWithKeysInArray:(NSArray *)someKeys
@@ -451,11 +533,7 @@
         return [NSArray array];
     }
     
-    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:self];
-    NSString *quotedString = [NSFNanoSearch _quoteStrings:someKeys joiningWithDelimiter:@","];
-    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT NSFKey, NSFKeyedArchive, NSFObjectClass FROM NSFKeys WHERE NSFKey IN (%@)", quotedString];
-    
-    return [[search executeSQL:theSQLStatement returnType:NSFReturnObjects error:nil]allValues];
+    return [self _objectsWithKeys:someKeys objectClassName:nil];
 }
 
 - (NSArray *)allObjectClasses
@@ -499,10 +577,10 @@
     
     NSFNanoSearch *search = [NSFNanoSearch searchWithStore:self];
     
-    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT count(*) FROM NSFKeys WHERE NSFObjectClass = \"%@\"", theClassName];
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT count(*) AS NSFCount FROM NSFKeys WHERE NSFObjectClass = \"%@\"", theClassName];
     NSFNanoResult *results = [search executeSQL:theSQLStatement];
     
-    return [results firstValue].longLongValue;
+    return (results.numberOfRows > 0) ? [results int64AtIndex:0 forColumn:@"NSFCount"] : 0;
 }
 
 #pragma mark -
@@ -545,6 +623,15 @@
     if ([self _isOurTransaction] == YES) {
         [[self nanoStoreEngine]rollbackTransaction];
         [self _setIsOurTransaction:NO];
+        
+        // The key paths recorded and the results cached during the transaction may have been discarded
+        [_indexedKeyPaths removeAllObjects];
+        [self clearResultCache];
+        @synchronized(_resultCache) {
+            // Nothing is waiting to be committed anymore
+            _resultCacheOldestCacheableCommitCount = [[self nanoStoreEngine]NSFP_commitCount];
+        }
+        [self clearObjectCache];
         return YES;
     }
     
@@ -585,6 +672,16 @@
     
     NSError *resultKeys = [self _executeSQL:[NSString stringWithFormat:@"DROP TABLE %@", NSFKeys]].error;
     NSError *resultValues = [self _executeSQL:[NSString stringWithFormat:@"DROP TABLE %@", NSFValues]].error;
+    [self _executeSQL:[NSString stringWithFormat:@"DROP TABLE %@", NSFKeyPathSegments]];
+    [self _executeSQL:[NSString stringWithFormat:@"DROP TABLE %@", NSFBagMembers]];
+    [_indexedKeyPaths removeAllObjects];
+    [self clearResultCache];
+    [self clearObjectCache];
+    
+    // The full-text index declarations are kept, only the indexed values go away
+    if (_fullTextAttributes.count > 0) {
+        [self _executeSQL:[NSString stringWithFormat:@"DELETE FROM %@", NSFFullTextValues]];
+    }
     
     [self _setupCachingSchema];
     
@@ -651,6 +748,15 @@
     _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumn: NSFKey table: NSFKeys isUnique:YES]: %@", [[self nanoStoreEngine]createIndexForColumn:NSFKey table:NSFKeys isUnique:YES] ? @"YES" : @"NO");
     _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumn: NSFCalendarDate table: NSFKeys isUnique:NO]: %@", [[self nanoStoreEngine]createIndexForColumn:NSFCalendarDate table:NSFKeys isUnique:NO] ? @"YES" : @"NO");
     _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumn: NSFObjectClass table: NSFKeys isUnique:NO]: %@", [[self nanoStoreEngine]createIndexForColumn:NSFObjectClass table:NSFKeys isUnique:NO] ? @"YES" : @"NO");
+    
+    _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumn: NSFSegment table: NSFKeyPathSegments isUnique:NO]: %@", [[self nanoStoreEngine]createIndexForColumn:NSFSegment table:NSFKeyPathSegments isUnique:NO] ? @"YES" : @"NO");
+    _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumn: NSFAttribute table: NSFKeyPathSegments isUnique:NO]: %@", [[self nanoStoreEngine]createIndexForColumn:NSFAttribute table:NSFKeyPathSegments isUnique:NO] ? @"YES" : @"NO");
+    _NSFLog(@"     [self _createCaseFoldedValuesIndex]: %@", [self _createCaseFoldedValuesIndex] ? @"YES" : @"NO");
+    _NSFLog(@"     [self _createBagMembersIndexes]: %@", [self _createBagMembersIndexes] ? @"YES" : @"NO");
+    
+    for (NSString *attribute in _attributeIndexes) {
+        _NSFLog(@"     [self _createIndexForAttribute: %@]: %@", attribute, [self _createIndexForAttribute:attribute] ? @"YES" : @"NO");
+    }
 
     NSTimeInterval seconds = [[NSDate date]timeIntervalSinceDate:startDate];    
     _NSFLog(@"Done. Rebuilding the indexes took %.3f seconds", seconds);
@@ -658,307 +764,1693 @@
     return YES;
 }
 
-- (BOOL)saveStoreToDirectoryAtPath:(NSString *)path compactDatabase:(BOOL)compact error:(NSError * __autoreleasing *)outError
+- (BOOL)createFullTextIndexForAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError
 {
-    if (nil == path)
-        [[NSException exceptionWithName:NSFUnexpectedParameterException
-                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: path is nil.", [self class], NSStringFromSelector(_cmd)]
-                               userInfo:nil]raise];
-    
-    // Make sure we've expanded the tilde
-    path = path.stringByExpandingTildeInPath;
-    
     if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
         return NO;
     
-    if ([[self nanoStoreEngine]isTransactionActive]) {
-        if (nil != outError) {
+    if (nil == theAttribute) {
+        theAttribute = NSF_Private_AllAttributesKey;
+    }
+    
+    if ([_fullTextAttributes containsObject:theAttribute]) {
+        return YES;
+    }
+    
+    NSArray *tables = [[self nanoStoreEngine]tables];
+    NSString *theSQLStatement = nil;
+    NSError *resultError = nil;
+    
+    if ([tables containsObject:NSFFullTextValues] == NO) {
+        resultError = [self _executeSQL:[self _SQLForCreatingFullTextTableNamed:NSFFullTextValues]].error;
+        if (nil != resultError) {
+            if (nil != outError)
+                *outError = [NSError errorWithDomain:NSFDomainKey
+                                                code:NSFNanoStoreErrorKey
+                                            userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: the full-text table could not be created. Reason: %@", [self class], NSStringFromSelector(_cmd), resultError.localizedDescription]}];
+            return NO;
+        }
+    }
+    
+    if ([tables containsObject:NSFFullTextAttributes] == NO) {
+        theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(%@ TEXT PRIMARY KEY);", NSFFullTextAttributes, NSFAttribute];
+        [self _executeSQL:theSQLStatement];
+    }
+    
+    BOOL transactionStartedHere = [self beginTransactionAndReturnError:nil];
+    
+    theSQLStatement = [NSString stringWithFormat:@"INSERT OR IGNORE INTO %@(%@) VALUES ('%@');", NSFFullTextAttributes, NSFAttribute, [theAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+    resultError = [self _executeSQL:theSQLStatement].error;
+    
+    if (nil == resultError) {
+        resultError = [self _populateFullTextIndexForAttribute:theAttribute].error;
+    }
+    
+    if (transactionStartedHere) {
+        if (nil == resultError) {
+            [self commitTransactionAndReturnError:nil];
+        } else {
+            [self rollbackTransactionAndReturnError:nil];
+        }
+    }
+    
+    if (nil != resultError) {
+        if (nil != outError)
             *outError = [NSError errorWithDomain:NSFDomainKey
                                             code:NSFNanoStoreErrorKey
-                                        userInfo:@{NSLocalizedDescriptionKey: @"Cannot backup store. A transaction is still open."}];
-        }
+                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: the full-text index could not be populated. Reason: %@", [self class], NSStringFromSelector(_cmd), resultError.localizedDescription]}];
         return NO;
     }
     
-    if ([[self filePath]isEqualToString:NSFMemoryDatabase] == YES) {
-        return [self _backupMemoryStoreToDirectoryAtPath:path extension:nil compact:compact error:outError];
-    } else {
-        return [self _backupFileStoreToDirectoryAtPath:path extension:nil compact:compact error:outError];
-    }
+    [_fullTextAttributes addObject:theAttribute];
     
-    return NO;
+    return [self _initializePreparedStatementsWithError:outError];
 }
 
-#pragma mark - Private Methods
-#pragma mark -
-
-/** \cond */
-
-+ (NSFNanoStore *)_createAndOpenDebugDatabase
+- (BOOL)dropFullTextIndexForAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError
 {
-    NSFNanoStore *db =  [NSFNanoStore createStoreWithType:NSFPersistentStoreType path:(@"~/Desktop/NanoStoreDebug.sqlite").stringByExpandingTildeInPath];
-    NSError *outError = nil;
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return NO;
     
-    if (NO == [db openWithError:&outError]) {
-        [[NSException exceptionWithName:NSFNanoStoreUnableToManipulateStoreException
-                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: could not open the database. Reason: %@", [self class], NSStringFromSelector(_cmd), outError.localizedDescription]
-                               userInfo:nil]raise];
+    if (nil == theAttribute) {
+        theAttribute = NSF_Private_AllAttributesKey;
     }
     
-    return db;
+    if (NO == [_fullTextAttributes containsObject:theAttribute]) {
+        return YES;
+    }
+    
+    BOOL transactionStartedHere = [self beginTransactionAndReturnError:nil];
+    
+    NSString *theSQLStatement = [NSString stringWithFormat:@"DELETE FROM %@ WHERE %@ = '%@';", NSFFullTextAttributes, NSFAttribute, [theAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+    [self _executeSQL:theSQLStatement];
+    [_fullTextAttributes removeObject:theAttribute];
+    
+    // The remaining declarations may overlap with the one being dropped, so repopulate from scratch
+    [self _executeSQL:[NSString stringWithFormat:@"DELETE FROM %@;", NSFFullTextValues]];
+    
+    for (NSString *attribute in _fullTextAttributes) {
+        [self _populateFullTextIndexForAttribute:attribute];
+    }
+    
+    if (transactionStartedHere)
+        if ([self commitTransactionAndReturnError:nil] == NO)
+            _NSFLog(@"          Could not commit the transaction.");
+    
+    return YES;
 }
 
-- (NSFNanoResult *)_executeSQL:(NSString *)theSQLStatement
+- (BOOL)hasFullTextIndexForAttribute:(NSString *)theAttribute
 {
-    if (nil == theSQLStatement)
-        return nil;
-    
-    return [[self nanoStoreEngine]executeSQL:theSQLStatement];
+    return [_fullTextAttributes containsObject:(nil == theAttribute ? NSF_Private_AllAttributesKey : theAttribute)];
 }
 
-- (BOOL)_initializePreparedStatementsWithError:(NSError * __autoreleasing *)outError
+- (BOOL)createCaseFoldedIndexForAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError
 {
-    BOOL hasInitializationSucceeded = YES;
+    if (nil == theAttribute)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: theAttribute is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
     
-    if (NULL == _storeValuesStatement) {
-        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@, %@, %@) VALUES (?,?,?,?);", NSFValues, NSFKey, NSFAttribute, NSFValue, NSFDatatype];
-        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_storeValuesStatement theSQLStatement:theSQLStatement];
-        
-        if (NO == hasInitializationSucceeded) {
-            if (nil != outError) {
-                *outError = [NSError errorWithDomain:NSFDomainKey
-                                                code:NSFNanoStoreErrorKey
-                                            userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: failed to prepare _storeValuesStatement.", [self class], NSStringFromSelector(_cmd)]}];
-            }
-            return NO;
-        }
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return NO;
+    
+    if ([_caseFoldedAttributes containsObject:theAttribute]) {
+        return YES;
     }
     
-    if (NULL == _storeKeysStatement) {
-        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@, %@, %@) VALUES (?,?,?,?);", NSFKeys, NSFKey, NSFKeyedArchive, NSFCalendarDate, NSFObjectClass];
-        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_storeKeysStatement theSQLStatement:theSQLStatement];
-        
-        if (NO == hasInitializationSucceeded) {
-            if (nil != outError) {
-                *outError = [NSError errorWithDomain:NSFDomainKey
-                                                code:NSFNanoStoreErrorKey
-                                            userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: failed to prepare _storeKeysStatement.", [self class], NSStringFromSelector(_cmd)]}];
-            }
-            return NO;
+    if ([[[self nanoStoreEngine]tables]containsObject:NSFFoldedAttributes] == NO) {
+        [self _executeSQL:[NSString stringWithFormat:@"CREATE TABLE %@(%@ TEXT PRIMARY KEY);", NSFFoldedAttributes, NSFAttribute]];
+    }
+    
+    BOOL transactionStartedHere = [self beginTransactionAndReturnError:nil];
+    
+    NSString *theSQLStatement = [NSString stringWithFormat:@"INSERT OR IGNORE INTO %@(%@) VALUES ('%@');", NSFFoldedAttributes, NSFAttribute, [theAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+    NSError *resultError = [self _executeSQL:theSQLStatement].error;
+    
+    if (nil == resultError) {
+        resultError = [self _populateCaseFoldedValuesForAttribute:theAttribute].error;
+    }
+    
+    if (transactionStartedHere) {
+        if (nil == resultError) {
+            [self commitTransactionAndReturnError:nil];
+        } else {
+            [self rollbackTransactionAndReturnError:nil];
         }
     }
     
+    if (nil != resultError) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: the case-folded values could not be populated. Reason: %@", [self class], NSStringFromSelector(_cmd), resultError.localizedDescription]}];
+        return NO;
+    }
+    
+    [_caseFoldedAttributes addObject:theAttribute];
+    [self _createCaseFoldedValuesIndex];
+    
     return YES;
 }
 
-- (void)_releasePreparedStatements
-{
-    if (_insertDeleteKeysStatement != NULL) { sqlite3_finalize(_insertDeleteKeysStatement);_insertDeleteKeysStatement = NULL; }
-    if (_storeValuesStatement != NULL) { sqlite3_finalize(_storeValuesStatement);_storeValuesStatement = NULL; }
-    if (_storeKeysStatement != NULL) { sqlite3_finalize(_storeKeysStatement);_storeKeysStatement = NULL; }
-}
-
-- (void)_setIsOurTransaction:(BOOL)value
+- (BOOL)dropCaseFoldedIndexForAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError
 {
-    if (_isOurTransaction != value) {
-        _isOurTransaction = value;
+    if (nil == theAttribute)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: theAttribute is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return NO;
+    
+    if (NO == [_caseFoldedAttributes containsObject:theAttribute]) {
+        return YES;
     }
+    
+    BOOL transactionStartedHere = [self beginTransactionAndReturnError:nil];
+    
+    NSString *theSQLStatement = [NSString stringWithFormat:@"DELETE FROM %@ WHERE %@ = '%@';", NSFFoldedAttributes, NSFAttribute, [theAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+    [self _executeSQL:theSQLStatement];
+    [_caseFoldedAttributes removeObject:theAttribute];
+    
+    // The remaining declarations may overlap with the one being dropped, so repopulate from scratch
+    [self _executeSQL:[NSString stringWithFormat:@"UPDATE %@ SET %@ = NULL WHERE %@ IS NOT NULL;", NSFValues, NSFFoldedValue, NSFFoldedValue]];
+    
+    for (NSString *attribute in _caseFoldedAttributes) {
+        [self _populateCaseFoldedValuesForAttribute:attribute];
+    }
+    
+    if (transactionStartedHere)
+        if ([self commitTransactionAndReturnError:nil] == NO)
+            _NSFLog(@"          Could not commit the transaction.");
+    
+    return YES;
 }
 
-- (BOOL)_isOurTransaction
-{
-    return _isOurTransaction;
-}
-
-- (BOOL)_checkNanoStoreIsReadyAndReturnError:(NSError * __autoreleasing *)outError
+- (BOOL)createIndexForAttribute:(NSString *)theAttribute type:(NSFNanoDatatype)theType error:(NSError * __autoreleasing *)outError
 {
-    if (nil == self.nanoStoreEngine) {
-        if (nil != outError)
-            *outError = [NSError errorWithDomain:NSFDomainKey
-                                            code:NSFNanoStoreErrorKey
-                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: the NSF store has not been set.", [self class], NSStringFromSelector(_cmd)]}];
+    if (nil == theAttribute)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: theAttribute is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    if ((NSFNanoTypeString != theType) && (NSFNanoTypeNumber != theType) && (NSFNanoTypeDate != theType))
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: only string, number and date attributes can be indexed.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
         return NO;
+    
+    if ([[[self nanoStoreEngine]tables]containsObject:NSFAttributeIndexes] == NO) {
+        [self _executeSQL:[NSString stringWithFormat:@"CREATE TABLE %@(%@ TEXT PRIMARY KEY, %@ INTEGER);", NSFAttributeIndexes, NSFAttribute, NSFDatatype]];
     }
     
-    if ([[self nanoStoreEngine]isDatabaseOpen] == NO) {
+    NSString *theSQLStatement = [NSString stringWithFormat:@"INSERT OR REPLACE INTO %@(%@, %@) VALUES ('%@', %ld);", NSFAttributeIndexes, NSFAttribute, NSFDatatype, [theAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"], (long)theType];
+    NSError *resultError = [self _executeSQL:theSQLStatement].error;
+    
+    if (nil == resultError) {
+        _attributeIndexes[theAttribute] = @(theType);
+        if (NO == [self _createIndexForAttribute:theAttribute]) {
+            resultError = [NSError errorWithDomain:NSFDomainKey code:NSFNanoStoreErrorKey userInfo:@{NSLocalizedDescriptionKey: @"CREATE INDEX failed."}];
+        }
+    }
+    
+    if (nil != resultError) {
         if (nil != outError)
             *outError = [NSError errorWithDomain:NSFDomainKey
                                             code:NSFNanoStoreErrorKey
-                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: the store is not open.", [self class], NSStringFromSelector(_cmd)]}];
+                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: the index could not be created. Reason: %@", [self class], NSStringFromSelector(_cmd), resultError.localizedDescription]}];
         return NO;
     }
     
     return YES;
 }
 
-- (BOOL)_setupCachingSchema
+- (BOOL)dropIndexForAttribute:(NSString *)theAttribute error:(NSError * __autoreleasing *)outError
 {
-    NSString *theSQLStatement;
-    BOOL success;
-    NSArray *tables = [[self nanoStoreEngine]tables];
-
-    // Setup the Values table
-    if ([tables containsObject:NSFValues] == NO) {
-        theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(ROWID INTEGER PRIMARY KEY, %@ TEXT, %@ TEXT, %@ NONE, %@ TEXT);", NSFValues, NSFKey, NSFAttribute, NSFValue, NSFDatatype];
-        success = (nil == [[self nanoStoreEngine]executeSQL:theSQLStatement].error);
-        if (NO == success) {
-            return NO;
-        }
-}
+    if (nil == theAttribute)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: theAttribute is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
     
-    // Setup the Plist table
-    if ([tables containsObject:NSFKeys] == NO) {
-        theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(ROWID INTEGER PRIMARY KEY, %@ TEXT, %@ BLOB, %@ TEXT, %@ TEXT);", NSFKeys, NSFKey, NSFKeyedArchive, NSFCalendarDate, NSFObjectClass];
-
-        success = (nil == [[self nanoStoreEngine]executeSQL:theSQLStatement].error);
-        if (NO == success) {
-            return NO;
-        }
-}
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return NO;
+    
+    if (nil == _attributeIndexes[theAttribute]) {
+        return YES;
+    }
+    
+    [self _executeSQL:[NSString stringWithFormat:@"DELETE FROM %@ WHERE %@ = '%@';", NSFAttributeIndexes, NSFAttribute, [theAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"]]];
+    [self _executeSQL:[NSString stringWithFormat:@"DROP INDEX IF EXISTS %@;", [NSFNanoStore _indexNameForAttribute:theAttribute]]];
+    [_attributeIndexes removeObjectForKey:theAttribute];
     
     return YES;
 }
 
-- (BOOL)_storeDictionary:(NSDictionary *)someInfo forKey:(NSString *)aKey forClassNamed:(NSString *)classType error:(NSError * __autoreleasing *)outError
+- (NSFNanoDatatype)typeOfIndexForAttribute:(NSString *)theAttribute
 {
-    if (nil == someInfo)
+    if (nil == theAttribute)
         [[NSException exceptionWithName:NSFUnexpectedParameterException
-                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: someInfo is nil.", [self class], NSStringFromSelector(_cmd)]
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: theAttribute is nil.", [self class], NSStringFromSelector(_cmd)]
                                userInfo:nil]raise];
     
-    if (nil == aKey)
-        [[NSException exceptionWithName:NSFUnexpectedParameterException
-                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: aKey is nil.", [self class], NSStringFromSelector(_cmd)]
-                               userInfo:nil]raise];
+    NSNumber *type = _attributeIndexes[theAttribute];
     
-    if (NULL == _storeValuesStatement)
+    return (nil == type) ? NSFNanoTypeUnknown : (NSFNanoDatatype)type.integerValue;
+}
+
+- (BOOL)hasCaseFoldedIndexForAttribute:(NSString *)theAttribute
+{
+    if (nil == theAttribute)
         [[NSException exceptionWithName:NSFUnexpectedParameterException
-                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: aStatement is NULL.", [self class], NSStringFromSelector(_cmd)]
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: theAttribute is nil.", [self class], NSStringFromSelector(_cmd)]
                                userInfo:nil]raise];
     
-    NSRange range = [aKey rangeOfString:@"."];
-    if (NSNotFound != range.location)
-        [[NSException exceptionWithName:NSFUnexpectedParameterException
-                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: aKey cannot contain a period ('.')", [self class], NSStringFromSelector(_cmd)]
+    return [_caseFoldedAttributes containsObject:theAttribute];
+}
+
+#pragma mark -
+
+// ----------------------------------------------
+// Search result cache
+// ----------------------------------------------
+
+- (void)setResultCacheCostLimit:(NSUInteger)theLimit
+{
+    @synchronized(_resultCache) {
+        _resultCacheCostLimit = theLimit;
+        [self _evictCachedResultsToFitCost:0];
+    }
+}
+
+- (void)clearResultCache
+{
+    @synchronized(_resultCache) {
+        [_resultCache removeAllObjects];
+        [_resultCacheOrder removeAllObjects];
+        _resultCacheCost = 0;
+    }
+}
+
+#pragma mark -
+
+// ----------------------------------------------
+// Identity map and object cache
+// ----------------------------------------------
+
+- (void)setUsesIdentityMap:(BOOL)usesIdentityMap
+{
+    @synchronized(_objectCache) {
+        _usesIdentityMap = usesIdentityMap;
+        if (NO == usesIdentityMap) {
+            [_liveObjects removeAllObjects];
+        }
+    }
+}
+
+- (void)setObjectCacheCountLimit:(NSUInteger)theLimit
+{
+    @synchronized(_objectCache) {
+        _objectCacheCountLimit = theLimit;
+        [self _evictCachedObjectsToFitCount:0];
+    }
+}
+
+- (NSDictionary *)objectCacheStatistics
+{
+    @synchronized(_objectCache) {
+        unsigned long long lookups = _objectCacheHitCount + _objectCacheMissCount;
+        
+        return @{NSFObjectCacheHitCountKey : @(_objectCacheHitCount),
+                 NSFObjectCacheMissCountKey : @(_objectCacheMissCount),
+                 NSFObjectCacheHitRateKey : @((lookups > 0) ? (double)_objectCacheHitCount / lookups : 0.0),
+                 NSFObjectCacheCountKey : @(_objectCache.count),
+                 NSFObjectCacheByteCountKey : @(_objectCacheByteCount),
+                 NSFIdentityMapCountKey : @(_liveObjects.keyEnumerator.allObjects.count)};
+    }
+}
+
+- (void)clearObjectCache
+{
+    @synchronized(_objectCache) {
+        [_liveObjects removeAllObjects];
+        [_objectCache removeAllObjects];
+        [_objectCacheOrder removeAllObjects];
+        _objectCacheByteCount = 0;
+    }
+}
+
+#pragma mark -
+
+// ----------------------------------------------
+// Read snapshots
+// ----------------------------------------------
+
+- (void)performReadSnapshot:(void (^)(void))theBlock
+{
+    if (nil == theBlock)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: theBlock is nil.", [self class], NSStringFromSelector(_cmd)]
                                userInfo:nil]raise];
     
-    NSArray *keys = someInfo.allKeys;
-    for (NSString *key in keys) {
-        range = [key rangeOfString:@"."];
-        if (NSNotFound != range.location)
+    NSFNanoEngine *engine = self.nanoStoreEngine;
+    
+    // Nested snapshots share the outer one
+    BOOL snapshotStartedHere = (NO == [engine NSFP_isReadSnapshotActive]) && [engine NSFP_beginReadSnapshot];
+    
+    @try {
+        theBlock();
+    }
+    @finally {
+        if (snapshotStartedHere) {
+            [engine NSFP_endReadSnapshot];
+        }
+    }
+}
+
+- (void)executeSearches:(NSArray *)theSearches completion:(void (^)(NSArray *theResults, NSError *theError))theCompletion
+{
+    [self executeSearches:theSearches dedupesIdenticalSearches:YES completion:theCompletion];
+}
+
+- (void)executeSearches:(NSArray *)theSearches dedupesIdenticalSearches:(BOOL)shouldDedupe completion:(void (^)(NSArray *theResults, NSError *theError))theCompletion
+{
+    [self executeSearches:theSearches dedupesIdenticalSearches:shouldDedupe completionQueue:dispatch_get_main_queue() completion:theCompletion];
+}
+
+- (void)executeSearches:(NSArray *)theSearches dedupesIdenticalSearches:(BOOL)shouldDedupe completionQueue:(dispatch_queue_t)theQueue completion:(void (^)(NSArray *theResults, NSError *theError))theCompletion
+{
+    if (nil == theSearches)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: the list of searches is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    if (nil == theCompletion)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: the completion block is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    if (nil == theQueue)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: the completion queue is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    for (NSFNanoSearch *search in theSearches) {
+        if ((NO == [search isKindOfClass:[NSFNanoSearch class]]) || (search.nanoStore != self))
             [[NSException exceptionWithName:NSFUnexpectedParameterException
-                                     reason:[NSString stringWithFormat:@"*** -[%@ %@]: the keys of the dictionary cannot contain a period ('.')", [self class], NSStringFromSelector(_cmd)]
+                                     reason:[NSString stringWithFormat:@"*** -[%@ %@]: the searches must be of type NSFNanoSearch and belong to this document store.", [self class], NSStringFromSelector(_cmd)]
                                    userInfo:nil]raise];
     }
     
-    const char *aKeyUTF8 = aKey.UTF8String;
-    BOOL success = YES;
+    // The searches run on copies, so the caller is free to change or reuse them meanwhile. Identical ones collapse into the first of them.
+    NSMutableArray *searches = [[NSMutableArray alloc]initWithCapacity:theSearches.count];
+    NSMutableArray *searchIndexes = [[NSMutableArray alloc]initWithCapacity:theSearches.count];
+    NSMutableDictionary *indexesByShape = [NSMutableDictionary new];
+    for (NSFNanoSearch *search in theSearches) {
+        NSFNanoSearch *searchCopy = [search copy];
+        NSString *shape = shouldDedupe ? [searchCopy _batchShape] : nil;
+        NSNumber *index = (nil != shape) ? indexesByShape[shape] : nil;
+        if (nil == index) {
+            index = @(searches.count);
+            [searches addObject:searchCopy];
+            if (nil != shape) {
+                indexesByShape[shape] = index;
+            }
+        }
+        [searchIndexes addObject:index];
+    }
+    
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        NSFNanoEngine *engine = self.nanoStoreEngine;
+        NSUInteger count = searches.count;
+        NSMutableArray *results = [[NSMutableArray alloc]initWithCapacity:count];
+        NSMutableArray *errors = [[NSMutableArray alloc]initWithCapacity:count];
+        for (NSUInteger i = 0; i < count; i++) {
+            [results addObject:[NSNull null]];
+            [errors addObject:[NSNull null]];
+        }
+        
+        void (^runSearch)(NSUInteger) = ^(NSUInteger i) {
+            @autoreleasepool {
+                NSFNanoSearch *search = searches[i];
+                NSError *searchError = nil;
+                id result = [search searchObjectsWithReturnType:search.returnedObjectType error:&searchError];
+                @synchronized(results) {
+                    results[i] = (nil != result) ? result : [NSNull null];
+                    errors[i] = ((nil == result) && (nil != searchError)) ? searchError : [NSNull null];
+                }
+            }
+        };
+        
+        BOOL isConsistent = NO;
+        
+        if ((count > 1) && [engine NSFP_hasReaders]) {
+            // Each search reads through a reader of its own. They saw the same version of the document store
+            // as long as nothing was committed while they ran; otherwise the batch runs again below.
+            unsigned long long commitCount = [engine NSFP_commitCount];
+            dispatch_apply(count, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t i) {
+                [self performReadSnapshot:^{
+                    runSearch(i);
+                }];
+            });
+            isConsistent = (commitCount == [engine NSFP_commitCount]);
+        }
+        
+        if (NO == isConsistent) {
+            [self performReadSnapshot:^{
+                // Without a reader there is no snapshot, so the batch shares a read transaction on the writer instead
+                BOOL transactionStartedHere = (NO == [engine NSFP_isReadSnapshotActive]) && [engine beginDeferredTransaction];
+                
+                @try {
+                    for (NSUInteger i = 0; i < count; i++) {
+                        runSearch(i);
+                    }
+                }
+                @finally {
+                    if (transactionStartedHere) {
+                        [engine commitTransaction];
+                    }
+                }
+            }];
+        }
+        
+        NSMutableArray *orderedResults = [[NSMutableArray alloc]initWithCapacity:searchIndexes.count];
+        NSError *firstError = nil;
+        for (NSNumber *index in searchIndexes) {
+            [orderedResults addObject:results[index.unsignedIntegerValue]];
+            if ((nil == firstError) && ([NSNull null] != errors[index.unsignedIntegerValue])) {
+                firstError = errors[index.unsignedIntegerValue];
+            }
+        }
+        
+        dispatch_async(theQueue, ^{
+            theCompletion(orderedResults, firstError);
+        });
+    });
+}
+
+#pragma mark -
+
+// ----------------------------------------------
+// Index advisor
+// ----------------------------------------------
+
+- (NSArray *)indexRecommendations
+{
+    if ([self _checkNanoStoreIsReadyAndReturnError:nil] == NO)
+        return @[];
+    
+    NSCountedSet *shapes = nil;
+    @synchronized(_recordedSearchShapes) {
+        shapes = [_recordedSearchShapes copy];
+    }
+    
+    NSMutableArray *recommendations = [NSMutableArray new];
+    
+    for (NSArray *shape in shapes) {
+        NSFIndexRecommendationType type = [shape[0]unsignedIntValue];
+        NSString *attribute = shape[1];
+        NSFNanoDatatype datatype = NSFNanoTypeString;
+        
+        if (NSFCaseFoldedIndexRecommendation == type) {
+            if ([self hasCaseFoldedIndexForAttribute:attribute]) {
+                continue;
+            }
+        } else {
+            if (NSFNanoTypeUnknown != [self typeOfIndexForAttribute:attribute]) {
+                continue;
+            }
+            
+            // The search compiler ignores the index of an undotted attribute found under several key paths
+            if ((NSNotFound == [attribute rangeOfString:@"."].location) && (NO == [self _isOnlyKeyPathWithSegment:attribute])) {
+                continue;
+            }
+            
+            datatype = [self _prevailingDatatypeForAttribute:attribute];
+            if ((NSFNanoTypeString != datatype) && (NSFNanoTypeNumber != datatype) && (NSFNanoTypeDate != datatype)) {
+                continue;
+            }
+        }
+        
+        NSUInteger searchCount = [shapes countForObject:shape];
+        double gain = [self _estimatedRowsSavedPerSearchOnAttribute:attribute] * searchCount;
+        if (gain <= 0) {
+            continue;
+        }
+        
+        [recommendations addObject:@{NSFIndexRecommendationAttributeKey : attribute,
+                                     NSFIndexRecommendationTypeKey : @(type),
+                                     NSFIndexRecommendationDatatypeKey : @(datatype),
+                                     NSFIndexRecommendationSearchCountKey : @(searchCount),
+                                     NSFIndexRecommendationEstimatedGainKey : @(gain)}];
+    }
+    
+    [recommendations sortUsingDescriptors:@[[NSSortDescriptor sortDescriptorWithKey:NSFIndexRecommendationEstimatedGainKey ascending:NO]]];
+    
+    return recommendations;
+}
+
+- (BOOL)createRecommendedIndexes:(NSArray *)theRecommendations error:(NSError * __autoreleasing *)outError
+{
+    if (nil == theRecommendations)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: theRecommendations is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    for (NSDictionary *recommendation in theRecommendations) {
+        NSString *attribute = recommendation[NSFIndexRecommendationAttributeKey];
+        BOOL success = NO;
+        
+        if (NSFCaseFoldedIndexRecommendation == [recommendation[NSFIndexRecommendationTypeKey]unsignedIntValue]) {
+            success = [self createCaseFoldedIndexForAttribute:attribute error:outError];
+        } else {
+            success = [self createIndexForAttribute:attribute type:(NSFNanoDatatype)[recommendation[NSFIndexRecommendationDatatypeKey]intValue] error:outError];
+        }
+        
+        if (NO == success) {
+            return NO;
+        }
+    }
+    
+    return YES;
+}
+
+- (void)clearRecordedSearchShapes
+{
+    @synchronized(_recordedSearchShapes) {
+        [_recordedSearchShapes removeAllObjects];
+    }
+}
+
+- (BOOL)saveStoreToDirectoryAtPath:(NSString *)path compactDatabase:(BOOL)compact error:(NSError * __autoreleasing *)outError
+{
+    if (nil == path)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: path is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    // Make sure we've expanded the tilde
+    path = path.stringByExpandingTildeInPath;
+    
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return NO;
+    
+    if ([[self nanoStoreEngine]isTransactionActive]) {
+        if (nil != outError) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:@{NSLocalizedDescriptionKey: @"Cannot backup store. A transaction is still open."}];
+        }
+        return NO;
+    }
+    
+    if ([[self filePath]isEqualToString:NSFMemoryDatabase] == YES) {
+        return [self _backupMemoryStoreToDirectoryAtPath:path extension:nil compact:compact error:outError];
+    } else {
+        return [self _backupFileStoreToDirectoryAtPath:path extension:nil compact:compact error:outError];
+    }
+    
+    return NO;
+}
+
+#pragma mark - Private Methods
+#pragma mark -
+
+/** \cond */
+
++ (NSFNanoStore *)_createAndOpenDebugDatabase
+{
+    NSFNanoStore *db =  [NSFNanoStore createStoreWithType:NSFPersistentStoreType path:(@"~/Desktop/NanoStoreDebug.sqlite").stringByExpandingTildeInPath];
+    NSError *outError = nil;
+    
+    if (NO == [db openWithError:&outError]) {
+        [[NSException exceptionWithName:NSFNanoStoreUnableToManipulateStoreException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: could not open the database. Reason: %@", [self class], NSStringFromSelector(_cmd), outError.localizedDescription]
+                               userInfo:nil]raise];
+    }
+    
+    return db;
+}
+
+- (NSFNanoResult *)_executeSQL:(NSString *)theSQLStatement
+{
+    if (nil == theSQLStatement)
+        return nil;
+    
+    return [[self nanoStoreEngine]executeSQL:theSQLStatement];
+}
+
+- (BOOL)_initializePreparedStatementsWithError:(NSError * __autoreleasing *)outError
+{
+    BOOL hasInitializationSucceeded = YES;
+    
+    if (NULL == _storeValuesStatement) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@, %@, %@, %@) VALUES (?,?,?,?,?);", NSFValues, NSFKey, NSFAttribute, NSFValue, NSFDatatype, NSFFoldedValue];
+        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_storeValuesStatement theSQLStatement:theSQLStatement];
+        
+        if (NO == hasInitializationSucceeded) {
+            if (nil != outError) {
+                *outError = [NSError errorWithDomain:NSFDomainKey
+                                                code:NSFNanoStoreErrorKey
+                                            userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: failed to prepare _storeValuesStatement.", [self class], NSStringFromSelector(_cmd)]}];
+            }
+            return NO;
+        }
+    }
+    
+    if (NULL == _storeKeysStatement) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@, %@, %@) VALUES (?,?,?,?);", NSFKeys, NSFKey, NSFKeyedArchive, NSFCalendarDate, NSFObjectClass];
+        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_storeKeysStatement theSQLStatement:theSQLStatement];
+        
+        if (NO == hasInitializationSucceeded) {
+            if (nil != outError) {
+                *outError = [NSError errorWithDomain:NSFDomainKey
+                                                code:NSFNanoStoreErrorKey
+                                            userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: failed to prepare _storeKeysStatement.", [self class], NSStringFromSelector(_cmd)]}];
+            }
+            return NO;
+        }
+    }
+    
+    if (NULL == _storeKeyPathSegmentsStatement) {
+        // Each (attribute, depth) pair identifies a single segment, so only record it once
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@, %@) SELECT ?1, ?2, ?3 WHERE NOT EXISTS (SELECT 1 FROM %@ WHERE %@ = ?1 AND %@ = ?3);", NSFKeyPathSegments, NSFAttribute, NSFSegment, NSFDepth, NSFKeyPathSegments, NSFAttribute, NSFDepth];
+        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_storeKeyPathSegmentsStatement theSQLStatement:theSQLStatement];
+        
+        if (NO == hasInitializationSucceeded) {
+            if (nil != outError) {
+                *outError = [NSError errorWithDomain:NSFDomainKey
+                                                code:NSFNanoStoreErrorKey
+                                            userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: failed to prepare _storeKeyPathSegmentsStatement.", [self class], NSStringFromSelector(_cmd)]}];
+            }
+            return NO;
+        }
+    }
+    
+    if ((NULL == _storeFullTextStatement) && (_fullTextAttributes.count > 0)) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(rowid, %@) VALUES (?,?);", NSFFullTextValues, NSFValue];
+        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_storeFullTextStatement theSQLStatement:theSQLStatement];
+        
+        if (NO == hasInitializationSucceeded) {
+            if (nil != outError) {
+                *outError = [NSError errorWithDomain:NSFDomainKey
+                                                code:NSFNanoStoreErrorKey
+                                            userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: failed to prepare _storeFullTextStatement.", [self class], NSStringFromSelector(_cmd)]}];
+            }
+            return NO;
+        }
+    }
+    
+    return YES;
+}
+
+- (void)_releasePreparedStatements
+{
+    if (_insertDeleteKeysStatement != NULL) { sqlite3_finalize(_insertDeleteKeysStatement);_insertDeleteKeysStatement = NULL; }
+    if (_storeValuesStatement != NULL) { sqlite3_finalize(_storeValuesStatement);_storeValuesStatement = NULL; }
+    if (_storeKeysStatement != NULL) { sqlite3_finalize(_storeKeysStatement);_storeKeysStatement = NULL; }
+    if (_storeKeyPathSegmentsStatement != NULL) { sqlite3_finalize(_storeKeyPathSegmentsStatement);_storeKeyPathSegmentsStatement = NULL; }
+    if (_storeFullTextStatement != NULL) { sqlite3_finalize(_storeFullTextStatement);_storeFullTextStatement = NULL; }
+    if (_lookupKeysStatement != NULL) { sqlite3_finalize(_lookupKeysStatement);_lookupKeysStatement = NULL; }
+    if (_storeBagMemberStatement != NULL) { sqlite3_finalize(_storeBagMemberStatement);_storeBagMemberStatement = NULL; }
+    if (_removeBagMemberStatement != NULL) { sqlite3_finalize(_removeBagMemberStatement);_removeBagMemberStatement = NULL; }
+}
+
+- (void)_setIsOurTransaction:(BOOL)value
+{
+    if (_isOurTransaction != value) {
+        _isOurTransaction = value;
+    }
+}
+
+- (BOOL)_isOurTransaction
+{
+    return _isOurTransaction;
+}
+
+- (BOOL)_checkNanoStoreIsReadyAndReturnError:(NSError * __autoreleasing *)outError
+{
+    if (nil == self.nanoStoreEngine) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: the NSF store has not been set.", [self class], NSStringFromSelector(_cmd)]}];
+        return NO;
+    }
+    
+    if ([[self nanoStoreEngine]isDatabaseOpen] == NO) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: the store is not open.", [self class], NSStringFromSelector(_cmd)]}];
+        return NO;
+    }
+    
+    return YES;
+}
+
+- (BOOL)_setupCachingSchema
+{
+    NSString *theSQLStatement;
+    BOOL success;
+    NSArray *tables = [[self nanoStoreEngine]tables];
+
+    // Setup the Values table
+    if ([tables containsObject:NSFValues] == NO) {
+        theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(ROWID INTEGER PRIMARY KEY, %@ TEXT, %@ TEXT, %@ NONE, %@ TEXT, %@ TEXT);", NSFValues, NSFKey, NSFAttribute, NSFValue, NSFDatatype, NSFFoldedValue];
+        success = (nil == [[self nanoStoreEngine]executeSQL:theSQLStatement].error);
+        if (NO == success) {
+            return NO;
+        }
+    } else if ([[[self nanoStoreEngine]columnsForTable:NSFValues]containsObject:NSFFoldedValue] == NO) {
+        // Stores created before the case-folded values existed need the column added
+        theSQLStatement = [NSString stringWithFormat:@"ALTER TABLE %@ ADD COLUMN %@ TEXT;", NSFValues, NSFFoldedValue];
+        success = (nil == [[self nanoStoreEngine]executeSQL:theSQLStatement].error);
+        if (NO == success) {
+            return NO;
+        }
+}
+    
+    // Setup the Plist table
+    if ([tables containsObject:NSFKeys] == NO) {
+        theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(ROWID INTEGER PRIMARY KEY, %@ TEXT, %@ BLOB, %@ TEXT, %@ TEXT);", NSFKeys, NSFKey, NSFKeyedArchive, NSFCalendarDate, NSFObjectClass];
+
+        success = (nil == [[self nanoStoreEngine]executeSQL:theSQLStatement].error);
+        if (NO == success) {
+            return NO;
+        }
+}
+    
+    // Setup the key path segments table
+    if ([tables containsObject:NSFKeyPathSegments] == NO) {
+        theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(ROWID INTEGER PRIMARY KEY, %@ TEXT, %@ TEXT, %@ INTEGER);", NSFKeyPathSegments, NSFAttribute, NSFSegment, NSFDepth];
+        
+        success = (nil == [[self nanoStoreEngine]executeSQL:theSQLStatement].error);
+        if (NO == success) {
+            return NO;
+        }
+        
+        // Stores created before the segments table existed need to have it populated. The attributes are split
+        // in a single statement, so a large store is migrated in one write instead of one per segment.
+        if ([tables containsObject:NSFValues] == YES) {
+            theSQLStatement = [NSString stringWithFormat:@"INSERT INTO %@(%@, %@, %@) WITH RECURSIVE NSFSplit(%@, %@, NSFRest, %@) AS "
+                               @"(SELECT %@, NULL, %@ || '.', -1 FROM (SELECT DISTINCT %@ FROM %@) "
+                               @"UNION ALL SELECT %@, substr(NSFRest, 1, instr(NSFRest, '.') - 1), substr(NSFRest, instr(NSFRest, '.') + 1), %@ + 1 FROM NSFSplit WHERE NSFRest <> '') "
+                               @"SELECT %@, %@, %@ FROM NSFSplit WHERE %@ >= 0 ORDER BY %@, %@;",
+                               NSFKeyPathSegments, NSFAttribute, NSFSegment, NSFDepth, NSFAttribute, NSFSegment, NSFDepth,
+                               NSFAttribute, NSFAttribute, NSFAttribute, NSFValues,
+                               NSFAttribute, NSFDepth,
+                               NSFAttribute, NSFSegment, NSFDepth, NSFDepth, NSFAttribute, NSFDepth];
+            success = (nil == [[self nanoStoreEngine]executeSQL:theSQLStatement].error);
+            if (NO == success) {
+                return NO;
+            }
+        }
+    }
+    
+    // Setup the bag membership table
+    if ([tables containsObject:NSFBagMembers] == NO) {
+        theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(ROWID INTEGER PRIMARY KEY, %@ TEXT, %@ TEXT);", NSFBagMembers, NSFBagKey, NSFKey];
+        
+        success = (nil == [[self nanoStoreEngine]executeSQL:theSQLStatement].error);
+        if (NO == success) {
+            return NO;
+        }
+        
+        // Stores created before the membership table existed kept the member keys inside each bag. Only bags are
+        // read: an object of another class may well have an attribute with the same name. Keys of objects which
+        // have been removed since are left behind.
+        if ([tables containsObject:NSFValues] == YES) {
+            theSQLStatement = [NSString stringWithFormat:@"INSERT INTO %@(%@, %@) SELECT %@, %@ FROM %@ WHERE %@ = '%@' AND %@ IN (SELECT %@ FROM %@ WHERE %@ = '%@') AND %@ IN (SELECT %@ FROM %@) ORDER BY ROWID;",
+                               NSFBagMembers, NSFBagKey, NSFKey, NSFKey, NSFValue, NSFValues, NSFAttribute, NSF_Private_NSFNanoBag_NSFObjectKeys,
+                               NSFKey, NSFKey, NSFKeys, NSFObjectClass, NSStringFromClass([NSFNanoBag class]),
+                               NSFValue, NSFKey, NSFKeys];
+            success = (nil == [[self nanoStoreEngine]executeSQL:theSQLStatement].error);
+            if (NO == success) {
+                // Without the table, the next opening tries the migration again
+                [[self nanoStoreEngine]executeSQL:[NSString stringWithFormat:@"DROP TABLE %@;", NSFBagMembers]];
+                return NO;
+            }
+        }
+        
+        [self _createBagMembersIndexes];
+    }
+    
+    return YES;
+}
+
+- (BOOL)_storeDictionary:(NSDictionary *)someInfo forKey:(NSString *)aKey forClassNamed:(NSString *)classType error:(NSError * __autoreleasing *)outError
+{
+    if (nil == someInfo)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: someInfo is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    if (nil == aKey)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: aKey is nil.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    if (NULL == _storeValuesStatement)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: aStatement is NULL.", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    NSRange range = [aKey rangeOfString:@"."];
+    if (NSNotFound != range.location)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %@]: aKey cannot contain a period ('.')", [self class], NSStringFromSelector(_cmd)]
+                               userInfo:nil]raise];
+    
+    NSArray *keys = someInfo.allKeys;
+    for (NSString *key in keys) {
+        range = [key rangeOfString:@"."];
+        if (NSNotFound != range.location)
+            [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                     reason:[NSString stringWithFormat:@"*** -[%@ %@]: the keys of the dictionary cannot contain a period ('.')", [self class], NSStringFromSelector(_cmd)]
+                                   userInfo:nil]raise];
+    }
+    
+    const char *aKeyUTF8 = aKey.UTF8String;
+    BOOL success = YES;
+    
+    // Flatten the dictionary
+    {
+        NSMutableArray *flattenedKeys = [NSMutableArray new];
+        NSMutableArray *flattenedValues = [NSMutableArray new];
+        
+        @autoreleasepool {
+            [self _flattenCollection:someInfo keys:&flattenedKeys values:&flattenedValues];
+            
+            [self _invalidateCachedResultsForKeyPaths:flattenedKeys objectClass:classType];
+            
+            NSUInteger i, count = flattenedKeys.count;
+            
+            success = NO;
+            
+            for (i = 0; i < count; i++) {
+                NSString *attribute = flattenedKeys[i];
+                id value = flattenedValues[i];
+                
+                // Record the segments of key paths we haven't seen yet
+                if (NO == [_indexedKeyPaths containsObject:attribute]) {
+                    if (NO == [self _storeKeyPathSegmentsForAttribute:attribute]) {
+                        success = NO;
+                        break;
+                    }
+                    [_indexedKeyPaths addObject:attribute];
+                }
+                
+                // Reset, as required by SQLite...
+                int status = sqlite3_reset (_storeValuesStatement);
+                
+                // Since we're operating with extended result code support, extract the bits
+                // and obtain the regular result code
+                // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
+                
+                status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+                
+                if (SQLITE_OK == status) {
+                    
+                    // Bind and execute the statement...
+                    BOOL resultBindKey = (sqlite3_bind_text (_storeValuesStatement, 1, aKeyUTF8, -1, SQLITE_STATIC) == SQLITE_OK);
+                    BOOL resultBindAttribute = (sqlite3_bind_text (_storeValuesStatement, 2, attribute.UTF8String, -1, SQLITE_STATIC) == SQLITE_OK);
+                    
+                    // Take advantage of manifest typing
+                    // Branch the type of bind based on the type to be stored: NSString, NSData, NSDate or NSNumber
+                    NSFNanoDatatype valueDataType = [self _NSFDatatypeOfObject:value];
+                    BOOL resultBindValue = NO;
+                    
+                    switch (valueDataType) {
+                        case NSFNanoTypeData:
+                            resultBindValue = (sqlite3_bind_blob(_storeValuesStatement, 3, [value bytes], (int)[value length], NULL) == SQLITE_OK);
+                            break;
+                        case NSFNanoTypeString:
+                        case NSFNanoTypeDate:
+                            resultBindValue = (sqlite3_bind_text (_storeValuesStatement, 3, [self _stringFromValue:value].UTF8String, -1, SQLITE_STATIC) == SQLITE_OK);
+                            break;
+                            break;
+                        case NSFNanoTypeNumber:
+                            resultBindValue = (sqlite3_bind_double (_storeValuesStatement, 3, [value doubleValue]) == SQLITE_OK);
+                            break;
+                        case NSFNanoTypeNULL:
+                            resultBindValue = (sqlite3_bind_null(_storeValuesStatement, 3) == SQLITE_OK);
+                            break;
+                        case NSFNanoTypeURL:
+                            resultBindValue = (sqlite3_bind_text (_storeValuesStatement, 3, [self _stringFromValue:value].UTF8String, -1, SQLITE_STATIC) == SQLITE_OK);
+                            break;
+                        default:
+                            [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                                     reason:[NSString stringWithFormat:@"*** -[%@ %@]: datatype %@ cannot be stored because its class type is unknown.", [self class], NSStringFromSelector(_cmd), [value class]]
+                                                   userInfo:nil]raise];
+                            break;
+                    }
+                    
+                    // Store the element's datatype so we can recreate it later on when we read it back from the store...
+                    NSString *valueDatatypeString = NSFStringFromNanoDataType(valueDataType);
+                    BOOL resultBindDatatype = (sqlite3_bind_text (_storeValuesStatement, 4, valueDatatypeString.UTF8String, -1, SQLITE_STATIC) == SQLITE_OK);
+                    
+                    // Keep a case-folded copy of the text values whose attribute has opted in
+                    BOOL resultBindFoldedValue = NO;
+                    if ((NSFNanoTypeString == valueDataType) && [self _isKeyPath:attribute coveredByAttributes:_caseFoldedAttributes]) {
+                        resultBindFoldedValue = (sqlite3_bind_text (_storeValuesStatement, 5, NSFCaseFoldedString(value).UTF8String, -1, SQLITE_TRANSIENT) == SQLITE_OK);
+                    } else {
+                        resultBindFoldedValue = (sqlite3_bind_null(_storeValuesStatement, 5) == SQLITE_OK);
+                    }
+                    
+                    success = (resultBindKey && resultBindAttribute && resultBindValue && resultBindDatatype && resultBindFoldedValue);
+                    if (success) {
+                        [self _executeSQLite3StepUsingSQLite3Statement:_storeValuesStatement];
+                        
+                        // Mirror the text value into the full-text index, sharing the NSFValues rowid
+                        if ((NULL != _storeFullTextStatement) && [valueDatatypeString isEqualToString:NSFStringFromNanoDataType(NSFNanoTypeString)] && [self _isFullTextIndexedKeyPath:attribute]) {
+                            success = [self _storeFullTextValue:[self _stringFromValue:value] rowUID:sqlite3_last_insert_rowid(self.nanoStoreEngine.sqlite)];
+                        }
+                    }
+                }
+            }
+            
+        }
+    }
+    
+    if (success) {
+        NSData *dictBinData = [NSKeyedArchiver archivedDataWithRootObject:someInfo];
+        {
+            int status = sqlite3_reset (_storeKeysStatement);
+            
+            // Since we're operating with extended result code support, extract the bits
+            // and obtain the regular result code
+            // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
+            
+            status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+            
+            // Bind and execute the statement...
+            if (SQLITE_OK == status) {
+                
+                BOOL resultBindKey = (sqlite3_bind_text (_storeKeysStatement, 1, aKeyUTF8, -1, SQLITE_STATIC) == SQLITE_OK);
+                BOOL resultBindData = (sqlite3_bind_blob(_storeKeysStatement, 2, dictBinData.bytes, (int)dictBinData.length, SQLITE_STATIC) == SQLITE_OK);
+                BOOL resultBindCalendarDate = (sqlite3_bind_text (_storeKeysStatement, 3, [NSFNanoStore _calendarDateToString:[NSDate date]].UTF8String, -1, SQLITE_STATIC) == SQLITE_OK);
+                BOOL resultBindClass = (sqlite3_bind_text (_storeKeysStatement, 4, classType.UTF8String, -1, SQLITE_STATIC) == SQLITE_OK);
+                
+                success = (resultBindKey && resultBindData && resultBindCalendarDate && resultBindClass);
+                if (success) {
+                    [self _executeSQLite3StepUsingSQLite3Statement:_storeKeysStatement];
+                }
+            }
+        }
+    }
+    
+    return success;
+}
+
+- (BOOL)_storeKeyPathSegmentsForAttribute:(NSString *)anAttribute
+{
+    NSArray *segments = [anAttribute componentsSeparatedByString:@"."];
+    NSUInteger i, count = segments.count;
+    
+    for (i = 0; i < count; i++) {
+        int status = sqlite3_reset (_storeKeyPathSegmentsStatement);
+        
+        // Since we're operating with extended result code support, extract the bits
+        // and obtain the regular result code
+        // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
+        
+        status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+        
+        if (SQLITE_OK != status) {
+            return NO;
+        }
+        
+        // Bind and execute the statement...
+        BOOL resultBindAttribute = (sqlite3_bind_text (_storeKeyPathSegmentsStatement, 1, anAttribute.UTF8String, -1, SQLITE_STATIC) == SQLITE_OK);
+        BOOL resultBindSegment = (sqlite3_bind_text (_storeKeyPathSegmentsStatement, 2, [segments[i] UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
+        BOOL resultBindDepth = (sqlite3_bind_int (_storeKeyPathSegmentsStatement, 3, (int)i) == SQLITE_OK);
+        
+        if ((NO == resultBindAttribute) || (NO == resultBindSegment) || (NO == resultBindDepth)) {
+            return NO;
+        }
+        
+        // A segment that failed to be stored must not let the attribute be recorded as indexed
+        if (SQLITE_DONE != [self _executeSQLite3StepUsingSQLite3Statement:_storeKeyPathSegmentsStatement]) {
+            return NO;
+        }
+    }
+    
+    return YES;
+}
+
+- (BOOL)_storeFullTextValue:(NSString *)aValue rowUID:(long long)aRowUID
+{
+    int status = sqlite3_reset (_storeFullTextStatement);
+    
+    // Since we're operating with extended result code support, extract the bits
+    // and obtain the regular result code
+    // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
+    
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    
+    if (SQLITE_OK != status) {
+        return NO;
+    }
+    
+    // Bind and execute the statement...
+    BOOL resultBindRowUID = (sqlite3_bind_int64 (_storeFullTextStatement, 1, aRowUID) == SQLITE_OK);
+    BOOL resultBindValue = (sqlite3_bind_text (_storeFullTextStatement, 2, aValue.UTF8String, -1, SQLITE_STATIC) == SQLITE_OK);
+    
+    if ((NO == resultBindRowUID) || (NO == resultBindValue)) {
+        return NO;
+    }
+    
+    [self _executeSQLite3StepUsingSQLite3Statement:_storeFullTextStatement];
+    
+    return YES;
+}
+
+- (void)_loadFullTextAttributes
+{
+    [_fullTextAttributes removeAllObjects];
+    
+    if ([[[self nanoStoreEngine]tables]containsObject:NSFFullTextAttributes]) {
+        NSFNanoResult *result = [self _executeSQL:[NSString stringWithFormat:@"SELECT %@ FROM %@", NSFAttribute, NSFFullTextAttributes]];
+        [_fullTextAttributes addObjectsFromArray:[result valuesForColumn:NSFAttribute]];
+    }
+    
+    // Older indexes split the values into words, which can't resolve the substrings contains searches look for
+    if (_fullTextAttributes.count > 0) {
+        NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT sql FROM sqlite_master WHERE type = 'table' AND name = '%@'", NSFFullTextValues];
+        NSString *tableDefinition = [[self _executeSQL:theSQLStatement]valuesForColumn:@"sql"].firstObject;
+        if ((nil != tableDefinition) && (NSNotFound == [tableDefinition rangeOfString:@"trigram"].location)) {
+            [self _rebuildFullTextTable];
+        }
+    }
+}
+
+- (NSString *)_SQLForCreatingFullTextTableNamed:(NSString *)aTableName
+{
+    // Trigrams let the index find any substring of three characters or more, so it can narrow down contains searches
+    return [NSString stringWithFormat:@"CREATE VIRTUAL TABLE %@ USING fts5(%@, tokenize='trigram');", aTableName, NSFValue];
+}
+
+- (BOOL)_rebuildFullTextTable
+{
+    BOOL transactionStartedHere = [self beginTransactionAndReturnError:nil];
+    
+    NSError *resultError = [self _executeSQL:[NSString stringWithFormat:@"DROP TABLE %@;", NSFFullTextValues]].error;
+    
+    if (nil == resultError) {
+        resultError = [self _executeSQL:[self _SQLForCreatingFullTextTableNamed:NSFFullTextValues]].error;
+    }
+    
+    for (NSString *attribute in _fullTextAttributes) {
+        if (nil != resultError) {
+            break;
+        }
+        resultError = [self _populateFullTextIndexForAttribute:attribute].error;
+    }
+    
+    if (transactionStartedHere) {
+        if (nil == resultError) {
+            [self commitTransactionAndReturnError:nil];
+        } else {
+            [self rollbackTransactionAndReturnError:nil];
+        }
+    }
+    
+    if (nil != resultError) {
+        _NSFLog(@"          Could not rebuild the full-text index: %@", resultError.localizedDescription);
+    }
+    
+    return (nil == resultError);
+}
+
+- (BOOL)_isFullTextIndexedKeyPath:(NSString *)aKeyPath
+{
+    return [self _isKeyPath:aKeyPath coveredByAttributes:_fullTextAttributes];
+}
+
+- (BOOL)_isCaseFoldedKeyPath:(NSString *)aKeyPath
+{
+    return [self _isKeyPath:aKeyPath coveredByAttributes:_caseFoldedAttributes];
+}
+
+- (BOOL)_isKeyPath:(NSString *)aKeyPath coveredByAttributes:(NSSet *)someAttributes
+{
+    if (0 == someAttributes.count) {
+        return NO;
+    }
+    
+    if ([someAttributes containsObject:NSF_Private_AllAttributesKey]) {
+        return YES;
+    }
+    
+    // Dotted attributes name a whole key path, just like they do in searches
+    if ([someAttributes containsObject:aKeyPath]) {
+        return YES;
+    }
+    
+    // The others match at any depth of the key path
+    for (NSString *segment in [aKeyPath componentsSeparatedByString:@"."]) {
+        if ([someAttributes containsObject:segment]) {
+            return YES;
+        }
+    }
+    
+    return NO;
+}
+
+- (void)_loadCaseFoldedAttributes
+{
+    [_caseFoldedAttributes removeAllObjects];
+    
+    if ([[[self nanoStoreEngine]tables]containsObject:NSFFoldedAttributes]) {
+        NSFNanoResult *result = [self _executeSQL:[NSString stringWithFormat:@"SELECT %@ FROM %@", NSFAttribute, NSFFoldedAttributes]];
+        [_caseFoldedAttributes addObjectsFromArray:[result valuesForColumn:NSFAttribute]];
+    }
+}
+
+- (NSFNanoResult *)_populateCaseFoldedValuesForAttribute:(NSString *)anAttribute
+{
+    NSMutableString *theSQLStatement = [NSMutableString stringWithFormat:@"UPDATE %@ SET %@ = NSFCaseFold(%@) WHERE %@ = '%@'",
+                                        NSFValues, NSFFoldedValue, NSFValue, NSFDatatype, NSFStringFromNanoDataType(NSFNanoTypeString)];
+    
+    // Dotted attributes name a whole key path, the others match at any depth
+    if (NSNotFound != [anAttribute rangeOfString:@"."].location) {
+        [theSQLStatement appendFormat:@" AND %@ = '%@'", NSFAttribute, [anAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+    } else {
+        [theSQLStatement appendFormat:@" AND %@ IN (SELECT %@ FROM %@ WHERE %@ = '%@')", NSFAttribute, NSFAttribute, NSFKeyPathSegments, NSFSegment, [anAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+    }
+    
+    return [self _executeSQL:theSQLStatement];
+}
+
+- (void)_loadAttributeIndexes
+{
+    [_attributeIndexes removeAllObjects];
+    
+    if ([[[self nanoStoreEngine]tables]containsObject:NSFAttributeIndexes]) {
+        NSFNanoResult *result = [self _executeSQL:[NSString stringWithFormat:@"SELECT %@, %@ FROM %@", NSFAttribute, NSFDatatype, NSFAttributeIndexes]];
+        NSArray *attributes = [result valuesForColumn:NSFAttribute];
+        NSArray *types = [result valuesForColumn:NSFDatatype];
+        
+        for (NSUInteger i = 0; i < attributes.count; i++) {
+            _attributeIndexes[attributes[i]] = @([types[i]integerValue]);
+        }
+    }
+}
+
++ (NSString *)_indexNameForAttribute:(NSString *)anAttribute
+{
+    // Attributes can contain any character, so quote the identifier
+    NSString *indexName = [NSString stringWithFormat:@"%@_%@_%@_IDX", NSFAttributeIndexes, NSFAttribute, anAttribute];
+    
+    return [NSString stringWithFormat:@"\"%@\"", [indexName stringByReplacingOccurrencesOfString:@"\"" withString:@"\"\""]];
+}
+
+- (BOOL)_createIndexForAttribute:(NSString *)anAttribute
+{
+    // Partial covering index: the search compiler filters on the exact attribute, so SQLite can
+    // range-scan the values of that attribute alone and read the keys straight from the index
+    NSString *theSQLStatement = [NSString stringWithFormat:@"CREATE INDEX IF NOT EXISTS %@ ON %@ (%@, %@) WHERE %@ = '%@';",
+                                 [NSFNanoStore _indexNameForAttribute:anAttribute], NSFValues, NSFValue, NSFKey, NSFAttribute, [anAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+    
+    return (nil == [self _executeSQL:theSQLStatement].error);
+}
+
+- (BOOL)_isOnlyKeyPathWithSegment:(NSString *)anAttribute
+{
+    NSString *escapedAttribute = [anAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"];
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT %@ FROM %@ WHERE %@ = '%@' AND %@ <> '%@' LIMIT 1",
+                                 NSFAttribute, NSFKeyPathSegments, NSFSegment, escapedAttribute, NSFAttribute, escapedAttribute];
+    
+    return (0 == [self _executeSQL:theSQLStatement].numberOfRows);
+}
+
+- (void)_recordSearchOnAttribute:(NSString *)anAttribute matching:(NSFMatchType)aMatch
+{
+    NSFIndexRecommendationType type = NSFAttributeIndexRecommendation;
+    
+    switch (aMatch) {
+        case NSFInsensitiveEqualTo:
+        case NSFInsensitiveBeginsWith:
+            type = NSFCaseFoldedIndexRecommendation;
+            break;
+        case NSFContains:
+        case NSFEndsWith:
+        case NSFInsensitiveContains:
+        case NSFInsensitiveEndsWith:
+            // A leading wildcard can't be resolved through an index
+            return;
+        default:
+            break;
+    }
+    
+    @synchronized(_recordedSearchShapes) {
+        [_recordedSearchShapes addObject:@[@(type), anAttribute]];
+    }
+}
+
+- (NSString *)_querySegmentForRowsOfAttribute:(NSString *)anAttribute
+{
+    NSString *escapedAttribute = [anAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"];
+    
+    // Undotted attributes match at any depth, just like they do when searching
+    if (NSNotFound == [anAttribute rangeOfString:@"."].location) {
+        return [NSString stringWithFormat:@"%@ IN (SELECT %@ FROM %@ WHERE %@ = '%@')", NSFAttribute, NSFAttribute, NSFKeyPathSegments, NSFSegment, escapedAttribute];
+    }
+    
+    return [NSString stringWithFormat:@"%@ = '%@'", NSFAttribute, escapedAttribute];
+}
+
+- (NSFNanoDatatype)_prevailingDatatypeForAttribute:(NSString *)anAttribute
+{
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT %@ FROM %@ WHERE %@ GROUP BY %@ ORDER BY count(*) DESC LIMIT 1",
+                                 NSFDatatype, NSFValues, [self _querySegmentForRowsOfAttribute:anAttribute], NSFDatatype];
+    NSString *datatype = [self _executeSQL:theSQLStatement].firstValue;
+    
+    return (nil == datatype) ? NSFNanoTypeUnknown : NSFNanoDatatypeFromString(datatype);
+}
+
+- (double)_estimatedRowsSavedPerSearchOnAttribute:(NSString *)anAttribute
+{
+    // Without a dedicated index every value of the attribute gets visited. With it, a lookup visits
+    // about as many rows as share a value.
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT count(*) AS NSFRows, count(DISTINCT %@) AS NSFDistinctValues FROM %@ WHERE %@",
+                                 NSFValue, NSFValues, [self _querySegmentForRowsOfAttribute:anAttribute]];
+    NSFNanoResult *result = [self _executeSQL:theSQLStatement];
+    if (0 == result.numberOfRows) {
+        return 0;
+    }
+    
+    double rows = [result doubleAtIndex:0 forColumn:@"NSFRows"];
+    double distinctValues = [result doubleAtIndex:0 forColumn:@"NSFDistinctValues"];
+    
+    if (distinctValues < 1) {
+        return 0;
+    }
+    
+    return rows - (rows / distinctValues);
+}
+
+- (id)_liveObjectForKey:(NSString *)aKey
+{
+    if (NO == _usesIdentityMap) {
+        return nil;
+    }
+    
+    @synchronized(_objectCache) {
+        id liveObject = [_liveObjects objectForKey:aKey];
+        if (nil != liveObject) {
+            _objectCacheHitCount++;
+        }
+        
+        return liveObject;
+    }
+}
+
+- (void)_registerLiveObject:(id)anObject
+{
+    if (NO == _usesIdentityMap) {
+        return;
+    }
+    
+    NSString *key = [anObject nanoObjectKey];
+    if (nil == key) {
+        return;
+    }
+    
+    @synchronized(_objectCache) {
+        [_liveObjects setObject:anObject forKey:key];
+    }
+}
+
+- (NSDictionary *)_cachedInfoForKey:(NSString *)aKey
+{
+    if ((NO == _usesIdentityMap) && (0 == _objectCacheCountLimit)) {
+        return nil;
+    }
+    
+    @synchronized(_objectCache) {
+        NSDictionary *entry = _objectCache[aKey];
+        if (nil == entry) {
+            _objectCacheMissCount++;
+            return nil;
+        }
+        
+        _objectCacheHitCount++;
+        
+        // Most recently used documents live at the end
+        [_objectCacheOrder removeObject:aKey];
+        [_objectCacheOrder addObject:aKey];
+        
+        return entry[NSF_Private_ObjectCacheInfoKey];
+    }
+}
+
+- (void)_cacheInfo:(NSDictionary *)theInfo forKey:(NSString *)aKey cost:(NSUInteger)aCost
+{
+    if (0 == _objectCacheCountLimit) {
+        return;
+    }
+    
+    @synchronized(_objectCache) {
+        [self _removeCachedInfoForKey:aKey];
+        [self _evictCachedObjectsToFitCount:1];
+        
+        _objectCache[aKey] = @{NSF_Private_ObjectCacheInfoKey : theInfo, NSF_Private_ObjectCacheCostKey : @(aCost)};
+        [_objectCacheOrder addObject:aKey];
+        _objectCacheByteCount += aCost;
+    }
+}
+
+- (void)_evictCachedObjectsWithKeys:(NSArray *)someKeys
+{
+    @synchronized(_objectCache) {
+        for (NSString *key in someKeys) {
+            [_liveObjects removeObjectForKey:key];
+            [self _removeCachedInfoForKey:key];
+        }
+    }
+}
+
+- (void)_removeCachedInfoForKey:(NSString *)aKey
+{
+    NSDictionary *entry = _objectCache[aKey];
+    if (nil != entry) {
+        _objectCacheByteCount -= [entry[NSF_Private_ObjectCacheCostKey]unsignedIntegerValue];
+        [_objectCache removeObjectForKey:aKey];
+        [_objectCacheOrder removeObject:aKey];
+    }
+}
+
+- (void)_evictCachedObjectsToFitCount:(NSUInteger)aCount
+{
+    // Least recently used documents go first
+    while ((_objectCacheOrder.count > 0) && (_objectCacheOrder.count + aCount > _objectCacheCountLimit)) {
+        [self _removeCachedInfoForKey:_objectCacheOrder.firstObject];
+    }
+}
+
+- (BOOL)_isResultCacheEnabled
+{
+    // A snapshot may be older than what the cache holds, and what it reads would be stale for everybody else
+    return ((_resultCacheCostLimit > 0) && (NO == [self.nanoStoreEngine NSFP_isReadSnapshotActive]));
+}
+
+- (NSDictionary *)_cachedResultsForKey:(NSString *)aCacheKey
+{
+    @synchronized(_resultCache) {
+        [self _discardResultCacheIfStale];
+        
+        NSDictionary *entry = _resultCache[aCacheKey];
+        if (nil == entry) {
+            return nil;
+        }
+        
+        // Most recently used entries live at the end
+        [_resultCacheOrder removeObject:aCacheKey];
+        [_resultCacheOrder addObject:aCacheKey];
+        
+        // Each caller gets a container of its own, so changing it doesn't change what later hits return
+        return [entry[NSF_Private_ResultCacheResultsKey]mutableCopy];
+    }
+}
+
+- (void)_cacheResults:(NSDictionary *)someResults forKey:(NSString *)aCacheKey attributes:(NSSet *)someAttributes objectClass:(NSString *)aClassName commitCount:(unsigned long long)aCommitCount
+{
+    // The cost is the number of rows cached, plus one so that empty results still count
+    NSUInteger cost = someResults.count + 1;
+    
+    @synchronized(_resultCache) {
+        if (cost > _resultCacheCostLimit) {
+            return;
+        }
+        
+        [self _discardResultCacheIfStale];
+        
+        // The search may have read rows which a commit made meanwhile replaced, or which a write waiting to be committed
+        // is about to replace. Its results were never seen by the invalidation, so they can't be kept.
+        if ((aCommitCount != _resultCacheCommitCount) || (aCommitCount < _resultCacheOldestCacheableCommitCount)) {
+            return;
+        }
+        [self _removeCachedResultsForKey:aCacheKey];
+        [self _evictCachedResultsToFitCost:cost];
+        
+        NSMutableDictionary *entry = [NSMutableDictionary new];
+        entry[NSF_Private_ResultCacheResultsKey] = [someResults copy];
+        if (nil != someAttributes) entry[NSF_Private_ResultCacheAttributesKey] = someAttributes;
+        if (nil != aClassName) entry[NSF_Private_ResultCacheObjectClassKey] = aClassName;
+        
+        _resultCache[aCacheKey] = entry;
+        [_resultCacheOrder addObject:aCacheKey];
+        _resultCacheCost += cost;
+    }
+}
+
+- (void)_removeCachedResultsForKey:(NSString *)aCacheKey
+{
+    NSDictionary *entry = _resultCache[aCacheKey];
+    if (nil != entry) {
+        _resultCacheCost -= [entry[NSF_Private_ResultCacheResultsKey]count] + 1;
+        [_resultCache removeObjectForKey:aCacheKey];
+        [_resultCacheOrder removeObject:aCacheKey];
+    }
+}
+
+- (void)_evictCachedResultsToFitCost:(NSUInteger)aCost
+{
+    // Least recently used entries go first
+    while ((_resultCacheOrder.count > 0) && (_resultCacheCost + aCost > _resultCacheCostLimit)) {
+        [self _removeCachedResultsForKey:_resultCacheOrder.firstObject];
+    }
+}
+
+- (void)_discardResultCacheIfStale
+{
+    unsigned long long commitCount = [[self nanoStoreEngine]NSFP_commitCount];
+    
+    if (commitCount != _resultCacheCommitCount) {
+        _resultCacheCommitCount = commitCount;
+        if (NSFResultCacheInvalidateOnCommit == _resultCacheInvalidation) {
+            [_resultCache removeAllObjects];
+            [_resultCacheOrder removeAllObjects];
+            _resultCacheCost = 0;
+        }
+    }
+}
+
+- (void)_holdResultCacheUntilCommit
+{
+    // The invalidation runs before the write is committed. Until then, searches on a reader still see the rows
+    // being replaced, so only searches started after the commit may fill the cache again.
+    _resultCacheOldestCacheableCommitCount = [[self nanoStoreEngine]NSFP_commitCount] + 1;
+}
+
+- (void)_invalidateCachedResultsContainingKeys:(NSArray *)someKeys
+{
+    if (NSFResultCacheInvalidateByTouchedAttributes != _resultCacheInvalidation) {
+        return;
+    }
+    
+    @synchronized(_resultCache) {
+        [self _holdResultCacheUntilCommit];
+        
+        for (NSString *cacheKey in [_resultCacheOrder copy]) {
+            NSDictionary *results = _resultCache[cacheKey][NSF_Private_ResultCacheResultsKey];
+            for (NSString *key in someKeys) {
+                if (nil != results[key]) {
+                    [self _removeCachedResultsForKey:cacheKey];
+                    break;
+                }
+            }
+        }
+    }
+}
+
+- (void)_invalidateCachedResultsForKeyPaths:(NSArray *)someKeyPaths objectClass:(NSString *)aClassName
+{
+    if (NSFResultCacheInvalidateByTouchedAttributes != _resultCacheInvalidation) {
+        return;
+    }
     
-    // Flatten the dictionary
-    {
-        NSMutableArray *flattenedKeys = [NSMutableArray new];
-        NSMutableArray *flattenedValues = [NSMutableArray new];
+    @synchronized(_resultCache) {
+        [self _holdResultCacheUntilCommit];
         
-        @autoreleasepool {
-            [self _flattenCollection:someInfo keys:&flattenedKeys values:&flattenedValues];
+        for (NSString *cacheKey in [_resultCacheOrder copy]) {
+            NSDictionary *entry = _resultCache[cacheKey];
+            NSSet *attributes = entry[NSF_Private_ResultCacheAttributesKey];
+            NSString *className = entry[NSF_Private_ResultCacheObjectClassKey];
             
-            NSUInteger i, count = flattenedKeys.count;
+            // Results filtered by class can't gain objects of a different class
+            if ((nil != className) && (NO == [className isEqualToString:aClassName])) {
+                continue;
+            }
             
-            success = NO;
+            // Results not bound to any attribute could gain any object
+            BOOL isAffected = (nil == attributes);
             
-            for (i = 0; i < count; i++) {
-                NSString *attribute = flattenedKeys[i];
-                id value = flattenedValues[i];
-                
-                // Reset, as required by SQLite...
-                int status = sqlite3_reset (_storeValuesStatement);
-                
-                // Since we're operating with extended result code support, extract the bits
-                // and obtain the regular result code
-                // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
-                
-                status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
-                
-                if (SQLITE_OK == status) {
-                    
-                    // Bind and execute the statement...
-                    BOOL resultBindKey = (sqlite3_bind_text (_storeValuesStatement, 1, aKeyUTF8, -1, SQLITE_STATIC) == SQLITE_OK);
-                    BOOL resultBindAttribute = (sqlite3_bind_text (_storeValuesStatement, 2, attribute.UTF8String, -1, SQLITE_STATIC) == SQLITE_OK);
-                    
-                    // Take advantage of manifest typing
-                    // Branch the type of bind based on the type to be stored: NSString, NSData, NSDate or NSNumber
-                    NSFNanoDatatype valueDataType = [self _NSFDatatypeOfObject:value];
-                    BOOL resultBindValue = NO;
-                    
-                    switch (valueDataType) {
-                        case NSFNanoTypeData:
-                            resultBindValue = (sqlite3_bind_blob(_storeValuesStatement, 3, [value bytes], (int)[value length], NULL) == SQLITE_OK);
-                            break;
-                        case NSFNanoTypeString:
-                        case NSFNanoTypeDate:
-                            resultBindValue = (sqlite3_bind_text (_storeValuesStatement, 3, [self _stringFromValue:value].UTF8String, -1, SQLITE_STATIC) == SQLITE_OK);
-                            break;
-                            break;
-                        case NSFNanoTypeNumber:
-                            resultBindValue = (sqlite3_bind_double (_storeValuesStatement, 3, [value doubleValue]) == SQLITE_OK);
-                            break;
-                        case NSFNanoTypeNULL:
-                            resultBindValue = (sqlite3_bind_null(_storeValuesStatement, 3) == SQLITE_OK);
-                            break;
-                        case NSFNanoTypeURL:
-                            resultBindValue = (sqlite3_bind_text (_storeValuesStatement, 3, [self _stringFromValue:value].UTF8String, -1, SQLITE_STATIC) == SQLITE_OK);
-                            break;
-                        default:
-                            [[NSException exceptionWithName:NSFUnexpectedParameterException
-                                                     reason:[NSString stringWithFormat:@"*** -[%@ %@]: datatype %@ cannot be stored because its class type is unknown.", [self class], NSStringFromSelector(_cmd), [value class]]
-                                                   userInfo:nil]raise];
-                            break;
-                    }
-                    
-                    // Store the element's datatype so we can recreate it later on when we read it back from the store...
-                    NSString *valueDatatypeString = NSFStringFromNanoDataType(valueDataType);
-                    BOOL resultBindDatatype = (sqlite3_bind_text (_storeValuesStatement, 4, valueDatatypeString.UTF8String, -1, SQLITE_STATIC) == SQLITE_OK);
-                    
-                    success = (resultBindKey && resultBindAttribute && resultBindValue && resultBindDatatype);
-                    if (success) {
-                        [self _executeSQLite3StepUsingSQLite3Statement:_storeValuesStatement];
-                    }
+            for (NSString *keyPath in someKeyPaths) {
+                if (isAffected) {
+                    break;
                 }
+                isAffected = ([attributes containsObject:keyPath] || [self _isKeyPath:keyPath coveredByAttributes:attributes]);
             }
             
+            if (isAffected) {
+                [self _removeCachedResultsForKey:cacheKey];
+            }
         }
     }
+}
+
+- (BOOL)_createCaseFoldedValuesIndex
+{
+    // Partial index: only the rows whose attribute opted in carry a case-folded value
+    NSString *theSQLStatement = [NSString stringWithFormat:@"CREATE INDEX IF NOT EXISTS %@_%@_IDX ON %@ (%@, %@) WHERE %@ IS NOT NULL;", NSFValues, NSFFoldedValue, NSFValues, NSFFoldedValue, NSFAttribute, NSFFoldedValue];
     
-    if (success) {
-        NSData *dictBinData = [NSKeyedArchiver archivedDataWithRootObject:someInfo];
-        {
-            int status = sqlite3_reset (_storeKeysStatement);
-            
-            // Since we're operating with extended result code support, extract the bits
-            // and obtain the regular result code
-            // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
-            
-            status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
-            
-            // Bind and execute the statement...
-            if (SQLITE_OK == status) {
-                
-                BOOL resultBindKey = (sqlite3_bind_text (_storeKeysStatement, 1, aKeyUTF8, -1, SQLITE_STATIC) == SQLITE_OK);
-                BOOL resultBindData = (sqlite3_bind_blob(_storeKeysStatement, 2, dictBinData.bytes, (int)dictBinData.length, SQLITE_STATIC) == SQLITE_OK);
-                BOOL resultBindCalendarDate = (sqlite3_bind_text (_storeKeysStatement, 3, [NSFNanoStore _calendarDateToString:[NSDate date]].UTF8String, -1, SQLITE_STATIC) == SQLITE_OK);
-                BOOL resultBindClass = (sqlite3_bind_text (_storeKeysStatement, 4, classType.UTF8String, -1, SQLITE_STATIC) == SQLITE_OK);
-                
-                success = (resultBindKey && resultBindData && resultBindCalendarDate && resultBindClass);
-                if (success) {
-                    [self _executeSQLite3StepUsingSQLite3Statement:_storeKeysStatement];
-                }
+    return (nil == [self _executeSQL:theSQLStatement].error);
+}
+
+- (BOOL)_createBagMembersIndexes
+{
+    // Bags look up their members and objects look up their bags, so both directions get an index
+    NSString *theSQLStatement = [NSString stringWithFormat:@"CREATE INDEX IF NOT EXISTS %@_%@_IDX ON %@ (%@, %@);", NSFBagMembers, NSFBagKey, NSFBagMembers, NSFBagKey, NSFKey];
+    BOOL success = (nil == [[self nanoStoreEngine]executeSQL:theSQLStatement].error);
+    
+    theSQLStatement = [NSString stringWithFormat:@"CREATE INDEX IF NOT EXISTS %@_%@_IDX ON %@ (%@, %@);", NSFBagMembers, NSFKey, NSFBagMembers, NSFKey, NSFBagKey];
+    if (nil != [[self nanoStoreEngine]executeSQL:theSQLStatement].error) {
+        success = NO;
+    }
+    
+    return success;
+}
+
+- (NSArray *)_keysOfMembersOfBagWithKey:(NSString *)aBagKey
+{
+    // Members whose object is gone are left out
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT %@ FROM %@ WHERE %@ = '%@' AND %@ IN (SELECT %@ FROM %@) ORDER BY ROWID", NSFKey, NSFBagMembers, NSFBagKey, [aBagKey stringByReplacingOccurrencesOfString:@"'" withString:@"''"], NSFKey, NSFKey, NSFKeys];
+    NSFNanoResult *result = [self _executeSQL:theSQLStatement];
+    
+    if (nil != result.error) {
+        return nil;
+    }
+    
+    NSArray *keys = [result valuesForColumn:NSFKey];
+    
+    return (nil != keys) ? keys : @[];
+}
+
+- (long long)_countOfMembersOfBagWithKey:(NSString *)aBagKey
+{
+    // Answered from the NSFBagKey index and the keys' index, without decoding the members. Members whose object is gone don't count.
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT count(*) AS NSFCount FROM %@ AS m JOIN %@ AS k ON k.%@ = m.%@ WHERE m.%@ = '%@'", NSFBagMembers, NSFKeys, NSFKey, NSFKey, NSFBagKey, [aBagKey stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+    NSFNanoResult *result = [self _executeSQL:theSQLStatement];
+    
+    return (result.numberOfRows > 0) ? [result int64AtIndex:0 forColumn:@"NSFCount"] : 0;
+}
+
+- (BOOL)_storeMembersOfBagWithKey:(NSString *)aBagKey addingKeys:(NSArray *)someAddedKeys removingKeys:(NSArray *)someRemovedKeys error:(NSError * __autoreleasing *)outError
+{
+    if ((0 == someAddedKeys.count) && (0 == someRemovedKeys.count)) {
+        return YES;
+    }
+    
+    if (NULL == _storeBagMemberStatement) {
+        // Only record a membership once, even if the bag is saved again before the change is noticed
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@) SELECT ?1, ?2 WHERE NOT EXISTS (SELECT 1 FROM %@ WHERE %@ = ?1 AND %@ = ?2);", NSFBagMembers, NSFBagKey, NSFKey, NSFBagMembers, NSFBagKey, NSFKey];
+        if (NO == [self _prepareSQLite3Statement:&_storeBagMemberStatement theSQLStatement:theSQLStatement]) {
+            if (nil != outError) {
+                *outError = [NSError errorWithDomain:NSFDomainKey
+                                                code:NSFNanoStoreErrorKey
+                                            userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: failed to prepare _storeBagMemberStatement.", [self class], NSStringFromSelector(_cmd)]}];
+            }
+            return NO;
+        }
+    }
+    
+    if (NULL == _removeBagMemberStatement) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ = ?1 AND %@ = ?2;", NSFBagMembers, NSFBagKey, NSFKey];
+        if (NO == [self _prepareSQLite3Statement:&_removeBagMemberStatement theSQLStatement:theSQLStatement]) {
+            if (nil != outError) {
+                *outError = [NSError errorWithDomain:NSFDomainKey
+                                                code:NSFNanoStoreErrorKey
+                                            userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: failed to prepare _removeBagMemberStatement.", [self class], NSStringFromSelector(_cmd)]}];
             }
+            return NO;
+        }
+    }
+    
+    BOOL transactionStartedHere = [self beginTransactionAndReturnError:nil];
+    
+    BOOL success = [self _stepBagMemberStatement:_removeBagMemberStatement bagKey:aBagKey objectKeys:someRemovedKeys error:outError];
+    if (success) {
+        success = [self _stepBagMemberStatement:_storeBagMemberStatement bagKey:aBagKey objectKeys:someAddedKeys error:outError];
+    }
+    
+    if (transactionStartedHere) {
+        if (success) {
+            success = [self commitTransactionAndReturnError:outError];
+        } else {
+            [self rollbackTransactionAndReturnError:nil];
         }
     }
     
+    // Objects joining or leaving the bag change the results scoped to it
+    [self _invalidateCachedResultsForKeyPaths:@[NSF_Private_NSFNanoBag_NSFObjectKeys] objectClass:nil];
+    
     return success;
 }
 
+- (BOOL)_stepBagMemberStatement:(sqlite3_stmt *)aStatement bagKey:(NSString *)aBagKey objectKeys:(NSArray *)someKeys error:(NSError * __autoreleasing *)outError
+{
+    for (NSString *key in someKeys) {
+        int status = sqlite3_reset (aStatement);
+        if (SQLITE_OK == status) {
+            status = sqlite3_bind_text (aStatement, 1, aBagKey.UTF8String, -1, SQLITE_TRANSIENT);
+        }
+        if (SQLITE_OK == status) {
+            status = sqlite3_bind_text (aStatement, 2, key.UTF8String, -1, SQLITE_TRANSIENT);
+        }
+        if (SQLITE_OK == status) {
+            status = sqlite3_step (aStatement);
+        }
+        
+        // Since we're operating with extended result code support, extract the bits
+        // and obtain the regular result code
+        // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
+        
+        status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+        
+        if (SQLITE_DONE != status) {
+            if (nil != outError) {
+                *outError = [NSError errorWithDomain:NSFDomainKey
+                                                code:NSFNanoStoreErrorKey
+                                            userInfo:@{NSLocalizedFailureReasonErrorKey: [NSString stringWithFormat:@"*** -[%@ %@]: the members of bag %@ could not be updated. Reason: %s", [self class], NSStringFromSelector(_cmd), aBagKey, sqlite3_errmsg(nanoStoreEngine.sqlite)]}];
+            }
+            return NO;
+        }
+    }
+    
+    return YES;
+}
+
+- (NSFNanoResult *)_populateFullTextIndexForAttribute:(NSString *)anAttribute
+{
+    NSMutableString *theSQLStatement = [NSMutableString stringWithFormat:@"INSERT INTO %@(rowid, %@) SELECT ROWID, %@ FROM %@ WHERE %@ = '%@'", NSFFullTextValues, NSFValue, NSFValue, NSFValues, NSFDatatype, NSFStringFromNanoDataType(NSFNanoTypeString)];
+    
+    if (NSNotFound != [anAttribute rangeOfString:@"."].location) {
+        [theSQLStatement appendFormat:@" AND %@ = '%@'", NSFAttribute, [anAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+    } else if (NO == [anAttribute isEqualToString:NSF_Private_AllAttributesKey]) {
+        [theSQLStatement appendFormat:@" AND %@ IN (SELECT %@ FROM %@ WHERE %@ = '%@')", NSFAttribute, NSFAttribute, NSFKeyPathSegments, NSFSegment, [anAttribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+    }
+    
+    // Skip the rows already indexed through another declaration
+    [theSQLStatement appendFormat:@" AND ROWID NOT IN (SELECT rowid FROM %@)", NSFFullTextValues];
+    
+    return [self _executeSQL:theSQLStatement];
+}
+
 - (NSFNanoDatatype)_NSFDatatypeOfObject:(id)value
 {
     NSFNanoDatatype type = NSFNanoTypeUnknown;
@@ -1072,12 +2564,132 @@
     return (SQLITE_OK == status);
 }
 
-- (void)_executeSQLite3StepUsingSQLite3Statement:(sqlite3_stmt *)aStatement
++ (NSString *)_lookupKeysSQLWithCount:(NSUInteger)aCount
+{
+    NSMutableString *theSQLStatement = [NSMutableString stringWithString:@"SELECT NSFKey, NSFKeyedArchive, NSFObjectClass FROM NSFKeys WHERE NSFKey IN (?"];
+    
+    for (NSUInteger i = 1; i < aCount; i++) {
+        [theSQLStatement appendString:@",?"];
+    }
+    
+    [theSQLStatement appendString:@")"];
+    
+    return theSQLStatement;
+}
+
+- (NSArray *)_objectsWithKeys:(NSArray *)someKeys objectClassName:(NSString *)aClassName
+{
+    return [self _objectsWithKeys:someKeys objectClassName:aClassName search:[NSFNanoSearch searchWithStore:self]];
+}
+
+- (NSArray *)_objectsWithKeys:(NSArray *)someKeys objectClassName:(NSString *)aClassName search:(NSFNanoSearch *)aSearch
+{
+    NSMutableArray *objects = [NSMutableArray arrayWithCapacity:someKeys.count];
+    
+    if (0 == someKeys.count) {
+        return objects;
+    }
+    
+    // Bind the keys in fixed-size chunks instead of quoting all of them into a single IN list: the SQL stays small,
+    // never reaches SQLITE_MAX_SQL_LENGTH and the full-size statement is prepared once and reused.
+    NSMutableDictionary *objectsByKey = [NSMutableDictionary dictionaryWithCapacity:someKeys.count];
+    NSUInteger chunkSize = (NSUInteger)NSF_Private_KeyLookupChunkSize;
+    NSUInteger count = someKeys.count;
+    
+    // Only the writer keeps its full-size statement around; a reader prepares its own for this lookup.
+    // Without a reader pool every thread shares the writer, and decoding an object may look up more keys,
+    // so the cached statement is claimed first and a lookup finding it busy prepares its own as well.
+    NSFNanoEngine *engine = self.nanoStoreEngine;
+    sqlite3 *sqliteStore = [engine NSFP_checkOutReadConnection];
+    BOOL usesCachedStatement = NO;
+    if (sqliteStore == engine.sqlite) {
+        @synchronized(self) {
+            usesCachedStatement = (NO == _isLookupKeysStatementInUse);
+            _isLookupKeysStatementInUse = YES;
+        }
+    }
+    sqlite3_stmt *ownStatement = NULL;
+    sqlite3_stmt **fullSizeStatement = usesCachedStatement ? &_lookupKeysStatement : &ownStatement;
+    
+    for (NSUInteger location = 0; location < count; location += chunkSize) {
+        NSUInteger length = MIN(chunkSize, count - location);
+        sqlite3_stmt *theSQLiteStatement = NULL;
+        
+        if (chunkSize == length) {
+            if ((NULL == *fullSizeStatement) && (SQLITE_OK != [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_prepare_v2 (sqliteStore, [NSFNanoStore _lookupKeysSQLWithCount:chunkSize].UTF8String, -1, fullSizeStatement, NULL)])) {
+                NSLog(@"*** Warning! -[%@ %@]: failed to prepare _lookupKeysStatement.", [self class], NSStringFromSelector(_cmd));
+                break;
+            }
+            theSQLiteStatement = *fullSizeStatement;
+        } else if (SQLITE_OK != [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_prepare_v2 (sqliteStore, [NSFNanoStore _lookupKeysSQLWithCount:length].UTF8String, -1, &theSQLiteStatement, NULL)]) {
+            NSLog(@"*** Warning! -[%@ %@]: failed to prepare the key lookup statement.", [self class], NSStringFromSelector(_cmd));
+            sqlite3_finalize (theSQLiteStatement);
+            break;
+        }
+        
+        for (NSUInteger i = 0; i < length; i++) {
+            NSString *key = someKeys[location + i];
+            sqlite3_bind_text (theSQLiteStatement, (int)i + 1, key.UTF8String, -1, SQLITE_TRANSIENT);
+        }
+        
+        while (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) {
+            char *keyUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 0);
+            char *objectClassUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 2);
+            
+            if ((NULL == keyUTF8) || (NULL == objectClassUTF8)) {
+                continue;
+            }
+            
+            NSString *objectClass = @(objectClassUTF8);
+            if ((nil != aClassName) && (NO == [objectClass isEqualToString:aClassName])) {
+                continue;
+            }
+            
+            NSString *key = @(keyUTF8);
+            NSData *archive = [[NSData alloc]initWithBytes:sqlite3_column_blob(theSQLiteStatement, 1) length:sqlite3_column_bytes(theSQLiteStatement, 1)];
+            id nanoObject = [aSearch _nanoObjectWithArchive:archive key:key className:objectClass];
+            
+            if (nil != nanoObject) {
+                objectsByKey[key] = nanoObject;
+            }
+        }
+        
+        if (theSQLiteStatement == *fullSizeStatement) {
+            sqlite3_reset (theSQLiteStatement);
+            sqlite3_clear_bindings (theSQLiteStatement);
+        } else {
+            sqlite3_finalize (theSQLiteStatement);
+        }
+    }
+    
+    sqlite3_finalize (ownStatement);
+    if (usesCachedStatement) {
+        @synchronized(self) {
+            _isLookupKeysStatementInUse = NO;
+        }
+    }
+    [engine NSFP_checkInReadConnection:sqliteStore];
+    
+    // Return the objects in the order the keys were specified, once per key
+    NSMutableSet *returnedKeys = [NSMutableSet setWithCapacity:objectsByKey.count];
+    for (NSString *key in someKeys) {
+        id nanoObject = objectsByKey[key];
+        if ((nil != nanoObject) && (NO == [returnedKeys containsObject:key])) {
+            [objects addObject:nanoObject];
+            [returnedKeys addObject:key];
+        }
+    }
+    
+    return objects;
+}
+
+- (int)_executeSQLite3StepUsingSQLite3Statement:(sqlite3_stmt *)aStatement
 {
     BOOL waitingForRow = YES;
+    int status = SQLITE_OK;
     
     do {
-        int status = sqlite3_step(aStatement);
+        status = sqlite3_step(aStatement);
         
         // Since we're operating with extended result code support, extract the bits
         // and obtain the regular result code
@@ -1100,6 +2712,8 @@
                 break;
         }
     } while (waitingForRow);
+    
+    return status;
 }
 
 - (BOOL)_addObjectsFromArray:(NSArray *)someObjects forceSave:(BOOL)forceSave error:(NSError * __autoreleasing *)outError
@@ -1146,7 +2760,7 @@
         
         if (unsavedObjectsCount > 0) {
             NSError *localOutError = nil;
-            if (NO == [self removeObjectsWithKeysInArray:keys.allObjects error:&localOutError]) {
+            if (NO == [self _removeObjectsWithKeysInArray:keys.allObjects removingBagMembers:NO error:&localOutError]) {
                 [[NSException exceptionWithName:NSFNanoStoreUnableToManipulateStoreException
                                          reason:[NSString stringWithFormat:@"*** -[%@ %@]: %@", [self class], NSStringFromSelector(_cmd), localOutError.localizedDescription]
                                        userInfo:nil]raise];
@@ -1181,7 +2795,10 @@
                     className = NSStringFromClass([object class]);
                 }
                 
-                if (NO == [self _storeDictionary:[object nanoObjectDictionaryRepresentation] forKey:[(id)object nanoObjectKey] forClassNamed:className error:outError]) {
+                // Bags keep their members in NSFBagMembers, so only the bag's own attributes are stored here
+                NSDictionary *info = [object isKindOfClass:[NSFNanoBag class]] ? [(NSFNanoBag *)object _storedDictionaryRepresentation] : [object nanoObjectDictionaryRepresentation];
+                
+                if (NO == [self _storeDictionary:info forKey:[(id)object nanoObjectKey] forClassNamed:className error:outError]) {
                     if (nil != outError) errorMessage = (*outError).localizedDescription;
                     [[NSException exceptionWithName:NSFNanoStoreUnableToManipulateStoreException
                                              reason:[NSString stringWithFormat:@"*** -[%@ %@]: %@", [self class], NSStringFromSelector(_cmd), errorMessage]
@@ -1200,6 +2817,9 @@
                     if ([object respondsToSelector:setHasUnsavedChangesSelector]) {
                         ((NSFNanoObject *)object).hasUnsavedChanges = NO;
                     }
+                    
+                    // The saved instance is the one searches should return from now on
+                    [self _registerLiveObject:object];
                 }
                 
                 i++;
@@ -1379,6 +2999,40 @@
     theSQLStatement = [NSString stringWithFormat:@"INSERT INTO fileDB.%@ (%@) SELECT * FROM main.%@", NSFValues, columns, NSFValues];
     [self _executeSQL:theSQLStatement];
     
+    // Transfer the NSFKeyPathSegments table
+    columns = [[[self nanoStoreEngine]columnsForTable:NSFKeyPathSegments]componentsJoinedByString:@", "];
+    theSQLStatement = [NSString stringWithFormat:@"INSERT INTO fileDB.%@ (%@) SELECT * FROM main.%@", NSFKeyPathSegments, columns, NSFKeyPathSegments];
+    [self _executeSQL:theSQLStatement];
+    
+    // Transfer the NSFBagMembers table
+    columns = [[[self nanoStoreEngine]columnsForTable:NSFBagMembers]componentsJoinedByString:@", "];
+    theSQLStatement = [NSString stringWithFormat:@"INSERT INTO fileDB.%@ (%@) SELECT * FROM main.%@", NSFBagMembers, columns, NSFBagMembers];
+    [self _executeSQL:theSQLStatement];
+    
+    // Transfer the full-text index, if one has been declared
+    if (_fullTextAttributes.count > 0) {
+        [self _executeSQL:[self _SQLForCreatingFullTextTableNamed:[NSString stringWithFormat:@"fileDB.%@", NSFFullTextValues]]];
+        [self _executeSQL:[NSString stringWithFormat:@"CREATE TABLE fileDB.%@(%@ TEXT PRIMARY KEY)", NSFFullTextAttributes, NSFAttribute]];
+        [self _executeSQL:[NSString stringWithFormat:@"INSERT INTO fileDB.%@ SELECT * FROM main.%@", NSFFullTextAttributes, NSFFullTextAttributes]];
+        [self _executeSQL:[NSString stringWithFormat:@"INSERT INTO fileDB.%@(rowid, %@) SELECT rowid, %@ FROM main.%@", NSFFullTextValues, NSFValue, NSFValue, NSFFullTextValues]];
+    }
+    
+    // Transfer the case-folded declarations; the folded values travel with NSFValues
+    if (_caseFoldedAttributes.count > 0) {
+        [self _executeSQL:[NSString stringWithFormat:@"CREATE TABLE fileDB.%@(%@ TEXT PRIMARY KEY)", NSFFoldedAttributes, NSFAttribute]];
+        [self _executeSQL:[NSString stringWithFormat:@"INSERT INTO fileDB.%@ SELECT * FROM main.%@", NSFFoldedAttributes, NSFFoldedAttributes]];
+    }
+    
+    // Transfer the attribute index declarations and their indexes
+    if (_attributeIndexes.count > 0) {
+        [self _executeSQL:[NSString stringWithFormat:@"CREATE TABLE fileDB.%@(%@ TEXT PRIMARY KEY, %@ INTEGER)", NSFAttributeIndexes, NSFAttribute, NSFDatatype]];
+        [self _executeSQL:[NSString stringWithFormat:@"INSERT INTO fileDB.%@ SELECT * FROM main.%@", NSFAttributeIndexes, NSFAttributeIndexes]];
+        for (NSString *attribute in _attributeIndexes) {
+            [self _executeSQL:[NSString stringWithFormat:@"CREATE INDEX IF NOT EXISTS fileDB.%@ ON %@ (%@, %@) WHERE %@ = '%@'",
+                               [NSFNanoStore _indexNameForAttribute:attribute], NSFValues, NSFValue, NSFKey, NSFAttribute, [attribute stringByReplacingOccurrencesOfString:@"'" withString:@"''"]]];
+        }
+    }
+    
     // Safely detach the file-based database
     [self _executeSQL:@"DETACH DATABASE fileDB"];
     
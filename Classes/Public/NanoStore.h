@@ -480,6 +480,16 @@
  
  @warning Setting saveInterval to a large number could result in decreased performance because SQLite's would have to spend more time reading the journal file and writing the changes to the database.
  
+ Searches issued from several threads run one after the other on the connection NanoStore writes with. For file-backed document stores, set the engine's
+ \link NSFNanoEngine::maximumNumberOfReaders maximumNumberOfReaders \endlink before opening the store to let them run in parallel on read-only connections instead.
+ 
+ @details <b>Example:</b>
+ @code
+ NSFNanoStore *nanoStore = [NSFNanoStore createStoreWithType:NSFPersistentStoreType path:thePath];
+ nanoStore.nanoStoreEngine.maximumNumberOfReaders = 4;
+ [nanoStore openWithError:nil];
+ @endcode
+ 
  @section needhelp_sec Need more help?
  There are two quick ways to find answers: reading the documentation and browsing the Unit tests.
  
@@ -48,4 +48,95 @@
     XCTAssertTrue (maxRowUID == 2, @"Expected to find the max RowUID for the given table.");
 }
 
+- (void)testTypedResultAccessors
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    
+    NSFNanoResult *result = [nanoStore.nanoStoreEngine executeSQL:@"SELECT 42 AS Integer, 2.5 AS Real, 3.0 AS Whole, 'abc' AS Text, NULL AS Nothing, x'0102' AS Blob"];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ((nil == result.error) && (1 == result.numberOfRows), @"Expected one row.");
+    XCTAssertEqualObjects (result.columns, (@[@"Integer", @"Real", @"Whole", @"Text", @"Nothing", @"Blob"]), @"Expected the columns in statement order.");
+    XCTAssertTrue (42 == [result int64AtIndex:0 forColumn:@"Integer"], @"Expected the integer to be kept as such.");
+    XCTAssertTrue (2.5 == [result doubleAtIndex:0 forColumn:@"Real"], @"Expected the real to be kept as such.");
+    XCTAssertEqualObjects ([result valueAtIndex:0 forColumn:@"Whole"], @"3.0", @"Expected reals formatted the way SQLite does.");
+    XCTAssertEqualObjects ([result valueAtIndex:0 forColumn:@"Text"], @"abc", @"Expected the text to be returned as a string.");
+    XCTAssertTrue ([result isNullAtIndex:0 forColumn:@"Nothing"] && [[result valueAtIndex:0 forColumn:@"Nothing"]isEqualToString:[NSNull null].description], @"Expected NULL to be reported.");
+    XCTAssertEqualObjects ([result dataAtIndex:0 forColumn:@"Blob"], ([NSData dataWithBytes:"\x01\x02" length:2]), @"Expected the blob bytes.");
+}
+
+- (void)testConcurrentSearchesUsingReaderPool
+{
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"%@.sqlite", [NSFNanoEngine stringWithUUID]]];
+    
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFPersistentStoreType path:path error:nil];
+    nanoStore.saveInterval = 1000;
+    for (NSInteger i = 0; i < 5000; i++) {
+        [nanoStore addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"Group" : @(i % 10), @"Title" : [NSString stringWithFormat:@"Title %ld", (long)i]}] error:nil];
+    }
+    [nanoStore saveStoreAndReturnError:nil];
+    [nanoStore closeWithError:nil];
+    
+    // Run the same searches from several threads, first on a single connection and then with a pool of readers
+    NSTimeInterval durations[2] = {0, 0};
+    __block BOOL allFound = YES;
+    NSUInteger readers[2] = {0, 4};
+    
+    for (NSUInteger run = 0; run < 2; run++) {
+        nanoStore = [NSFNanoStore createStoreWithType:NSFPersistentStoreType path:path];
+        nanoStore.nanoStoreEngine.maximumNumberOfReaders = readers[run];
+        [nanoStore openWithError:nil];
+        
+        NSDate *startDate = [NSDate date];
+        dispatch_apply(64, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t iteration) {
+            NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+            search.attribute = @"Title";
+            search.match = NSFBeginsWith;
+            search.value = [NSString stringWithFormat:@"Title %zu", iteration % 10];
+            
+            NSArray *keys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+            if (0 == keys.count) {
+                allFound = NO;
+            }
+        });
+        durations[run] = [[NSDate date]timeIntervalSinceDate:startDate];
+        
+        [nanoStore closeWithError:nil];
+    }
+    
+    [[NSFileManager defaultManager]removeItemAtPath:path error:nil];
+    
+    XCTAssertTrue (allFound, @"Expected every search to find objects.");
+    
+    // The margin absorbs the readers being opened during the run and the noise of a loaded machine
+    XCTAssertTrue (durations[1] <= durations[0] * 1.25, @"Expected the searches not to run slower with %lu readers (%.3f seconds) than on a single connection (%.3f seconds).", (unsigned long)readers[1], durations[1], durations[0]);
+}
+
+- (void)testSearchBagsUsingSingleReader
+{
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"%@.sqlite", [NSFNanoEngine stringWithUUID]]];
+    
+    NSFNanoStore *nanoStore = [NSFNanoStore createStoreWithType:NSFPersistentStoreType path:path];
+    nanoStore.nanoStoreEngine.maximumNumberOfReaders = 1;
+    [nanoStore openWithError:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoBag *bag = [NSFNanoBag bagWithName:@"Cities"];
+    [bag addObjectsFromArray:@[[NSFNanoObject nanoObjectWithDictionary:@{@"City" : @"Paris"}], [NSFNanoObject nanoObjectWithDictionary:@{@"City" : @"Rome"}]] error:nil];
+    [nanoStore addObject:bag error:nil];
+    
+    // Inflating the bags looks up their objects while the search still holds the only reader
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.filterClass = NSStringFromClass([NSFNanoBag class]);
+    NSDictionary *bags = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    NSFNanoBag *fetchedBag = [nanoStore bagsWithKeysInArray:@[bag.key]].lastObject;
+    
+    [nanoStore closeWithError:nil];
+    [[NSFileManager defaultManager]removeItemAtPath:path error:nil];
+    
+    XCTAssertTrue ((1 == bags.count) && (2 == [bags[bag.key]count]), @"Expected the bag and its objects to be found.");
+    XCTAssertTrue (2 == fetchedBag.count, @"Expected the fetched bag to be inflated.");
+}
+
 @end
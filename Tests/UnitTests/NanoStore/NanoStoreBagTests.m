@@ -905,4 +905,226 @@
     XCTAssertTrue (inflated, @"Expected the bag to be inflated.");
 }
 
+- (void)testBagSavesOnlyMembershipChanges
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoBag *bag = [NSFNanoBag bag];
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [bag addObjectsFromArray:@[obj1, obj2] error:nil];
+    [nanoStore addObject:bag error:nil];
+    
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT count(*) AS NSFCount FROM %@ WHERE %@ = '%@'", NSFBagMembers, NSFBagKey, bag.key];
+    long long membersAfterFirstSave = [[nanoStore _executeSQL:theSQLStatement]int64AtIndex:0 forColumn:@"NSFCount"];
+    
+    [bag addObject:obj3 error:nil];
+    [bag removeObject:obj1];
+    NSError *outError = nil;
+    BOOL success = [bag saveAndReturnError:&outError];
+    long long membersAfterSecondSave = [[nanoStore _executeSQL:theSQLStatement]int64AtIndex:0 forColumn:@"NSFCount"];
+    
+    // The bag document no longer carries the member keys
+    theSQLStatement = [NSString stringWithFormat:@"SELECT count(*) AS NSFCount FROM NSFValues WHERE NSFKey = '%@' AND NSFAttribute = '%@'", bag.key, NSF_Private_NSFNanoBag_NSFObjectKeys];
+    long long keysInDocument = [[nanoStore _executeSQL:theSQLStatement]int64AtIndex:0 forColumn:@"NSFCount"];
+    
+    NSFNanoBag *savedBag = [nanoStore bagsWithKeysInArray:@[bag.key]].lastObject;
+    NSArray *bagsWithObj1 = [nanoStore bagsContainingObjectWithKey:obj1.key];
+    NSArray *bagsWithObj3 = [nanoStore bagsContainingObjectWithKey:obj3.key];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue (success && (nil == outError), @"Expected the bag to be saved.");
+    XCTAssertTrue (2 == membersAfterFirstSave, @"Expected two members to be recorded, got %lld.", membersAfterFirstSave);
+    XCTAssertTrue (2 == membersAfterSecondSave, @"Expected two members to be recorded, got %lld.", membersAfterSecondSave);
+    XCTAssertTrue (0 == keysInDocument, @"Expected the bag document to be saved without its members.");
+    XCTAssertTrue ((2 == savedBag.count) && (nil != savedBag.savedObjects[obj3.key]) && (nil == savedBag.savedObjects[obj1.key]), @"Expected the reloaded bag to contain obj2 and obj3.");
+    XCTAssertTrue ((0 == bagsWithObj1.count) && (1 == bagsWithObj3.count), @"Expected only obj3 to be found in the bag.");
+}
+
+- (void)testBagEnumeratesObjectsInPages
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoBag *bag = [NSFNanoBag bag];
+    for (NSUInteger i = 0; i < 5; i++) {
+        [bag addObject:[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo] error:nil];
+    }
+    [nanoStore addObject:bag error:nil];
+    
+    NSFNanoBag *fetchedBag = [nanoStore bagsWithKeysInArray:@[bag.key]].lastObject;
+    NSUInteger count = fetchedBag.count;
+    NSUInteger numberOfKeys = fetchedBag.objectKeys.count;
+    
+    NSMutableArray *pageSizes = [NSMutableArray new];
+    NSMutableSet *enumeratedKeys = [NSMutableSet new];
+    [fetchedBag enumerateObjectsInPagesOfSize:2 usingBlock:^(NSArray *objects, BOOL *stop) {
+        [pageSizes addObject:@(objects.count)];
+        for (NSFNanoObject *object in objects) {
+            [enumeratedKeys addObject:object.key];
+        }
+    }];
+    
+    __block NSUInteger numberOfPagesBeforeStopping = 0;
+    [fetchedBag enumerateObjectsInPagesOfSize:2 usingBlock:^(NSArray *objects, BOOL *stop) {
+        numberOfPagesBeforeStopping++;
+        *stop = YES;
+    }];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ((5 == count) && (5 == numberOfKeys), @"Expected the bag to report five members.");
+    XCTAssertTrue ([pageSizes isEqualToArray:@[@2, @2, @1]], @"Expected the objects to be enumerated in pages of two.");
+    XCTAssertTrue ([enumeratedKeys isEqualToSet:[NSSet setWithArray:bag.objectKeys]], @"Expected every member to be enumerated.");
+    XCTAssertTrue (1 == numberOfPagesBeforeStopping, @"Expected the enumeration to stop after the first page.");
+}
+
+- (void)testBagKeysContainingObjectFollowRemovals
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoBag *bagA = [NSFNanoBag bagWithObjects:@[obj1, obj2]];
+    NSFNanoBag *bagB = [NSFNanoBag bagWithObjects:@[obj1]];
+    [nanoStore addObjectsFromArray:@[bagA, bagB] error:nil];
+    
+    NSSet *bagKeysBeforeRemoval = [NSSet setWithArray:[nanoStore bagKeysContainingObjectWithKey:obj1.key]];
+    
+    // Saving the bag again must not disturb the memberships
+    bagA.name = @"renamed";
+    [bagA saveAndReturnError:nil];
+    NSArray *bagKeysAfterSaving = [nanoStore bagKeysContainingObjectWithKey:obj2.key];
+    
+    [nanoStore removeObject:obj1 error:nil];
+    NSArray *bagKeysAfterRemoval = [nanoStore bagKeysContainingObjectWithKey:obj1.key];
+    NSUInteger countAfterRemoval = [nanoStore bagsWithKeysInArray:@[bagA.key]].lastObject.count;
+    
+    [nanoStore removeObject:bagA error:nil];
+    NSArray *bagKeysAfterRemovingBag = [nanoStore bagKeysContainingObjectWithKey:obj2.key];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ([bagKeysBeforeRemoval isEqualToSet:[NSSet setWithObjects:bagA.key, bagB.key, nil]], @"Expected obj1 to be found in both bags.");
+    XCTAssertTrue ([bagKeysAfterSaving isEqualToArray:@[bagA.key]], @"Expected obj2 to remain in the saved bag.");
+    XCTAssertTrue ((0 == bagKeysAfterRemoval.count) && (1 == countAfterRemoval), @"Expected the removed object to leave its bags.");
+    XCTAssertTrue (0 == bagKeysAfterRemovingBag.count, @"Expected the removed bag to let go of its members.");
+}
+
+- (void)testBagSetOperations
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoBag *bagA = [NSFNanoBag bagWithObjects:@[obj1, obj2]];
+    NSFNanoBag *bagB = [NSFNanoBag bagWithObjects:@[obj2, obj3]];
+    [nanoStore addObjectsFromArray:@[bagA, bagB] error:nil];
+    
+    NSError *outError = nil;
+    long long unionCount = [bagA countOfObjectsFromOperation:NSFBagUnion withBag:bagB error:&outError];
+    NSArray *intersectionKeys = [bagA objectKeysFromOperation:NSFBagIntersection withBag:bagB error:&outError];
+    NSFNanoBag *differenceBag = [bagA bagFromOperation:NSFBagDifference withBag:bagB name:@"difference" error:&outError];
+    NSArray *fetchedDifferenceKeys = [nanoStore bagsWithName:@"difference"].lastObject.objectKeys;
+    
+    NSFNanoBag *fetchedBagA = [nanoStore bagsWithKeysInArray:@[bagA.key]].lastObject;
+    NSFNanoBag *otherFetchedBagA = [nanoStore bagsWithKeysInArray:@[bagA.key]].lastObject;
+    NSFNanoBag *fetchedBagB = [nanoStore bagsWithKeysInArray:@[bagB.key]].lastObject;
+    BOOL sameBagsAreEqual = [fetchedBagA isEqualToNanoBag:otherFetchedBagA];
+    BOOL differentBagsAreEqual = [fetchedBagA isEqualToNanoBag:fetchedBagB];
+    
+    // Unsaved members can't take part in the operations
+    [bagA addObject:obj3 error:nil];
+    NSError *unsavedError = nil;
+    long long unsavedCount = [bagA countOfObjectsFromOperation:NSFBagUnion withBag:bagB error:&unsavedError];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ((nil == outError) && (3 == unionCount), @"Expected the union to hold three objects.");
+    XCTAssertTrue ([intersectionKeys isEqualToArray:@[obj2.key]], @"Expected the intersection to hold obj2.");
+    XCTAssertTrue ((1 == differenceBag.count) && [fetchedDifferenceKeys isEqualToArray:@[obj1.key]], @"Expected the difference bag to hold obj1.");
+    XCTAssertTrue (sameBagsAreEqual && (NO == differentBagsAreEqual), @"Expected the bags to be compared by their members.");
+    XCTAssertTrue ((-1 == unsavedCount) && (nil != unsavedError), @"Expected an error when combining a bag with unsaved members.");
+}
+
+- (void)testBagFromOperationRollsBackOnError
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoBag *bagA = [NSFNanoBag bagWithObjects:@[[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo]]];
+    NSFNanoBag *bagB = [NSFNanoBag bagWithObjects:@[[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo]]];
+    [nanoStore addObjectsFromArray:@[bagA, bagB] error:nil];
+    
+    // Make recording the members of the new bag fail
+    [nanoStore _executeSQL:@"CREATE TEMP TRIGGER NSFRejectMembers BEFORE INSERT ON NSFBagMembers BEGIN SELECT RAISE(ABORT, 'Members rejected'); END"];
+    
+    NSError *outError = nil;
+    NSFNanoBag *unionBag = [bagA bagFromOperation:NSFBagUnion withBag:bagB name:@"union" error:&outError];
+    NSArray *unionBags = [nanoStore bagsWithName:@"union"];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ((nil == unionBag) && (nil != outError), @"Expected the operation to fail.");
+    XCTAssertTrue (0 == unionBags.count, @"Expected the empty bag to be rolled back.");
+}
+
+- (void)testBagDropsMembersWhoseObjectIsGone
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoBag *bag = [NSFNanoBag bagWithObjects:@[obj1, obj2]];
+    [nanoStore addObject:bag error:nil];
+    
+    // Delete the object behind the store's back, so its membership is left dangling
+    [nanoStore _executeSQL:[NSString stringWithFormat:@"DELETE FROM NSFKeys WHERE NSFKey = '%@'", obj2.key]];
+    [nanoStore _executeSQL:[NSString stringWithFormat:@"DELETE FROM NSFValues WHERE NSFKey = '%@'", obj2.key]];
+    
+    NSUInteger count = [nanoStore bagsWithKeysInArray:@[bag.key]].lastObject.count;
+    NSFNanoBag *fetchedBag = [nanoStore bagsWithKeysInArray:@[bag.key]].lastObject;
+    NSDictionary *savedObjects = fetchedBag.savedObjects;
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue (1 == count, @"Expected the count to leave the removed object out.");
+    XCTAssertTrue ((1 == savedObjects.count) && (nil != savedObjects[obj1.key]) && (nil == savedObjects[obj2.key]), @"Expected only the remaining object once the bag is inflated.");
+}
+
+- (void)testBagMembersAreMigratedFromBagsOnly
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *member = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoBag *bag = [NSFNanoBag bagWithObjects:@[member]];
+    NSFNanoObject *other = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObjectsFromArray:@[bag, other] error:nil];
+    
+    // Simulate a store created before the membership table existed: the bag kept its member keys among its values.
+    // An object of another class holding an attribute with the same name must not be taken for a bag, and the key of an object
+    // removed since must not come back.
+    [nanoStore _executeSQL:[NSString stringWithFormat:@"INSERT INTO NSFValues (NSFKey, NSFAttribute, NSFValue) VALUES ('%@', '%@', '%@')", bag.key, NSF_Private_NSFNanoBag_NSFObjectKeys, member.key]];
+    [nanoStore _executeSQL:[NSString stringWithFormat:@"INSERT INTO NSFValues (NSFKey, NSFAttribute, NSFValue) VALUES ('%@', '%@', '%@')", bag.key, NSF_Private_NSFNanoBag_NSFObjectKeys, [NSFNanoEngine stringWithUUID]]];
+    [nanoStore _executeSQL:[NSString stringWithFormat:@"INSERT INTO NSFValues (NSFKey, NSFAttribute, NSFValue) VALUES ('%@', '%@', '%@')", other.key, NSF_Private_NSFNanoBag_NSFObjectKeys, member.key]];
+    [nanoStore _executeSQL:@"DROP TABLE NSFBagMembers"];
+    
+    BOOL success = nanoStore._setupCachingSchema;
+    NSFNanoResult *members = [nanoStore _executeSQL:@"SELECT NSFBagKey, NSFKey FROM NSFBagMembers"];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue (success, @"Expected the schema to be migrated.");
+    XCTAssertTrue (1 == [members numberOfRows], @"Expected only the bag's member to be migrated.");
+    XCTAssertEqualObjects ([members valuesForColumn:@"NSFBagKey"].lastObject, bag.key, @"Expected the member to belong to the bag.");
+}
+
 @end
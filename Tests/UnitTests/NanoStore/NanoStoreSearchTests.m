@@ -15,6 +15,7 @@
 #import "NanoCarTestClass.h"
 #import "NanoPersonTestClass.h"
 #import "NSFNanoGlobals_Private.h"
+#include <fcntl.h>
 
 @implementation NanoStoreSearchTests
 
@@ -424,6 +425,54 @@
     XCTAssertTrue ([searchResults count] == 2, @"Expected to find two objects.");
 }
 
+- (void)testSearchWithAttributeSegmentAtAnyDepth
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:@{@"Marseille" : @"Bouillabaisse", @"Marseilles" : @"Bouillabaisse"}];
+    [nanoStore addObjectsFromArray:@[obj1, obj2] error:nil];
+
+    // "Marseille" is found at the root of obj2 and at Countries.France.Marseille in obj1, but "Marseilles" must not match.
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Marseille";
+    search.match = NSFEqualTo;
+    search.value = @"Bouillabaisse";
+
+    NSError *searchError = nil;
+    id searchResults = [search searchObjectsWithReturnType:NSFReturnKeys error:&searchError];
+
+    NSFNanoResult *segments = [nanoStore _executeSQL:@"SELECT NSFDepth FROM NSFKeyPathSegments WHERE NSFSegment = 'Marseille' ORDER BY NSFDepth"];
+
+    [nanoStore closeWithError:nil];
+
+    XCTAssertTrue ([searchResults count] == 2, @"Expected to find two objects.");
+    XCTAssertTrue ([segments numberOfRows] == 2, @"Expected the segment to be recorded once per key path.");
+    XCTAssertTrue ([[segments valueAtIndex:1 forColumn:@"NSFDepth"]integerValue] == 2, @"Expected Countries.France.Marseille to be recorded at depth 2.");
+}
+
+- (void)testKeyPathSegmentsArePopulatedForExistingStores
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+
+    [nanoStore addObject:[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo] error:nil];
+    NSFNanoResult *segmentsBefore = [nanoStore _executeSQL:@"SELECT NSFAttribute, NSFSegment, NSFDepth FROM NSFKeyPathSegments ORDER BY NSFAttribute, NSFDepth"];
+
+    // Simulate a store created before the segments table existed
+    [nanoStore _executeSQL:@"DROP TABLE NSFKeyPathSegments"];
+    BOOL success = nanoStore._setupCachingSchema;
+    NSFNanoResult *segmentsAfter = [nanoStore _executeSQL:@"SELECT NSFAttribute, NSFSegment, NSFDepth FROM NSFKeyPathSegments ORDER BY NSFAttribute, NSFDepth"];
+
+    [nanoStore closeWithError:nil];
+
+    XCTAssertTrue (success, @"Expected the schema to be migrated.");
+    XCTAssertTrue (([segmentsBefore numberOfRows] > 0) && ([segmentsAfter numberOfRows] == [segmentsBefore numberOfRows]), @"Expected every segment to be recorded again.");
+    XCTAssertEqualObjects ([segmentsAfter valuesForColumn:@"NSFSegment"], [segmentsBefore valuesForColumn:@"NSFSegment"], @"Expected the same segments.");
+    XCTAssertEqualObjects ([segmentsAfter valuesForColumn:@"NSFDepth"], [segmentsBefore valuesForColumn:@"NSFDepth"], @"Expected the same depths.");
+}
+
 - (void)testSearchObjectsWithOffsetAndLimit
 {
     NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
@@ -1235,6 +1284,479 @@
     XCTAssertTrue (isLioniOS5OrLater && ([results error] == nil), @"Wasn't expecting an error.");
 }
 
+- (void)testSearchContainsUsingFullTextIndex
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"The quick brown fox", @"Notes" : @"quick"}];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"A lazy dog"}];
+    [nanoStore addObjectsFromArray:@[obj1, obj2] error:nil];
+    
+    // Index after the fact to make sure existing values are picked up
+    NSError *outError = nil;
+    BOOL success = [nanoStore createFullTextIndexForAttribute:@"Title" error:&outError];
+    
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Quicksilver"}];
+    [nanoStore addObject:obj3 error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Title";
+    search.match = NSFInsensitiveContains;
+    search.value = @"quick";
+    
+    NSArray *keys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    [nanoStore removeObject:obj1 error:nil];
+    NSArray *keysAfterRemoval = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue (success, @"Expected the full-text index to be created. Reason: %@", outError);
+    XCTAssertTrue ([search.sql rangeOfString:NSFFullTextValues].location != NSNotFound, @"Expected the search to go through the full-text index.");
+    XCTAssertTrue ([keys count] == 2, @"Expected to find two objects.");
+    XCTAssertTrue ([keysAfterRemoval count] == 1, @"Expected to find one object.");
+}
+
+- (void)testSearchContainsUsingFullTextIndexKeepsSubstringSemantics
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"hello world"}];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Foo"}];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:@{@"address" : @{@"city" : @"Marseille"}}];
+    [nanoStore addObjectsFromArray:@[obj1, obj2, obj3] error:nil];
+    
+    [nanoStore createFullTextIndexForAttribute:@"Title" error:nil];
+    BOOL success = [nanoStore createFullTextIndexForAttribute:@"address.city" error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Title";
+    search.match = NSFContains;
+    search.value = @"ell";
+    NSArray *substringKeys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    NSString *substringSQL = search.sql;
+    
+    search.value = @"foo";
+    NSArray *caseSensitiveKeys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    search.match = NSFInsensitiveContains;
+    NSArray *insensitiveKeys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    search.attribute = @"address.city";
+    search.match = NSFContains;
+    search.value = @"rseil";
+    NSArray *keyPathKeys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    NSString *keyPathSQL = search.sql;
+    long long indexedValues = [[nanoStore _executeSQL:[NSString stringWithFormat:@"SELECT count(*) AS NSFCount FROM %@", NSFFullTextValues]]int64AtIndex:0 forColumn:@"NSFCount"];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue (success, @"Expected the key path to be indexed.");
+    XCTAssertTrue ((1 == substringKeys.count) && [substringKeys containsObject:obj1.key], @"Expected ell to be found inside hello.");
+    XCTAssertTrue ([substringSQL rangeOfString:NSFFullTextValues].location != NSNotFound, @"Expected the search to go through the full-text index.");
+    XCTAssertTrue (0 == caseSensitiveKeys.count, @"Expected NSFContains to stay case-sensitive.");
+    XCTAssertTrue ((1 == insensitiveKeys.count) && [insensitiveKeys containsObject:obj2.key], @"Expected NSFInsensitiveContains to match Foo.");
+    XCTAssertTrue ((1 == keyPathKeys.count) && [keyPathKeys containsObject:obj3.key], @"Expected the key path to be found.");
+    XCTAssertTrue ([keyPathSQL rangeOfString:NSFFullTextValues].location != NSNotFound, @"Expected the key path search to go through the full-text index.");
+    XCTAssertTrue (3 == indexedValues, @"Expected the two titles and the city to be indexed, got %lld.", indexedValues);
+}
+
+- (void)testSearchFullTextQueryRankedByRelevance
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    [nanoStore createFullTextIndexForAttribute:nil error:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"Body" : @"NanoStore is a document store built on top of SQLite, with lots of words in between"}];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:@{@"Body" : @"SQLite store"}];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:@{@"Body" : @"Something else entirely"}];
+    [nanoStore addObjectsFromArray:@[obj1, obj2, obj3] error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    NSArray *keys = [search searchObjectsMatchingFullTextQuery:@"sqlite AND store" returnType:NSFReturnKeys error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ([keys count] == 2, @"Expected to find two objects.");
+    XCTAssertEqualObjects ([keys firstObject], obj2.key, @"Expected the shortest match to rank first.");
+}
+
+- (void)testSearchPagedWithContinuationToken
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *objects = [NSMutableArray new];
+    for (NSInteger i = 0; i < 5; i++) {
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"Price" : @(i * 10)}]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Price";
+    search.sort = @[[NSFNanoSortDescriptor sortDescriptorWithAttribute:@"Price" ascending:NO]];
+    
+    NSString *token = nil;
+    NSArray *firstPage = [search searchObjectsWithReturnType:NSFReturnObjects pageSize:2 continuationToken:nil nextContinuationToken:&token error:nil];
+    
+    // Objects sorting before the current position must not shift the next pages
+    [nanoStore addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"Price" : @100}] error:nil];
+    
+    NSArray *secondPage = [search searchObjectsWithReturnType:NSFReturnKeys pageSize:2 continuationToken:token nextContinuationToken:&token error:nil];
+    NSArray *lastPage = [search searchObjectsWithReturnType:NSFReturnKeys pageSize:2 continuationToken:token nextContinuationToken:&token error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ([[firstPage[0] objectForKey:@"Price"]integerValue] == 40, @"Expected the highest price first.");
+    XCTAssertEqualObjects (secondPage, (@[[objects[2] key], [objects[1] key]]), @"Expected the second page to resume after the first one.");
+    XCTAssertTrue ([lastPage count] == 1, @"Expected one object in the last page.");
+    XCTAssertNil (token, @"Expected no token after the last page.");
+}
+
+- (void)testSearchPagedKeepsObjectsWithoutSortValue
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"A", @"Price" : @10}];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"B", @"Price" : [NSNull null]}];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"C"}];
+    NSFNanoObject *obj4 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"D", @"Price" : @20}];
+    [nanoStore addObjectsFromArray:@[obj1, obj2, obj3, obj4] error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Title";
+    search.sort = @[[NSFNanoSortDescriptor sortDescriptorWithAttribute:@"Price" ascending:YES]];
+    
+    // Pages of one make sure the seek gets past the objects without a price
+    NSMutableArray *keys = [NSMutableArray new];
+    NSString *token = nil;
+    NSUInteger numberOfPages = 0;
+    do {
+        NSArray *page = [search searchObjectsWithReturnType:NSFReturnKeys pageSize:1 continuationToken:token nextContinuationToken:&token error:nil];
+        [keys addObjectsFromArray:page];
+        numberOfPages++;
+    } while ((nil != token) && (numberOfPages < 10));
+    
+    NSString *fingerprint = [NSFNanoSearch _digestOfString:@"NanoStore"];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue (4 == keys.count, @"Expected every object to be paged through, got %lu.", (unsigned long)keys.count);
+    XCTAssertTrue ([[NSSet setWithArray:[keys subarrayWithRange:NSMakeRange(0, 2)]]isEqualToSet:[NSSet setWithArray:@[obj2.key, obj3.key]]], @"Expected the objects without a price first.");
+    XCTAssertEqualObjects ([keys subarrayWithRange:NSMakeRange(2, 2)], (@[obj1.key, obj4.key]), @"Expected the priced objects in order.");
+    XCTAssertEqualObjects (fingerprint, @"f76233e4475e517e2f12b91f619e79c14fa808f2c2cecb4f24adfa33d76fad1a", @"Expected a stable digest.");
+}
+
+- (void)testSearchPagedSortedByMultiValuedAttribute
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"A", @"Prices" : @[@30, @5]}];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"B", @"Prices" : @[@10, @20]}];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"C", @"Prices" : @[@15]}];
+    [nanoStore addObjectsFromArray:@[obj1, obj2, obj3] error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Title";
+    search.sort = @[[NSFNanoSortDescriptor sortDescriptorWithAttribute:@"Prices" ascending:YES]];
+    
+    NSMutableArray *keys = [NSMutableArray new];
+    NSString *token = nil;
+    NSUInteger numberOfPages = 0;
+    do {
+        NSArray *page = [search searchObjectsWithReturnType:NSFReturnKeys pageSize:1 continuationToken:token nextContinuationToken:&token error:nil];
+        [keys addObjectsFromArray:page];
+        numberOfPages++;
+    } while ((nil != token) && (numberOfPages < 10));
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertEqualObjects (keys, (@[obj1.key, obj2.key, obj3.key]), @"Expected each object once, sorted by its lowest price.");
+}
+
+- (void)testSearchCountAndExistence
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Foo", @"Notes" : @"Foo"}];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Foo"}];
+    [nanoStore addObjectsFromArray:@[obj1, obj2] error:nil];
+    
+    NSFNanoBag *bag = [NSFNanoBag bagWithObjects:@[obj1]];
+    [nanoStore addObject:bag error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.match = NSFEqualTo;
+    search.value = @"Foo";
+    
+    NSError *outError = nil;
+    long long count = [search countOfObjectsWithError:&outError];
+    BOOL exists = [search existsWithError:nil];
+    
+    search.bag = bag;
+    long long countInBag = [search countOfObjectsWithError:nil];
+    
+    search.bag = nil;
+    search.value = @"Bar";
+    BOOL existsAfterChange = [search existsWithError:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue (count == 2, @"Expected to count two objects. Reason: %@", outError);
+    XCTAssertTrue (exists, @"Expected a match to exist.");
+    XCTAssertTrue (countInBag == 1, @"Expected to count one object in the bag.");
+    XCTAssertFalse (existsAfterChange, @"Expected no match to exist.");
+}
+
+- (void)testSearchAggregateOperationsGroupedByAttribute
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    [nanoStore addObjectsFromArray:@[[NSFNanoObject nanoObjectWithDictionary:@{@"Category" : @"Books", @"Price" : @10}],
+                                     [NSFNanoObject nanoObjectWithDictionary:@{@"Category" : @"Books", @"Price" : @30}],
+                                     [NSFNanoObject nanoObjectWithDictionary:@{@"Category" : @"Music", @"Price" : @5}]] error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    NSArray *functions = @[@(NSFMin), @(NSFMax), @(NSFAverage), @(NSFCount)];
+    
+    NSArray *totals = [search aggregateOperations:functions onAttribute:@"Price" error:nil];
+    
+    NSMutableDictionary *groups = [NSMutableDictionary new];
+    NSError *outError = nil;
+    BOOL success = [search enumerateAggregateOperations:functions onAttribute:@"Price" groupedByAttribute:@"Category" usingBlock:^(id groupValue, NSArray *values, BOOL *stop) {
+        groups[groupValue] = values;
+    } error:&outError];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ([totals[3]longLongValue] == 3, @"Expected to count three objects.");
+    XCTAssertTrue ([totals[1]doubleValue] == 30, @"Expected the maximum to be 30.");
+    XCTAssertTrue (success, @"Expected the grouped aggregates to succeed. Reason: %@", outError);
+    XCTAssertTrue (groups.count == 2, @"Expected two groups.");
+    XCTAssertTrue ([groups[@"Books"][2]doubleValue] == 20, @"Expected the average price of books to be 20.");
+    XCTAssertTrue ([groups[@"Music"][3]longLongValue] == 1, @"Expected to count one music object.");
+}
+
+- (void)testSearchResultCacheInvalidatedOnCommit
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    nanoStore.resultCacheCostLimit = 100;
+    
+    [nanoStore addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Foo"}] error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Title";
+    search.match = NSFEqualTo;
+    search.value = @"Foo";
+    
+    NSDictionary *firstResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    NSDictionary *cachedResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    [nanoStore addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Foo"}] error:nil];
+    NSDictionary *resultsAfterCommit = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ([firstResults allValues].lastObject == [cachedResults allValues].lastObject, @"Expected the second search to be served from the cache.");
+    XCTAssertTrue ([resultsAfterCommit count] == 2, @"Expected the commit to invalidate the cache.");
+}
+
+- (void)testSearchResultCacheInvalidatedByTouchedAttributes
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    nanoStore.resultCacheCostLimit = 100;
+    nanoStore.resultCacheInvalidation = NSFResultCacheInvalidateByTouchedAttributes;
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Foo"}];
+    [nanoStore addObject:obj1 error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Title";
+    search.match = NSFEqualTo;
+    search.value = @"Foo";
+    
+    NSDictionary *firstResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    // Objects without the attribute can't affect the results
+    [nanoStore addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"Notes" : @"Foo"}] error:nil];
+    NSDictionary *resultsAfterUnrelatedWrite = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    [nanoStore addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Foo"}] error:nil];
+    NSDictionary *resultsAfterRelatedWrite = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    [nanoStore removeObject:obj1 error:nil];
+    NSDictionary *resultsAfterRemoval = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ([firstResults allValues].lastObject == [resultsAfterUnrelatedWrite allValues].lastObject, @"Expected the unrelated write to keep the cached results.");
+    XCTAssertTrue ([resultsAfterRelatedWrite count] == 2, @"Expected to find two objects.");
+    XCTAssertTrue ([resultsAfterRemoval count] == 1, @"Expected to find one object.");
+}
+
+- (void)testSearchResultCacheInvalidatedByRemovingBag
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    nanoStore.resultCacheCostLimit = 100;
+    nanoStore.resultCacheInvalidation = NSFResultCacheInvalidateByTouchedAttributes;
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Foo"}];
+    NSFNanoBag *bag = [NSFNanoBag bagWithObjects:@[obj1]];
+    [nanoStore addObject:bag error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Title";
+    search.match = NSFEqualTo;
+    search.value = @"Foo";
+    search.bag = bag;
+    
+    NSDictionary *resultsInBag = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    [nanoStore removeObject:bag error:nil];
+    NSDictionary *resultsAfterRemovingBag = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue (1 == resultsInBag.count, @"Expected to find the object in the bag.");
+    XCTAssertTrue (0 == resultsAfterRemovingBag.count, @"Expected the removed bag to hold nothing anymore.");
+}
+
+- (void)testSearchResultCacheKeepsReturnedAttributesAndContainersApart
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    nanoStore.resultCacheCostLimit = 100;
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Foo", @"Notes" : @"Bar"}];
+    [nanoStore addObject:obj1 error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Title";
+    search.match = NSFEqualTo;
+    search.value = @"Foo";
+    search.attributesToBeReturned = @[@"Title"];
+    NSDictionary *partialResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    search.attributesToBeReturned = nil;
+    NSMutableDictionary *wholeResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    [wholeResults removeAllObjects];
+    NSDictionary *cachedResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    NSFNanoObject *partialObject = partialResults[obj1.key];
+    NSFNanoObject *cachedObject = cachedResults[obj1.key];
+    XCTAssertTrue ((nil == partialObject[@"Notes"]) && [cachedObject[@"Notes"]isEqualToString:@"Bar"], @"Expected searches returning different attributes to be cached apart.");
+    XCTAssertTrue (1 == cachedResults.count, @"Expected changing the results of a search to leave the cache alone.");
+}
+
+- (void)testSearchUsingAttributeIndex
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"Price" : @50}];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:@{@"Price" : @150}];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:@{@"Price" : @250}];
+    [nanoStore addObjectsFromArray:@[obj1, obj2, obj3] error:nil];
+    
+    NSError *outError = nil;
+    BOOL success = [nanoStore createIndexForAttribute:@"Price" type:NSFNanoTypeNumber error:&outError];
+    
+    // The declaration must survive an index rebuild
+    [nanoStore rebuildIndexesAndReturnError:nil];
+    NSArray *indexes = [[nanoStore nanoStoreEngine]indexes];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Price";
+    search.match = NSFGreaterThan;
+    search.value = @"100";
+    
+    NSArray *keys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue (success, @"Expected the attribute index to be created. Reason: %@", outError);
+    XCTAssertTrue ([indexes containsObject:@"NSFAttributeIndexes_NSFAttribute_Price_IDX"], @"Expected the attribute index to be rebuilt.");
+    XCTAssertTrue ([search.sql rangeOfString:@"NSFAttribute = 'Price'"].location != NSNotFound, @"Expected the search to filter on the exact attribute.");
+    XCTAssertTrue ([keys count] == 2, @"Expected to find two objects.");
+}
+
+- (void)testSearchInsensitiveUsingCaseFoldedIndex
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"Street" : @"straße"}];
+    [nanoStore addObject:obj1 error:nil];
+    
+    // Index after the fact to make sure existing values are folded
+    NSError *outError = nil;
+    BOOL success = [nanoStore createCaseFoldedIndexForAttribute:@"Street" error:&outError];
+    
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:@{@"Street" : @"Strandweg"}];
+    [nanoStore addObject:obj2 error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Street";
+    search.match = NSFInsensitiveEqualTo;
+    search.value = @"STRASSE";
+    
+    NSArray *equalKeys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    NSString *equalSQL = search.sql;
+    
+    search.match = NSFInsensitiveBeginsWith;
+    search.value = @"STR";
+    
+    NSArray *prefixKeys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue (success, @"Expected the case-folded index to be created. Reason: %@", outError);
+    XCTAssertTrue ([equalSQL rangeOfString:NSFFoldedValue].location != NSNotFound, @"Expected the search to go through the case-folded values.");
+    XCTAssertTrue ([equalKeys count] == 1, @"Expected to find one object.");
+    XCTAssertTrue ([prefixKeys count] == 2, @"Expected to find two objects.");
+}
+
+- (void)testSearchInsensitiveUsingCaseFoldedIndexOnKeyPath
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"address" : @{@"street" : @"straße"}}];
+    [nanoStore addObject:obj1 error:nil];
+    
+    NSError *outError = nil;
+    BOOL success = [nanoStore createCaseFoldedIndexForAttribute:@"address.street" error:&outError];
+    
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:@{@"address" : @{@"street" : @"Strasse"}}];
+    [nanoStore addObject:obj2 error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"address.street";
+    search.match = NSFInsensitiveEqualTo;
+    search.value = @"STRASSE";
+    
+    NSArray *keys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    NSString *theSQL = search.sql;
+    long long foldedValues = [[nanoStore _executeSQL:[NSString stringWithFormat:@"SELECT count(*) AS NSFCount FROM NSFValues WHERE %@ IS NOT NULL", NSFFoldedValue]]int64AtIndex:0 forColumn:@"NSFCount"];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue (success, @"Expected the case-folded index to be created. Reason: %@", outError);
+    XCTAssertTrue ([theSQL rangeOfString:NSFFoldedValue].location != NSNotFound, @"Expected the search to go through the case-folded values.");
+    XCTAssertTrue (2 == foldedValues, @"Expected both values to be folded, got %lld.", foldedValues);
+    XCTAssertTrue ([keys count] == 2, @"Expected to find two objects.");
+}
+
 - (void)testSearchObjectsQuotes
 {
     NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
@@ -1612,4 +2134,358 @@
     XCTAssertTrue ([searchResults count] == 3, @"Expected to find three matching objects.");
 }
 
+- (void)testSearchWithConcurrentHydration
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *objects = [NSMutableArray new];
+    for (NSInteger i = 0; i < 1000; i++) {
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"Index" : @(i), @"Title" : @"Foo"}]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Title";
+    search.match = NSFEqualTo;
+    search.value = @"Foo";
+    
+    NSDictionary *inlineResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    search.hydrationConcurrency = 4;
+    NSDictionary *concurrentResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ([concurrentResults count] == 1000, @"Expected to find 1000 objects.");
+    XCTAssertEqualObjects ([NSSet setWithArray:[concurrentResults allKeys]], [NSSet setWithArray:[inlineResults allKeys]], @"Expected the same keys as the inline search.");
+    XCTAssertEqualObjects ([concurrentResults[[objects[999] key]] objectForKey:@"Index"], @999, @"Expected the objects to be fully decoded.");
+}
+
+- (void)testSearchReturnsFaultsWhenCachingDataOnDemand
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *objects = [NSMutableArray new];
+    for (NSInteger i = 0; i < 10; i++) {
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"Index" : @(i), @"Title" : @"Foo"}]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Title";
+    search.match = NSFEqualTo;
+    search.value = @"Foo";
+    
+    nanoStore.nanoStoreEngine.cacheMethod = CacheDataOnDemand;
+    NSDictionary *results = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    NSFNanoObject *first = results[[objects[0] key]];
+    NSFNanoObject *last = results[[objects[9] key]];
+    BOOL wasFault = first.isFault;
+    id index = [first objectForKey:@"Index"];
+    
+    // Firing one fault loads its siblings too
+    BOOL siblingWasLoaded = (NO == last.isFault);
+    
+    nanoStore.nanoStoreEngine.cacheMethod = DoNotCacheData;
+    results = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    NSFNanoObject *uncached = results[[objects[5] key]];
+    id uncachedIndex = [uncached objectForKey:@"Index"];
+    BOOL stillFault = uncached.isFault;
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue (wasFault && [index isEqual:@0], @"Expected a fault that loads its data on first access.");
+    XCTAssertTrue (siblingWasLoaded, @"Expected the sibling faults to be loaded in the same batch.");
+    XCTAssertTrue ([uncachedIndex isEqual:@5] && stillFault, @"Expected the data to be dropped after use.");
+}
+
+- (void)testSearchQueryPlanAndIndexAdvisor
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    nanoStore.recordsSearchShapes = YES;
+    
+    NSMutableArray *objects = [NSMutableArray new];
+    for (NSInteger i = 0; i < 100; i++) {
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"City" : [NSString stringWithFormat:@"City %ld", (long)i]}]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    NSArray *plan = [search queryPlanForSQL:@"SELECT NSFKey FROM NSFValues WHERE NSFValue + 0 = 1 ORDER BY NSFDatatype" error:nil];
+    NSFQueryPlanWarning warnings = [NSFNanoSearch warningsInQueryPlan:plan];
+    
+    search.attribute = @"City";
+    search.match = NSFEqualTo;
+    search.value = @"City 7";
+    [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    NSArray *recommendations = [nanoStore indexRecommendations];
+    BOOL created = [nanoStore createRecommendedIndexes:recommendations error:nil];
+    NSArray *remainingRecommendations = [nanoStore indexRecommendations];
+    NSArray *keys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ([plan count] > 0, @"Expected a query plan.");
+    XCTAssertTrue (warnings & NSFQueryPlanFullScanOfValues, @"Expected the full scan of NSFValues to be flagged.");
+    XCTAssertTrue (warnings & NSFQueryPlanTemporaryBTree, @"Expected the temporary B-tree to be flagged.");
+    XCTAssertTrue ([recommendations count] == 1, @"Expected one recommendation.");
+    XCTAssertEqualObjects (recommendations.firstObject[NSFIndexRecommendationAttributeKey], @"City", @"Expected an index on City.");
+    XCTAssertTrue ([recommendations.firstObject[NSFIndexRecommendationTypeKey]unsignedIntValue] == NSFAttributeIndexRecommendation, @"Expected an attribute index.");
+    XCTAssertTrue ([recommendations.firstObject[NSFIndexRecommendationDatatypeKey]intValue] == NSFNanoTypeString, @"Expected a string index.");
+    XCTAssertTrue (created, @"Expected the recommended index to be created.");
+    XCTAssertTrue ([remainingRecommendations count] == 0, @"Expected no recommendation once the index exists.");
+    XCTAssertTrue ([keys count] == 1, @"Expected to find one object.");
+}
+
+- (void)testExportSearchResultsToFileDescriptor
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *objects = [NSMutableArray new];
+    for (NSInteger i = 0; i < 10; i++) {
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"City" : [NSString stringWithFormat:@"City \"%ld\", Inc.", (long)i], @"Index" : @(i)}]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSString *JSONPath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID]UUIDString]];
+    NSString *CSVPath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID]UUIDString]];
+    int JSONFileDescriptor = open (JSONPath.fileSystemRepresentation, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int CSVFileDescriptor = open (CSVPath.fileSystemRepresentation, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Index";
+    search.match = NSFLessThan;
+    search.value = @5;
+    search.attributesToBeReturned = @[@"City"];
+    
+    NSError *JSONError = nil;
+    BOOL exportedJSON = [search exportObjectsWithFormat:NSFExportJSONLines toFileDescriptor:JSONFileDescriptor syncInterval:2 error:&JSONError];
+    NSError *CSVError = nil;
+    BOOL exportedCSV = [search exportSQL:@"SELECT NSFKey, NSFValue FROM NSFValues WHERE NSFAttribute = 'City'" format:NSFExportCSV toFileDescriptor:CSVFileDescriptor syncInterval:0 error:&CSVError];
+    
+    close (JSONFileDescriptor);
+    close (CSVFileDescriptor);
+    [nanoStore closeWithError:nil];
+    
+    NSString *JSONLines = [NSString stringWithContentsOfFile:JSONPath encoding:NSUTF8StringEncoding error:nil];
+    NSString *CSV = [NSString stringWithContentsOfFile:CSVPath encoding:NSUTF8StringEncoding error:nil];
+    [[NSFileManager defaultManager]removeItemAtPath:JSONPath error:nil];
+    [[NSFileManager defaultManager]removeItemAtPath:CSVPath error:nil];
+    
+    NSArray *lines = [[JSONLines stringByTrimmingCharactersInSet:[NSCharacterSet newlineCharacterSet]]componentsSeparatedByString:@"\n"];
+    NSDictionary *firstObject = [NSJSONSerialization JSONObjectWithData:[lines.firstObject dataUsingEncoding:NSUTF8StringEncoding] options:0 error:nil];
+    NSArray *rows = [CSV componentsSeparatedByString:@"\r\n"];
+    
+    XCTAssertTrue (exportedJSON && (nil == JSONError), @"Expected the objects to be exported.");
+    XCTAssertTrue ([lines count] == 5, @"Expected one line per matching object.");
+    XCTAssertTrue ([firstObject[NSFKey] length] > 0 && [firstObject[@"NSFInfo"] count] == 1 && [firstObject[@"NSFInfo"][@"City"] hasPrefix:@"City \""], @"Expected the key and the requested attributes.");
+    XCTAssertTrue (exportedCSV && (nil == CSVError), @"Expected the rows to be exported.");
+    XCTAssertEqualObjects (rows.firstObject, @"NSFKey,NSFValue", @"Expected a header row.");
+    XCTAssertTrue ([rows count] == 12 && [CSV rangeOfString:@",\"City \"\"0\"\", Inc.\"\r\n"].location != NSNotFound, @"Expected the fields to be quoted.");
+}
+
+- (void)testSearchComparesNumbersAndDatesNatively
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSDate *now = [NSDate date];
+    NSMutableArray *objects = [NSMutableArray new];
+    for (NSInteger i = 0; i < 20; i++) {
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"Price" : @(i * 10), @"Date" : [now dateByAddingTimeInterval:i * 3600]}]];
+    }
+    // Text that would sort after any number if compared as text
+    [objects addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"Price" : @"Free"}]];
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Price";
+    search.match = NSFGreaterThan;
+    search.value = @95;
+    NSArray *expensiveKeys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    search.match = NSFBetween;
+    search.value = @[@20, @50];
+    NSArray *midRangeKeys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    NSFNanoPredicate *attribute = [NSFNanoPredicate predicateWithColumn:NSFAttributeColumn matching:NSFEqualTo value:@"Date"];
+    NSFNanoPredicate *value = [NSFNanoPredicate predicateWithColumn:NSFValueColumn matching:NSFLessThan value:[now dateByAddingTimeInterval:5 * 3600 - 1]];
+    NSFNanoExpression *expression = [NSFNanoExpression expressionWithPredicate:attribute];
+    [expression addPredicate:value withOperator:NSFAnd];
+    search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.expressions = @[expression];
+    NSArray *earlyKeys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ([expensiveKeys count] == 10, @"Expected the prices to be compared as numbers, leaving the text out.");
+    XCTAssertTrue ([midRangeKeys count] == 4, @"Expected both bounds to be included.");
+    XCTAssertTrue ([earlyKeys count] == 5, @"Expected the dates to be compared as dates.");
+}
+
+- (void)testSearchWithCompoundExpressionTree
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSArray *cities = @[@"Paris", @"London", @"Rome"];
+    NSMutableArray *objects = [NSMutableArray new];
+    for (NSInteger i = 0; i < 12; i++) {
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"City" : cities[i % 3], @"Status" : (i % 2) ? @"Inactive" : @"Active"}]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSFNanoExpression *(^expressionMatching)(NSString *, NSString *) = ^(NSString *attribute, NSString *value) {
+        NSFNanoExpression *expression = [NSFNanoExpression expressionWithPredicate:[NSFNanoPredicate predicateWithColumn:NSFAttributeColumn matching:NSFEqualTo value:attribute]];
+        [expression addPredicate:[NSFNanoPredicate predicateWithColumn:NSFValueColumn matching:NSFEqualTo value:value] withOperator:NSFAnd];
+        return expression;
+    };
+    
+    // (City = 'Paris' OR City = 'London') AND NOT Status = 'Inactive'
+    NSFNanoExpression *parisOrLondon = [NSFNanoExpression expressionWithOperator:NSFOr subexpressions:@[expressionMatching(@"City", @"Paris"), expressionMatching(@"City", @"London")]];
+    NSFNanoExpression *notInactive = [NSFNanoExpression expressionNegatingExpression:expressionMatching(@"Status", @"Inactive")];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.expressions = @[[NSFNanoExpression expressionWithOperator:NSFAnd subexpressions:@[parisOrLondon, notInactive]]];
+    NSDictionary *results = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    BOOL allMatch = YES;
+    for (NSFNanoObject *object in results.allValues) {
+        allMatch &= ([[object objectForKey:@"Status"]isEqualToString:@"Active"] && (NO == [[object objectForKey:@"City"]isEqualToString:@"Rome"]));
+    }
+    
+    // A plain expression listed next to a compound one is intersected with it
+    search.expressions = @[parisOrLondon, expressionMatching(@"Status", @"Inactive")];
+    NSArray *inactiveKeys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ([results count] == 4, @"Expected the active objects in Paris or London.");
+    XCTAssertTrue (allMatch, @"Expected every object to match the expression tree.");
+    XCTAssertTrue ([inactiveKeys count] == 4, @"Expected the inactive objects in Paris or London.");
+}
+
+- (void)testSearchScopedToBagOnEveryForm
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Foo", @"Color" : @"Red"}];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Foo", @"Color" : @"Blue"}];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Bar", @"Color" : @"Red"}];
+    [nanoStore addObjectsFromArray:@[obj1, obj2, obj3] error:nil];
+    
+    NSFNanoBag *bag = [NSFNanoBag bagWithObjects:@[obj1, obj3]];
+    [nanoStore addObject:bag error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.bag = bag;
+    search.match = NSFEqualTo;
+    search.value = @"Foo";
+    NSDictionary *valueResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    NSString *valueSQL = search.sql;
+    
+    search.value = nil;
+    NSArray *allKeys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    NSFNanoExpression *titleIsFoo = [NSFNanoExpression expressionWithPredicate:[NSFNanoPredicate predicateWithColumn:NSFAttributeColumn matching:NSFEqualTo value:@"Title"]];
+    [titleIsFoo addPredicate:[NSFNanoPredicate predicateWithColumn:NSFValueColumn matching:NSFEqualTo value:@"Foo"] withOperator:NSFAnd];
+    NSFNanoExpression *colorIsRed = [NSFNanoExpression expressionWithPredicate:[NSFNanoPredicate predicateWithColumn:NSFAttributeColumn matching:NSFEqualTo value:@"Color"]];
+    [colorIsRed addPredicate:[NSFNanoPredicate predicateWithColumn:NSFValueColumn matching:NSFEqualTo value:@"Red"] withOperator:NSFAnd];
+    
+    search.expressions = @[titleIsFoo];
+    NSDictionary *expressionResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    search.expressions = @[[NSFNanoExpression expressionWithOperator:NSFOr subexpressions:@[titleIsFoo, colorIsRed]]];
+    NSArray *compoundKeys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    long long compoundCount = [search countOfObjectsWithError:nil];
+    NSString *compoundSQL = search.sql;
+    
+    search.bag = nil;
+    long long compoundCountOutsideBag = [search countOfObjectsWithError:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ((1 == valueResults.count) && (nil != valueResults[obj1.key]), @"Expected only obj1 to match in the bag.");
+    XCTAssertTrue ((2 == allKeys.count) && [allKeys containsObject:obj1.key] && [allKeys containsObject:obj3.key], @"Expected the keys of the bag's objects.");
+    XCTAssertTrue ((1 == expressionResults.count) && (nil != expressionResults[obj1.key]), @"Expected the expression to match obj1 in the bag.");
+    XCTAssertTrue ((2 == compoundKeys.count) && (NO == [compoundKeys containsObject:obj2.key]), @"Expected the compound expression to match obj1 and obj3 in the bag.");
+    XCTAssertTrue ((2 == compoundCount) && (3 == compoundCountOutsideBag), @"Expected the count to honor the bag.");
+    XCTAssertTrue ((NSNotFound == [valueSQL rangeOfString:@":NSFBagKey"].location) && (NSNotFound != [valueSQL rangeOfString:bag.key].location), @"Expected the bag key to be rendered into the SQL.");
+    XCTAssertTrue ((NSNotFound == [compoundSQL rangeOfString:@":NSFBagKey"].location) && (NSNotFound != [compoundSQL rangeOfString:bag.key].location), @"Expected the bag key to be rendered into the SQL.");
+}
+
+- (void)testSearchSQLScopedToBagRunsAsIs
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Foo"}];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Foo"}];
+    [nanoStore addObjectsFromArray:@[obj1, obj2] error:nil];
+    
+    NSFNanoBag *bag = [NSFNanoBag bagWithObjects:@[obj1]];
+    [nanoStore addObject:bag error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.bag = bag;
+    search.attribute = @"Title";
+    search.match = NSFEqualTo;
+    search.value = @"Foo";
+    NSString *theSQLStatement = search.sql;
+    
+    NSFNanoSearch *otherSearch = [NSFNanoSearch searchWithStore:nanoStore];
+    NSDictionary *searchResults = [otherSearch executeSQL:theSQLStatement returnType:NSFReturnObjects error:nil];
+    NSFNanoResult *searchResult = [otherSearch executeSQL:theSQLStatement];
+    NSFNanoResult *storeResult = [nanoStore _executeSQL:theSQLStatement];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ((1 == searchResults.count) && (nil != searchResults[obj1.key]), @"Expected the SQL to match obj1 in the bag.");
+    XCTAssertTrue ((nil == searchResult.error) && (1 == searchResult.numberOfRows), @"Expected the SQL to match obj1 through the search.");
+    XCTAssertTrue ((nil == storeResult.error) && (1 == storeResult.numberOfRows), @"Expected the SQL to match obj1 through the store.");
+}
+
+- (void)testSearchFullTextQueryAndDateAddedScopedToBag
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    [nanoStore createFullTextIndexForAttribute:nil error:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:@{@"Body" : @"SQLite store"}];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:@{@"Body" : @"Another SQLite store"}];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:@{@"Body" : @"Something else entirely"}];
+    [nanoStore addObjectsFromArray:@[obj1, obj2, obj3] error:nil];
+    
+    NSFNanoBag *bag = [NSFNanoBag bagWithObjects:@[obj1, obj3]];
+    [nanoStore addObject:bag error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.bag = bag;
+    NSArray *fullTextKeys = [search searchObjectsMatchingFullTextQuery:@"sqlite AND store" returnType:NSFReturnKeys error:nil];
+    NSArray *fullTextObjects = [search searchObjectsMatchingFullTextQuery:@"sqlite AND store" returnType:NSFReturnObjects error:nil];
+    
+    NSDate *date = [[NSDate date]dateByAddingTimeInterval:60 * 60];
+    NSDictionary *addedObjects = [search searchObjectsAdded:NSFBeforeDate date:date returnType:NSFReturnObjects error:nil];
+    NSArray *addedKeys = [search searchObjectsAdded:NSFBeforeDate date:date returnType:NSFReturnKeys error:nil];
+    
+    search.bag = nil;
+    NSArray *fullTextKeysOutsideBag = [search searchObjectsMatchingFullTextQuery:@"sqlite AND store" returnType:NSFReturnKeys error:nil];
+    NSArray *addedKeysOutsideBag = [search searchObjectsAdded:NSFBeforeDate date:date returnType:NSFReturnKeys error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ([fullTextKeys isEqualToArray:@[obj1.key]], @"Expected the full-text search to only match obj1 in the bag.");
+    XCTAssertTrue ((1 == fullTextObjects.count) && [[fullTextObjects.lastObject key]isEqualToString:obj1.key], @"Expected the full-text search to return obj1.");
+    XCTAssertTrue ((2 == fullTextKeysOutsideBag.count), @"Expected the full-text search to match obj1 and obj2 outside the bag.");
+    XCTAssertTrue ((2 == addedObjects.count) && (nil != addedObjects[obj1.key]) && (nil != addedObjects[obj3.key]), @"Expected the date search to return the bag's objects.");
+    XCTAssertTrue ((2 == addedKeys.count) && (NO == [addedKeys containsObject:obj2.key]), @"Expected the date search to honor the bag.");
+    XCTAssertTrue ((4 == addedKeysOutsideBag.count), @"Expected the three objects and the bag outside the bag.");
+}
+
 @end
@@ -502,6 +502,253 @@
     XCTAssertTrue (([objects count] == 2), @"Expected to find two objects.");
 }
 
+- (void)testObjectsWithManyKeysInArrayKeepsKeyOrder
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *objects = [NSMutableArray new];
+    for (NSInteger i = 0; i < 1200; i++) {
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"Index" : @(i)}]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    // Spans several lookup batches, in reverse order and with an unknown key
+    NSMutableArray *keys = [NSMutableArray new];
+    for (NSFNanoObject *object in objects.reverseObjectEnumerator) {
+        [keys addObject:object.key];
+    }
+    [keys insertObject:@"NotAKey" atIndex:600];
+    
+    NSArray *foundObjects = [nanoStore objectsWithKeysInArray:keys];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue (([foundObjects count] == 1200), @"Expected to find 1200 objects.");
+    XCTAssertEqualObjects ([foundObjects.firstObject key], [objects.lastObject key], @"Expected the objects in the order of the keys.");
+    XCTAssertEqualObjects ([foundObjects.lastObject key], [objects.firstObject key], @"Expected the objects in the order of the keys.");
+}
+
+- (void)testObjectsWithManyKeysInArrayFromSeveralThreads
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *keys = [NSMutableArray new];
+    for (NSInteger i = 0; i < 1200; i++) {
+        NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:@{@"Index" : @(i)}];
+        [nanoStore addObject:object error:nil];
+        [keys addObject:object.key];
+    }
+    
+    // Without a reader pool every lookup goes through the writer and its cached full-size statement
+    __block BOOL allFound = YES;
+    dispatch_apply(16, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t iteration) {
+        NSArray *foundObjects = [nanoStore objectsWithKeysInArray:keys];
+        if ((1200 != foundObjects.count) || (NO == [[foundObjects.lastObject key]isEqualToString:keys.lastObject])) {
+            allFound = NO;
+        }
+    });
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue (allFound, @"Expected every lookup to find all the objects.");
+}
+
+- (void)testIdentityMapAndObjectCache
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObject:object error:nil];
+    
+    nanoStore.objectCacheCountLimit = 10;
+    NSFNanoObject *first = [nanoStore objectsWithKeysInArray:@[object.key]].firstObject;
+    NSFNanoObject *second = [nanoStore objectsWithKeysInArray:@[object.key]].firstObject;
+    NSDictionary *statistics = nanoStore.objectCacheStatistics;
+    
+    nanoStore.usesIdentityMap = YES;
+    NSFNanoObject *live = [nanoStore objectsWithKeysInArray:@[object.key]].firstObject;
+    NSFNanoObject *sameLive = [nanoStore objectsWithKeysInArray:@[object.key]].firstObject;
+    
+    // Saving an object evicts its cached document
+    [live setObject:@"Changed" forKey:@"LastName"];
+    [nanoStore addObject:live error:nil];
+    long long cachedCount = [nanoStore.objectCacheStatistics[NSFObjectCacheCountKey]longLongValue];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ((first != second) && [first isEqualToNanoObject:second], @"Expected distinct instances without the identity map.");
+    XCTAssertTrue ([statistics[NSFObjectCacheHitCountKey]longLongValue] == 1 && [statistics[NSFObjectCacheMissCountKey]longLongValue] == 1, @"Expected the second fetch to skip the decode.");
+    XCTAssertTrue (live == sameLive, @"Expected the identity map to return the live instance.");
+    XCTAssertTrue (0 == cachedCount, @"Expected the saved document to be evicted.");
+}
+
+- (void)testPerformReadSnapshotIgnoresConcurrentCommits
+{
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"%@.sqlite", [NSFNanoEngine stringWithUUID]]];
+    
+    NSFNanoStore *nanoStore = [NSFNanoStore createStoreWithType:NSFPersistentStoreType path:path];
+    nanoStore.nanoStoreEngine.maximumNumberOfReaders = 2;
+    [nanoStore openWithError:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    [nanoStore addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"First"}] error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Title";
+    search.match = NSFNotEqualTo;
+    search.value = @"";
+    
+    __block long long countBefore = 0;
+    __block long long countAfterCommit = 0;
+    
+    [nanoStore performReadSnapshot:^{
+        countBefore = [search countOfObjectsWithError:nil];
+        
+        // Commit from another thread while the snapshot is held
+        dispatch_sync(dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+            [nanoStore addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"Title" : @"Second"}] error:nil];
+        });
+        
+        countAfterCommit = [search countOfObjectsWithError:nil];
+    }];
+    
+    long long countOutside = [search countOfObjectsWithError:nil];
+    
+    [nanoStore closeWithError:nil];
+    [[NSFileManager defaultManager]removeItemAtPath:path error:nil];
+    
+    XCTAssertTrue ((1 == countBefore) && (1 == countAfterCommit), @"Expected the snapshot to keep reading the same version of the store.");
+    XCTAssertTrue (2 == countOutside, @"Expected the commit to be visible once the snapshot ended.");
+}
+
+- (void)testExecuteSearchesInOneBatch
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSArray *cities = @[@"Paris", @"London", @"Rome"];
+    NSMutableArray *objects = [NSMutableArray new];
+    for (NSInteger i = 0; i < 9; i++) {
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"City" : cities[i % 3]}]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSMutableArray *searches = [NSMutableArray new];
+    for (NSString *city in @[@"Paris", @"London", @"Paris", @"Berlin"]) {
+        NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+        search.attribute = @"City";
+        search.match = NSFEqualTo;
+        search.value = city;
+        [searches addObject:search];
+    }
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Searches executed"];
+    __block NSArray *results = nil;
+    __block NSError *error = nil;
+    
+    [nanoStore executeSearches:searches completion:^(NSArray *theResults, NSError *theError) {
+        results = theResults;
+        error = theError;
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ((4 == [results count]) && (nil == error), @"Expected one result per search.");
+    XCTAssertTrue ((3 == [results[0] count]) && (3 == [results[1] count]) && (0 == [results[3] count]), @"Expected each search to find its own objects.");
+    XCTAssertTrue (results[0] == results[2], @"Expected identical searches to run once and share their result.");
+}
+
+- (void)testExecuteSearchesHonorsReturnTypeOfEachSearch
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    [nanoStore addObjectsFromArray:@[[NSFNanoObject nanoObjectWithDictionary:@{@"City" : @"Paris"}], [NSFNanoObject nanoObjectWithDictionary:@{@"City" : @"Rome"}]] error:nil];
+    
+    NSMutableArray *searches = [NSMutableArray new];
+    for (NSNumber *returnType in @[@(NSFReturnObjects), @(NSFReturnKeys)]) {
+        NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+        search.attribute = @"City";
+        search.match = NSFEqualTo;
+        search.value = @"Paris";
+        search.returnedObjectType = returnType.unsignedIntValue;
+        [searches addObject:search];
+    }
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Searches executed"];
+    __block NSArray *results = nil;
+    
+    [nanoStore executeSearches:searches completion:^(NSArray *theResults, NSError *theError) {
+        results = theResults;
+        [expectation fulfill];
+    }];
+    
+    // The batch works on copies, so changing the searches right away doesn't affect it
+    for (NSFNanoSearch *search in searches) {
+        search.value = @"Rome";
+    }
+    
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    XCTAssertTrue ([results[0] isKindOfClass:[NSDictionary class]] && [results[1] isKindOfClass:[NSArray class]], @"Expected each search to return its own type of results.");
+    XCTAssertTrue ([[[results[0] allValues].lastObject objectForKey:@"City"]isEqualToString:@"Paris"], @"Expected the searches to run as they were when handed over.");
+}
+
+- (void)testExecuteSearchesOnReadersCallsBackOnCompletionQueue
+{
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"%@.sqlite", [NSFNanoEngine stringWithUUID]]];
+    
+    NSFNanoStore *nanoStore = [NSFNanoStore createStoreWithType:NSFPersistentStoreType path:path];
+    nanoStore.nanoStoreEngine.maximumNumberOfReaders = 4;
+    [nanoStore openWithError:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSArray *cities = @[@"Paris", @"London", @"Rome"];
+    NSMutableArray *objects = [NSMutableArray new];
+    for (NSInteger i = 0; i < 9; i++) {
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:@{@"City" : cities[i % 3]}]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSMutableArray *searches = [NSMutableArray new];
+    for (NSString *city in @[@"Paris", @"London", @"Rome", @"Paris"]) {
+        NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+        search.attribute = @"City";
+        search.match = NSFEqualTo;
+        search.value = city;
+        [searches addObject:search];
+    }
+    
+    static char queueTag;
+    dispatch_queue_t queue = dispatch_queue_create("com.Webbo.NanoStore.tests.completion", DISPATCH_QUEUE_SERIAL);
+    dispatch_queue_set_specific(queue, &queueTag, &queueTag, NULL);
+    
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Searches executed"];
+    __block NSArray *results = nil;
+    __block BOOL calledBackOnQueue = NO;
+    
+    [nanoStore executeSearches:searches dedupesIdenticalSearches:YES completionQueue:queue completion:^(NSArray *theResults, NSError *theError) {
+        results = theResults;
+        calledBackOnQueue = (&queueTag == dispatch_get_specific(&queueTag));
+        [expectation fulfill];
+    }];
+    
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    
+    [nanoStore closeWithError:nil];
+    [[NSFileManager defaultManager]removeItemAtPath:path error:nil];
+    
+    XCTAssertTrue (calledBackOnQueue, @"Expected the completion block to run on the queue provided.");
+    XCTAssertTrue ((4 == [results count]) && (3 == [results[0] count]) && (3 == [results[1] count]) && (3 == [results[2] count]), @"Expected each search to find its own objects.");
+    XCTAssertTrue (results[0] == results[3], @"Expected identical searches to run once and share their result.");
+}
+
 #pragma mark -
 
 - (void)testStoreObjectsWithBadKeyBadAttributeBadValueAndReturnObjectsWithSomeAttributes